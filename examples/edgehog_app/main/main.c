@@ -11,6 +11,7 @@
 
 static const char *TAG = "CORE_WIFI";
 static EventGroupHandle_t wifi_event_group;
+static edgehog_device_handle_t edgehog_device;
 #define NVS_PARTITION "nvs"
 
 static void event_handler(
@@ -66,9 +67,19 @@ void wifi_init(void)
     vEventGroupDelete(wifi_event_group);
 }
 
-static void astarte_connection_events_handler()
+static void astarte_connection_events_handler(astarte_device_connection_event_t *event)
 {
     ESP_LOGI(TAG, "on_connected");
+    if (edgehog_device) {
+        edgehog_device_astarte_connection_event_handler(edgehog_device, event);
+    }
+}
+
+static void astarte_data_events_handler(astarte_device_data_event_t *event)
+{
+    if (edgehog_device) {
+        edgehog_device_astarte_event_handler(edgehog_device, event);
+    }
 }
 
 static void astarte_disconnection_events_handler()
@@ -82,7 +93,8 @@ astarte_device_handle_t astarte_init()
     astarte_credentials_use_nvs_storage(NVS_PARTITION);
     astarte_credentials_init();
 
-    astarte_device_config_t cfg = { .connection_event_callback = astarte_connection_events_handler,
+    astarte_device_config_t cfg = { .data_event_callback = astarte_data_events_handler,
+        .connection_event_callback = astarte_connection_events_handler,
         .disconnection_event_callback = astarte_disconnection_events_handler };
 
     astarte_device = astarte_device_init(&cfg);
@@ -117,7 +129,7 @@ void app_main(void)
 
     edgehog_device_config_t edgehog_conf
         = { .astarte_device = astarte_device, .partition_label = "nvs" };
-    edgehog_device_handle_t edgehog_device = edgehog_device_new(&edgehog_conf);
+    edgehog_device = edgehog_device_new(&edgehog_conf);
 
     edgehog_device_set_appliance_serial_number(edgehog_device, "serial_number_1");
     edgehog_device_set_appliance_part_number(edgehog_device, "part_number_1");
@@ -0,0 +1,32 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ASTARTE_H
+#define ASTARTE_H
+
+typedef enum
+{
+    ASTARTE_OK = 0,
+    ASTARTE_ERR = 1,
+    ASTARTE_ERR_NOT_FOUND = 2,
+    ASTARTE_ERR_OUT_OF_MEMORY = 3,
+    ASTARTE_ERR_INVALID_INTERFACE_PATH = 4,
+    ASTARTE_ERR_INVALID_QOS = 5,
+} astarte_err_t;
+
+#endif // ASTARTE_H
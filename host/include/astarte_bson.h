@@ -0,0 +1,33 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ASTARTE_BSON_H
+#define ASTARTE_BSON_H
+
+#include "astarte_bson_types.h"
+#include <stdint.h>
+
+const void *astarte_bson_key_lookup(const char *key, const void *document, uint8_t *type);
+uint32_t astarte_bson_document_size(const void *document);
+const char *astarte_bson_value_to_string(const void *value_ptr, uint32_t *len);
+int32_t astarte_bson_value_to_int32(const void *value_ptr);
+int64_t astarte_bson_value_to_int64(const void *value_ptr);
+double astarte_bson_value_to_double(const void *value_ptr);
+int8_t astarte_bson_value_to_int8(const void *value_ptr);
+
+#endif // ASTARTE_BSON_H
@@ -0,0 +1,70 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ASTARTE_BSON_SERIALIZER_H
+#define ASTARTE_BSON_SERIALIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct astarte_byte_array_t
+{
+    size_t capacity;
+    size_t size;
+    uint8_t *buf;
+};
+
+struct astarte_bson_serializer_t
+{
+    struct astarte_byte_array_t ba;
+};
+
+void astarte_bson_serializer_init(struct astarte_bson_serializer_t *bs);
+void astarte_bson_serializer_destroy(struct astarte_bson_serializer_t *bs);
+const void *astarte_bson_serializer_get_document(
+    const struct astarte_bson_serializer_t *bs, int *size);
+int astarte_bson_serializer_write_document(
+    const struct astarte_bson_serializer_t *bs, void *out_buf, int out_buf_len);
+int astarte_bson_serializer_document_size(const struct astarte_bson_serializer_t *bs);
+void astarte_bson_serializer_append_end_of_document(struct astarte_bson_serializer_t *bs);
+void astarte_bson_serializer_append_double(
+    struct astarte_bson_serializer_t *bs, const char *name, double value);
+void astarte_bson_serializer_append_int32(
+    struct astarte_bson_serializer_t *bs, const char *name, int32_t value);
+void astarte_bson_serializer_append_int64(
+    struct astarte_bson_serializer_t *bs, const char *name, int64_t value);
+void astarte_bson_serializer_append_binary(
+    struct astarte_bson_serializer_t *bs, const char *name, const void *bin, int size);
+void astarte_bson_serializer_append_string(
+    struct astarte_bson_serializer_t *bs, const char *name, const char *string);
+void astarte_bson_serializer_append_datetime(
+    struct astarte_bson_serializer_t *bs, const char *name, uint64_t epoch_millis);
+void astarte_bson_serializer_append_document(
+    struct astarte_bson_serializer_t *bs, const char *name, const void *document);
+void astarte_bson_serializer_append_boolean(
+    struct astarte_bson_serializer_t *bs, const char *name, int value);
+void astarte_bson_serializer_append_int32_array(
+    struct astarte_bson_serializer_t *bs, const char *name, const int32_t *arr, int count);
+void astarte_bson_serializer_append_int64_array(
+    struct astarte_bson_serializer_t *bs, const char *name, const int64_t *arr, int count);
+void astarte_bson_serializer_append_double_array(
+    struct astarte_bson_serializer_t *bs, const char *name, const double *arr, int count);
+void astarte_bson_serializer_append_string_array(
+    struct astarte_bson_serializer_t *bs, const char *name, const char *const *arr, int count);
+
+#endif // ASTARTE_BSON_SERIALIZER_H
@@ -0,0 +1,121 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ASTARTE_DEVICE_H
+#define ASTARTE_DEVICE_H
+
+#include "astarte.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The Astarte device API of the host build. Devices publish over MQTT to the broker set with
+ * sim_astarte_configure(), or count their publishes on a scripted connection, see sim.h.
+ */
+
+typedef struct astarte_device_t *astarte_device_handle_t;
+
+typedef enum
+{
+    OWNERSHIP_DEVICE = 1,
+    OWNERSHIP_SERVER,
+} astarte_interface_ownership_t;
+
+typedef enum
+{
+    TYPE_DATASTREAM = 1,
+    TYPE_PROPERTIES,
+} astarte_interface_type_t;
+
+typedef struct
+{
+    const char *name;
+    int major_version;
+    int minor_version;
+    astarte_interface_ownership_t ownership;
+    astarte_interface_type_t type;
+} astarte_interface_t;
+
+typedef struct
+{
+    astarte_device_handle_t device;
+    const char *interface_name;
+    const char *path;
+    const void *bson_value;
+    int bson_value_type;
+} astarte_device_data_event_t;
+
+typedef struct
+{
+    astarte_device_handle_t device;
+    int session_present;
+} astarte_device_connection_event_t;
+
+typedef struct
+{
+    astarte_device_handle_t device;
+} astarte_device_disconnection_event_t;
+
+typedef void (*astarte_device_data_event_callback_t)(astarte_device_data_event_t *event);
+typedef void (*astarte_device_connection_event_callback_t)(
+    astarte_device_connection_event_t *event);
+typedef void (*astarte_device_disconnection_event_callback_t)(
+    astarte_device_disconnection_event_t *event);
+
+typedef struct
+{
+    astarte_device_data_event_callback_t data_event_callback;
+    astarte_device_connection_event_callback_t connection_event_callback;
+    astarte_device_disconnection_event_callback_t disconnection_event_callback;
+    // Device ID, drawn at random when NULL
+    const char *hwid;
+    const char *credentials_secret;
+    const char *realm;
+} astarte_device_config_t;
+
+astarte_device_handle_t astarte_device_init(astarte_device_config_t *cfg);
+void astarte_device_destroy(astarte_device_handle_t device);
+astarte_err_t astarte_device_add_interface(
+    astarte_device_handle_t device, const astarte_interface_t *interface);
+astarte_err_t astarte_device_start(astarte_device_handle_t device);
+astarte_err_t astarte_device_stop(astarte_device_handle_t device);
+bool astarte_device_is_connected(astarte_device_handle_t device);
+char *astarte_device_get_encoded_id(astarte_device_handle_t device);
+
+astarte_err_t astarte_device_stream_aggregate(astarte_device_handle_t device,
+    const char *interface_name, const char *path_prefix, const void *bson_document, int qos);
+astarte_err_t astarte_device_stream_aggregate_with_timestamp(astarte_device_handle_t device,
+    const char *interface_name, const char *path_prefix, const void *bson_document,
+    uint64_t ts_epoch_millis, int qos);
+astarte_err_t astarte_device_stream_string(astarte_device_handle_t device,
+    const char *interface_name, const char *path, const char *value, int qos);
+astarte_err_t astarte_device_stream_integer(astarte_device_handle_t device,
+    const char *interface_name, const char *path, int32_t value, int qos);
+astarte_err_t astarte_device_set_string_property(astarte_device_handle_t device,
+    const char *interface_name, const char *path, const char *value);
+astarte_err_t astarte_device_set_integer_property(astarte_device_handle_t device,
+    const char *interface_name, const char *path, int32_t value);
+astarte_err_t astarte_device_set_longinteger_property(astarte_device_handle_t device,
+    const char *interface_name, const char *path, int64_t value);
+astarte_err_t astarte_device_set_boolean_property(astarte_device_handle_t device,
+    const char *interface_name, const char *path, bool value);
+astarte_err_t astarte_device_unset_path(
+    astarte_device_handle_t device, const char *interface_name, const char *path);
+
+#endif // ASTARTE_DEVICE_H
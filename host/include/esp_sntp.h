@@ -0,0 +1,41 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ESP_SNTP_H
+#define ESP_SNTP_H
+
+#include <stdbool.h>
+#include <sys/time.h>
+
+/*
+ * There is no SNTP client on the host, the system time is the one of the host or, on a virtual
+ * clock, the one set with sim_time_set_epoch(). Build without CONFIG_EDGEHOG_SNTP.
+ */
+
+#define SNTP_OPMODE_POLL 0
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void sntp_setoperatingmode(unsigned char operating_mode);
+void sntp_setservername(unsigned char idx, const char *server);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+void sntp_init(void);
+void sntp_stop(void);
+unsigned char sntp_enabled(void);
+
+#endif // ESP_SNTP_H
@@ -0,0 +1,432 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <astarte_device.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_wifi_types.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Simulation of the chips running Edgehog, used by the host tools.
+ *
+ * The host build of Edgehog runs on shims of the ESP-IDF, FreeRTOS and Astarte APIs. A single
+ * process simulates many chips: each one has its own heap, NVS, default event loop, WiFi radio and
+ * Astarte connection, and every task and callback runs on behalf of the chip it belongs to.
+ * Edgehog keeps some state process wide (the time reference and the debug rings), so the chips
+ * share one esp_timer clock and one system time.
+ */
+
+typedef enum
+{
+    // Tasks run concurrently on the host clock, needed to talk to a real broker
+    SIM_CLOCK_REAL = 0,
+    // Tasks run one at a time and the clock jumps to the next deadline when all of them are
+    // blocked: runs are deterministic and take no longer than the CPU work they do
+    SIM_CLOCK_VIRTUAL,
+} sim_clock_t;
+
+typedef struct
+{
+    sim_clock_t clock;
+    // Seed of every random choice of the simulation, 0 means 1
+    uint32_t seed;
+    esp_log_level_t log_level;
+} sim_config_t;
+
+/**
+ * @brief start the simulation.
+ *
+ * @details This function must be called once, from the main thread, before any other. The
+ * calling thread becomes a task that belongs to no chip.
+ *
+ * @param config The simulation configuration.
+ */
+void sim_init(const sim_config_t *config);
+
+/**
+ * @brief get the clock of the simulation.
+ *
+ * @return The microseconds since sim_init, the same value returned by esp_timer_get_time.
+ */
+int64_t sim_time_us(void);
+
+/**
+ * @brief get the clock mode of the simulation.
+ *
+ * @return The clock mode set by sim_init.
+ */
+sim_clock_t sim_clock(void);
+
+/**
+ * @brief set the system time of all the chips, as SNTP would.
+ *
+ * @details Until this is called the system time counts from the epoch, as on a chip that never
+ * synced.
+ *
+ * @param epoch_us The current system time in microseconds since the epoch.
+ */
+void sim_time_set_epoch(int64_t epoch_us);
+
+/**
+ * @brief intercept the readings of the system time.
+ *
+ * @details The hook is called for each gettimeofday of the simulated code with the simulated
+ * system time and returns the time to report instead. Pass NULL to remove it.
+ *
+ * @param hook The hook.
+ * @param arg The argument of the hook.
+ */
+void sim_time_set_hook(int64_t (*hook)(int64_t epoch_us, void *arg), void *arg);
+
+typedef struct sim_chip sim_chip_t;
+
+typedef struct
+{
+    // Short name prefixed to the log lines of the chip
+    const char *name;
+    // Heap of the chip, 300 KiB when zero
+    size_t heap_size;
+    // Heap already used by the firmware when Edgehog starts, 100 KiB when zero
+    size_t heap_used_at_boot;
+    // Size of the NVS partitions of the chip, 24 KiB when zero
+    uint32_t nvs_partition_size;
+} sim_chip_config_t;
+
+/**
+ * @brief create a chip.
+ *
+ * @details Chips are never destroyed, their NVS survives the destruction of the Edgehog and
+ * Astarte devices running on them, as across a reboot.
+ *
+ * @param config The chip configuration.
+ * @return The chip, NULL when out of memory.
+ */
+sim_chip_t *sim_chip_new(const sim_chip_config_t *config);
+
+/**
+ * @brief run the calling task on behalf of a chip.
+ *
+ * @details The heap, NVS, event loop and WiFi APIs called by the task act on the chip, and its CPU
+ * time is charged to it, until the matching sim_chip_leave. Calls can be nested.
+ *
+ * @param chip The chip.
+ */
+void sim_chip_enter(sim_chip_t *chip);
+
+/**
+ * @brief stop running on behalf of the chip of the last sim_chip_enter.
+ */
+void sim_chip_leave(void);
+
+/**
+ * @brief get the chip the calling task runs on behalf of.
+ *
+ * @return The chip, NULL if none.
+ */
+sim_chip_t *sim_chip_current(void);
+
+/**
+ * @brief create a task that belongs to a chip.
+ *
+ * @details The tasks created by a task belong to the same chip, like the ones created by Edgehog.
+ *
+ * @param chip The chip.
+ * @param task The task function.
+ * @param name The task name.
+ * @param arg The argument of the task function.
+ * @param out_handle Where to store the task handle, can be NULL.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the chip is out of heap.
+ */
+esp_err_t sim_chip_start_task(sim_chip_t *chip, TaskFunction_t task, const char *name, void *arg,
+    TaskHandle_t *out_handle);
+
+/**
+ * @brief get the name of a chip.
+ *
+ * @param chip The chip.
+ * @return The name.
+ */
+const char *sim_chip_name(const sim_chip_t *chip);
+
+/**
+ * @brief get the host CPU time used on behalf of a chip.
+ *
+ * @details The time of a running task is charged when it blocks, so the value of a busy chip lags
+ * behind.
+ *
+ * @param chip The chip.
+ * @return The CPU time in microseconds.
+ */
+uint64_t sim_chip_cpu_us(const sim_chip_t *chip);
+
+typedef struct
+{
+    uint64_t mutex_takes;
+    // Takes that found the mutex held and waited for it
+    uint64_t mutex_contended;
+    // Time spent waiting for the mutexes, on the simulation clock
+    uint64_t mutex_wait_us;
+    // portMUX critical sections, nested entries are not counted
+    uint64_t critical_entries;
+    // Entries that found the spinlock held by another task
+    uint64_t critical_contended;
+} sim_lock_stats_t;
+
+/**
+ * @brief get the contention on the FreeRTOS mutexes and the critical sections of a chip.
+ *
+ * @details Locks are charged to the chip of the task taking them, whichever chip created them.
+ *
+ * @param chip The chip.
+ * @param stats Where to store the statistics.
+ */
+void sim_chip_get_lock_stats(const sim_chip_t *chip, sim_lock_stats_t *stats);
+
+typedef struct
+{
+    size_t total;
+    size_t free;
+    size_t minimum_free;
+    size_t largest_free_block;
+    size_t allocated_blocks;
+} sim_heap_info_t;
+
+/**
+ * @brief get the state of the heap of a chip.
+ *
+ * @details The heap of a chip is a first fit allocator of the heap_size of the chip, with the
+ * block overhead of the ESP-IDF heap, so that it fragments like the one of the chip. Allocations
+ * made on behalf of no chip are not accounted.
+ *
+ * @param chip The chip.
+ * @param info Where to store the heap state.
+ */
+void sim_heap_get_info(sim_chip_t *chip, sim_heap_info_t *info);
+
+/**
+ * @brief get a random number.
+ *
+ * @details Each chip has its own generator, seeded from the simulation seed and the chip, so that
+ * the numbers drawn by a chip do not depend on the scheduling of the others.
+ *
+ * @return A random number drawn from the generator of the current chip, or from the one of the
+ * simulation when running on behalf of no chip.
+ */
+uint32_t sim_random(void);
+
+typedef enum
+{
+    // Scans last as long as on the chip and find the APs set with sim_wifi_set_aps
+    SIM_WIFI_SCAN_RADIO = 0,
+    // Scans last until sim_wifi_complete_scan
+    SIM_WIFI_SCAN_EXTERNAL,
+} sim_wifi_scan_mode_t;
+
+/**
+ * @brief set the access points around a chip.
+ *
+ * @param chip The chip.
+ * @param aps The APs, copied.
+ * @param count The number of APs.
+ * @param associated The index of the AP the station is associated with, -1 if none.
+ */
+void sim_wifi_set_aps(
+    sim_chip_t *chip, const wifi_ap_record_t *aps, size_t count, int associated);
+
+/**
+ * @brief change the RSSI of an access point set with sim_wifi_set_aps.
+ *
+ * @param chip The chip.
+ * @param index The index of the AP.
+ * @param rssi The new RSSI.
+ */
+void sim_wifi_set_rssi(sim_chip_t *chip, size_t index, int8_t rssi);
+
+/**
+ * @brief set how the scans of a chip complete.
+ *
+ * @param chip The chip.
+ * @param mode The scan mode.
+ */
+void sim_wifi_set_scan_mode(sim_chip_t *chip, sim_wifi_scan_mode_t mode);
+
+/**
+ * @brief complete the scan of a chip with the given results.
+ *
+ * @details The results are returned by the next esp_wifi_scan_get_ap_records and
+ * WIFI_EVENT_SCAN_DONE is posted, also when no scan was started, as when the application scans.
+ *
+ * @param chip The chip.
+ * @param status The status of the scan done event.
+ * @param records The APs found, copied.
+ * @param count The number of APs found.
+ * @return ESP_OK on success, an error if the event could not be posted.
+ */
+esp_err_t sim_wifi_complete_scan(
+    sim_chip_t *chip, uint32_t status, const wifi_ap_record_t *records, uint16_t count);
+
+/**
+ * @brief intercept the results of the NVS commits.
+ *
+ * @details The hook is called for each nvs_commit with its result and returns the result to report
+ * instead. Pass NULL to remove it.
+ *
+ * @param hook The hook.
+ * @param arg The argument of the hook.
+ */
+void sim_nvs_set_commit_hook(esp_err_t (*hook)(esp_err_t ret, void *arg), void *arg);
+
+typedef struct
+{
+    // Broker of the Astarte devices, NULL to script the connections without any network
+    const char *broker_host;
+    uint16_t broker_port;
+    // Realm of the devices, "test" when NULL
+    const char *realm;
+    // Scripted connections: delay between astarte_device_start, or the end of an outage, and the
+    // connection, 0 means that the devices connect only on sim_astarte_connect
+    uint32_t connect_delay_ms;
+    // Scripted connections: probability that a reconnection does not resume the session
+    float session_loss;
+} sim_astarte_config_t;
+
+/**
+ * @brief configure how the Astarte devices connect.
+ *
+ * @details This function must be called before the first astarte_device_init. Without it the
+ * connections are scripted and happen 100 ms after astarte_device_start.
+ *
+ * @param config The configuration.
+ */
+void sim_astarte_configure(const sim_astarte_config_t *config);
+
+/**
+ * @brief drop the connection of an Astarte device.
+ *
+ * @param device The device.
+ * @param down_ms How long the device stays disconnected before reconnecting, 0 means until
+ * sim_astarte_connect with scripted connections and until the next reconnection attempt with a
+ * broker.
+ */
+void sim_astarte_disconnect(astarte_device_handle_t device, uint32_t down_ms);
+
+/**
+ * @brief connect a started Astarte device, for scripted connections only.
+ *
+ * @param device The device.
+ * @param session_present Whether the broker resumed the session, -1 to let the simulation decide.
+ */
+void sim_astarte_connect(astarte_device_handle_t device, int session_present);
+
+/**
+ * @brief receive a string on a server owned interface, as if sent by Astarte.
+ *
+ * @details The data event callback of the device is called by the calling task, on behalf of the
+ * chip the device was created on.
+ *
+ * @param device The device.
+ * @param interface_name The interface.
+ * @param path The path.
+ * @param value The string.
+ */
+void sim_astarte_receive_string(astarte_device_handle_t device, const char *interface_name,
+    const char *path, const char *value);
+
+/**
+ * @brief get the chip an Astarte device was created on.
+ *
+ * @param device The device.
+ * @return The chip, NULL if none.
+ */
+sim_chip_t *sim_astarte_chip(astarte_device_handle_t device);
+
+// Payload sizes are counted in power of two buckets, from below 16 bytes to 64 KiB and more
+#define SIM_ASTARTE_PAYLOAD_BUCKETS 14
+
+typedef struct
+{
+    uint64_t publishes;
+    uint64_t failed_publishes;
+    uint64_t payload_bytes;
+    // Payload, topic and MQTT headers
+    uint64_t wire_bytes;
+    uint64_t connections;
+    uint64_t resumed_sessions;
+    uint64_t disconnections;
+    uint64_t payload_sizes[SIM_ASTARTE_PAYLOAD_BUCKETS];
+} sim_astarte_stats_t;
+
+/**
+ * @brief get the publish statistics of a chip.
+ *
+ * @details The statistics of a chip add up the ones of all the Astarte devices created on it.
+ *
+ * @param chip The chip, NULL for the whole simulation.
+ * @param stats Where to store the statistics.
+ */
+void sim_astarte_get_stats(const sim_chip_t *chip, sim_astarte_stats_t *stats);
+
+typedef struct
+{
+    const char *interface_name;
+    uint64_t publishes;
+    uint64_t payload_bytes;
+} sim_astarte_interface_stats_t;
+
+/**
+ * @brief get the publish statistics of each interface.
+ *
+ * @param stats Where to store the statistics.
+ * @param max_count The size of stats.
+ * @return The number of interfaces, it can exceed max_count.
+ */
+size_t sim_astarte_get_interface_stats(sim_astarte_interface_stats_t *stats, size_t max_count);
+
+/**
+ * @brief observe the publishes of all the Astarte devices.
+ *
+ * @details The hook is called by the publishing task for each successful publish, the calls for
+ * the publishes of a device are serialized and in the order they were sent. Pass NULL to remove it.
+ *
+ * @param hook The hook.
+ * @param arg The argument of the hook.
+ */
+void sim_astarte_set_publish_hook(void (*hook)(astarte_device_handle_t device, const char *topic,
+                                      const void *payload, size_t len, int qos, void *arg),
+    void *arg);
+
+/**
+ * @brief intercept the results of the publishes.
+ *
+ * @details The hook is called for each publish, property or datastream, with its result and
+ * returns the result to report instead. Pass NULL to remove it.
+ *
+ * @param hook The hook.
+ * @param arg The argument of the hook.
+ */
+void sim_astarte_set_result_hook(astarte_err_t (*hook)(astarte_err_t ret, void *arg), void *arg);
+
+#endif // SIM_H
@@ -0,0 +1,321 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <astarte_bson.h>
+#include <astarte_bson_serializer.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The BSON serializer and reader of the Astarte device SDK, little endian hosts only
+
+#define BYTE_ARRAY_INITIAL_CAPACITY 64
+
+static void byte_array_append(struct astarte_byte_array_t *ba, const void *bytes, size_t len)
+{
+    if (!ba->buf) {
+        // A previous allocation failed, the document is dropped by get_document
+        return;
+    }
+    if (ba->size + len > ba->capacity) {
+        size_t capacity = ba->capacity;
+        while (ba->size + len > capacity) {
+            capacity *= 2;
+        }
+        uint8_t *buf = realloc(ba->buf, capacity);
+        if (!buf) {
+            free(ba->buf);
+            ba->buf = NULL;
+            return;
+        }
+        ba->buf = buf;
+        ba->capacity = capacity;
+    }
+    memcpy(ba->buf + ba->size, bytes, len);
+    ba->size += len;
+}
+
+static void append_element(struct astarte_bson_serializer_t *bs, uint8_t type, const char *name)
+{
+    byte_array_append(&bs->ba, &type, 1);
+    byte_array_append(&bs->ba, name, strlen(name) + 1);
+}
+
+void astarte_bson_serializer_init(struct astarte_bson_serializer_t *bs)
+{
+    bs->ba.buf = malloc(BYTE_ARRAY_INITIAL_CAPACITY);
+    bs->ba.capacity = BYTE_ARRAY_INITIAL_CAPACITY;
+    bs->ba.size = 0;
+    static const uint8_t size_placeholder[4] = { 0 };
+    byte_array_append(&bs->ba, size_placeholder, sizeof(size_placeholder));
+}
+
+void astarte_bson_serializer_destroy(struct astarte_bson_serializer_t *bs)
+{
+    free(bs->ba.buf);
+    bs->ba.buf = NULL;
+    bs->ba.size = 0;
+    bs->ba.capacity = 0;
+}
+
+const void *astarte_bson_serializer_get_document(
+    const struct astarte_bson_serializer_t *bs, int *size)
+{
+    if (size) {
+        *size = bs->ba.buf ? (int) bs->ba.size : 0;
+    }
+    return bs->ba.buf;
+}
+
+int astarte_bson_serializer_write_document(
+    const struct astarte_bson_serializer_t *bs, void *out_buf, int out_buf_len)
+{
+    if (!bs->ba.buf || out_buf_len < (int) bs->ba.size) {
+        return 0;
+    }
+    memcpy(out_buf, bs->ba.buf, bs->ba.size);
+    return (int) bs->ba.size;
+}
+
+int astarte_bson_serializer_document_size(const struct astarte_bson_serializer_t *bs)
+{
+    return bs->ba.buf ? (int) bs->ba.size : 0;
+}
+
+void astarte_bson_serializer_append_end_of_document(struct astarte_bson_serializer_t *bs)
+{
+    static const uint8_t terminator = 0;
+    byte_array_append(&bs->ba, &terminator, 1);
+    if (bs->ba.buf) {
+        uint32_t size = bs->ba.size;
+        memcpy(bs->ba.buf, &size, sizeof(size));
+    }
+}
+
+void astarte_bson_serializer_append_double(
+    struct astarte_bson_serializer_t *bs, const char *name, double value)
+{
+    append_element(bs, BSON_TYPE_DOUBLE, name);
+    byte_array_append(&bs->ba, &value, sizeof(value));
+}
+
+void astarte_bson_serializer_append_int32(
+    struct astarte_bson_serializer_t *bs, const char *name, int32_t value)
+{
+    append_element(bs, BSON_TYPE_INT32, name);
+    byte_array_append(&bs->ba, &value, sizeof(value));
+}
+
+void astarte_bson_serializer_append_int64(
+    struct astarte_bson_serializer_t *bs, const char *name, int64_t value)
+{
+    append_element(bs, BSON_TYPE_INT64, name);
+    byte_array_append(&bs->ba, &value, sizeof(value));
+}
+
+void astarte_bson_serializer_append_binary(
+    struct astarte_bson_serializer_t *bs, const char *name, const void *bin, int size)
+{
+    append_element(bs, BSON_TYPE_BINARY, name);
+    int32_t len = size;
+    uint8_t subtype = BSON_SUBTYPE_DEFAULT_BINARY;
+    byte_array_append(&bs->ba, &len, sizeof(len));
+    byte_array_append(&bs->ba, &subtype, 1);
+    byte_array_append(&bs->ba, bin, size);
+}
+
+void astarte_bson_serializer_append_string(
+    struct astarte_bson_serializer_t *bs, const char *name, const char *string)
+{
+    append_element(bs, BSON_TYPE_STRING, name);
+    int32_t len = strlen(string) + 1;
+    byte_array_append(&bs->ba, &len, sizeof(len));
+    byte_array_append(&bs->ba, string, len);
+}
+
+void astarte_bson_serializer_append_datetime(
+    struct astarte_bson_serializer_t *bs, const char *name, uint64_t epoch_millis)
+{
+    append_element(bs, BSON_TYPE_DATETIME, name);
+    byte_array_append(&bs->ba, &epoch_millis, sizeof(epoch_millis));
+}
+
+void astarte_bson_serializer_append_document(
+    struct astarte_bson_serializer_t *bs, const char *name, const void *document)
+{
+    append_element(bs, BSON_TYPE_DOCUMENT, name);
+    byte_array_append(&bs->ba, document, astarte_bson_document_size(document));
+}
+
+void astarte_bson_serializer_append_boolean(
+    struct astarte_bson_serializer_t *bs, const char *name, int value)
+{
+    append_element(bs, BSON_TYPE_BOOLEAN, name);
+    uint8_t byte = value ? 1 : 0;
+    byte_array_append(&bs->ba, &byte, 1);
+}
+
+#define APPEND_ARRAY(bs, name, count, append_item)                                                 \
+    do {                                                                                           \
+        struct astarte_bson_serializer_t array;                                                    \
+        astarte_bson_serializer_init(&array);                                                      \
+        for (int i = 0; i < (count); i++) {                                                        \
+            char key[12];                                                                          \
+            snprintf(key, sizeof(key), "%i", i);                                                   \
+            append_item;                                                                           \
+        }                                                                                          \
+        astarte_bson_serializer_append_end_of_document(&array);                                    \
+        append_element((bs), BSON_TYPE_ARRAY, (name));                                             \
+        if (array.ba.buf) {                                                                        \
+            byte_array_append(&(bs)->ba, array.ba.buf, array.ba.size);                             \
+        } else {                                                                                   \
+            free((bs)->ba.buf);                                                                    \
+            (bs)->ba.buf = NULL;                                                                   \
+        }                                                                                          \
+        astarte_bson_serializer_destroy(&array);                                                   \
+    } while (0)
+
+void astarte_bson_serializer_append_int32_array(
+    struct astarte_bson_serializer_t *bs, const char *name, const int32_t *arr, int count)
+{
+    APPEND_ARRAY(bs, name, count, astarte_bson_serializer_append_int32(&array, key, arr[i]));
+}
+
+void astarte_bson_serializer_append_int64_array(
+    struct astarte_bson_serializer_t *bs, const char *name, const int64_t *arr, int count)
+{
+    APPEND_ARRAY(bs, name, count, astarte_bson_serializer_append_int64(&array, key, arr[i]));
+}
+
+void astarte_bson_serializer_append_double_array(
+    struct astarte_bson_serializer_t *bs, const char *name, const double *arr, int count)
+{
+    APPEND_ARRAY(bs, name, count, astarte_bson_serializer_append_double(&array, key, arr[i]));
+}
+
+void astarte_bson_serializer_append_string_array(
+    struct astarte_bson_serializer_t *bs, const char *name, const char *const *arr, int count)
+{
+    APPEND_ARRAY(bs, name, count, astarte_bson_serializer_append_string(&array, key, arr[i]));
+}
+
+static uint32_t read_uint32(const uint8_t *ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+uint32_t astarte_bson_document_size(const void *document)
+{
+    return read_uint32(document);
+}
+
+static bool value_size(uint8_t type, const uint8_t *value, uint32_t *size)
+{
+    switch (type) {
+        case BSON_TYPE_DOUBLE:
+        case BSON_TYPE_DATETIME:
+        case BSON_TYPE_INT64:
+            *size = 8;
+            return true;
+        case BSON_TYPE_STRING:
+            *size = 4 + read_uint32(value);
+            return true;
+        case BSON_TYPE_DOCUMENT:
+        case BSON_TYPE_ARRAY:
+            *size = read_uint32(value);
+            return true;
+        case BSON_TYPE_BINARY:
+            *size = 5 + read_uint32(value);
+            return true;
+        case BSON_TYPE_BOOLEAN:
+            *size = 1;
+            return true;
+        case BSON_TYPE_INT32:
+            *size = 4;
+            return true;
+        default:
+            return false;
+    }
+}
+
+const void *astarte_bson_key_lookup(const char *key, const void *document, uint8_t *type)
+{
+    const uint8_t *doc = document;
+    uint32_t doc_size = astarte_bson_document_size(document);
+    uint32_t offset = 4;
+    while (offset + 1 < doc_size) {
+        uint8_t element_type = doc[offset++];
+        const char *element_key = (const char *) doc + offset;
+        size_t key_len = strnlen(element_key, doc_size - offset);
+        if (offset + key_len + 1 > doc_size) {
+            return NULL;
+        }
+        offset += key_len + 1;
+        const uint8_t *value = doc + offset;
+        uint32_t size;
+        if (!value_size(element_type, value, &size) || offset + size > doc_size) {
+            return NULL;
+        }
+        if (strcmp(element_key, key) == 0) {
+            if (type) {
+                *type = element_type;
+            }
+            return value;
+        }
+        offset += size;
+    }
+    return NULL;
+}
+
+const char *astarte_bson_value_to_string(const void *value_ptr, uint32_t *len)
+{
+    uint32_t size = read_uint32(value_ptr);
+    if (len) {
+        *len = size > 0 ? size - 1 : 0;
+    }
+    return (const char *) value_ptr + 4;
+}
+
+int32_t astarte_bson_value_to_int32(const void *value_ptr)
+{
+    int32_t value;
+    memcpy(&value, value_ptr, sizeof(value));
+    return value;
+}
+
+int64_t astarte_bson_value_to_int64(const void *value_ptr)
+{
+    int64_t value;
+    memcpy(&value, value_ptr, sizeof(value));
+    return value;
+}
+
+double astarte_bson_value_to_double(const void *value_ptr)
+{
+    double value;
+    memcpy(&value, value_ptr, sizeof(value));
+    return value;
+}
+
+int8_t astarte_bson_value_to_int8(const void *value_ptr)
+{
+    return *(const int8_t *) value_ptr;
+}
@@ -0,0 +1,770 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_mqtt.h"
+#include <astarte_bson.h>
+#include <astarte_bson_serializer.h>
+#include <astarte_device.h>
+#include <esp_log.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * As in the Astarte device SDK, each device has an MQTT task that connects it and runs its
+ * callbacks. Publishes are written by the calling task and fail while the device is disconnected.
+ */
+
+#define MAX_INTERFACES 32
+#define TOPIC_MAX_LEN 512
+#define EVENT_QUEUE_SIZE 16
+// Stack of the esp-mqtt task and the buffers the SDK and esp-mqtt allocate for each device
+#define MQTT_TASK_STACK_SIZE 6144
+#define MQTT_TASK_PRIORITY 5
+#define MQTT_BUFFERS_SIZE 8192
+#define DEFAULT_CONNECT_DELAY_MS 100
+#define DEFAULT_REALM "test"
+#define ENCODED_ID_LEN 22
+#define INTROSPECTION_MAX_LEN 4096
+
+static const char *TAG = "SIM_ASTARTE";
+
+typedef enum
+{
+    EVENT_START,
+    EVENT_STOP,
+    EVENT_DROP,
+    EVENT_CONNECT,
+    EVENT_CONNECTED,
+    EVENT_DISCONNECTED,
+    EVENT_DATA,
+    EVENT_EXIT,
+} event_type_t;
+
+typedef struct
+{
+    event_type_t type;
+    int session_present;
+    uint32_t down_ms;
+    // EVENT_DATA only, allocated on the chip
+    char *topic;
+    void *payload;
+    size_t payload_len;
+} device_event_t;
+
+struct astarte_device_t
+{
+    sim_chip_t *chip;
+    astarte_device_config_t config;
+    char realm[64];
+    char encoded_id[ENCODED_ID_LEN + 1];
+    const astarte_interface_t *interfaces[MAX_INTERFACES];
+    int interface_count;
+    QueueHandle_t events;
+    SemaphoreHandle_t exited;
+    void *mqtt_buffers;
+    sim_mqtt_client_t *client;
+    // Serializes the publishes, so that the hooks see them in the order they are sent
+    pthread_mutex_t publish_lock;
+    // Read by the publishing tasks, written by the MQTT task
+    bool connected;
+    // Owned by the MQTT task
+    bool started;
+    bool has_session;
+    int64_t connect_at_us;
+};
+
+typedef struct
+{
+    char *interface_name;
+    uint64_t publishes;
+    uint64_t payload_bytes;
+} interface_stats_t;
+
+static sim_astarte_config_t astarte_config = { .connect_delay_ms = DEFAULT_CONNECT_DELAY_MS };
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static sim_astarte_stats_t global_stats;
+static interface_stats_t interface_stats[MAX_INTERFACES * 2];
+static size_t interface_stats_count;
+static void (*publish_hook)(astarte_device_handle_t device, const char *topic, const void *payload,
+    size_t len, int qos, void *arg);
+static void *publish_hook_arg;
+static astarte_err_t (*result_hook)(astarte_err_t ret, void *arg);
+static void *result_hook_arg;
+
+void sim_astarte_configure(const sim_astarte_config_t *config)
+{
+    astarte_config = *config;
+}
+
+static const char *realm_of(const astarte_device_config_t *cfg)
+{
+    if (cfg->realm) {
+        return cfg->realm;
+    }
+    return astarte_config.realm ? astarte_config.realm : DEFAULT_REALM;
+}
+
+static void post_event(astarte_device_handle_t device, const device_event_t *event)
+{
+    if (xQueueSend(device->events, event, portMAX_DELAY) != pdPASS) {
+        sim_panic("Astarte device event lost");
+    }
+}
+
+// A full queue blocks the I/O thread, which serves all the devices: the event is dropped instead
+static void post_io_event(astarte_device_handle_t device, const device_event_t *event)
+{
+    if (xQueueSend(device->events, event, 0) != pdPASS) {
+        ESP_LOGW(TAG, "MQTT event %d of %s dropped", event->type, device->encoded_id);
+        if (event->type == EVENT_DATA) {
+            free(event->topic);
+            free(event->payload);
+        }
+    }
+}
+
+static int payload_bucket(size_t len)
+{
+    int bucket = 0;
+    for (size_t size = 16; size <= len && bucket < SIM_ASTARTE_PAYLOAD_BUCKETS - 1; size *= 2) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static void account_publish(astarte_device_handle_t device, const char *interface_name,
+    size_t topic_len, size_t len, int qos, bool ok)
+{
+    // Fixed header, remaining length, topic and packet identifier of the MQTT PUBLISH
+    size_t remaining_len = 2 + topic_len + (qos > 0 ? 2 : 0) + len;
+    size_t wire_bytes = 1 + remaining_len;
+    for (size_t rest = remaining_len; rest >= 128; rest /= 128) {
+        wire_bytes++;
+    }
+    wire_bytes++;
+
+    pthread_mutex_lock(&stats_lock);
+    sim_astarte_stats_t *stats[] = { &global_stats, &device->chip->astarte_stats };
+    for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+        if (!ok) {
+            stats[i]->failed_publishes++;
+            continue;
+        }
+        stats[i]->publishes++;
+        stats[i]->payload_bytes += len;
+        stats[i]->wire_bytes += wire_bytes;
+        stats[i]->payload_sizes[payload_bucket(len)]++;
+    }
+    if (ok) {
+        size_t i = 0;
+        while (i < interface_stats_count
+            && strcmp(interface_stats[i].interface_name, interface_name) != 0) {
+            i++;
+        }
+        if (i == interface_stats_count
+            && interface_stats_count < sizeof(interface_stats) / sizeof(interface_stats[0])) {
+            interface_stats[i].interface_name = sim_sys_strdup(interface_name);
+            interface_stats_count++;
+        }
+        if (i < interface_stats_count) {
+            interface_stats[i].publishes++;
+            interface_stats[i].payload_bytes += len;
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// The publishes of the SDK itself, like the introspection, bypass the result hook
+static astarte_err_t publish(astarte_device_handle_t device, const char *interface_name,
+    const char *topic, const void *payload, size_t len, int qos, bool hooked)
+{
+    astarte_err_t ret = ASTARTE_ERR;
+    pthread_mutex_lock(&device->publish_lock);
+    if (__atomic_load_n(&device->connected, __ATOMIC_ACQUIRE)) {
+        if (!device->client || sim_mqtt_publish(device->client, topic, payload, len, qos)) {
+            ret = ASTARTE_OK;
+        }
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    astarte_err_t (*hook)(astarte_err_t ret, void *arg) = result_hook;
+    void *hook_arg = result_hook_arg;
+    void (*on_publish)(astarte_device_handle_t device, const char *topic, const void *payload,
+        size_t len, int qos, void *arg)
+        = publish_hook;
+    void *on_publish_arg = publish_hook_arg;
+    pthread_mutex_unlock(&stats_lock);
+    if (hook && hooked) {
+        ret = hook(ret, hook_arg);
+    }
+    account_publish(device, interface_name, strlen(topic), len, qos, ret == ASTARTE_OK);
+    if (ret == ASTARTE_OK && on_publish) {
+        on_publish(device, topic, payload, len, qos, on_publish_arg);
+    }
+    pthread_mutex_unlock(&device->publish_lock);
+    return ret;
+}
+
+static astarte_err_t publish_bson(astarte_device_handle_t device, const char *interface_name,
+    const char *path, struct astarte_bson_serializer_t *bs, int qos)
+{
+    astarte_bson_serializer_append_end_of_document(bs);
+    int len;
+    const void *doc = astarte_bson_serializer_get_document(bs, &len);
+    if (!doc) {
+        astarte_bson_serializer_destroy(bs);
+        return ASTARTE_ERR_OUT_OF_MEMORY;
+    }
+    char topic[TOPIC_MAX_LEN];
+    if (snprintf(topic, sizeof(topic), "%s/%s/%s%s", device->realm, device->encoded_id,
+            interface_name, path)
+        >= (int) sizeof(topic)) {
+        astarte_bson_serializer_destroy(bs);
+        return ASTARTE_ERR_INVALID_INTERFACE_PATH;
+    }
+    astarte_err_t ret = publish(device, interface_name, topic, doc, len, qos, true);
+    astarte_bson_serializer_destroy(bs);
+    return ret;
+}
+
+// Sent on each connection without a session, so that Astarte knows the interfaces of the device
+static void publish_introspection(astarte_device_handle_t device)
+{
+    char *introspection = malloc(INTROSPECTION_MAX_LEN);
+    if (!introspection) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return;
+    }
+    size_t len = 0;
+    introspection[0] = '\0';
+    for (int i = 0; i < device->interface_count && len < INTROSPECTION_MAX_LEN; i++) {
+        const astarte_interface_t *interface = device->interfaces[i];
+        len += snprintf(introspection + len, INTROSPECTION_MAX_LEN - len, "%s%s:%d:%d",
+            i > 0 ? ";" : "", interface->name, interface->major_version,
+            interface->minor_version);
+    }
+    len = strnlen(introspection, INTROSPECTION_MAX_LEN);
+
+    char topic[TOPIC_MAX_LEN];
+    snprintf(topic, sizeof(topic), "%s/%s", device->realm, device->encoded_id);
+    publish(device, "introspection", topic, introspection, len, 2, false);
+    snprintf(topic, sizeof(topic), "%s/%s/control/emptyCache", device->realm, device->encoded_id);
+    publish(device, "control", topic, "1", 1, 2, false);
+    free(introspection);
+}
+
+static void subscribe(astarte_device_handle_t device)
+{
+    char topic[TOPIC_MAX_LEN];
+    snprintf(topic, sizeof(topic), "%s/%s/control/consumer/properties", device->realm,
+        device->encoded_id);
+    sim_mqtt_subscribe(device->client, topic, 2);
+    for (int i = 0; i < device->interface_count; i++) {
+        if (device->interfaces[i]->ownership == OWNERSHIP_SERVER) {
+            snprintf(topic, sizeof(topic), "%s/%s/%s/#", device->realm, device->encoded_id,
+                device->interfaces[i]->name);
+            sim_mqtt_subscribe(device->client, topic, 2);
+        }
+    }
+}
+
+static void connected(astarte_device_handle_t device, int session_present)
+{
+    __atomic_store_n(&device->connected, true, __ATOMIC_RELEASE);
+    device->has_session = true;
+    pthread_mutex_lock(&stats_lock);
+    global_stats.connections++;
+    device->chip->astarte_stats.connections++;
+    if (session_present) {
+        global_stats.resumed_sessions++;
+        device->chip->astarte_stats.resumed_sessions++;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    if (device->client) {
+        subscribe(device);
+    }
+    if (!session_present) {
+        publish_introspection(device);
+    }
+    if (device->config.connection_event_callback) {
+        astarte_device_connection_event_t event
+            = { .device = device, .session_present = session_present };
+        device->config.connection_event_callback(&event);
+    }
+}
+
+static void disconnected(astarte_device_handle_t device)
+{
+    if (!__atomic_exchange_n(&device->connected, false, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    pthread_mutex_lock(&stats_lock);
+    global_stats.disconnections++;
+    device->chip->astarte_stats.disconnections++;
+    pthread_mutex_unlock(&stats_lock);
+    if (device->config.disconnection_event_callback) {
+        astarte_device_disconnection_event_t event = { .device = device };
+        device->config.disconnection_event_callback(&event);
+    }
+}
+
+static void data_received(
+    astarte_device_handle_t device, const char *topic, const void *payload, size_t len)
+{
+    size_t prefix_len = strlen(device->realm) + 1 + strlen(device->encoded_id) + 1;
+    if (strlen(topic) <= prefix_len || strncmp(topic + prefix_len, "control/", 8) == 0) {
+        return;
+    }
+    const char *interface_name = topic + prefix_len;
+    const char *path = strchr(interface_name, '/');
+    if (!path || !device->config.data_event_callback || len < 5
+        || astarte_bson_document_size(payload) != len) {
+        return;
+    }
+
+    char name[TOPIC_MAX_LEN];
+    snprintf(name, sizeof(name), "%.*s", (int) (path - interface_name), interface_name);
+    uint8_t type;
+    const void *value = astarte_bson_key_lookup("v", payload, &type);
+    if (!value) {
+        ESP_LOGW(TAG, "Unexpected payload on %s", topic);
+        return;
+    }
+    astarte_device_data_event_t event = { .device = device,
+        .interface_name = name,
+        .path = path,
+        .bson_value = value,
+        .bson_value_type = type };
+    device->config.data_event_callback(&event);
+}
+
+static bool scripted_session_present(astarte_device_handle_t device)
+{
+    return device->has_session
+        && (double) sim_random() / UINT32_MAX >= astarte_config.session_loss;
+}
+
+static void mqtt_task(void *arg)
+{
+    astarte_device_handle_t device = arg;
+    device_event_t event;
+    for (;;) {
+        TickType_t ticks = portMAX_DELAY;
+        if (device->connect_at_us != SIM_FOREVER) {
+            int64_t wait_us = device->connect_at_us - sim_time_us();
+            ticks = wait_us <= 0 ? 0 : (wait_us + 999) / 1000 / portTICK_PERIOD_MS;
+        }
+        if (xQueueReceive(device->events, &event, ticks) != pdPASS) {
+            if (sim_time_us() >= device->connect_at_us) {
+                device->connect_at_us = SIM_FOREVER;
+                connected(device, scripted_session_present(device));
+            }
+            continue;
+        }
+
+        switch (event.type) {
+            case EVENT_START:
+                device->started = true;
+                if (device->client) {
+                    sim_mqtt_client_start(device->client);
+                } else if (!device->connected && astarte_config.connect_delay_ms > 0) {
+                    device->connect_at_us
+                        = sim_time_us() + astarte_config.connect_delay_ms * 1000LL;
+                }
+                break;
+            case EVENT_STOP:
+                device->started = false;
+                device->connect_at_us = SIM_FOREVER;
+                if (device->client) {
+                    sim_mqtt_client_stop(device->client);
+                }
+                disconnected(device);
+                break;
+            case EVENT_DROP:
+                if (device->client) {
+                    sim_mqtt_client_drop(device->client, event.down_ms);
+                    break;
+                }
+                disconnected(device);
+                if (device->started && event.down_ms > 0) {
+                    device->connect_at_us = sim_time_us() + event.down_ms * 1000LL;
+                } else {
+                    device->connect_at_us = SIM_FOREVER;
+                }
+                break;
+            case EVENT_CONNECT:
+                if (device->client) {
+                    ESP_LOGW(TAG, "Connections to a broker cannot be scripted");
+                } else if (device->started && !device->connected) {
+                    device->connect_at_us = SIM_FOREVER;
+                    connected(device,
+                        event.session_present >= 0 ? event.session_present
+                                                   : scripted_session_present(device));
+                }
+                break;
+            case EVENT_CONNECTED:
+                if (device->started) {
+                    connected(device, event.session_present);
+                }
+                break;
+            case EVENT_DISCONNECTED:
+                disconnected(device);
+                break;
+            case EVENT_DATA:
+                data_received(device, event.topic, event.payload, event.payload_len);
+                free(event.topic);
+                free(event.payload);
+                break;
+            case EVENT_EXIT:
+                xSemaphoreGive(device->exited);
+                vTaskDelete(NULL);
+                return;
+        }
+    }
+}
+
+static void on_mqtt_connect(void *arg, bool session_present)
+{
+    device_event_t event = { .type = EVENT_CONNECTED, .session_present = session_present };
+    post_io_event(arg, &event);
+}
+
+static void on_mqtt_disconnect(void *arg)
+{
+    device_event_t event = { .type = EVENT_DISCONNECTED };
+    post_io_event(arg, &event);
+}
+
+// Runs on behalf of the chip of the device, the copies are accounted on its heap
+static void on_mqtt_message(void *arg, const char *topic, size_t topic_len,
+    const uint8_t *payload, size_t payload_len)
+{
+    device_event_t event = { .type = EVENT_DATA, .payload_len = payload_len };
+    event.topic = malloc(topic_len + 1);
+    event.payload = malloc(payload_len ? payload_len : 1);
+    if (!event.topic || !event.payload) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        free(event.topic);
+        free(event.payload);
+        return;
+    }
+    memcpy(event.topic, topic, topic_len);
+    event.topic[topic_len] = '\0';
+    memcpy(event.payload, payload, payload_len);
+    post_io_event(arg, &event);
+}
+
+static void encode_random_id(char *out)
+{
+    static const char alphabet[]
+        = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    for (int i = 0; i < ENCODED_ID_LEN; i++) {
+        out[i] = alphabet[sim_random() % 64];
+    }
+    out[ENCODED_ID_LEN] = '\0';
+}
+
+astarte_device_handle_t astarte_device_init(astarte_device_config_t *cfg)
+{
+    sim_chip_t *chip = sim_chip_current();
+    if (!chip) {
+        sim_panic("Astarte device created on behalf of no chip");
+    }
+    astarte_device_handle_t device = calloc(1, sizeof(struct astarte_device_t));
+    if (!device) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return NULL;
+    }
+    device->chip = chip;
+    device->config = *cfg;
+    pthread_mutex_init(&device->publish_lock, NULL);
+    device->connect_at_us = SIM_FOREVER;
+    snprintf(device->realm, sizeof(device->realm), "%s", realm_of(cfg));
+    if (cfg->hwid) {
+        snprintf(device->encoded_id, sizeof(device->encoded_id), "%s", cfg->hwid);
+    } else {
+        encode_random_id(device->encoded_id);
+    }
+
+    device->mqtt_buffers = malloc(MQTT_BUFFERS_SIZE);
+    device->events = xQueueCreate(EVENT_QUEUE_SIZE, sizeof(device_event_t));
+    device->exited = xSemaphoreCreateBinary();
+    if (!device->mqtt_buffers || !device->events || !device->exited) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        goto error;
+    }
+    if (astarte_config.broker_host) {
+        static const sim_mqtt_callbacks_t callbacks = {
+            .on_connect = on_mqtt_connect,
+            .on_disconnect = on_mqtt_disconnect,
+            .on_message = on_mqtt_message,
+        };
+        device->client = sim_mqtt_client_new(astarte_config.broker_host,
+            astarte_config.broker_port, device->encoded_id, &callbacks, device);
+        if (!device->client) {
+            ESP_LOGE(TAG, "Unable to resolve %s", astarte_config.broker_host);
+            goto error;
+        }
+    }
+    if (xTaskCreate(mqtt_task, "mqtt_task", MQTT_TASK_STACK_SIZE, device, MQTT_TASK_PRIORITY,
+            NULL)
+        != pdPASS) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        goto error;
+    }
+    return device;
+
+error:
+    if (device->client) {
+        sim_mqtt_client_destroy(device->client);
+    }
+    if (device->events) {
+        vQueueDelete(device->events);
+    }
+    if (device->exited) {
+        vSemaphoreDelete(device->exited);
+    }
+    free(device->mqtt_buffers);
+    pthread_mutex_destroy(&device->publish_lock);
+    free(device);
+    return NULL;
+}
+
+void astarte_device_destroy(astarte_device_handle_t device)
+{
+    if (!device) {
+        return;
+    }
+    // No MQTT callback runs from here on, the events already queued are drained below
+    if (device->client) {
+        sim_mqtt_client_destroy(device->client);
+    }
+    device_event_t event = { .type = EVENT_EXIT };
+    post_event(device, &event);
+    xSemaphoreTake(device->exited, portMAX_DELAY);
+    while (xQueueReceive(device->events, &event, 0) == pdPASS) {
+        if (event.type == EVENT_DATA) {
+            free(event.topic);
+            free(event.payload);
+        }
+    }
+    vQueueDelete(device->events);
+    vSemaphoreDelete(device->exited);
+    free(device->mqtt_buffers);
+    pthread_mutex_destroy(&device->publish_lock);
+    free(device);
+}
+
+astarte_err_t astarte_device_add_interface(
+    astarte_device_handle_t device, const astarte_interface_t *interface)
+{
+    if (device->interface_count == MAX_INTERFACES) {
+        return ASTARTE_ERR;
+    }
+    device->interfaces[device->interface_count++] = interface;
+    return ASTARTE_OK;
+}
+
+astarte_err_t astarte_device_start(astarte_device_handle_t device)
+{
+    device_event_t event = { .type = EVENT_START };
+    post_event(device, &event);
+    return ASTARTE_OK;
+}
+
+astarte_err_t astarte_device_stop(astarte_device_handle_t device)
+{
+    device_event_t event = { .type = EVENT_STOP };
+    post_event(device, &event);
+    return ASTARTE_OK;
+}
+
+bool astarte_device_is_connected(astarte_device_handle_t device)
+{
+    return __atomic_load_n(&device->connected, __ATOMIC_ACQUIRE);
+}
+
+char *astarte_device_get_encoded_id(astarte_device_handle_t device)
+{
+    return device->encoded_id;
+}
+
+astarte_err_t astarte_device_stream_aggregate(astarte_device_handle_t device,
+    const char *interface_name, const char *path_prefix, const void *bson_document, int qos)
+{
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_document(&bs, "v", bson_document);
+    return publish_bson(device, interface_name, path_prefix, &bs, qos);
+}
+
+astarte_err_t astarte_device_stream_aggregate_with_timestamp(astarte_device_handle_t device,
+    const char *interface_name, const char *path_prefix, const void *bson_document,
+    uint64_t ts_epoch_millis, int qos)
+{
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_document(&bs, "v", bson_document);
+    astarte_bson_serializer_append_datetime(&bs, "t", ts_epoch_millis);
+    return publish_bson(device, interface_name, path_prefix, &bs, qos);
+}
+
+astarte_err_t astarte_device_stream_string(astarte_device_handle_t device,
+    const char *interface_name, const char *path, const char *value, int qos)
+{
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_string(&bs, "v", value);
+    return publish_bson(device, interface_name, path, &bs, qos);
+}
+
+astarte_err_t astarte_device_stream_integer(astarte_device_handle_t device,
+    const char *interface_name, const char *path, int32_t value, int qos)
+{
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int32(&bs, "v", value);
+    return publish_bson(device, interface_name, path, &bs, qos);
+}
+
+astarte_err_t astarte_device_set_string_property(astarte_device_handle_t device,
+    const char *interface_name, const char *path, const char *value)
+{
+    return astarte_device_stream_string(device, interface_name, path, value, 2);
+}
+
+astarte_err_t astarte_device_set_integer_property(astarte_device_handle_t device,
+    const char *interface_name, const char *path, int32_t value)
+{
+    return astarte_device_stream_integer(device, interface_name, path, value, 2);
+}
+
+astarte_err_t astarte_device_set_longinteger_property(astarte_device_handle_t device,
+    const char *interface_name, const char *path, int64_t value)
+{
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int64(&bs, "v", value);
+    return publish_bson(device, interface_name, path, &bs, 2);
+}
+
+astarte_err_t astarte_device_set_boolean_property(astarte_device_handle_t device,
+    const char *interface_name, const char *path, bool value)
+{
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_boolean(&bs, "v", value);
+    return publish_bson(device, interface_name, path, &bs, 2);
+}
+
+astarte_err_t astarte_device_unset_path(
+    astarte_device_handle_t device, const char *interface_name, const char *path)
+{
+    char topic[TOPIC_MAX_LEN];
+    if (snprintf(topic, sizeof(topic), "%s/%s/%s%s", device->realm, device->encoded_id,
+            interface_name, path)
+        >= (int) sizeof(topic)) {
+        return ASTARTE_ERR_INVALID_INTERFACE_PATH;
+    }
+    return publish(device, interface_name, topic, NULL, 0, 2, true);
+}
+
+void sim_astarte_disconnect(astarte_device_handle_t device, uint32_t down_ms)
+{
+    device_event_t event = { .type = EVENT_DROP, .down_ms = down_ms };
+    post_event(device, &event);
+}
+
+void sim_astarte_connect(astarte_device_handle_t device, int session_present)
+{
+    device_event_t event = { .type = EVENT_CONNECT, .session_present = session_present };
+    post_event(device, &event);
+}
+
+void sim_astarte_receive_string(astarte_device_handle_t device, const char *interface_name,
+    const char *path, const char *value)
+{
+    sim_chip_enter(device->chip);
+    if (device->config.data_event_callback) {
+        struct astarte_bson_serializer_t bs;
+        astarte_bson_serializer_init(&bs);
+        astarte_bson_serializer_append_string(&bs, "v", value);
+        astarte_bson_serializer_append_end_of_document(&bs);
+        const void *doc = astarte_bson_serializer_get_document(&bs, NULL);
+        uint8_t type;
+        const void *bson_value = doc ? astarte_bson_key_lookup("v", doc, &type) : NULL;
+        if (bson_value) {
+            astarte_device_data_event_t event = { .device = device,
+                .interface_name = interface_name,
+                .path = path,
+                .bson_value = bson_value,
+                .bson_value_type = type };
+            device->config.data_event_callback(&event);
+        }
+        astarte_bson_serializer_destroy(&bs);
+    }
+    sim_chip_leave();
+}
+
+sim_chip_t *sim_astarte_chip(astarte_device_handle_t device)
+{
+    return device->chip;
+}
+
+void sim_astarte_get_stats(const sim_chip_t *chip, sim_astarte_stats_t *stats)
+{
+    pthread_mutex_lock(&stats_lock);
+    *stats = chip ? chip->astarte_stats : global_stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+size_t sim_astarte_get_interface_stats(sim_astarte_interface_stats_t *stats, size_t max_count)
+{
+    pthread_mutex_lock(&stats_lock);
+    for (size_t i = 0; i < interface_stats_count && i < max_count; i++) {
+        stats[i].interface_name = interface_stats[i].interface_name;
+        stats[i].publishes = interface_stats[i].publishes;
+        stats[i].payload_bytes = interface_stats[i].payload_bytes;
+    }
+    size_t count = interface_stats_count;
+    pthread_mutex_unlock(&stats_lock);
+    return count;
+}
+
+void sim_astarte_set_publish_hook(void (*hook)(astarte_device_handle_t device, const char *topic,
+                                      const void *payload, size_t len, int qos, void *arg),
+    void *arg)
+{
+    pthread_mutex_lock(&stats_lock);
+    publish_hook = hook;
+    publish_hook_arg = arg;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void sim_astarte_set_result_hook(astarte_err_t (*hook)(astarte_err_t ret, void *arg), void *arg)
+{
+    pthread_mutex_lock(&stats_lock);
+    result_hook = hook;
+    result_hook_arg = arg;
+    pthread_mutex_unlock(&stats_lock);
+}
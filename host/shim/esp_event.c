@@ -0,0 +1,264 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_internal.h"
+#include <esp_event.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The default event loop of the ESP-IDF
+#define EVENT_QUEUE_SIZE 32
+#define EVENT_TASK_STACK_SIZE 2304
+#define EVENT_TASK_PRIORITY 20
+
+typedef struct event_handler
+{
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t function;
+    void *arg;
+    // A handler unregistered while it runs is freed once it returns
+    uint32_t running;
+    bool unregistered;
+    struct event_handler *next;
+} event_handler_t;
+
+typedef struct
+{
+    esp_event_base_t base;
+    int32_t id;
+    void *data;
+    bool stop;
+} event_t;
+
+struct sim_event_loop
+{
+    QueueHandle_t queue;
+    SemaphoreHandle_t stopped;
+    event_handler_t *handlers;
+};
+
+static struct sim_event_loop *current_loop(void)
+{
+    sim_chip_t *chip = sim_chip_current();
+    if (!chip) {
+        sim_panic("event loop used on behalf of no chip");
+    }
+    return chip->event_loop;
+}
+
+static bool handler_matches(
+    const event_handler_t *handler, esp_event_base_t base, int32_t id)
+{
+    return !handler->unregistered && (!handler->base || handler->base == base)
+        && (handler->id == ESP_EVENT_ANY_ID || handler->id == id);
+}
+
+static void unlink_handler(struct sim_event_loop *loop, event_handler_t *handler)
+{
+    for (event_handler_t **link = &loop->handlers; *link; link = &(*link)->next) {
+        if (*link == handler) {
+            *link = handler->next;
+            free(handler);
+            return;
+        }
+    }
+}
+
+static void dispatch(struct sim_event_loop *loop, const event_t *event)
+{
+    sim_lock();
+    event_handler_t *handler = loop->handlers;
+    while (handler) {
+        if (!handler_matches(handler, event->base, event->id)) {
+            handler = handler->next;
+            continue;
+        }
+        handler->running++;
+        sim_unlock();
+        handler->function(handler->arg, event->base, event->id, event->data);
+        sim_lock();
+        handler->running--;
+        event_handler_t *next = handler->next;
+        if (handler->unregistered && handler->running == 0) {
+            unlink_handler(loop, handler);
+        }
+        handler = next;
+    }
+    sim_unlock();
+}
+
+static void event_task(void *arg)
+{
+    struct sim_event_loop *loop = arg;
+    event_t event;
+    for (;;) {
+        xQueueReceive(loop->queue, &event, portMAX_DELAY);
+        if (event.stop) {
+            break;
+        }
+        dispatch(loop, &event);
+        free(event.data);
+    }
+    xSemaphoreGive(loop->stopped);
+    vTaskDelete(NULL);
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    sim_chip_t *chip = sim_chip_current();
+    if (!chip) {
+        sim_panic("default event loop created on behalf of no chip");
+    }
+    if (chip->event_loop) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    struct sim_event_loop *loop = calloc(1, sizeof(struct sim_event_loop));
+    if (!loop) {
+        return ESP_ERR_NO_MEM;
+    }
+    loop->queue = xQueueCreate(EVENT_QUEUE_SIZE, sizeof(event_t));
+    loop->stopped = xSemaphoreCreateBinary();
+    if (!loop->queue || !loop->stopped
+        || xTaskCreate(event_task, "sys_evt", EVENT_TASK_STACK_SIZE, loop, EVENT_TASK_PRIORITY,
+               NULL)
+            != pdPASS) {
+        if (loop->queue) {
+            vQueueDelete(loop->queue);
+        }
+        if (loop->stopped) {
+            vSemaphoreDelete(loop->stopped);
+        }
+        free(loop);
+        return ESP_ERR_NO_MEM;
+    }
+    chip->event_loop = loop;
+    return ESP_OK;
+}
+
+esp_err_t esp_event_loop_delete_default(void)
+{
+    struct sim_event_loop *loop = current_loop();
+    if (!loop) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    event_t stop = { .stop = true };
+    xQueueSend(loop->queue, &stop, portMAX_DELAY);
+    xSemaphoreTake(loop->stopped, portMAX_DELAY);
+    sim_chip_current()->event_loop = NULL;
+
+    event_t event;
+    while (xQueueReceive(loop->queue, &event, 0) == pdPASS) {
+        free(event.data);
+    }
+    while (loop->handlers) {
+        event_handler_t *handler = loop->handlers;
+        loop->handlers = handler->next;
+        free(handler);
+    }
+    vQueueDelete(loop->queue);
+    vSemaphoreDelete(loop->stopped);
+    free(loop);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+    esp_event_handler_t event_handler, void *event_handler_arg,
+    esp_event_handler_instance_t *instance)
+{
+    struct sim_event_loop *loop = current_loop();
+    if (!loop) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!event_handler || (!event_base && event_id != ESP_EVENT_ANY_ID)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    event_handler_t *handler = calloc(1, sizeof(event_handler_t));
+    if (!handler) {
+        return ESP_ERR_NO_MEM;
+    }
+    handler->base = event_base;
+    handler->id = event_id;
+    handler->function = event_handler;
+    handler->arg = event_handler_arg;
+
+    sim_lock();
+    event_handler_t **link = &loop->handlers;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = handler;
+    sim_unlock();
+    if (instance) {
+        *instance = handler;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_unregister(
+    esp_event_base_t event_base, int32_t event_id, esp_event_handler_instance_t instance)
+{
+    struct sim_event_loop *loop = current_loop();
+    if (!loop) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sim_lock();
+    for (event_handler_t *handler = loop->handlers; handler; handler = handler->next) {
+        if (handler == instance && !handler->unregistered && handler->base == event_base
+            && handler->id == event_id) {
+            handler->unregistered = true;
+            if (handler->running == 0) {
+                unlink_handler(loop, handler);
+            }
+            sim_unlock();
+            return ESP_OK;
+        }
+    }
+    sim_unlock();
+    return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void *event_data,
+    size_t event_data_size, TickType_t ticks_to_wait)
+{
+    struct sim_event_loop *loop = current_loop();
+    if (!loop) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    event_t event = { .base = event_base, .id = event_id };
+    if (event_data && event_data_size > 0) {
+        event.data = malloc(event_data_size);
+        if (!event.data) {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(event.data, event_data, event_data_size);
+    }
+    if (xQueueSend(loop->queue, &event, ticks_to_wait) != pdPASS) {
+        free(event.data);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
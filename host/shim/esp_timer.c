@@ -0,0 +1,249 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_internal.h"
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+
+#define NOT_ARMED SIZE_MAX
+
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    sim_chip_t *chip;
+    int64_t due_us;
+    uint64_t period_us;
+    // Timers due at the same time run in the order they were armed
+    uint64_t sequence;
+    size_t armed_index;
+    bool running;
+    bool deleted;
+};
+
+// The armed timers, a min heap on the due time
+static struct esp_timer **armed;
+static size_t armed_count;
+static size_t armed_capacity;
+static uint64_t next_sequence;
+static sim_waitlist_t timer_task_waitlist;
+
+static bool due_before(const struct esp_timer *a, const struct esp_timer *b)
+{
+    return a->due_us < b->due_us || (a->due_us == b->due_us && a->sequence < b->sequence);
+}
+
+static void armed_swap(size_t i, size_t j)
+{
+    struct esp_timer *timer = armed[i];
+    armed[i] = armed[j];
+    armed[j] = timer;
+    armed[i]->armed_index = i;
+    armed[j]->armed_index = j;
+}
+
+static void armed_sift_up(size_t i)
+{
+    while (i > 0 && due_before(armed[i], armed[(i - 1) / 2])) {
+        armed_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void armed_sift_down(size_t i)
+{
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < armed_count && due_before(armed[left], armed[smallest])) {
+            smallest = left;
+        }
+        if (right < armed_count && due_before(armed[right], armed[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        armed_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+static void arm(struct esp_timer *timer, int64_t due_us)
+{
+    if (armed_count == armed_capacity) {
+        armed_capacity = armed_capacity ? armed_capacity * 2 : 64;
+        armed = sim_sys_realloc(armed, armed_capacity * sizeof(*armed));
+        if (!armed) {
+            sim_panic("out of host memory");
+        }
+    }
+    timer->due_us = due_us;
+    timer->sequence = next_sequence++;
+    timer->armed_index = armed_count;
+    armed[armed_count++] = timer;
+    armed_sift_up(timer->armed_index);
+    if (armed[0] == timer) {
+        // The timer task waits for a later timer
+        sim_wake_one(&timer_task_waitlist);
+    }
+}
+
+static void disarm(struct esp_timer *timer)
+{
+    size_t i = timer->armed_index;
+    timer->armed_index = NOT_ARMED;
+    if (i != --armed_count) {
+        armed[i] = armed[armed_count];
+        armed[i]->armed_index = i;
+        armed_sift_up(i);
+        armed_sift_down(armed[i]->armed_index);
+    }
+}
+
+static void timer_task(void *arg)
+{
+    sim_lock();
+    for (;;) {
+        if (armed_count == 0) {
+            sim_wait(&timer_task_waitlist, SIM_FOREVER);
+            continue;
+        }
+        struct esp_timer *timer = armed[0];
+        int64_t now_us = sim_time_us();
+        if (timer->due_us > now_us) {
+            sim_wait(&timer_task_waitlist, timer->due_us);
+            continue;
+        }
+
+        disarm(timer);
+        if (timer->period_us > 0) {
+            // Periods missed while the host was busy are skipped, not run back to back
+            uint64_t missed = (now_us - timer->due_us) / timer->period_us;
+            arm(timer, timer->due_us + (missed + 1) * timer->period_us);
+        }
+        timer->running = true;
+        sim_unlock();
+
+        sim_chip_enter(timer->chip);
+        timer->callback(timer->arg);
+        sim_chip_leave();
+
+        sim_lock();
+        timer->running = false;
+        if (timer->deleted) {
+            free(timer);
+        }
+    }
+}
+
+void sim_timer_init(void)
+{
+    if (xTaskCreate(timer_task, "esp_timer", 3584, NULL, 22, NULL) != pdPASS) {
+        sim_panic("unable to start the esp_timer task");
+    }
+}
+
+esp_err_t esp_timer_create(
+    const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (!create_args || !create_args->callback || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct esp_timer *timer = calloc(1, sizeof(struct esp_timer));
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->chip = sim_chip_current();
+    timer->armed_index = NOT_ARMED;
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_lock();
+    if (timer->armed_index != NOT_ARMED) {
+        sim_unlock();
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->period_us = period_us;
+    arm(timer, sim_time_us() + (int64_t) timeout_us);
+    sim_unlock();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    if (period == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_lock();
+    if (timer->armed_index == NOT_ARMED) {
+        sim_unlock();
+        return ESP_ERR_INVALID_STATE;
+    }
+    disarm(timer);
+    sim_unlock();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_lock();
+    if (timer->armed_index != NOT_ARMED) {
+        sim_unlock();
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (timer->running) {
+        // Freed by the timer task once the callback returns
+        timer->deleted = true;
+    } else {
+        free(timer);
+    }
+    sim_unlock();
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return sim_time_us();
+}
@@ -0,0 +1,293 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_internal.h"
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Channels of an all channel scan and default dwell time of an active scan on each of them
+#define SCAN_CHANNELS 13
+#define SCAN_DEFAULT_DWELL_MS 120
+// The RSSI of the APs varies between scans by up to this many dB
+#define SCAN_RSSI_NOISE_DB 2
+
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+struct sim_wifi
+{
+    wifi_ap_record_t *aps;
+    size_t ap_count;
+    int associated;
+    sim_wifi_scan_mode_t scan_mode;
+    bool scanning;
+    uint8_t scan_id;
+    esp_timer_handle_t scan_timer;
+    // Results of the last scan, until read
+    wifi_ap_record_t *results;
+    uint16_t result_count;
+    wifi_config_t config;
+};
+
+static pthread_mutex_t wifi_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Called with wifi_lock held
+static struct sim_wifi *chip_wifi(sim_chip_t *chip)
+{
+    if (!chip) {
+        sim_panic("WiFi used on behalf of no chip");
+    }
+    if (!chip->wifi) {
+        chip->wifi = sim_sys_calloc(1, sizeof(struct sim_wifi));
+        if (!chip->wifi) {
+            sim_panic("out of host memory");
+        }
+        chip->wifi->associated = -1;
+    }
+    return chip->wifi;
+}
+
+static int compare_rssi(const void *a, const void *b)
+{
+    return ((const wifi_ap_record_t *) b)->rssi - ((const wifi_ap_record_t *) a)->rssi;
+}
+
+static void set_results(struct sim_wifi *wifi, const wifi_ap_record_t *records, uint16_t count)
+{
+    sim_sys_free(wifi->results);
+    wifi->results = NULL;
+    wifi->result_count = 0;
+    if (count > 0) {
+        wifi->results = sim_sys_malloc(count * sizeof(wifi_ap_record_t));
+        if (!wifi->results) {
+            sim_panic("out of host memory");
+        }
+        memcpy(wifi->results, records, count * sizeof(wifi_ap_record_t));
+        wifi->result_count = count;
+    }
+}
+
+static void post_scan_done(uint32_t status, uint8_t number, uint8_t scan_id)
+{
+    wifi_event_sta_scan_done_t event = { .status = status, .number = number, .scan_id = scan_id };
+    esp_err_t ret = esp_event_post(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event, sizeof(event), 0);
+    if (ret != ESP_OK) {
+        ESP_LOGW("SIM_WIFI", "Scan done event lost, error %d", ret);
+    }
+}
+
+static void complete_radio_scan(sim_chip_t *chip)
+{
+    pthread_mutex_lock(&wifi_lock);
+    struct sim_wifi *wifi = chip_wifi(chip);
+    if (!wifi->scanning) {
+        pthread_mutex_unlock(&wifi_lock);
+        return;
+    }
+    wifi->scanning = false;
+    set_results(wifi, wifi->aps, wifi->ap_count);
+    for (int i = 0; i < wifi->result_count; i++) {
+        int rssi = wifi->results[i].rssi
+            + (int) (sim_chip_random(chip) % (2 * SCAN_RSSI_NOISE_DB + 1)) - SCAN_RSSI_NOISE_DB;
+        wifi->results[i].rssi = rssi < -127 ? -127 : rssi > 0 ? 0 : rssi;
+    }
+    qsort(wifi->results, wifi->result_count, sizeof(wifi_ap_record_t), compare_rssi);
+    uint8_t number = wifi->result_count > UINT8_MAX ? UINT8_MAX : wifi->result_count;
+    uint8_t scan_id = ++wifi->scan_id;
+    pthread_mutex_unlock(&wifi_lock);
+
+    post_scan_done(0, number, scan_id);
+}
+
+// The scan timer belongs to no chip, the scan is completed on behalf of the one that started it
+static void scan_timer_cb(void *arg)
+{
+    sim_chip_enter(arg);
+    complete_radio_scan(arg);
+    sim_chip_leave();
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block)
+{
+    if (block) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    sim_chip_t *chip = sim_chip_current();
+    pthread_mutex_lock(&wifi_lock);
+    struct sim_wifi *wifi = chip_wifi(chip);
+    if (wifi->scanning) {
+        pthread_mutex_unlock(&wifi_lock);
+        return ESP_ERR_WIFI_STATE;
+    }
+    if (wifi->scan_mode == SIM_WIFI_SCAN_RADIO && !wifi->scan_timer) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = scan_timer_cb,
+            .arg = chip,
+            .name = "sim_wifi_scan",
+        };
+        // Memory of the driver, taken by esp_wifi_init on the chip and not accounted on its heap
+        // like the rest of sim_wifi, so the first scan does not look like a leak of the caller
+        sim_chip_enter(NULL);
+        esp_err_t ret = esp_timer_create(&timer_args, &wifi->scan_timer);
+        sim_chip_leave();
+        if (ret != ESP_OK) {
+            pthread_mutex_unlock(&wifi_lock);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    wifi->scanning = true;
+    set_results(wifi, NULL, 0);
+    if (wifi->scan_mode == SIM_WIFI_SCAN_RADIO) {
+        uint32_t dwell_ms = config && config->scan_time.active.max ? config->scan_time.active.max
+                                                                   : SCAN_DEFAULT_DWELL_MS;
+        uint32_t channels = config && config->channel ? 1 : SCAN_CHANNELS;
+        esp_timer_start_once(wifi->scan_timer, (uint64_t) dwell_ms * channels * 1000);
+    }
+    pthread_mutex_unlock(&wifi_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t *number)
+{
+    if (!number) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&wifi_lock);
+    *number = chip_wifi(sim_chip_current())->result_count;
+    pthread_mutex_unlock(&wifi_lock);
+    return ESP_OK;
+}
+
+// As on the chip, the results are freed once read, even if not all of them fit
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *number, wifi_ap_record_t *ap_records)
+{
+    if (!number || !ap_records) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&wifi_lock);
+    struct sim_wifi *wifi = chip_wifi(sim_chip_current());
+    if (*number > wifi->result_count) {
+        *number = wifi->result_count;
+    }
+    memcpy(ap_records, wifi->results, *number * sizeof(wifi_ap_record_t));
+    set_results(wifi, NULL, 0);
+    pthread_mutex_unlock(&wifi_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    if (!ap_info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&wifi_lock);
+    struct sim_wifi *wifi = chip_wifi(sim_chip_current());
+    esp_err_t ret = ESP_ERR_WIFI_NOT_CONNECT;
+    if (wifi->associated >= 0) {
+        *ap_info = wifi->aps[wifi->associated];
+        ret = ESP_OK;
+    }
+    pthread_mutex_unlock(&wifi_lock);
+    return ret;
+}
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    if (interface != WIFI_IF_STA || !conf) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&wifi_lock);
+    *conf = chip_wifi(sim_chip_current())->config;
+    pthread_mutex_unlock(&wifi_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    if (interface != WIFI_IF_STA || !conf) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&wifi_lock);
+    chip_wifi(sim_chip_current())->config = *conf;
+    pthread_mutex_unlock(&wifi_lock);
+    return ESP_OK;
+}
+
+void sim_wifi_set_aps(
+    sim_chip_t *chip, const wifi_ap_record_t *aps, size_t count, int associated)
+{
+    pthread_mutex_lock(&wifi_lock);
+    struct sim_wifi *wifi = chip_wifi(chip);
+    sim_sys_free(wifi->aps);
+    wifi->aps = NULL;
+    wifi->ap_count = 0;
+    if (count > 0) {
+        wifi->aps = sim_sys_malloc(count * sizeof(wifi_ap_record_t));
+        if (!wifi->aps) {
+            sim_panic("out of host memory");
+        }
+        memcpy(wifi->aps, aps, count * sizeof(wifi_ap_record_t));
+        wifi->ap_count = count;
+    }
+    wifi->associated = associated < (int) count ? associated : -1;
+    memset(&wifi->config, 0, sizeof(wifi->config));
+    if (wifi->associated >= 0) {
+        memcpy(wifi->config.sta.ssid, wifi->aps[associated].ssid, sizeof(wifi->config.sta.ssid));
+    }
+    pthread_mutex_unlock(&wifi_lock);
+}
+
+void sim_wifi_set_rssi(sim_chip_t *chip, size_t index, int8_t rssi)
+{
+    pthread_mutex_lock(&wifi_lock);
+    struct sim_wifi *wifi = chip_wifi(chip);
+    if (index < wifi->ap_count) {
+        wifi->aps[index].rssi = rssi;
+    }
+    pthread_mutex_unlock(&wifi_lock);
+}
+
+void sim_wifi_set_scan_mode(sim_chip_t *chip, sim_wifi_scan_mode_t mode)
+{
+    pthread_mutex_lock(&wifi_lock);
+    chip_wifi(chip)->scan_mode = mode;
+    pthread_mutex_unlock(&wifi_lock);
+}
+
+esp_err_t sim_wifi_complete_scan(
+    sim_chip_t *chip, uint32_t status, const wifi_ap_record_t *records, uint16_t count)
+{
+    pthread_mutex_lock(&wifi_lock);
+    struct sim_wifi *wifi = chip_wifi(chip);
+    wifi->scanning = false;
+    set_results(wifi, records, count);
+    uint8_t scan_id = ++wifi->scan_id;
+    pthread_mutex_unlock(&wifi_lock);
+    if (wifi->scan_timer) {
+        esp_timer_stop(wifi->scan_timer);
+    }
+
+    sim_chip_enter(chip);
+    wifi_event_sta_scan_done_t event
+        = { .status = status, .number = count > UINT8_MAX ? UINT8_MAX : count, .scan_id = scan_id };
+    esp_err_t ret = esp_event_post(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event, sizeof(event), 0);
+    sim_chip_leave();
+    return ret;
+}
@@ -0,0 +1,531 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_internal.h"
+#include <esp_partition.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * The space used is modelled on the NVS of the ESP-IDF: pages of 4 KiB hold 126 entries of 32
+ * bytes, one page is kept free for the garbage collection, a namespace or an integer takes one
+ * entry and a string or blob one more entry for each 32 bytes of data.
+ */
+
+#define PAGE_SIZE 4096
+#define ENTRIES_PER_PAGE 126
+#define ENTRY_SIZE 32
+#define MAX_HANDLES 256
+#define MAX_STRING_SIZE 4000
+#define MAX_BLOB_SIZE (508 * 1024)
+
+typedef enum
+{
+    ENTRY_NAMESPACE,
+    ENTRY_U8,
+    ENTRY_U32,
+    ENTRY_I32,
+    ENTRY_STR,
+    ENTRY_BLOB,
+} entry_type_t;
+
+struct sim_nvs_entry
+{
+    const esp_partition_t *partition;
+    char namespace_name[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    entry_type_t type;
+    void *data;
+    size_t length;
+    struct sim_nvs_entry *next;
+};
+
+typedef struct
+{
+    bool open;
+    sim_chip_t *chip;
+    const esp_partition_t *partition;
+    char namespace_name[NVS_KEY_NAME_MAX_SIZE];
+    nvs_open_mode_t open_mode;
+} handle_t;
+
+// Locked before the handles, never held while blocking
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static handle_t handles[MAX_HANDLES];
+static esp_err_t (*commit_hook)(esp_err_t ret, void *arg);
+static void *commit_hook_arg;
+
+static sim_chip_t *current_chip(void)
+{
+    sim_chip_t *chip = sim_chip_current();
+    if (!chip) {
+        sim_panic("NVS used on behalf of no chip");
+    }
+    return chip;
+}
+
+static size_t entry_span(const struct sim_nvs_entry *entry)
+{
+    if (entry->type == ENTRY_STR || entry->type == ENTRY_BLOB) {
+        return 1 + (entry->length + ENTRY_SIZE - 1) / ENTRY_SIZE;
+    }
+    return 1;
+}
+
+static size_t partition_entries(const esp_partition_t *partition)
+{
+    size_t pages = partition->size / PAGE_SIZE;
+    return pages > 1 ? (pages - 1) * ENTRIES_PER_PAGE : 0;
+}
+
+static size_t used_entries(sim_chip_t *chip, const esp_partition_t *partition)
+{
+    size_t used = 0;
+    for (struct sim_nvs_entry *entry = chip->nvs_entries; entry; entry = entry->next) {
+        if (entry->partition == partition) {
+            used += entry_span(entry);
+        }
+    }
+    return used;
+}
+
+// The NVS partitions of a chip are created when first used, with the size of its configuration
+static const esp_partition_t *find_partition(sim_chip_t *chip, const char *label, bool create)
+{
+    for (int i = 0; i < SIM_MAX_PARTITIONS && chip->partitions[i].label[0]; i++) {
+        if (strcmp(chip->partitions[i].label, label) == 0) {
+            return &chip->partitions[i];
+        }
+    }
+    if (!create || strlen(label) >= sizeof(chip->partitions[0].label)) {
+        return NULL;
+    }
+    for (int i = 0; i < SIM_MAX_PARTITIONS; i++) {
+        esp_partition_t *partition = &chip->partitions[i];
+        if (!partition->label[0]) {
+            partition->type = ESP_PARTITION_TYPE_DATA;
+            partition->subtype = ESP_PARTITION_SUBTYPE_DATA_NVS;
+            partition->address = 0x9000 + i * chip->nvs_partition_size;
+            partition->size = chip->nvs_partition_size;
+            snprintf(partition->label, sizeof(partition->label), "%s", label);
+            return partition;
+        }
+    }
+    return NULL;
+}
+
+static struct sim_nvs_entry **find_entry(sim_chip_t *chip, const esp_partition_t *partition,
+    const char *namespace_name, entry_type_t type, const char *key)
+{
+    struct sim_nvs_entry **link = &chip->nvs_entries;
+    for (; *link; link = &(*link)->next) {
+        struct sim_nvs_entry *entry = *link;
+        if (entry->partition == partition && entry->type == type
+            && strcmp(entry->namespace_name, namespace_name) == 0
+            && strcmp(entry->key, key) == 0) {
+            return link;
+        }
+    }
+    return link;
+}
+
+// Called with nvs_lock held, the entry is valid until it is released
+static esp_err_t get_handle(nvs_handle_t handle, handle_t **out)
+{
+    if (handle == 0 || handle > MAX_HANDLES || !handles[handle - 1].open) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    *out = &handles[handle - 1];
+    return ESP_OK;
+}
+
+static esp_err_t check_key(const char *key)
+{
+    if (!key || !key[0]) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return nvs_flash_init_partition(NVS_DEFAULT_PART_NAME);
+}
+
+esp_err_t nvs_flash_init_partition(const char *partition_label)
+{
+    sim_chip_t *chip = current_chip();
+    pthread_mutex_lock(&nvs_lock);
+    const esp_partition_t *partition = find_partition(chip, partition_label, true);
+    pthread_mutex_unlock(&nvs_lock);
+    return partition ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    sim_chip_t *chip = current_chip();
+    pthread_mutex_lock(&nvs_lock);
+    const esp_partition_t *partition = find_partition(chip, NVS_DEFAULT_PART_NAME, false);
+    struct sim_nvs_entry **link = &chip->nvs_entries;
+    while (partition && *link) {
+        struct sim_nvs_entry *entry = *link;
+        if (entry->partition == partition) {
+            *link = entry->next;
+            sim_sys_free(entry->data);
+            sim_sys_free(entry);
+        } else {
+            link = &entry->next;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    return nvs_open_from_partition(NVS_DEFAULT_PART_NAME, name, open_mode, out_handle);
+}
+
+esp_err_t nvs_open_from_partition(const char *part_name, const char *name,
+    nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    esp_err_t ret = check_key(name);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    sim_chip_t *chip = current_chip();
+    pthread_mutex_lock(&nvs_lock);
+    const esp_partition_t *partition = find_partition(chip, part_name, true);
+    if (!partition) {
+        ret = ESP_ERR_NVS_PART_NOT_FOUND;
+        goto exit;
+    }
+
+    struct sim_nvs_entry **link = find_entry(chip, partition, name, ENTRY_NAMESPACE, "");
+    if (!*link) {
+        if (open_mode == NVS_READONLY) {
+            ret = ESP_ERR_NVS_NOT_FOUND;
+            goto exit;
+        }
+        if (used_entries(chip, partition) + 1 > partition_entries(partition)) {
+            ret = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+            goto exit;
+        }
+        struct sim_nvs_entry *entry = sim_sys_calloc(1, sizeof(struct sim_nvs_entry));
+        if (!entry) {
+            sim_panic("out of host memory");
+        }
+        entry->partition = partition;
+        entry->type = ENTRY_NAMESPACE;
+        snprintf(entry->namespace_name, sizeof(entry->namespace_name), "%s", name);
+        *link = entry;
+    }
+
+    ret = ESP_ERR_NO_MEM;
+    for (int i = 0; i < MAX_HANDLES; i++) {
+        if (!handles[i].open) {
+            handles[i].open = true;
+            handles[i].chip = chip;
+            handles[i].partition = partition;
+            handles[i].open_mode = open_mode;
+            snprintf(handles[i].namespace_name, sizeof(handles[i].namespace_name), "%s", name);
+            *out_handle = i + 1;
+            ret = ESP_OK;
+            break;
+        }
+    }
+
+exit:
+    pthread_mutex_unlock(&nvs_lock);
+    return ret;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&nvs_lock);
+    handle_t *entry;
+    if (get_handle(handle, &entry) == ESP_OK) {
+        entry->open = false;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+}
+
+void sim_nvs_set_commit_hook(esp_err_t (*hook)(esp_err_t ret, void *arg), void *arg)
+{
+    pthread_mutex_lock(&nvs_lock);
+    commit_hook = hook;
+    commit_hook_arg = arg;
+    pthread_mutex_unlock(&nvs_lock);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&nvs_lock);
+    handle_t *entry;
+    esp_err_t ret = get_handle(handle, &entry);
+    esp_err_t (*hook)(esp_err_t ret, void *arg) = commit_hook;
+    void *hook_arg = commit_hook_arg;
+    pthread_mutex_unlock(&nvs_lock);
+    return hook ? hook(ret, hook_arg) : ret;
+}
+
+static esp_err_t erase(nvs_handle_t handle, const char *key)
+{
+    pthread_mutex_lock(&nvs_lock);
+    handle_t *h;
+    esp_err_t ret = get_handle(handle, &h);
+    if (ret != ESP_OK) {
+        goto exit;
+    }
+    if (h->open_mode == NVS_READONLY) {
+        ret = ESP_ERR_NVS_READ_ONLY;
+        goto exit;
+    }
+
+    ret = key ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+    struct sim_nvs_entry **link = &h->chip->nvs_entries;
+    while (*link) {
+        struct sim_nvs_entry *entry = *link;
+        if (entry->partition == h->partition && entry->type != ENTRY_NAMESPACE
+            && strcmp(entry->namespace_name, h->namespace_name) == 0
+            && (!key || strcmp(entry->key, key) == 0)) {
+            *link = entry->next;
+            sim_sys_free(entry->data);
+            sim_sys_free(entry);
+            ret = ESP_OK;
+        } else {
+            link = &entry->next;
+        }
+    }
+
+exit:
+    pthread_mutex_unlock(&nvs_lock);
+    return ret;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    esp_err_t ret = check_key(key);
+    return ret == ESP_OK ? erase(handle, key) : ret;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    return erase(handle, NULL);
+}
+
+static esp_err_t set_value(
+    nvs_handle_t handle, const char *key, entry_type_t type, const void *data, size_t length)
+{
+    esp_err_t ret = check_key(key);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    handle_t *h;
+    ret = get_handle(handle, &h);
+    if (ret != ESP_OK) {
+        goto exit;
+    }
+    if (h->open_mode == NVS_READONLY) {
+        ret = ESP_ERR_NVS_READ_ONLY;
+        goto exit;
+    }
+
+    struct sim_nvs_entry **link = find_entry(h->chip, h->partition, h->namespace_name, type, key);
+    struct sim_nvs_entry *entry = *link;
+    struct sim_nvs_entry update = { .type = type, .length = length };
+    size_t used = used_entries(h->chip, h->partition) + entry_span(&update);
+    // The new value is written before the old one is erased, both must fit
+    if (used > partition_entries(h->partition)) {
+        ret = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        goto exit;
+    }
+
+    void *copy = sim_sys_malloc(length ? length : 1);
+    if (!copy) {
+        sim_panic("out of host memory");
+    }
+    memcpy(copy, data, length);
+    if (!entry) {
+        entry = sim_sys_calloc(1, sizeof(struct sim_nvs_entry));
+        if (!entry) {
+            sim_panic("out of host memory");
+        }
+        entry->partition = h->partition;
+        entry->type = type;
+        snprintf(entry->namespace_name, sizeof(entry->namespace_name), "%s", h->namespace_name);
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+        *link = entry;
+    }
+    sim_sys_free(entry->data);
+    entry->data = copy;
+    entry->length = length;
+
+exit:
+    pthread_mutex_unlock(&nvs_lock);
+    return ret;
+}
+
+// Values of another type under the same key are not found, as on the chip
+static esp_err_t get_value(nvs_handle_t handle, const char *key, entry_type_t type, void *out,
+    size_t *length, bool variable_length)
+{
+    esp_err_t ret = check_key(key);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    handle_t *h;
+    ret = get_handle(handle, &h);
+    if (ret != ESP_OK) {
+        goto exit;
+    }
+
+    struct sim_nvs_entry *entry
+        = *find_entry(h->chip, h->partition, h->namespace_name, type, key);
+    if (!entry) {
+        ret = ESP_ERR_NVS_NOT_FOUND;
+        goto exit;
+    }
+    if (variable_length) {
+        if (!out) {
+            *length = entry->length;
+            goto exit;
+        }
+        if (*length < entry->length) {
+            *length = entry->length;
+            ret = ESP_ERR_NVS_INVALID_LENGTH;
+            goto exit;
+        }
+        *length = entry->length;
+    }
+    memcpy(out, entry->data, entry->length);
+
+exit:
+    pthread_mutex_unlock(&nvs_lock);
+    return ret;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return set_value(handle, key, ENTRY_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    return get_value(handle, key, ENTRY_U8, out_value, NULL, false);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return set_value(handle, key, ENTRY_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    return get_value(handle, key, ENTRY_U32, out_value, NULL, false);
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value)
+{
+    return set_value(handle, key, ENTRY_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *out_value)
+{
+    return get_value(handle, key, ENTRY_I32, out_value, NULL, false);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    size_t length = strlen(value) + 1;
+    if (length > MAX_STRING_SIZE) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+    return set_value(handle, key, ENTRY_STR, value, length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return get_value(handle, key, ENTRY_STR, out_value, length, true);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    if (length > MAX_BLOB_SIZE) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+    return set_value(handle, key, ENTRY_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return get_value(handle, key, ENTRY_BLOB, out_value, length, true);
+}
+
+esp_err_t nvs_get_stats(const char *part_name, nvs_stats_t *nvs_stats)
+{
+    if (!nvs_stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(nvs_stats, 0, sizeof(nvs_stats_t));
+    sim_chip_t *chip = current_chip();
+    pthread_mutex_lock(&nvs_lock);
+    const esp_partition_t *partition
+        = find_partition(chip, part_name ? part_name : NVS_DEFAULT_PART_NAME, false);
+    if (!partition) {
+        pthread_mutex_unlock(&nvs_lock);
+        return ESP_ERR_NVS_PART_NOT_FOUND;
+    }
+    for (struct sim_nvs_entry *entry = chip->nvs_entries; entry; entry = entry->next) {
+        if (entry->partition == partition && entry->type == ENTRY_NAMESPACE) {
+            nvs_stats->namespace_count++;
+        }
+    }
+    nvs_stats->used_entries = used_entries(chip, partition);
+    // The spare page is counted as free, as nvs_get_stats of the ESP-IDF does
+    nvs_stats->total_entries = partition->size / PAGE_SIZE * ENTRIES_PER_PAGE;
+    nvs_stats->free_entries = nvs_stats->total_entries - nvs_stats->used_entries;
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_partition_find_first(
+    esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    if ((type != ESP_PARTITION_TYPE_DATA && type != ESP_PARTITION_TYPE_ANY)
+        || (subtype != ESP_PARTITION_SUBTYPE_DATA_NVS && subtype != ESP_PARTITION_SUBTYPE_ANY)) {
+        return NULL;
+    }
+    sim_chip_t *chip = current_chip();
+    pthread_mutex_lock(&nvs_lock);
+    const esp_partition_t *partition = NULL;
+    if (label) {
+        partition = find_partition(chip, label, false);
+    } else if (chip->partitions[0].label[0]) {
+        partition = &chip->partitions[0];
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return partition;
+}
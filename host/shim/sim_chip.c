@@ -0,0 +1,300 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_internal.h"
+#include <esp_sntp.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <uuid.h>
+
+#define DEFAULT_HEAP_SIZE (300 * 1024)
+#define DEFAULT_HEAP_USED_AT_BOOT (100 * 1024)
+#define DEFAULT_NVS_PARTITION_SIZE 0x6000
+#define CHIP_NESTING_MAX 8
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+
+void sim_timer_init(void);
+
+static uint32_t simulation_seed = 1;
+static uint64_t simulation_random_state;
+static esp_log_level_t log_level = ESP_LOG_INFO;
+static pthread_mutex_t chips_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t chip_count;
+static int64_t epoch_offset_us;
+static int64_t (*time_hook)(int64_t epoch_us, void *arg);
+static void *time_hook_arg;
+
+static __thread sim_chip_t *chip_stack[CHIP_NESTING_MAX];
+static __thread int chip_depth;
+static __thread uint64_t cpu_mark_us;
+
+void sim_init(const sim_config_t *config)
+{
+    simulation_seed = config->seed ? config->seed : 1;
+    simulation_random_state = simulation_seed * GOLDEN_GAMMA;
+    log_level = config->log_level;
+    sim_kernel_init(config->clock);
+    sim_timer_init();
+}
+
+void sim_time_set_epoch(int64_t epoch_us)
+{
+    __atomic_store_n(&epoch_offset_us, epoch_us - sim_time_us(), __ATOMIC_RELEASE);
+}
+
+void sim_time_set_hook(int64_t (*hook)(int64_t epoch_us, void *arg), void *arg)
+{
+    sim_lock();
+    time_hook = hook;
+    time_hook_arg = arg;
+    sim_unlock();
+}
+
+// Linked with --wrap=gettimeofday, the system time of the chips runs on the simulation clock
+int __wrap_gettimeofday(struct timeval *tv, void *tz)
+{
+    int64_t epoch_us = __atomic_load_n(&epoch_offset_us, __ATOMIC_ACQUIRE) + sim_time_us();
+    sim_lock();
+    int64_t (*hook)(int64_t epoch_us, void *arg) = time_hook;
+    void *hook_arg = time_hook_arg;
+    sim_unlock();
+    if (hook) {
+        epoch_us = hook(epoch_us, hook_arg);
+    }
+    if (tv) {
+        tv->tv_sec = epoch_us / 1000000;
+        tv->tv_usec = epoch_us % 1000000;
+    }
+    return 0;
+}
+
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = __atomic_add_fetch(state, GOLDEN_GAMMA, __ATOMIC_RELAXED);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+uint32_t sim_chip_random(sim_chip_t *chip)
+{
+    return (uint32_t) (splitmix64(chip ? &chip->random_state : &simulation_random_state) >> 32);
+}
+
+uint32_t sim_random(void)
+{
+    return sim_chip_random(sim_chip_current());
+}
+
+sim_chip_t *sim_chip_new(const sim_chip_config_t *config)
+{
+    sim_chip_t *chip = sim_sys_calloc(1, sizeof(sim_chip_t));
+    if (!chip) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&chips_lock);
+    chip->id = chip_count++;
+    pthread_mutex_unlock(&chips_lock);
+    if (config->name) {
+        snprintf(chip->name, sizeof(chip->name), "%s", config->name);
+    } else {
+        snprintf(chip->name, sizeof(chip->name), "chip%u", chip->id);
+    }
+    chip->random_state = (simulation_seed * GOLDEN_GAMMA) ^ ((uint64_t) (chip->id + 1) << 32);
+    sim_heap_init(&chip->heap, config->heap_size ? config->heap_size : DEFAULT_HEAP_SIZE,
+        config->heap_used_at_boot ? config->heap_used_at_boot : DEFAULT_HEAP_USED_AT_BOOT);
+    chip->nvs_partition_size
+        = config->nvs_partition_size ? config->nvs_partition_size : DEFAULT_NVS_PARTITION_SIZE;
+    return chip;
+}
+
+void sim_chip_charge_cpu(void)
+{
+    uint64_t now_us = sim_thread_cpu_us();
+    sim_chip_t *chip = sim_chip_current();
+    if (chip) {
+        __atomic_add_fetch(&chip->cpu_us, now_us - cpu_mark_us, __ATOMIC_RELAXED);
+    }
+    cpu_mark_us = now_us;
+}
+
+void sim_chip_enter(sim_chip_t *chip)
+{
+    if (chip_depth == CHIP_NESTING_MAX) {
+        sim_panic("chips entered too many times");
+    }
+    sim_chip_charge_cpu();
+    chip_stack[chip_depth++] = chip;
+}
+
+void sim_chip_leave(void)
+{
+    if (chip_depth == 0) {
+        sim_panic("sim_chip_leave without sim_chip_enter");
+    }
+    sim_chip_charge_cpu();
+    chip_depth--;
+}
+
+sim_chip_t *sim_chip_current(void)
+{
+    return chip_depth > 0 ? chip_stack[chip_depth - 1] : NULL;
+}
+
+esp_err_t sim_chip_start_task(sim_chip_t *chip, TaskFunction_t task, const char *name, void *arg,
+    TaskHandle_t *out_handle)
+{
+    sim_chip_enter(chip);
+    BaseType_t ret = xTaskCreate(task, name, 4096, arg, 5, out_handle);
+    sim_chip_leave();
+    return ret == pdPASS ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+const char *sim_chip_name(const sim_chip_t *chip)
+{
+    return chip->name;
+}
+
+uint64_t sim_chip_cpu_us(const sim_chip_t *chip)
+{
+    return __atomic_load_n(&chip->cpu_us, __ATOMIC_RELAXED);
+}
+
+void sim_chip_get_lock_stats(const sim_chip_t *chip, sim_lock_stats_t *stats)
+{
+    const sim_lock_stats_t *from = &chip->lock_stats;
+    stats->mutex_takes = __atomic_load_n(&from->mutex_takes, __ATOMIC_RELAXED);
+    stats->mutex_contended = __atomic_load_n(&from->mutex_contended, __ATOMIC_RELAXED);
+    stats->mutex_wait_us = __atomic_load_n(&from->mutex_wait_us, __ATOMIC_RELAXED);
+    stats->critical_entries = __atomic_load_n(&from->critical_entries, __ATOMIC_RELAXED);
+    stats->critical_contended = __atomic_load_n(&from->critical_contended, __ATOMIC_RELAXED);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    if (strcmp(tag, "*") == 0) {
+        log_level = level;
+    }
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+    if (level > log_level) {
+        return;
+    }
+
+    char line[512];
+    sim_chip_t *chip = sim_chip_current();
+    int len = snprintf(line, sizeof(line), "%c (%lld) %s%s%s: ", letters[level],
+        (long long) (sim_time_us() / 1000), chip ? chip->name : "", chip ? " " : "", tag);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line + len, sizeof(line) - len, format, args);
+    va_end(args);
+    // A single write, so that the lines of concurrent tasks do not interleave
+    fprintf(stderr, "%s\n", line);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_FAIL:
+            return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:
+            return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:
+            return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:
+            return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:
+            return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED:
+            return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:
+            return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_CRC:
+            return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_INVALID_VERSION:
+            return "ESP_ERR_INVALID_VERSION";
+        default:
+            return "UNKNOWN ERROR";
+    }
+}
+
+void esp_chip_info(esp_chip_info_t *out_info)
+{
+    memset(out_info, 0, sizeof(esp_chip_info_t));
+    out_info->model = CHIP_ESP32;
+    out_info->features = CHIP_FEATURE_WIFI_BGN | CHIP_FEATURE_BLE | CHIP_FEATURE_BT;
+    out_info->cores = 2;
+    out_info->revision = 1;
+}
+
+void uuid_generate_v4(uuid_t out)
+{
+    for (int i = 0; i < 16; i += 4) {
+        uint32_t random = sim_random();
+        memcpy(out + i, &random, sizeof(random));
+    }
+    out[6] = (out[6] & 0x0f) | 0x40;
+    out[8] = (out[8] & 0x3f) | 0x80;
+}
+
+void uuid_to_string(const uuid_t uuid, char *out)
+{
+    snprintf(out, UUID_STR_LEN,
+        "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x", uuid[0], uuid[1],
+        uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7], uuid[8], uuid[9], uuid[10],
+        uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+}
+
+void sntp_setoperatingmode(unsigned char operating_mode)
+{
+}
+
+void sntp_setservername(unsigned char idx, const char *server)
+{
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback)
+{
+}
+
+void sntp_init(void)
+{
+    ESP_LOGW("SIM", "No SNTP on the host, set the system time with sim_time_set_epoch()");
+}
+
+void sntp_stop(void)
+{
+}
+
+unsigned char sntp_enabled(void)
+{
+    return 0;
+}
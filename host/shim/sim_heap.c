@@ -0,0 +1,350 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_internal.h"
+#include <errno.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Linked with --wrap for the libc allocator: every block is also placed in the heap arena of the
+ * chip it is allocated on behalf of. The arena only tracks offsets, the memory itself comes from
+ * the host allocator.
+ */
+
+#define BLOCK_MAGIC 0x5e1f4ea9
+// Header and minimum size of a block of the multi_heap allocator of the ESP-IDF
+#define BLOCK_OVERHEAD 8
+#define BLOCK_MIN_SIZE 12
+
+struct sim_free_range
+{
+    uint32_t offset;
+    uint32_t size;
+    struct sim_free_range *next;
+};
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t span;
+    uint32_t offset;
+    uint32_t reserved;
+    sim_chip_t *chip;
+    size_t size;
+} block_header_t;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *sim_sys_malloc(size_t size)
+{
+    return __real_malloc(size);
+}
+
+void *sim_sys_calloc(size_t count, size_t size)
+{
+    return __real_calloc(count, size);
+}
+
+void *sim_sys_realloc(void *ptr, size_t size)
+{
+    return __real_realloc(ptr, size);
+}
+
+void sim_sys_free(void *ptr)
+{
+    __real_free(ptr);
+}
+
+char *sim_sys_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = __real_malloc(len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+void sim_heap_init(sim_heap_t *heap, size_t size, size_t used_at_boot)
+{
+    pthread_mutex_init(&heap->lock, NULL);
+    heap->total = size;
+    heap->free = size - used_at_boot;
+    heap->minimum_free = heap->free;
+    heap->free_ranges = __real_calloc(1, sizeof(sim_free_range_t));
+    if (!heap->free_ranges) {
+        sim_panic("out of host memory");
+    }
+    heap->free_ranges->offset = used_at_boot;
+    heap->free_ranges->size = size - used_at_boot;
+}
+
+static uint32_t block_span(size_t size)
+{
+    size = (size + 3) & ~(size_t) 3;
+    if (size < BLOCK_MIN_SIZE) {
+        size = BLOCK_MIN_SIZE;
+    }
+    return size + BLOCK_OVERHEAD;
+}
+
+// First fit, like the allocator of the chip, so that long running allocations fragment the heap
+static bool arena_take(sim_heap_t *heap, uint32_t span, uint32_t *offset)
+{
+    pthread_mutex_lock(&heap->lock);
+    sim_free_range_t *prev = NULL;
+    for (sim_free_range_t *range = heap->free_ranges; range; prev = range, range = range->next) {
+        if (range->size < span) {
+            continue;
+        }
+        *offset = range->offset;
+        range->offset += span;
+        range->size -= span;
+        if (range->size == 0) {
+            if (prev) {
+                prev->next = range->next;
+            } else {
+                heap->free_ranges = range->next;
+            }
+            __real_free(range);
+        }
+        heap->free -= span;
+        if (heap->free < heap->minimum_free) {
+            heap->minimum_free = heap->free;
+        }
+        heap->allocated_blocks++;
+        pthread_mutex_unlock(&heap->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&heap->lock);
+    return false;
+}
+
+static void arena_give(sim_heap_t *heap, uint32_t offset, uint32_t span)
+{
+    pthread_mutex_lock(&heap->lock);
+    sim_free_range_t *prev = NULL;
+    sim_free_range_t *next = heap->free_ranges;
+    while (next && next->offset < offset) {
+        prev = next;
+        next = next->next;
+    }
+
+    if (prev && prev->offset + prev->size == offset) {
+        prev->size += span;
+        if (next && prev->offset + prev->size == next->offset) {
+            prev->size += next->size;
+            prev->next = next->next;
+            __real_free(next);
+        }
+    } else if (next && offset + span == next->offset) {
+        next->offset = offset;
+        next->size += span;
+    } else {
+        sim_free_range_t *range = __real_malloc(sizeof(sim_free_range_t));
+        if (!range) {
+            sim_panic("out of host memory");
+        }
+        range->offset = offset;
+        range->size = span;
+        range->next = next;
+        if (prev) {
+            prev->next = range;
+        } else {
+            heap->free_ranges = range;
+        }
+    }
+    heap->free += span;
+    heap->allocated_blocks--;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+static void *alloc_on(sim_chip_t *chip, size_t size)
+{
+    uint32_t span = 0;
+    uint32_t offset = 0;
+    if (chip) {
+        span = block_span(size);
+        if (size > UINT32_MAX - BLOCK_MIN_SIZE || !arena_take(&chip->heap, span, &offset)) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    block_header_t *header = __real_malloc(sizeof(block_header_t) + size);
+    if (!header) {
+        if (chip) {
+            arena_give(&chip->heap, offset, span);
+        }
+        return NULL;
+    }
+    header->magic = BLOCK_MAGIC;
+    header->span = span;
+    header->offset = offset;
+    header->chip = chip;
+    header->size = size;
+    return header + 1;
+}
+
+static block_header_t *header_of(void *ptr)
+{
+    block_header_t *header = (block_header_t *) ptr - 1;
+    if (header->magic != BLOCK_MAGIC) {
+        sim_panic("free of %p, not allocated by malloc or already freed", ptr);
+    }
+    return header;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    return alloc_on(sim_chip_current(), size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    if (size && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = alloc_on(sim_chip_current(), count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    block_header_t *header = header_of(ptr);
+    if (header->chip) {
+        arena_give(&header->chip->heap, header->offset, header->span);
+    }
+    header->magic = 0;
+    __real_free(header);
+}
+
+// A new block is always allocated, as the chip does when the next block is not free
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return __wrap_malloc(size);
+    }
+    if (size == 0) {
+        __wrap_free(ptr);
+        return NULL;
+    }
+    block_header_t *header = header_of(ptr);
+    void *new_ptr = alloc_on(header->chip, size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, header->size < size ? header->size : size);
+        __wrap_free(ptr);
+    }
+    return new_ptr;
+}
+
+char *__wrap_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = __wrap_malloc(len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+void sim_heap_get_info(sim_chip_t *chip, sim_heap_info_t *info)
+{
+    sim_heap_t *heap = &chip->heap;
+    pthread_mutex_lock(&heap->lock);
+    info->total = heap->total;
+    info->free = heap->free;
+    info->minimum_free = heap->minimum_free;
+    info->allocated_blocks = heap->allocated_blocks;
+    info->largest_free_block = 0;
+    for (sim_free_range_t *range = heap->free_ranges; range; range = range->next) {
+        if (range->size > info->largest_free_block) {
+            info->largest_free_block = range->size;
+        }
+    }
+    pthread_mutex_unlock(&heap->lock);
+    if (info->largest_free_block > BLOCK_OVERHEAD) {
+        info->largest_free_block -= BLOCK_OVERHEAD;
+    }
+}
+
+static bool current_heap_info(sim_heap_info_t *info)
+{
+    sim_chip_t *chip = sim_chip_current();
+    if (!chip) {
+        memset(info, 0, sizeof(sim_heap_info_t));
+        return false;
+    }
+    sim_heap_get_info(chip, info);
+    return true;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    sim_heap_info_t info;
+    current_heap_info(&info);
+    return info.free;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    sim_heap_info_t info;
+    current_heap_info(&info);
+    return info.minimum_free;
+}
+
+size_t heap_caps_get_total_size(uint32_t caps)
+{
+    sim_heap_info_t info;
+    current_heap_info(&info);
+    return caps & MALLOC_CAP_SPIRAM ? 0 : info.total;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    sim_heap_info_t info;
+    current_heap_info(&info);
+    return caps & MALLOC_CAP_SPIRAM ? 0 : info.free;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    sim_heap_info_t info;
+    current_heap_info(&info);
+    return caps & MALLOC_CAP_SPIRAM ? 0 : info.minimum_free;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    sim_heap_info_t info;
+    current_heap_info(&info);
+    return caps & MALLOC_CAP_SPIRAM ? 0 : info.largest_free_block;
+}
@@ -0,0 +1,126 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_INTERNAL_H
+#define SIM_INTERNAL_H
+
+#include "sim.h"
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared by the shims, not part of the API of the tools
+
+#define SIM_FOREVER INT64_MAX
+#define SIM_MAX_PARTITIONS 4
+
+struct sim_task;
+
+typedef struct
+{
+    struct sim_task *head;
+    struct sim_task *tail;
+} sim_waitlist_t;
+
+/*
+ * Every blocking primitive is built on the kernel lock and its wait lists: a task waits with the
+ * lock held and is woken by another task or by its deadline. Shim locks other than the kernel one
+ * must never be held while waiting.
+ */
+
+void sim_kernel_init(sim_clock_t clock);
+void sim_lock(void);
+void sim_unlock(void);
+
+/**
+ * @brief block the calling task until woken or until a deadline.
+ *
+ * @details The kernel lock must be held, it is released while blocked.
+ *
+ * @param list The wait list, NULL to wait for the deadline only.
+ * @param deadline_us The deadline on the simulation clock, SIM_FOREVER for none.
+ * @return true if woken, false if the deadline passed.
+ */
+bool sim_wait(sim_waitlist_t *list, int64_t deadline_us);
+
+/**
+ * @brief wake the task waiting the longest on a wait list.
+ *
+ * @param list The wait list.
+ * @return true if a task was woken.
+ */
+bool sim_wake_one(sim_waitlist_t *list);
+
+int64_t sim_deadline_from_ticks(TickType_t ticks);
+
+/**
+ * @brief charge the CPU time used by the calling thread since the last charge to its chip.
+ */
+void sim_chip_charge_cpu(void);
+
+typedef struct sim_free_range sim_free_range_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t total;
+    size_t free;
+    size_t minimum_free;
+    size_t allocated_blocks;
+    // Free ranges of the arena, sorted by offset
+    sim_free_range_t *free_ranges;
+} sim_heap_t;
+
+struct sim_chip
+{
+    uint32_t id;
+    char name[16];
+    uint64_t random_state;
+    uint64_t cpu_us;
+    uint32_t task_count;
+    struct sim_task *idle_tasks[portNUM_PROCESSORS];
+    sim_heap_t heap;
+    uint32_t nvs_partition_size;
+    esp_partition_t partitions[SIM_MAX_PARTITIONS];
+    struct sim_nvs_entry *nvs_entries;
+    struct sim_event_loop *event_loop;
+    struct sim_wifi *wifi;
+    sim_astarte_stats_t astarte_stats;
+    // Updated with atomics
+    sim_lock_stats_t lock_stats;
+};
+
+void sim_heap_init(sim_heap_t *heap, size_t size, size_t used_at_boot);
+
+// Memory of the simulation itself, not accounted on any chip
+void *sim_sys_malloc(size_t size);
+void *sim_sys_calloc(size_t count, size_t size);
+void *sim_sys_realloc(void *ptr, size_t size);
+void sim_sys_free(void *ptr);
+char *sim_sys_strdup(const char *str);
+
+uint32_t sim_chip_random(sim_chip_t *chip);
+uint64_t sim_thread_cpu_us(void);
+
+// Fatal errors of the simulated code, e.g. a misuse of the FreeRTOS API
+void sim_panic(const char *format, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+#endif // SIM_INTERNAL_H
@@ -0,0 +1,857 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_internal.h"
+#include <errno.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Host threads need more stack than the tasks of the chip, whose stack size is only accounted
+#define TASK_THREAD_STACK_SIZE (256 * 1024)
+// Heap used by the task control block of FreeRTOS, charged with the stack
+#define TASK_TCB_SIZE 352
+// Tasks the ESP-IDF runs on each chip: IDLE0, IDLE1, ipc0, ipc1, esp_timer, wifi and tiT
+#define CHIP_SYSTEM_TASKS 7
+
+struct sim_task
+{
+    pthread_t thread;
+    pthread_cond_t cond;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t number;
+    UBaseType_t priority;
+    BaseType_t core_id;
+    sim_chip_t *chip;
+    TaskFunction_t function;
+    void *arg;
+    void *stack;
+    // Idle tasks are not threads, they count the time their chip did not use
+    bool idle;
+    bool blocked;
+    bool woken;
+    int64_t deadline_us;
+    sim_waitlist_t *waiting_on;
+    struct sim_task *wait_next;
+    // Index in the deadlines of the virtual clock, SIZE_MAX when not there
+    size_t timed_index;
+    struct sim_task *ready_next;
+    struct sim_task *prev;
+    struct sim_task *next;
+    uint32_t notify_value;
+    sim_waitlist_t notify_waiters;
+};
+
+struct sim_queue
+{
+    size_t item_size;
+    // Mutexes are semaphores whose takes are accounted as lock contention
+    bool mutex;
+    UBaseType_t length;
+    UBaseType_t head;
+    UBaseType_t count;
+    sim_waitlist_t senders;
+    sim_waitlist_t receivers;
+    uint8_t items[];
+};
+
+static pthread_mutex_t kernel_lock = PTHREAD_MUTEX_INITIALIZER;
+static sim_clock_t kernel_clock;
+static struct timespec start_time;
+static int64_t virtual_now_us;
+// With the virtual clock, the only task allowed to run
+static struct sim_task *running;
+static struct sim_task *ready_head;
+static struct sim_task *ready_tail;
+// With the virtual clock, the blocked tasks with a deadline, a min heap
+static struct sim_task **timed;
+static size_t timed_count;
+static size_t timed_capacity;
+// All the tasks, in creation order
+static struct sim_task *tasks_head;
+static struct sim_task *tasks_tail;
+static UBaseType_t task_count;
+static UBaseType_t next_task_number;
+static struct sim_task *idle_tasks[portNUM_PROCESSORS];
+static __thread struct sim_task *current_task;
+
+void sim_panic(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "SIMULATION PANIC: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    abort();
+}
+
+int64_t sim_time_us(void)
+{
+    if (kernel_clock == SIM_CLOCK_VIRTUAL) {
+        return __atomic_load_n(&virtual_now_us, __ATOMIC_ACQUIRE);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) (now.tv_sec - start_time.tv_sec) * 1000000
+        + (now.tv_nsec - start_time.tv_nsec) / 1000;
+}
+
+sim_clock_t sim_clock(void)
+{
+    return kernel_clock;
+}
+
+uint64_t sim_thread_cpu_us(void)
+{
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    return (uint64_t) cpu.tv_sec * 1000000 + cpu.tv_nsec / 1000;
+}
+
+void sim_lock(void)
+{
+    pthread_mutex_lock(&kernel_lock);
+}
+
+void sim_unlock(void)
+{
+    pthread_mutex_unlock(&kernel_lock);
+}
+
+int64_t sim_deadline_from_ticks(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return SIM_FOREVER;
+    }
+    return sim_time_us() + (int64_t) ticks * (1000000 / configTICK_RATE_HZ);
+}
+
+static struct sim_task *task_new(const char *name, sim_chip_t *chip)
+{
+    struct sim_task *task = sim_sys_calloc(1, sizeof(struct sim_task));
+    if (!task) {
+        sim_panic("out of host memory");
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&task->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    task->chip = chip;
+    task->timed_index = SIZE_MAX;
+    return task;
+}
+
+static struct sim_task *task_self(void)
+{
+    if (current_task) {
+        return current_task;
+    }
+    if (kernel_clock == SIM_CLOCK_VIRTUAL) {
+        sim_panic("a thread not created by the simulation used FreeRTOS with the virtual clock");
+    }
+
+    // e.g. the MQTT thread, it never blocks on the FreeRTOS API
+    current_task = task_new("foreign", NULL);
+    current_task->number = next_task_number++;
+    return current_task;
+}
+
+static void waitlist_append(sim_waitlist_t *list, struct sim_task *task)
+{
+    task->wait_next = NULL;
+    if (list->tail) {
+        list->tail->wait_next = task;
+    } else {
+        list->head = task;
+    }
+    list->tail = task;
+}
+
+static void waitlist_remove(sim_waitlist_t *list, struct sim_task *task)
+{
+    struct sim_task *prev = NULL;
+    for (struct sim_task *t = list->head; t; prev = t, t = t->wait_next) {
+        if (t == task) {
+            if (prev) {
+                prev->wait_next = t->wait_next;
+            } else {
+                list->head = t->wait_next;
+            }
+            if (list->tail == t) {
+                list->tail = prev;
+            }
+            t->wait_next = NULL;
+            return;
+        }
+    }
+}
+
+static void ready_push(struct sim_task *task)
+{
+    task->ready_next = NULL;
+    if (ready_tail) {
+        ready_tail->ready_next = task;
+    } else {
+        ready_head = task;
+    }
+    ready_tail = task;
+}
+
+static struct sim_task *ready_pop(void)
+{
+    struct sim_task *task = ready_head;
+    if (task) {
+        ready_head = task->ready_next;
+        if (!ready_head) {
+            ready_tail = NULL;
+        }
+    }
+    return task;
+}
+
+// Deadlines are ordered by time, then by task creation, so that runs are reproducible
+static bool timed_before(const struct sim_task *a, const struct sim_task *b)
+{
+    return a->deadline_us < b->deadline_us
+        || (a->deadline_us == b->deadline_us && a->number < b->number);
+}
+
+static void timed_swap(size_t i, size_t j)
+{
+    struct sim_task *task = timed[i];
+    timed[i] = timed[j];
+    timed[j] = task;
+    timed[i]->timed_index = i;
+    timed[j]->timed_index = j;
+}
+
+static void timed_sift_up(size_t i)
+{
+    while (i > 0 && timed_before(timed[i], timed[(i - 1) / 2])) {
+        timed_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void timed_sift_down(size_t i)
+{
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < timed_count && timed_before(timed[left], timed[smallest])) {
+            smallest = left;
+        }
+        if (right < timed_count && timed_before(timed[right], timed[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        timed_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+static void timed_push(struct sim_task *task)
+{
+    if (timed_count == timed_capacity) {
+        timed_capacity = timed_capacity ? timed_capacity * 2 : 64;
+        timed = sim_sys_realloc(timed, timed_capacity * sizeof(*timed));
+        if (!timed) {
+            sim_panic("out of host memory");
+        }
+    }
+    task->timed_index = timed_count;
+    timed[timed_count++] = task;
+    timed_sift_up(task->timed_index);
+}
+
+static void timed_remove(struct sim_task *task)
+{
+    size_t i = task->timed_index;
+    task->timed_index = SIZE_MAX;
+    if (i != --timed_count) {
+        timed[i] = timed[timed_count];
+        timed[i]->timed_index = i;
+        timed_sift_up(i);
+        timed_sift_down(timed[i]->timed_index);
+    }
+}
+
+static void unblock(struct sim_task *task, bool woken)
+{
+    if (task->waiting_on) {
+        waitlist_remove(task->waiting_on, task);
+        task->waiting_on = NULL;
+    }
+    if (task->timed_index != SIZE_MAX) {
+        timed_remove(task);
+    }
+    task->blocked = false;
+    task->woken = woken;
+    if (kernel_clock == SIM_CLOCK_VIRTUAL) {
+        ready_push(task);
+    } else {
+        pthread_cond_signal(&task->cond);
+    }
+}
+
+static void dump_tasks(void)
+{
+    for (struct sim_task *task = tasks_head; task; task = task->next) {
+        fprintf(stderr, "  %s%s%s: %s\n", task->chip ? task->chip->name : "",
+            task->chip ? "/" : "", task->name, task->blocked ? "blocked" : "ready");
+    }
+}
+
+// Hands the CPU to the next ready task, advancing the virtual clock when none is ready
+static void schedule_next(void)
+{
+    for (;;) {
+        struct sim_task *next = ready_pop();
+        if (next) {
+            running = next;
+            pthread_cond_signal(&next->cond);
+            return;
+        }
+        if (timed_count == 0) {
+            dump_tasks();
+            sim_panic("all the tasks are blocked forever");
+        }
+        int64_t now_us = timed[0]->deadline_us;
+        __atomic_store_n(&virtual_now_us, now_us, __ATOMIC_RELEASE);
+        while (timed_count > 0 && timed[0]->deadline_us <= now_us) {
+            unblock(timed[0], false);
+        }
+    }
+}
+
+static void wait_for_cpu(struct sim_task *self)
+{
+    while (running != self) {
+        pthread_cond_wait(&self->cond, &kernel_lock);
+    }
+}
+
+bool sim_wait(sim_waitlist_t *list, int64_t deadline_us)
+{
+    struct sim_task *self = task_self();
+    if (deadline_us <= sim_time_us()) {
+        return false;
+    }
+
+    sim_chip_charge_cpu();
+    self->blocked = true;
+    self->woken = false;
+    self->deadline_us = deadline_us;
+    self->waiting_on = list;
+    if (list) {
+        waitlist_append(list, self);
+    }
+
+    if (kernel_clock == SIM_CLOCK_VIRTUAL) {
+        if (deadline_us != SIM_FOREVER) {
+            timed_push(self);
+        }
+        schedule_next();
+        wait_for_cpu(self);
+        return self->woken;
+    }
+
+    struct timespec deadline = start_time;
+    if (deadline_us != SIM_FOREVER) {
+        deadline.tv_sec += deadline_us / 1000000;
+        deadline.tv_nsec += (deadline_us % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    while (self->blocked) {
+        if (deadline_us == SIM_FOREVER) {
+            pthread_cond_wait(&self->cond, &kernel_lock);
+        } else if (pthread_cond_timedwait(&self->cond, &kernel_lock, &deadline) == ETIMEDOUT
+            && self->blocked) {
+            unblock(self, false);
+        }
+    }
+    return self->woken;
+}
+
+bool sim_wake_one(sim_waitlist_t *list)
+{
+    if (!list->head) {
+        return false;
+    }
+    unblock(list->head, true);
+    return true;
+}
+
+static void yield(void)
+{
+    if (kernel_clock == SIM_CLOCK_REAL) {
+        sched_yield();
+        return;
+    }
+    sim_lock();
+    struct sim_task *self = task_self();
+    sim_chip_charge_cpu();
+    ready_push(self);
+    schedule_next();
+    wait_for_cpu(self);
+    sim_unlock();
+}
+
+void sim_kernel_init(sim_clock_t clock)
+{
+    kernel_clock = clock;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    struct sim_task *task = task_new("main", NULL);
+    task->thread = pthread_self();
+    sim_lock();
+    task->number = next_task_number++;
+    tasks_head = tasks_tail = task;
+    task_count++;
+    current_task = task;
+    running = task;
+    sim_unlock();
+}
+
+static void *task_main(void *arg)
+{
+    struct sim_task *task = arg;
+    current_task = task;
+    sim_chip_enter(task->chip);
+
+    sim_lock();
+    if (kernel_clock == SIM_CLOCK_VIRTUAL) {
+        wait_for_cpu(task);
+    }
+    sim_unlock();
+
+    task->function(task->arg);
+    sim_panic("task %s returned from its function", task->name);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName,
+    uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask,
+    BaseType_t xCoreID)
+{
+    sim_chip_t *chip = sim_chip_current();
+    void *stack = malloc(usStackDepth + TASK_TCB_SIZE);
+    if (!stack) {
+        return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+    }
+
+    struct sim_task *task = task_new(pcName, chip);
+    task->function = pvTaskCode;
+    task->arg = pvParameters;
+    task->stack = stack;
+    task->priority = uxPriority;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, TASK_THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    sim_lock();
+    task->number = next_task_number++;
+    task->core_id = xCoreID == tskNO_AFFINITY ? (BaseType_t) (task->number % portNUM_PROCESSORS)
+                                              : xCoreID;
+    task->prev = tasks_tail;
+    tasks_tail->next = task;
+    tasks_tail = task;
+    task_count++;
+    if (chip) {
+        chip->task_count++;
+    }
+    if (pvCreatedTask) {
+        *pvCreatedTask = task;
+    }
+    if (pthread_create(&task->thread, &attr, task_main, task) != 0) {
+        sim_panic("unable to create the thread of task %s", pcName);
+    }
+    if (kernel_clock == SIM_CLOCK_VIRTUAL) {
+        ready_push(task);
+    }
+    sim_unlock();
+    pthread_attr_destroy(&attr);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+    void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask)
+{
+    return xTaskCreatePinnedToCore(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority,
+        pvCreatedTask, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    struct sim_task *self = current_task;
+    if (xTaskToDelete && xTaskToDelete != self) {
+        sim_panic("only vTaskDelete(NULL) is supported");
+    }
+    if (!self || !self->function) {
+        sim_panic("vTaskDelete(NULL) called outside of a task");
+    }
+
+    sim_chip_charge_cpu();
+    free(self->stack);
+    sim_lock();
+    if (self->prev) {
+        self->prev->next = self->next;
+    } else {
+        tasks_head = self->next;
+    }
+    if (self->next) {
+        self->next->prev = self->prev;
+    } else {
+        tasks_tail = self->prev;
+    }
+    task_count--;
+    if (self->chip) {
+        self->chip->task_count--;
+    }
+    if (kernel_clock == SIM_CLOCK_VIRTUAL) {
+        schedule_next();
+    }
+    sim_unlock();
+
+    current_task = NULL;
+    pthread_cond_destroy(&self->cond);
+    sim_sys_free(self);
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+    if (xTicksToDelay == 0) {
+        yield();
+        return;
+    }
+    sim_lock();
+    sim_wait(NULL, sim_deadline_from_ticks(xTicksToDelay));
+    sim_unlock();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t) (sim_time_us() / (1000000 / configTICK_RATE_HZ));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    sim_lock();
+    struct sim_task *self = task_self();
+    sim_unlock();
+    return self;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandleForCPU(BaseType_t cpuid)
+{
+    return xTaskGetCurrentTaskHandle();
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t cpuid)
+{
+    if (cpuid >= portNUM_PROCESSORS) {
+        return NULL;
+    }
+    sim_chip_t *chip = sim_chip_current();
+    struct sim_task **idle = chip ? &chip->idle_tasks[cpuid] : &idle_tasks[cpuid];
+
+    sim_lock();
+    if (!*idle) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "IDLE%u", cpuid);
+        *idle = task_new(name, chip);
+        (*idle)->idle = true;
+        (*idle)->core_id = cpuid;
+    }
+    sim_unlock();
+    return *idle;
+}
+
+char *pcTaskGetTaskName(TaskHandle_t xTaskToQuery)
+{
+    struct sim_task *task = xTaskToQuery ? xTaskToQuery : xTaskGetCurrentTaskHandle();
+    return task->name;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    sim_chip_t *chip = sim_chip_current();
+    sim_lock();
+    UBaseType_t count = chip ? chip->task_count + CHIP_SYSTEM_TASKS : task_count;
+    sim_unlock();
+    return count;
+}
+
+// Run time counters are in microseconds, they count host CPU time on the real clock only
+static uint32_t run_time_counter(const struct sim_task *task)
+{
+    if (task->idle) {
+        // The time the cores of the chip did not use, split between its idle tasks
+        uint64_t busy_us = 0;
+        if (kernel_clock == SIM_CLOCK_REAL && task->chip) {
+            busy_us = sim_chip_cpu_us(task->chip);
+        }
+        int64_t idle_us = (sim_time_us() * portNUM_PROCESSORS - (int64_t) busy_us)
+            / portNUM_PROCESSORS;
+        return idle_us > 0 ? (uint32_t) idle_us : 0;
+    }
+    if (kernel_clock == SIM_CLOCK_VIRTUAL) {
+        return 0;
+    }
+
+    clockid_t clock;
+    struct timespec cpu;
+    if (pthread_getcpuclockid(task->thread, &clock) != 0 || clock_gettime(clock, &cpu) != 0) {
+        return 0;
+    }
+    return (uint32_t) ((uint64_t) cpu.tv_sec * 1000000 + cpu.tv_nsec / 1000);
+}
+
+void vTaskGetInfo(TaskHandle_t xTask, TaskStatus_t *pxTaskStatus, BaseType_t xGetFreeStackSpace,
+    eTaskState eState)
+{
+    struct sim_task *self = xTaskGetCurrentTaskHandle();
+    struct sim_task *task = xTask ? xTask : self;
+
+    memset(pxTaskStatus, 0, sizeof(TaskStatus_t));
+    pxTaskStatus->xHandle = task;
+    pxTaskStatus->pcTaskName = task->name;
+    pxTaskStatus->xTaskNumber = task->number;
+    if (task == self) {
+        pxTaskStatus->eCurrentState = eRunning;
+    } else {
+        pxTaskStatus->eCurrentState = task->blocked ? eBlocked : eReady;
+    }
+    pxTaskStatus->uxCurrentPriority = task->priority;
+    pxTaskStatus->uxBasePriority = task->priority;
+    pxTaskStatus->xCoreID = task->core_id;
+    pxTaskStatus->ulRunTimeCounter = run_time_counter(task);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+    sim_lock();
+    xTaskToNotify->notify_value++;
+    sim_wake_one(&xTaskToNotify->notify_waiters);
+    sim_unlock();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    int64_t deadline_us = sim_deadline_from_ticks(xTicksToWait);
+    sim_lock();
+    struct sim_task *self = task_self();
+    while (self->notify_value == 0) {
+        if (xTicksToWait == 0 || !sim_wait(&self->notify_waiters, deadline_us)) {
+            break;
+        }
+    }
+    uint32_t value = self->notify_value;
+    if (value > 0) {
+        self->notify_value = xClearCountOnExit ? 0 : value - 1;
+    }
+    sim_unlock();
+    return value;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return current_task ? current_task->core_id : 0;
+}
+
+void vPortCPUInitializeMutex(portMUX_TYPE *mux)
+{
+    mux->owner = 0;
+    mux->count = 0;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    uintptr_t self = (uintptr_t) pthread_self();
+    if (__atomic_load_n(&mux->owner, __ATOMIC_ACQUIRE) == self) {
+        mux->count++;
+        return;
+    }
+
+    uintptr_t unlocked = 0;
+    bool contended = false;
+    while (!__atomic_compare_exchange_n(
+        &mux->owner, &unlocked, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        unlocked = 0;
+        contended = true;
+        sched_yield();
+    }
+    mux->count = 1;
+
+    sim_chip_t *chip = sim_chip_current();
+    if (chip) {
+        __atomic_add_fetch(&chip->lock_stats.critical_entries, 1, __ATOMIC_RELAXED);
+        if (contended) {
+            __atomic_add_fetch(&chip->lock_stats.critical_contended, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    if (__atomic_load_n(&mux->owner, __ATOMIC_RELAXED) != (uintptr_t) pthread_self()) {
+        sim_panic("critical section exited by a task that does not own it");
+    }
+    if (--mux->count == 0) {
+        __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static QueueHandle_t queue_new(UBaseType_t length, size_t item_size, UBaseType_t count)
+{
+    struct sim_queue *queue = calloc(1, sizeof(struct sim_queue) + length * item_size);
+    if (queue) {
+        queue->item_size = item_size;
+        queue->length = length;
+        queue->count = count;
+    }
+    return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    return queue_new(uxQueueLength, uxItemSize, 0);
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+    if (xQueue && (xQueue->senders.head || xQueue->receivers.head)) {
+        sim_panic("queue deleted while tasks wait on it");
+    }
+    free(xQueue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    int64_t deadline_us = sim_deadline_from_ticks(xTicksToWait);
+    sim_lock();
+    while (xQueue->count == xQueue->length) {
+        if (xTicksToWait == 0 || !sim_wait(&xQueue->senders, deadline_us)) {
+            sim_unlock();
+            return errQUEUE_FULL;
+        }
+    }
+    if (xQueue->item_size > 0 && pvItemToQueue) {
+        UBaseType_t tail = (xQueue->head + xQueue->count) % xQueue->length;
+        memcpy(xQueue->items + tail * xQueue->item_size, pvItemToQueue, xQueue->item_size);
+    }
+    xQueue->count++;
+    sim_wake_one(&xQueue->receivers);
+    sim_unlock();
+    return pdPASS;
+}
+
+static void account_mutex_take(QueueHandle_t xQueue, int64_t wait_start_us)
+{
+    sim_chip_t *chip = sim_chip_current();
+    if (!xQueue->mutex || !chip) {
+        return;
+    }
+    __atomic_add_fetch(&chip->lock_stats.mutex_takes, 1, __ATOMIC_RELAXED);
+    if (wait_start_us >= 0) {
+        __atomic_add_fetch(&chip->lock_stats.mutex_contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(
+            &chip->lock_stats.mutex_wait_us, sim_time_us() - wait_start_us, __ATOMIC_RELAXED);
+    }
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    int64_t deadline_us = sim_deadline_from_ticks(xTicksToWait);
+    int64_t wait_start_us = -1;
+    sim_lock();
+    while (xQueue->count == 0) {
+        if (wait_start_us < 0) {
+            wait_start_us = sim_time_us();
+        }
+        if (xTicksToWait == 0 || !sim_wait(&xQueue->receivers, deadline_us)) {
+            sim_unlock();
+            return errQUEUE_EMPTY;
+        }
+    }
+    account_mutex_take(xQueue, wait_start_us);
+    if (xQueue->item_size > 0) {
+        memcpy(pvBuffer, xQueue->items + xQueue->head * xQueue->item_size, xQueue->item_size);
+    }
+    xQueue->head = (xQueue->head + 1) % xQueue->length;
+    xQueue->count--;
+    sim_wake_one(&xQueue->senders);
+    sim_unlock();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    sim_lock();
+    UBaseType_t count = xQueue->count;
+    sim_unlock();
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    QueueHandle_t mutex = queue_new(1, 0, 1);
+    if (mutex) {
+        mutex->mutex = true;
+    }
+    return mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return queue_new(1, 0, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount)
+{
+    return queue_new(uxMaxCount, 0, uxInitialCount);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+{
+    return xQueueReceive(xSemaphore, NULL, xBlockTime);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+    return xQueueSend(xSemaphore, NULL, 0);
+}
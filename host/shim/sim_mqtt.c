@@ -0,0 +1,691 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_mqtt.h"
+#include <errno.h>
+#include <esp_log.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Defaults of the esp-mqtt client of the ESP-IDF
+#define KEEPALIVE_S 120
+#define RECONNECT_DELAY_US (10 * 1000000LL)
+#define NETWORK_TIMEOUT_US (10 * 1000000LL)
+#define OUT_BUFFER_MAX (64 * 1024)
+#define IN_PACKET_MAX (256 * 1024)
+#define EPOLL_BATCH 64
+
+#define PACKET_CONNECT 0x10
+#define PACKET_CONNACK 0x20
+#define PACKET_PUBLISH 0x30
+#define PACKET_PUBACK 0x40
+#define PACKET_PUBREC 0x50
+#define PACKET_PUBREL 0x62
+#define PACKET_PUBCOMP 0x70
+#define PACKET_SUBSCRIBE 0x82
+#define PACKET_PINGREQ 0xc0
+#define PACKET_DISCONNECT 0xe0
+
+static const char *TAG = "SIM_MQTT";
+
+typedef enum
+{
+    STATE_IDLE,
+    STATE_WAIT_RETRY,
+    STATE_CONNECTING,
+    STATE_WAIT_CONNACK,
+    STATE_CONNECTED,
+} client_state_t;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+} buffer_t;
+
+struct sim_mqtt_client
+{
+    pthread_mutex_t lock;
+    sim_chip_t *chip;
+    struct sockaddr_storage address;
+    socklen_t address_len;
+    char *client_id;
+    sim_mqtt_callbacks_t callbacks;
+    void *arg;
+    int fd;
+    client_state_t state;
+    bool started;
+    bool dead;
+    // Forced drop requested, served by the I/O thread, -1 if none
+    int64_t drop_down_us;
+    int64_t deadline_us;
+    int64_t last_tx_us;
+    uint16_t next_packet_id;
+    bool polling_out;
+    // Callbacks running, the client is not freed until they return
+    uint32_t busy;
+    buffer_t out;
+    buffer_t in;
+    struct sim_mqtt_client *next;
+};
+
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t io_thread;
+static bool io_thread_started;
+static int epoll_fd = -1;
+static int kick_fd = -1;
+static sim_mqtt_client_t *clients;
+
+static void *io_thread_main(void *arg);
+
+static void kick(void)
+{
+    uint64_t one = 1;
+    if (write(kick_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        sim_panic("unable to wake the MQTT I/O thread: %s", strerror(errno));
+    }
+}
+
+static void start_io_thread(void)
+{
+    if (io_thread_started) {
+        return;
+    }
+    if (sim_clock() != SIM_CLOCK_REAL) {
+        sim_panic("MQTT connections need the real clock");
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_fd < 0 || kick_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, kick_fd, &event) != 0
+        || pthread_create(&io_thread, NULL, io_thread_main, NULL) != 0) {
+        sim_panic("unable to start the MQTT I/O thread: %s", strerror(errno));
+    }
+    io_thread_started = true;
+}
+
+static void buffer_reserve(buffer_t *buffer, size_t len)
+{
+    if (buffer->len + len <= buffer->capacity) {
+        return;
+    }
+    size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+    while (capacity < buffer->len + len) {
+        capacity *= 2;
+    }
+    buffer->data = sim_sys_realloc(buffer->data, capacity);
+    if (!buffer->data) {
+        sim_panic("out of host memory");
+    }
+    buffer->capacity = capacity;
+}
+
+static void buffer_append(buffer_t *buffer, const void *data, size_t len)
+{
+    buffer_reserve(buffer, len);
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+}
+
+static void buffer_consume(buffer_t *buffer, size_t len)
+{
+    memmove(buffer->data, buffer->data + len, buffer->len - len);
+    buffer->len -= len;
+}
+
+static size_t encode_remaining_length(uint8_t *out, size_t len)
+{
+    size_t count = 0;
+    do {
+        uint8_t byte = len % 128;
+        len /= 128;
+        out[count++] = byte | (len > 0 ? 0x80 : 0);
+    } while (len > 0);
+    return count;
+}
+
+static void append_header(buffer_t *buffer, uint8_t type, size_t remaining_len)
+{
+    uint8_t header[5] = { type };
+    size_t len = 1 + encode_remaining_length(header + 1, remaining_len);
+    buffer_append(buffer, header, len);
+}
+
+static void append_u16(buffer_t *buffer, uint16_t value)
+{
+    uint8_t bytes[2] = { value >> 8, value & 0xff };
+    buffer_append(buffer, bytes, sizeof(bytes));
+}
+
+static void append_string(buffer_t *buffer, const char *string)
+{
+    size_t len = strlen(string);
+    append_u16(buffer, len);
+    buffer_append(buffer, string, len);
+}
+
+// Writability is polled only while the output is pending, not to wake up for each write
+static void update_events(sim_mqtt_client_t *client)
+{
+    bool poll_out = client->state == STATE_CONNECTING || client->out.len > 0;
+    if (poll_out != client->polling_out) {
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = client };
+        if (poll_out) {
+            event.events |= EPOLLOUT;
+        }
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+        client->polling_out = poll_out;
+    }
+}
+
+// Called with the client lock held
+static bool flush(sim_mqtt_client_t *client)
+{
+    size_t sent = 0;
+    while (sent < client->out.len) {
+        ssize_t ret = send(client->fd, client->out.data + sent, client->out.len - sent,
+            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += ret;
+    }
+    buffer_consume(&client->out, sent);
+    update_events(client);
+    client->last_tx_us = sim_time_us();
+    return true;
+}
+
+// Called with the client lock held, returns whether the client was connected
+static bool close_connection(sim_mqtt_client_t *client, int64_t down_us)
+{
+    bool was_connected = client->state == STATE_CONNECTED;
+    if (client->fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+        close(client->fd);
+        client->fd = -1;
+    }
+    client->out.len = 0;
+    client->in.len = 0;
+    client->state = client->started ? STATE_WAIT_RETRY : STATE_IDLE;
+    client->deadline_us = sim_time_us() + down_us;
+    return was_connected;
+}
+
+static void begin_connect(sim_mqtt_client_t *client)
+{
+    client->fd = socket(client->address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (client->fd < 0) {
+        ESP_LOGE(TAG, "Unable to create a socket: %s", strerror(errno));
+        client->deadline_us = sim_time_us() + RECONNECT_DELAY_US;
+        return;
+    }
+    int one = 1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(client->fd, (struct sockaddr *) &client->address, client->address_len);
+    if (ret != 0 && errno != EINPROGRESS) {
+        close(client->fd);
+        client->fd = -1;
+        client->deadline_us = sim_time_us() + RECONNECT_DELAY_US;
+        return;
+    }
+    client->state = STATE_CONNECTING;
+    client->deadline_us = sim_time_us() + NETWORK_TIMEOUT_US;
+    client->polling_out = true;
+    struct epoll_event event = { .events = EPOLLIN | EPOLLOUT, .data.ptr = client };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event);
+}
+
+static void send_connect(sim_mqtt_client_t *client)
+{
+    // Persistent session, as the Astarte device SDK asks for
+    size_t remaining_len = 10 + 2 + strlen(client->client_id);
+    append_header(&client->out, PACKET_CONNECT, remaining_len);
+    append_string(&client->out, "MQTT");
+    static const uint8_t level_and_flags[] = { 4, 0 };
+    buffer_append(&client->out, level_and_flags, sizeof(level_and_flags));
+    append_u16(&client->out, KEEPALIVE_S);
+    append_string(&client->out, client->client_id);
+    client->state = STATE_WAIT_CONNACK;
+    client->deadline_us = sim_time_us() + NETWORK_TIMEOUT_US;
+}
+
+static void send_ack(sim_mqtt_client_t *client, uint8_t type, uint16_t packet_id)
+{
+    append_header(&client->out, type, 2);
+    append_u16(&client->out, packet_id);
+}
+
+typedef enum
+{
+    CALLBACK_NONE,
+    CALLBACK_CONNECT,
+    CALLBACK_DISCONNECT,
+    CALLBACK_MESSAGE,
+} callback_t;
+
+// Runs a callback with the client lock released, returns false if the client died meanwhile
+static bool run_callback(sim_mqtt_client_t *client, callback_t callback, bool session_present,
+    const char *topic, size_t topic_len, const uint8_t *payload, size_t payload_len)
+{
+    if (client->dead || callback == CALLBACK_NONE) {
+        return !client->dead;
+    }
+    client->busy++;
+    pthread_mutex_unlock(&client->lock);
+    sim_chip_enter(client->chip);
+    switch (callback) {
+        case CALLBACK_CONNECT:
+            client->callbacks.on_connect(client->arg, session_present);
+            break;
+        case CALLBACK_DISCONNECT:
+            client->callbacks.on_disconnect(client->arg);
+            break;
+        case CALLBACK_MESSAGE:
+            client->callbacks.on_message(client->arg, topic, topic_len, payload, payload_len);
+            break;
+        default:
+            break;
+    }
+    sim_chip_leave();
+    pthread_mutex_lock(&client->lock);
+    client->busy--;
+    return !client->dead;
+}
+
+// Called with the client lock held, returns false when the connection must be closed
+static bool handle_packet(sim_mqtt_client_t *client, uint8_t type, uint8_t *body, size_t len)
+{
+    uint16_t packet_id = len >= 2 ? (body[0] << 8) | body[1] : 0;
+    switch (type & 0xf0) {
+        case PACKET_CONNACK:
+            if (client->state != STATE_WAIT_CONNACK || len < 2 || body[1] != 0) {
+                ESP_LOGW(TAG, "Connection of %s refused, code %d", client->client_id,
+                    len >= 2 ? body[1] : -1);
+                return false;
+            }
+            client->state = STATE_CONNECTED;
+            return run_callback(client, CALLBACK_CONNECT, body[0] & 1, NULL, 0, NULL, 0);
+        case PACKET_PUBLISH: {
+            int qos = (type >> 1) & 3;
+            if (len < 2) {
+                return false;
+            }
+            size_t topic_len = (body[0] << 8) | body[1];
+            size_t offset = 2 + topic_len + (qos > 0 ? 2 : 0);
+            if (offset > len) {
+                return false;
+            }
+            if (qos > 0) {
+                packet_id = (body[2 + topic_len] << 8) | body[3 + topic_len];
+                send_ack(client, qos == 1 ? PACKET_PUBACK : PACKET_PUBREC, packet_id);
+                if (!flush(client)) {
+                    return false;
+                }
+            }
+            return run_callback(client, CALLBACK_MESSAGE, false, (const char *) body + 2,
+                topic_len, body + offset, len - offset);
+        }
+        case PACKET_PUBREC & 0xf0:
+            send_ack(client, PACKET_PUBREL, packet_id);
+            return flush(client);
+        case PACKET_PUBREL & 0xf0:
+            send_ack(client, PACKET_PUBCOMP, packet_id);
+            return flush(client);
+        default:
+            // PUBACK, PUBCOMP, SUBACK and PINGRESP need no answer
+            return true;
+    }
+}
+
+// Called with the client lock held, returns false when the connection must be closed
+static bool handle_input(sim_mqtt_client_t *client)
+{
+    for (;;) {
+        buffer_reserve(&client->in, 4096);
+        ssize_t ret = recv(client->fd, client->in.data + client->in.len,
+            client->in.capacity - client->in.len, MSG_DONTWAIT);
+        if (ret == 0) {
+            return false;
+        }
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        client->in.len += ret;
+    }
+
+    for (;;) {
+        size_t remaining_len = 0;
+        size_t header_len = 1;
+        bool complete_header = false;
+        for (int shift = 0; header_len < client->in.len && header_len <= 4; shift += 7) {
+            uint8_t byte = client->in.data[header_len++];
+            remaining_len |= (size_t) (byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                complete_header = true;
+                break;
+            }
+        }
+        if (!complete_header) {
+            return client->in.len < 5;
+        }
+        if (remaining_len > IN_PACKET_MAX) {
+            return false;
+        }
+        if (client->in.len < header_len + remaining_len) {
+            return true;
+        }
+        // Copied out, the callbacks run with the lock released and the buffer may move
+        uint8_t *packet = sim_sys_malloc(remaining_len + 1);
+        if (!packet) {
+            sim_panic("out of host memory");
+        }
+        uint8_t type = client->in.data[0];
+        memcpy(packet, client->in.data + header_len, remaining_len);
+        buffer_consume(&client->in, header_len + remaining_len);
+        bool ok = handle_packet(client, type, packet, remaining_len);
+        sim_sys_free(packet);
+        if (!ok || client->fd < 0) {
+            return ok;
+        }
+    }
+}
+
+static void handle_io(sim_mqtt_client_t *client, uint32_t events)
+{
+    pthread_mutex_lock(&client->lock);
+    if (client->fd < 0) {
+        pthread_mutex_unlock(&client->lock);
+        return;
+    }
+    bool ok = true;
+    if (client->state == STATE_CONNECTING && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+        if (error != 0) {
+            ok = false;
+        } else {
+            send_connect(client);
+            ok = flush(client);
+        }
+    } else {
+        if (events & EPOLLOUT) {
+            ok = flush(client);
+        }
+        if (ok && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+            ok = handle_input(client);
+        }
+    }
+    if (!ok && client->fd >= 0 && close_connection(client, RECONNECT_DELAY_US)) {
+        run_callback(client, CALLBACK_DISCONNECT, false, NULL, 0, NULL, 0);
+    }
+    pthread_mutex_unlock(&client->lock);
+}
+
+// Called with the client lock held, returns the next deadline of the client
+static int64_t handle_timers(sim_mqtt_client_t *client, int64_t now_us)
+{
+    if (client->drop_down_us >= 0) {
+        int64_t down_us = client->drop_down_us ? client->drop_down_us : RECONNECT_DELAY_US;
+        client->drop_down_us = -1;
+        if (close_connection(client, down_us)) {
+            run_callback(client, CALLBACK_DISCONNECT, false, NULL, 0, NULL, 0);
+        }
+    }
+    if (!client->started && client->state != STATE_IDLE) {
+        if (client->state == STATE_CONNECTED) {
+            append_header(&client->out, PACKET_DISCONNECT, 0);
+            flush(client);
+        }
+        close_connection(client, 0);
+    }
+
+    switch (client->state) {
+        case STATE_IDLE:
+            return SIM_FOREVER;
+        case STATE_WAIT_RETRY:
+            if (now_us >= client->deadline_us) {
+                begin_connect(client);
+            }
+            return client->deadline_us;
+        case STATE_CONNECTING:
+        case STATE_WAIT_CONNACK:
+            if (now_us >= client->deadline_us) {
+                close_connection(client, RECONNECT_DELAY_US);
+            }
+            return client->deadline_us;
+        case STATE_CONNECTED:
+            if (now_us >= client->last_tx_us + KEEPALIVE_S * 1000000LL) {
+                append_header(&client->out, PACKET_PINGREQ, 0);
+                if (!flush(client) && close_connection(client, RECONNECT_DELAY_US)) {
+                    run_callback(client, CALLBACK_DISCONNECT, false, NULL, 0, NULL, 0);
+                    return client->deadline_us;
+                }
+            }
+            return client->last_tx_us + KEEPALIVE_S * 1000000LL;
+    }
+    return SIM_FOREVER;
+}
+
+static void *io_thread_main(void *arg)
+{
+    struct epoll_event events[EPOLL_BATCH];
+    int64_t next_deadline_us = 0;
+    for (;;) {
+        int64_t timeout_us = next_deadline_us - sim_time_us();
+        int timeout_ms = timeout_us <= 0 ? 0
+            : timeout_us > 1000000      ? 1000
+                                        : (int) ((timeout_us + 999) / 1000);
+        int count = epoll_wait(epoll_fd, events, EPOLL_BATCH, timeout_ms);
+        bool kicked = false;
+        for (int i = 0; i < count; i++) {
+            if (!events[i].data.ptr) {
+                uint64_t value;
+                kicked = read(kick_fd, &value, sizeof(value)) > 0 || kicked;
+            } else {
+                handle_io(events[i].data.ptr, events[i].events);
+            }
+        }
+
+        int64_t now_us = sim_time_us();
+        if (!kicked && now_us < next_deadline_us) {
+            continue;
+        }
+        next_deadline_us = SIM_FOREVER;
+        pthread_mutex_lock(&io_lock);
+        sim_mqtt_client_t **link = &clients;
+        while (*link) {
+            sim_mqtt_client_t *client = *link;
+            pthread_mutex_lock(&client->lock);
+            if (client->dead) {
+                client->started = false;
+                handle_timers(client, now_us);
+                bool idle = client->busy == 0;
+                pthread_mutex_unlock(&client->lock);
+                if (idle) {
+                    // Only this thread frees clients, so no event of this batch refers to it
+                    *link = client->next;
+                    pthread_mutex_destroy(&client->lock);
+                    sim_sys_free(client->out.data);
+                    sim_sys_free(client->in.data);
+                    sim_sys_free(client->client_id);
+                    sim_sys_free(client);
+                    continue;
+                }
+                next_deadline_us = now_us;
+            } else {
+                int64_t deadline_us = handle_timers(client, now_us);
+                pthread_mutex_unlock(&client->lock);
+                if (deadline_us < next_deadline_us) {
+                    next_deadline_us = deadline_us;
+                }
+            }
+            link = &client->next;
+        }
+        pthread_mutex_unlock(&io_lock);
+    }
+    return NULL;
+}
+
+sim_mqtt_client_t *sim_mqtt_client_new(const char *host, uint16_t port, const char *client_id,
+    const sim_mqtt_callbacks_t *callbacks, void *arg)
+{
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *result;
+    if (getaddrinfo(host, service, &hints, &result) != 0) {
+        return NULL;
+    }
+    sim_mqtt_client_t *client = sim_sys_calloc(1, sizeof(sim_mqtt_client_t));
+    if (!client) {
+        sim_panic("out of host memory");
+    }
+    memcpy(&client->address, result->ai_addr, result->ai_addrlen);
+    client->address_len = result->ai_addrlen;
+    freeaddrinfo(result);
+
+    pthread_mutex_init(&client->lock, NULL);
+    client->chip = sim_chip_current();
+    client->client_id = sim_sys_strdup(client_id);
+    client->callbacks = *callbacks;
+    client->arg = arg;
+    client->fd = -1;
+    client->state = STATE_IDLE;
+    client->drop_down_us = -1;
+    client->next_packet_id = 1;
+
+    pthread_mutex_lock(&io_lock);
+    start_io_thread();
+    client->next = clients;
+    clients = client;
+    pthread_mutex_unlock(&io_lock);
+    return client;
+}
+
+void sim_mqtt_client_start(sim_mqtt_client_t *client)
+{
+    pthread_mutex_lock(&client->lock);
+    if (!client->started) {
+        client->started = true;
+        if (client->state == STATE_IDLE) {
+            client->state = STATE_WAIT_RETRY;
+            client->deadline_us = sim_time_us();
+        }
+    }
+    pthread_mutex_unlock(&client->lock);
+    kick();
+}
+
+void sim_mqtt_client_stop(sim_mqtt_client_t *client)
+{
+    pthread_mutex_lock(&client->lock);
+    client->started = false;
+    pthread_mutex_unlock(&client->lock);
+    kick();
+}
+
+void sim_mqtt_client_drop(sim_mqtt_client_t *client, uint32_t down_ms)
+{
+    pthread_mutex_lock(&client->lock);
+    client->drop_down_us = (int64_t) down_ms * 1000;
+    pthread_mutex_unlock(&client->lock);
+    kick();
+}
+
+void sim_mqtt_client_destroy(sim_mqtt_client_t *client)
+{
+    pthread_mutex_lock(&client->lock);
+    client->dead = true;
+    while (client->busy > 0) {
+        pthread_mutex_unlock(&client->lock);
+        struct timespec pause = { .tv_nsec = 1000000 };
+        nanosleep(&pause, NULL);
+        pthread_mutex_lock(&client->lock);
+    }
+    pthread_mutex_unlock(&client->lock);
+    // Freed by the I/O thread
+    kick();
+}
+
+bool sim_mqtt_publish(
+    sim_mqtt_client_t *client, const char *topic, const void *payload, size_t len, int qos)
+{
+    pthread_mutex_lock(&client->lock);
+    if (client->state != STATE_CONNECTED || client->dead
+        || client->out.len + len > OUT_BUFFER_MAX) {
+        // The network timeout of esp-mqtt would expire on a connection this backed up
+        pthread_mutex_unlock(&client->lock);
+        return false;
+    }
+    size_t remaining_len = 2 + strlen(topic) + (qos > 0 ? 2 : 0) + len;
+    append_header(&client->out, PACKET_PUBLISH | (qos << 1), remaining_len);
+    append_string(&client->out, topic);
+    if (qos > 0) {
+        append_u16(&client->out, client->next_packet_id);
+        client->next_packet_id = client->next_packet_id == UINT16_MAX ? 1
+                                                                      : client->next_packet_id + 1;
+    }
+    buffer_append(&client->out, payload, len);
+    // On a write error the connection is closed by the I/O thread
+    bool ret = flush(client);
+    pthread_mutex_unlock(&client->lock);
+    return ret;
+}
+
+bool sim_mqtt_subscribe(sim_mqtt_client_t *client, const char *topic_filter, int qos)
+{
+    pthread_mutex_lock(&client->lock);
+    if (client->state != STATE_CONNECTED || client->dead) {
+        pthread_mutex_unlock(&client->lock);
+        return false;
+    }
+    append_header(&client->out, PACKET_SUBSCRIBE, 2 + 2 + strlen(topic_filter) + 1);
+    append_u16(&client->out, client->next_packet_id);
+    client->next_packet_id
+        = client->next_packet_id == UINT16_MAX ? 1 : client->next_packet_id + 1;
+    append_string(&client->out, topic_filter);
+    uint8_t requested_qos = qos;
+    buffer_append(&client->out, &requested_qos, 1);
+    bool ret = flush(client);
+    pthread_mutex_unlock(&client->lock);
+    return ret;
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_MQTT_H
+#define SIM_MQTT_H
+
+#include "sim_internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * MQTT 3.1.1 client of the Astarte devices of the host build, over plain TCP. The sockets of all
+ * the clients are served by a single I/O thread, which also reconnects them and runs the
+ * callbacks, on behalf of the chip of the client and never with a client lock held.
+ */
+
+typedef struct sim_mqtt_client sim_mqtt_client_t;
+
+typedef struct
+{
+    void (*on_connect)(void *arg, bool session_present);
+    void (*on_disconnect)(void *arg);
+    void (*on_message)(void *arg, const char *topic, size_t topic_len, const uint8_t *payload,
+        size_t payload_len);
+} sim_mqtt_callbacks_t;
+
+/**
+ * @brief create a client, not connected until sim_mqtt_client_start.
+ *
+ * @param host The broker host.
+ * @param port The broker port.
+ * @param client_id The MQTT client ID, copied.
+ * @param callbacks The callbacks, copied.
+ * @param arg The argument of the callbacks.
+ * @return The client, NULL if the broker host cannot be resolved.
+ */
+sim_mqtt_client_t *sim_mqtt_client_new(const char *host, uint16_t port, const char *client_id,
+    const sim_mqtt_callbacks_t *callbacks, void *arg);
+
+/**
+ * @brief connect, and keep reconnecting, a client.
+ */
+void sim_mqtt_client_start(sim_mqtt_client_t *client);
+
+/**
+ * @brief disconnect a client, no callback is called for this disconnection.
+ */
+void sim_mqtt_client_stop(sim_mqtt_client_t *client);
+
+/**
+ * @brief drop the connection of a client, as a network failure would.
+ *
+ * @param down_ms The time before the reconnection, 0 for the usual reconnection delay.
+ */
+void sim_mqtt_client_drop(sim_mqtt_client_t *client, uint32_t down_ms);
+
+/**
+ * @brief destroy a client.
+ *
+ * @details Returns once no callback of the client runs, none is called afterwards.
+ */
+void sim_mqtt_client_destroy(sim_mqtt_client_t *client);
+
+/**
+ * @brief publish a message.
+ *
+ * @return true if the message was written or buffered, false if the client is not connected or
+ * its output buffer is full.
+ */
+bool sim_mqtt_publish(
+    sim_mqtt_client_t *client, const char *topic, const void *payload, size_t len, int qos);
+
+/**
+ * @brief subscribe to a topic filter.
+ *
+ * @return true if the subscription was written or buffered.
+ */
+bool sim_mqtt_subscribe(sim_mqtt_client_t *client, const char *topic_filter, int qos);
+
+#endif // SIM_MQTT_H
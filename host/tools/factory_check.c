@@ -0,0 +1,452 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_factory_data.h"
+#include <astarte_bson.h>
+#include <edgehog_device.h>
+#include <esp_event.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <getopt.h>
+#include <sim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Checks the parser of the factory data partition on images written to files, as the host build
+ * maps a file in place of the partition: a valid image, images whose header or CRC are wrong and
+ * images with valid CRC whose records are malformed, which must be rejected one by one. Then it
+ * boots Edgehog on the valid image and checks that the appliance info setters leave the factory
+ * values read-only while still sending them to Astarte.
+ */
+
+#define FACTORY_DATA_MAGIC 0x44464845
+#define FACTORY_DATA_VERSION 1
+#define HEADER_SIZE 16
+#define IMAGE_MAX_LEN 256
+#define UNKNOWN_TAG 0x7F
+#define SERIAL_NUMBER "SN-0001"
+#define PART_NUMBER "PN-0001"
+#define APPLIANCE_INTERFACE "io.edgehog.devicemanager.ApplianceInfo"
+// Time given to Edgehog to connect and to run its worker jobs, on the virtual clock
+#define SETTLE_MS 5000
+
+typedef struct
+{
+    uint8_t data[IMAGE_MAX_LEN];
+    size_t len;
+} image_t;
+
+typedef struct
+{
+    const char *name;
+    void (*build)(image_t *image);
+    esp_err_t open_result;
+    // Expected values, NULL when the record must not be found
+    const char *serial_number;
+    const char *part_number;
+} image_case_t;
+
+typedef struct
+{
+    esp_log_level_t log_level;
+    bool keep;
+} options_t;
+
+static options_t options = { .log_level = ESP_LOG_NONE };
+static char dir[] = "/tmp/factory_check.XXXXXX";
+static edgehog_device_handle_t edgehog_device;
+static char published_serial_number[32];
+static esp_err_t async_result = ESP_FAIL;
+
+static uint32_t crc32_le(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static void put_u32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = value >> (8 * i);
+    }
+}
+
+static void add_record(
+    image_t *image, uint8_t tag, uint8_t len, const void *value, size_t value_len)
+{
+    if (image->len == 0) {
+        image->len = HEADER_SIZE;
+    }
+    image->data[image->len++] = tag;
+    image->data[image->len++] = len;
+    if (value_len > 0) {
+        memcpy(&image->data[image->len], value, value_len);
+        image->len += value_len;
+    }
+}
+
+static void add_string(image_t *image, uint8_t tag, const char *value)
+{
+    add_record(image, tag, strlen(value) + 1, value, strlen(value) + 1);
+}
+
+// Writes the header of the records added so far
+static void seal(image_t *image)
+{
+    if (image->len == 0) {
+        image->len = HEADER_SIZE;
+    }
+    uint32_t length = image->len - HEADER_SIZE;
+    put_u32(&image->data[0], FACTORY_DATA_MAGIC);
+    image->data[4] = FACTORY_DATA_VERSION;
+    put_u32(&image->data[8], length);
+    put_u32(&image->data[12], crc32_le(&image->data[HEADER_SIZE], length));
+}
+
+static void build_valid(image_t *image)
+{
+    add_string(image, EDGEHOG_FACTORY_DATA_SERIAL_NUMBER, SERIAL_NUMBER);
+    add_string(image, EDGEHOG_FACTORY_DATA_PART_NUMBER, PART_NUMBER);
+    seal(image);
+}
+
+static void build_bad_crc(image_t *image)
+{
+    build_valid(image);
+    image->data[HEADER_SIZE + 2] ^= 0x01;
+}
+
+static void build_bad_magic(image_t *image)
+{
+    build_valid(image);
+    image->data[0] ^= 0x01;
+}
+
+static void build_bad_version(image_t *image)
+{
+    build_valid(image);
+    image->data[4] = FACTORY_DATA_VERSION + 1;
+}
+
+static void build_short_header(image_t *image)
+{
+    build_valid(image);
+    image->len = HEADER_SIZE / 2;
+}
+
+static void build_empty(image_t *image)
+{
+    image->len = 0;
+}
+
+// The length of the records goes one byte past the end of the partition
+static void build_length_bound(image_t *image)
+{
+    build_valid(image);
+    put_u32(&image->data[8], image->len - HEADER_SIZE + 1);
+}
+
+// The last record claims more bytes than the records hold, the CRC covers what is there
+static void build_truncated_record(image_t *image)
+{
+    add_string(image, EDGEHOG_FACTORY_DATA_SERIAL_NUMBER, SERIAL_NUMBER);
+    add_record(image, EDGEHOG_FACTORY_DATA_PART_NUMBER, sizeof(PART_NUMBER) + 8, PART_NUMBER,
+        sizeof(PART_NUMBER));
+    seal(image);
+}
+
+// A record header without its value, the length byte is the last one of the records
+static void build_truncated_header(image_t *image)
+{
+    add_string(image, EDGEHOG_FACTORY_DATA_SERIAL_NUMBER, SERIAL_NUMBER);
+    image->data[image->len++] = EDGEHOG_FACTORY_DATA_PART_NUMBER;
+    seal(image);
+}
+
+static void build_unterminated(image_t *image)
+{
+    add_record(image, EDGEHOG_FACTORY_DATA_SERIAL_NUMBER, strlen(SERIAL_NUMBER), SERIAL_NUMBER,
+        strlen(SERIAL_NUMBER));
+    add_string(image, EDGEHOG_FACTORY_DATA_PART_NUMBER, PART_NUMBER);
+    seal(image);
+}
+
+static void build_unknown_tag(image_t *image)
+{
+    static const uint8_t unknown[] = { 0xDE, 0xAD, 0x00, 0xBE, 0xEF };
+    add_record(image, UNKNOWN_TAG, sizeof(unknown), unknown, sizeof(unknown));
+    add_string(image, EDGEHOG_FACTORY_DATA_SERIAL_NUMBER, SERIAL_NUMBER);
+    add_record(image, UNKNOWN_TAG, 0, NULL, 0);
+    add_string(image, EDGEHOG_FACTORY_DATA_PART_NUMBER, PART_NUMBER);
+    seal(image);
+}
+
+static const image_case_t image_cases[] = {
+    { "valid", build_valid, ESP_OK, SERIAL_NUMBER, PART_NUMBER },
+    { "bad crc", build_bad_crc, ESP_ERR_INVALID_CRC, NULL, NULL },
+    { "bad magic", build_bad_magic, ESP_ERR_INVALID_VERSION, NULL, NULL },
+    { "bad version", build_bad_version, ESP_ERR_INVALID_VERSION, NULL, NULL },
+    { "short header", build_short_header, ESP_ERR_INVALID_VERSION, NULL, NULL },
+    { "empty", build_empty, ESP_ERR_INVALID_SIZE, NULL, NULL },
+    { "length bound", build_length_bound, ESP_ERR_INVALID_SIZE, NULL, NULL },
+    { "truncated record", build_truncated_record, ESP_OK, SERIAL_NUMBER, NULL },
+    { "truncated header", build_truncated_header, ESP_OK, SERIAL_NUMBER, NULL },
+    { "unterminated", build_unterminated, ESP_OK, NULL, PART_NUMBER },
+    { "unknown tag", build_unknown_tag, ESP_OK, SERIAL_NUMBER, PART_NUMBER },
+};
+
+static bool write_image(const char *path, const image_t *image)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    bool written = fwrite(image->data, 1, image->len, file) == image->len;
+    return fclose(file) == 0 && written;
+}
+
+static bool same_value(const char *expected, const char *value)
+{
+    return expected ? value && strcmp(expected, value) == 0 : value == NULL;
+}
+
+static int check_image(const image_case_t *image_case, const char *path)
+{
+    image_t image = { 0 };
+    image_case->build(&image);
+    if (!write_image(path, &image)) {
+        printf("  %-18s unable to write %s  FAIL\n", image_case->name, path);
+        return 1;
+    }
+
+    edgehog_factory_data_t factory_data;
+    esp_err_t ret = edgehog_factory_data_open(path, &factory_data);
+    const char *serial_number
+        = edgehog_factory_data_get_string(&factory_data, EDGEHOG_FACTORY_DATA_SERIAL_NUMBER);
+    const char *part_number
+        = edgehog_factory_data_get_string(&factory_data, EDGEHOG_FACTORY_DATA_PART_NUMBER);
+    bool ok = ret == image_case->open_result
+        && same_value(image_case->serial_number, serial_number)
+        && same_value(image_case->part_number, part_number);
+    printf("  %-18s %-24s serial %-8s part %-8s %s\n", image_case->name, esp_err_to_name(ret),
+        serial_number ? serial_number : "-", part_number ? part_number : "-", ok ? "ok" : "FAIL");
+    edgehog_factory_data_close(&factory_data);
+    return !ok;
+}
+
+static int check_missing(void)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "%s/missing", dir);
+    edgehog_factory_data_t factory_data;
+    esp_err_t ret = edgehog_factory_data_open(path, &factory_data);
+    bool ok = ret == ESP_ERR_NOT_FOUND
+        && !edgehog_factory_data_get_string(&factory_data, EDGEHOG_FACTORY_DATA_SERIAL_NUMBER);
+    printf("  %-18s %-24s %s\n", "missing", esp_err_to_name(ret), ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+static void publish_hook(astarte_device_handle_t device, const char *topic, const void *payload,
+    size_t len, int qos, void *arg)
+{
+    const char *path = strstr(topic, APPLIANCE_INTERFACE "/serialNumber");
+    uint8_t type;
+    const void *value = path ? astarte_bson_key_lookup("v", payload, &type) : NULL;
+    if (!value || type != BSON_TYPE_STRING) {
+        return;
+    }
+    uint32_t value_len;
+    const char *string = astarte_bson_value_to_string(value, &value_len);
+    snprintf(published_serial_number, sizeof(published_serial_number), "%.*s", (int) value_len,
+        string);
+}
+
+static void astarte_connection_events_handler(astarte_device_connection_event_t *event)
+{
+    edgehog_device_astarte_connection_event_handler(edgehog_device, event);
+}
+
+static void astarte_disconnection_events_handler(astarte_device_disconnection_event_t *event)
+{
+}
+
+static void astarte_data_events_handler(astarte_device_data_event_t *event)
+{
+    edgehog_device_astarte_event_handler(edgehog_device, event);
+}
+
+static void set_cb(edgehog_device_handle_t device, esp_err_t publish_result,
+    esp_err_t persist_result, void *user_data)
+{
+    async_result = publish_result != ESP_OK ? publish_result : persist_result;
+}
+
+static int check_setter(const char *name, esp_err_t ret, esp_err_t expected)
+{
+    bool ok = ret == expected;
+    printf("  %-18s %-24s %s\n", name, esp_err_to_name(ret), ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+// The setters of a field written by the factory accept only its factory value
+static int check_read_only(const char *path)
+{
+    sim_chip_config_t chip_config = { .name = "factory" };
+    sim_chip_t *chip = sim_chip_new(&chip_config);
+    if (!chip) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    sim_chip_enter(chip);
+    esp_event_loop_create_default();
+    astarte_device_config_t astarte_config = {
+        .data_event_callback = astarte_data_events_handler,
+        .connection_event_callback = astarte_connection_events_handler,
+        .disconnection_event_callback = astarte_disconnection_events_handler,
+        .hwid = "factory-device",
+    };
+    astarte_device_handle_t astarte_device = astarte_device_init(&astarte_config);
+    if (astarte_device) {
+        edgehog_device_config_t edgehog_config = {
+            .astarte_device = astarte_device,
+            .partition_label = "nvs",
+            .factory_partition_label = path,
+        };
+        edgehog_device = edgehog_device_new(&edgehog_config);
+    }
+    if (!edgehog_device || astarte_device_start(astarte_device) != ASTARTE_OK) {
+        sim_chip_leave();
+        fprintf(stderr, "Unable to start Edgehog\n");
+        return 1;
+    }
+    sim_chip_leave();
+    vTaskDelay(pdMS_TO_TICKS(SETTLE_MS));
+
+    int failures = 0;
+    sim_chip_enter(chip);
+    failures += check_setter("set other value",
+        edgehog_device_set_appliance_serial_number(edgehog_device, "SN-9999"),
+        ESP_ERR_NOT_SUPPORTED);
+    failures += check_setter("set factory value",
+        edgehog_device_set_appliance_serial_number(edgehog_device, SERIAL_NUMBER), ESP_OK);
+    esp_err_t ret = edgehog_device_set_appliance_serial_number_async(
+        edgehog_device, "SN-9999", set_cb, NULL);
+    sim_chip_leave();
+    vTaskDelay(pdMS_TO_TICKS(SETTLE_MS));
+    failures += check_setter("queue other value", ret, ESP_OK);
+    failures += check_setter("async other value", async_result, ESP_ERR_NOT_SUPPORTED);
+
+    bool ok = strcmp(published_serial_number, SERIAL_NUMBER) == 0;
+    printf("  %-18s %-24s %s\n", "published", published_serial_number, ok ? "ok" : "FAIL");
+    failures += !ok;
+
+    sim_chip_enter(chip);
+    edgehog_device_destroy(edgehog_device);
+    sim_chip_leave();
+    return failures;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --keep                 keep the images written, in a directory under /tmp\n"
+        "  --log-level N          ESP log level, 0-5 (0)\n",
+        name);
+}
+
+static bool parse_options(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "keep", no_argument, NULL, 'k' },
+        { "log-level", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'k':
+                options.keep = true;
+                break;
+            case 'l':
+                options.log_level = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                return false;
+        }
+    }
+    return optind == argc && options.log_level <= ESP_LOG_VERBOSE;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_options(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    sim_config_t sim_config
+        = { .clock = SIM_CLOCK_VIRTUAL, .seed = 1, .log_level = options.log_level };
+    sim_init(&sim_config);
+    sim_astarte_set_publish_hook(publish_hook, NULL);
+
+    int failures = 0;
+    char valid_path[64] = "";
+    printf("Images\n");
+    for (size_t i = 0; i < sizeof(image_cases) / sizeof(image_cases[0]); i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/image%zu.bin", dir, i);
+        failures += check_image(&image_cases[i], path);
+        if (image_cases[i].build == build_valid) {
+            strcpy(valid_path, path);
+        }
+    }
+    failures += check_missing();
+
+    printf("\nRead-only appliance info\n");
+    failures += check_read_only(valid_path);
+
+    if (options.keep) {
+        printf("\nImages kept in %s\n", dir);
+    } else {
+        for (size_t i = 0; i < sizeof(image_cases) / sizeof(image_cases[0]); i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "%s/image%zu.bin", dir, i);
+            unlink(path);
+        }
+        rmdir(dir);
+    }
+
+    printf("%d failures\n", failures);
+    return failures ? 2 : 0;
+}
@@ -0,0 +1,731 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_trace.h"
+#include <edgehog_device.h>
+#include <esp_event.h>
+#include <esp_log.h>
+#include <freertos/semphr.h>
+#include <getopt.h>
+#include <math.h>
+#include <sim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Runs a fleet of Edgehog devices in one process, each on its own simulated chip, to measure the
+ * Astarte load the fleet puts on the broker and the CPU and heap each device needs.
+ *
+ * The devices boot within the boot window, scan a set of simulated APs whose RSSI drifts and lose
+ * their connection at random, during fleet wide outages and when they reboot. Without a broker
+ * the connections are scripted and the clock can be virtual, to simulate days in minutes.
+ */
+
+#define MAX_SCHEDULED 16
+#define RSSI_DRIFT_PERIOD_S 30
+#define RSSI_DRIFT_DB 3
+#define RSSI_MIN -95
+#define RSSI_MAX -30
+// pdMS_TO_TICKS overflows past 71 minutes, longer waits are made of steps of at most this
+#define MAX_WAIT_S 3600
+
+typedef struct
+{
+    int64_t at_us;
+    int64_t duration_us;
+} scheduled_t;
+
+typedef struct
+{
+    uint32_t devices;
+    const char *broker_host;
+    uint16_t broker_port;
+    const char *realm;
+    uint32_t duration_s;
+    sim_clock_t clock;
+    bool clock_set;
+    uint32_t boot_window_s;
+    uint32_t aps;
+    edgehog_wifi_scan_config_t wifi_scan;
+    uint32_t status_period_s;
+    uint32_t metrics_period_s;
+    uint32_t disconnect_mtbf_s;
+    uint32_t disconnect_mttr_s;
+    scheduled_t outages[MAX_SCHEDULED];
+    int outage_count;
+    scheduled_t reboots[MAX_SCHEDULED];
+    int reboot_count;
+    uint32_t report_period_s;
+    uint32_t seed;
+    uint32_t heap_kib;
+    esp_log_level_t log_level;
+    const char *trace_path;
+} options_t;
+
+typedef struct
+{
+    uint32_t index;
+    sim_chip_t *chip;
+    astarte_device_handle_t astarte_device;
+    edgehog_device_handle_t edgehog_device;
+    SemaphoreHandle_t stop;
+    SemaphoreHandle_t stopped;
+    int64_t boot_at_us;
+    int8_t *rssi;
+    bool connected;
+    uint32_t reboots;
+} device_t;
+
+static options_t options = {
+    .devices = 10,
+    .realm = "test",
+    .duration_s = 3600,
+    .aps = 10,
+    .wifi_scan = { .period_s = 60 },
+    .report_period_s = 60,
+    .log_level = ESP_LOG_WARN,
+};
+static device_t *devices;
+
+static device_t *device_of(astarte_device_handle_t astarte_device)
+{
+    for (uint32_t i = 0; i < options.devices; i++) {
+        if (devices[i].astarte_device == astarte_device) {
+            return &devices[i];
+        }
+    }
+    return NULL;
+}
+
+static void astarte_connection_events_handler(astarte_device_connection_event_t *event)
+{
+    device_t *device = device_of(event->device);
+    if (device) {
+        __atomic_store_n(&device->connected, true, __ATOMIC_RELAXED);
+        edgehog_device_astarte_connection_event_handler(device->edgehog_device, event);
+    }
+}
+
+static void astarte_disconnection_events_handler(astarte_device_disconnection_event_t *event)
+{
+    device_t *device = device_of(event->device);
+    if (device) {
+        __atomic_store_n(&device->connected, false, __ATOMIC_RELAXED);
+    }
+}
+
+static void astarte_data_events_handler(astarte_device_data_event_t *event)
+{
+    device_t *device = device_of(event->device);
+    if (device) {
+        edgehog_device_astarte_event_handler(device->edgehog_device, event);
+    }
+}
+
+static int64_t seconds(uint32_t s)
+{
+    return (int64_t) s * 1000000;
+}
+
+static TickType_t ticks_until(int64_t at_us)
+{
+    int64_t wait_us = at_us - sim_time_us();
+    if (wait_us <= 0) {
+        return 0;
+    }
+    wait_us = wait_us < seconds(MAX_WAIT_S) ? wait_us : seconds(MAX_WAIT_S);
+    return pdMS_TO_TICKS((wait_us + 999) / 1000);
+}
+
+// Exponentially distributed, for the times between independent failures
+static int64_t random_exponential_us(uint32_t mean_s)
+{
+    double u = (sim_random() + 1.0) / ((double) UINT32_MAX + 2.0);
+    return (int64_t) (-log(u) * mean_s * 1000000);
+}
+
+static void set_aps(device_t *device)
+{
+    wifi_ap_record_t *aps = calloc(options.aps, sizeof(wifi_ap_record_t));
+    if (!aps) {
+        return;
+    }
+    for (uint32_t i = 0; i < options.aps; i++) {
+        // A few ESSIDs, several BSSIDs each, as on a mesh network
+        snprintf((char *) aps[i].ssid, sizeof(aps[i].ssid), "fleet-%u", i % 3);
+        uint32_t bssid = sim_random();
+        aps[i].bssid[0] = 0x02;
+        memcpy(aps[i].bssid + 2, &bssid, sizeof(bssid));
+        aps[i].primary = 1 + sim_random() % 13;
+        aps[i].rssi = device->rssi[i];
+        aps[i].authmode = WIFI_AUTH_WPA2_PSK;
+    }
+    sim_wifi_set_aps(device->chip, aps, options.aps, options.aps > 0 ? 0 : -1);
+    free(aps);
+}
+
+// A random walk, the associated AP is the first one and its RSSI drives the RSSI scan trigger
+static void drift_rssi(device_t *device)
+{
+    for (uint32_t i = 0; i < options.aps; i++) {
+        int rssi = device->rssi[i] + (int) (sim_random() % (2 * RSSI_DRIFT_DB + 1)) - RSSI_DRIFT_DB;
+        device->rssi[i] = rssi < RSSI_MIN ? RSSI_MIN : rssi > RSSI_MAX ? RSSI_MAX : rssi;
+        sim_wifi_set_rssi(device->chip, i, device->rssi[i]);
+    }
+}
+
+static bool boot(device_t *device)
+{
+    char hwid[32];
+    snprintf(hwid, sizeof(hwid), "fleet-device-%05u", device->index);
+    astarte_device_config_t astarte_config = {
+        .data_event_callback = astarte_data_events_handler,
+        .connection_event_callback = astarte_connection_events_handler,
+        .disconnection_event_callback = astarte_disconnection_events_handler,
+        .hwid = hwid,
+        .realm = options.realm,
+    };
+    device->astarte_device = astarte_device_init(&astarte_config);
+    if (!device->astarte_device) {
+        return false;
+    }
+
+    edgehog_device_config_t edgehog_config = {
+        .astarte_device = device->astarte_device,
+        .partition_label = "nvs",
+        .wifi_scan = options.wifi_scan,
+        .system_status_period_s = options.status_period_s,
+        .metrics_period_s = options.metrics_period_s,
+    };
+    device->edgehog_device = edgehog_device_new(&edgehog_config);
+    if (!device->edgehog_device) {
+        astarte_device_destroy(device->astarte_device);
+        device->astarte_device = NULL;
+        return false;
+    }
+    if (astarte_device_start(device->astarte_device) != ASTARTE_OK) {
+        ESP_LOGE("FLEET", "Unable to start the Astarte device");
+    }
+
+    char serial_number[32];
+    snprintf(serial_number, sizeof(serial_number), "SN%08u", device->index);
+    edgehog_device_set_appliance_serial_number_async(
+        device->edgehog_device, serial_number, NULL, NULL);
+    edgehog_device_set_appliance_part_number_async(
+        device->edgehog_device, "PN-FLEET-01", NULL, NULL);
+    return true;
+}
+
+static void shutdown(device_t *device)
+{
+    __atomic_store_n(&device->connected, false, __ATOMIC_RELAXED);
+    // Destroys the Astarte device too
+    edgehog_device_destroy(device->edgehog_device);
+    device->edgehog_device = NULL;
+    device->astarte_device = NULL;
+}
+
+static const scheduled_t *next_scheduled(const scheduled_t *scheduled, int count, int64_t after_us)
+{
+    const scheduled_t *next = NULL;
+    for (int i = 0; i < count; i++) {
+        if (scheduled[i].at_us > after_us && (!next || scheduled[i].at_us < next->at_us)) {
+            next = &scheduled[i];
+        }
+    }
+    return next;
+}
+
+static void device_task(void *arg)
+{
+    device_t *device = arg;
+    int64_t boot_at_us = sim_time_us() + device->boot_at_us;
+    do {
+        if (xSemaphoreTake(device->stop, ticks_until(boot_at_us)) == pdTRUE) {
+            goto exit;
+        }
+    } while (sim_time_us() < boot_at_us);
+    esp_event_loop_create_default();
+    set_aps(device);
+    if (!boot(device)) {
+        ESP_LOGE("FLEET", "Unable to boot");
+        goto exit;
+    }
+
+    int64_t now_us = sim_time_us();
+    int64_t disconnect_at_us
+        = options.disconnect_mtbf_s ? now_us + random_exponential_us(options.disconnect_mtbf_s)
+                                    : INT64_MAX;
+    int64_t drift_at_us = now_us + seconds(RSSI_DRIFT_PERIOD_S);
+    // The fleet wide events already served, the ones of the past are skipped
+    int64_t outages_served_us = now_us - 1;
+    int64_t reboots_served_us = now_us - 1;
+    for (;;) {
+        now_us = sim_time_us();
+        const scheduled_t *outage
+            = next_scheduled(options.outages, options.outage_count, outages_served_us);
+        const scheduled_t *reboot
+            = next_scheduled(options.reboots, options.reboot_count, reboots_served_us);
+        int64_t outage_at_us = outage ? outage->at_us : INT64_MAX;
+        int64_t reboot_at_us = reboot ? reboot->at_us : INT64_MAX;
+        int64_t next_us = disconnect_at_us;
+        next_us = outage_at_us < next_us ? outage_at_us : next_us;
+        next_us = reboot_at_us < next_us ? reboot_at_us : next_us;
+        next_us = drift_at_us < next_us ? drift_at_us : next_us;
+        if (xSemaphoreTake(device->stop, ticks_until(next_us)) == pdTRUE) {
+            break;
+        }
+        now_us = sim_time_us();
+        if (now_us < next_us) {
+            continue;
+        }
+
+        if (next_us == reboot_at_us) {
+            reboots_served_us = reboot_at_us;
+            shutdown(device);
+            device->reboots++;
+            if (!boot(device)) {
+                ESP_LOGE("FLEET", "Unable to boot after a reboot");
+                goto exit;
+            }
+        } else if (next_us == outage_at_us) {
+            outages_served_us = outage_at_us;
+            sim_astarte_disconnect(device->astarte_device, outage->duration_us / 1000);
+        } else if (next_us == disconnect_at_us) {
+            uint32_t down_ms = options.disconnect_mttr_s
+                ? random_exponential_us(options.disconnect_mttr_s) / 1000 + 1
+                : 1;
+            sim_astarte_disconnect(device->astarte_device, down_ms);
+            disconnect_at_us = now_us + random_exponential_us(options.disconnect_mtbf_s);
+        } else {
+            drift_rssi(device);
+            drift_at_us = now_us + seconds(RSSI_DRIFT_PERIOD_S);
+        }
+    }
+    shutdown(device);
+
+exit:
+    xSemaphoreGive(device->stopped);
+    vTaskDelete(NULL);
+}
+
+typedef struct
+{
+    int64_t time_us;
+    sim_astarte_stats_t stats;
+} snapshot_t;
+
+static uint64_t process_cpu_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint32_t connected_devices(void)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < options.devices; i++) {
+        count += __atomic_load_n(&devices[i].connected, __ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+static void report_interval(const snapshot_t *from, const snapshot_t *to)
+{
+    double s = (to->time_us - from->time_us) / 1e6;
+    if (s <= 0) {
+        return;
+    }
+    uint64_t publishes = to->stats.publishes - from->stats.publishes;
+    printf("%8.0f s  connected %6u/%-6u  %9.1f publish/s  %10.1f B/s payload  %10.1f B/s wire"
+           "  %6llu failed\n",
+        to->time_us / 1e6, connected_devices(), options.devices, publishes / s,
+        (to->stats.payload_bytes - from->stats.payload_bytes) / s,
+        (to->stats.wire_bytes - from->stats.wire_bytes) / s,
+        (unsigned long long) (to->stats.failed_publishes - from->stats.failed_publishes));
+    fflush(stdout);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void report_summary(int64_t elapsed_us, uint64_t host_us)
+{
+    sim_astarte_stats_t stats;
+    sim_astarte_get_stats(NULL, &stats);
+    double s = elapsed_us / 1e6;
+
+    printf("\nAstarte load of %u devices over %.0f s\n", options.devices, s);
+    printf("  publishes       %llu, %.2f/s, %.4f/s per device\n",
+        (unsigned long long) stats.publishes, stats.publishes / s,
+        stats.publishes / s / options.devices);
+    printf("  payload bytes   %llu, %.1f B/s, mean payload %.1f B\n",
+        (unsigned long long) stats.payload_bytes, stats.payload_bytes / s,
+        stats.publishes ? (double) stats.payload_bytes / stats.publishes : 0.0);
+    printf("  MQTT bytes      %llu, %.1f B/s\n", (unsigned long long) stats.wire_bytes,
+        stats.wire_bytes / s);
+    printf("  failed          %llu\n", (unsigned long long) stats.failed_publishes);
+    printf("  connections     %llu, %llu resumed sessions, %llu disconnections\n",
+        (unsigned long long) stats.connections, (unsigned long long) stats.resumed_sessions,
+        (unsigned long long) stats.disconnections);
+
+    printf("\nPayload sizes\n");
+    for (int i = 0; i < SIM_ASTARTE_PAYLOAD_BUCKETS; i++) {
+        if (stats.payload_sizes[i] == 0) {
+            continue;
+        }
+        unsigned low = i == 0 ? 0 : 8u << i;
+        if (i == SIM_ASTARTE_PAYLOAD_BUCKETS - 1) {
+            printf("  %6u B and more  %10llu\n", low,
+                (unsigned long long) stats.payload_sizes[i]);
+        } else {
+            printf("  %6u-%-6u B     %10llu\n", low, (16u << i) - 1,
+                (unsigned long long) stats.payload_sizes[i]);
+        }
+    }
+
+    sim_astarte_interface_stats_t interfaces[64];
+    size_t interface_count = sim_astarte_get_interface_stats(interfaces, 64);
+    printf("\n%-48s %12s %14s %10s\n", "Interface", "publishes", "payload bytes", "mean B");
+    for (size_t i = 0; i < interface_count && i < 64; i++) {
+        printf("%-48s %12llu %14llu %10.1f\n", interfaces[i].interface_name,
+            (unsigned long long) interfaces[i].publishes,
+            (unsigned long long) interfaces[i].payload_bytes,
+            interfaces[i].publishes
+                ? (double) interfaces[i].payload_bytes / interfaces[i].publishes
+                : 0.0);
+    }
+
+    uint64_t *cpu_us = calloc(options.devices, sizeof(uint64_t));
+    if (!cpu_us) {
+        return;
+    }
+    uint64_t cpu_total_us = 0;
+    size_t heap_min = SIZE_MAX;
+    uint64_t heap_min_sum = 0;
+    uint32_t reboots = 0;
+    for (uint32_t i = 0; i < options.devices; i++) {
+        cpu_us[i] = sim_chip_cpu_us(devices[i].chip);
+        cpu_total_us += cpu_us[i];
+        sim_heap_info_t heap;
+        sim_heap_get_info(devices[i].chip, &heap);
+        heap_min = heap.minimum_free < heap_min ? heap.minimum_free : heap_min;
+        heap_min_sum += heap.minimum_free;
+        reboots += devices[i].reboots;
+    }
+    qsort(cpu_us, options.devices, sizeof(uint64_t), compare_u64);
+    double mean_us = (double) cpu_total_us / options.devices;
+    printf("\nHost CPU time per device, %.1f s of host CPU in total\n", host_us / 1e6);
+    printf("  mean %.1f ms, p95 %.1f ms, max %.1f ms, %.2f us per simulated second\n",
+        mean_us / 1e3, cpu_us[(options.devices * 95) / 100 < options.devices
+                                 ? (options.devices * 95) / 100
+                                 : options.devices - 1]
+            / 1e3,
+        cpu_us[options.devices - 1] / 1e3, mean_us / s);
+    if (stats.publishes > 0) {
+        printf("  %.1f us per publish\n", (double) cpu_total_us / stats.publishes);
+    }
+    printf("\nHeap, minimum free of the worst device %zu B, mean %.0f B, %u reboots\n", heap_min,
+        (double) heap_min_sum / options.devices, reboots);
+    free(cpu_us);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --devices N            devices of the fleet (10)\n"
+        "  --broker HOST:PORT     MQTT broker, the connections are scripted without one\n"
+        "  --realm NAME           Astarte realm of the topics (test)\n"
+        "  --duration S           simulated time (3600)\n"
+        "  --clock real|virtual   clock, virtual by default without a broker\n"
+        "  --boot-window S        devices boot at random within this time, 0 boots them all at"
+        " once (0)\n"
+        "  --aps N                APs found by each scan (10)\n"
+        "  --scan-period S        WiFi scan period, 0 scans only at boot (60)\n"
+        "  --scan-trigger periodic|rssi\n"
+        "  --scan-report all|changes|grouped\n"
+        "  --scan-source own|opportunistic\n"
+        "  --status-period S      SystemStatus period (Edgehog default)\n"
+        "  --metrics-period S     metrics period (Edgehog default)\n"
+        "  --disconnect-mtbf S    mean time between the disconnections of each device, 0 for"
+        " none (0)\n"
+        "  --disconnect-mttr S    mean time to reconnect after them (10)\n"
+        "  --outage AT:DUR        fleet wide outage at AT seconds for DUR seconds, repeatable\n"
+        "  --reboot AT            reboot of the whole fleet at AT seconds, repeatable\n"
+        "  --report S             reporting period (60)\n"
+        "  --seed N               seed of the simulation (1)\n"
+        "  --heap KIB             heap of each chip (300)\n"
+        "  --log-level N          ESP log level of the devices, 0-5 (2)\n"
+        "  --trace FILE           write the last trace points of the fleet as a Chrome trace\n",
+        name);
+}
+
+static bool parse_choice(const char *arg, const char *const *choices, int count, int *out)
+{
+    for (int i = 0; i < count; i++) {
+        if (strcmp(arg, choices[i]) == 0) {
+            *out = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_options(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "devices", required_argument, NULL, 'n' },
+        { "broker", required_argument, NULL, 'b' },
+        { "realm", required_argument, NULL, 'r' },
+        { "duration", required_argument, NULL, 'd' },
+        { "clock", required_argument, NULL, 'c' },
+        { "boot-window", required_argument, NULL, 'w' },
+        { "aps", required_argument, NULL, 'a' },
+        { "scan-period", required_argument, NULL, 'p' },
+        { "scan-trigger", required_argument, NULL, 't' },
+        { "scan-report", required_argument, NULL, 'R' },
+        { "scan-source", required_argument, NULL, 'S' },
+        { "status-period", required_argument, NULL, 's' },
+        { "metrics-period", required_argument, NULL, 'm' },
+        { "disconnect-mtbf", required_argument, NULL, 'f' },
+        { "disconnect-mttr", required_argument, NULL, 'F' },
+        { "outage", required_argument, NULL, 'o' },
+        { "reboot", required_argument, NULL, 'B' },
+        { "report", required_argument, NULL, 'P' },
+        { "seed", required_argument, NULL, 'z' },
+        { "heap", required_argument, NULL, 'h' },
+        { "log-level", required_argument, NULL, 'l' },
+        { "trace", required_argument, NULL, 'T' },
+        { NULL, 0, NULL, 0 },
+    };
+    static const char *const clocks[] = { "real", "virtual" };
+    static const char *const triggers[] = { "periodic", "rssi" };
+    static const char *const reports[] = { "all", "changes", "grouped" };
+    static const char *const sources[] = { "own", "opportunistic" };
+    options.disconnect_mttr_s = 10;
+
+    int opt;
+    int choice;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                options.devices = strtoul(optarg, NULL, 0);
+                break;
+            case 'b': {
+                static char host[256];
+                unsigned port;
+                if (sscanf(optarg, "%255[^:]:%u", host, &port) != 2 || port > UINT16_MAX) {
+                    return false;
+                }
+                options.broker_host = host;
+                options.broker_port = port;
+                break;
+            }
+            case 'r':
+                options.realm = optarg;
+                break;
+            case 'd':
+                options.duration_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                if (!parse_choice(optarg, clocks, 2, &choice)) {
+                    return false;
+                }
+                options.clock = choice;
+                options.clock_set = true;
+                break;
+            case 'w':
+                options.boot_window_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                options.aps = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                options.wifi_scan.period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                if (!parse_choice(optarg, triggers, 2, &choice)) {
+                    return false;
+                }
+                options.wifi_scan.trigger = choice;
+                break;
+            case 'R':
+                if (!parse_choice(optarg, reports, 3, &choice)) {
+                    return false;
+                }
+                options.wifi_scan.report = choice;
+                break;
+            case 'S':
+                if (!parse_choice(optarg, sources, 2, &choice)) {
+                    return false;
+                }
+                options.wifi_scan.source = choice;
+                break;
+            case 's':
+                options.status_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                options.metrics_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                options.disconnect_mtbf_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'F':
+                options.disconnect_mttr_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'o': {
+                unsigned at_s;
+                unsigned duration_s;
+                if (options.outage_count == MAX_SCHEDULED
+                    || sscanf(optarg, "%u:%u", &at_s, &duration_s) != 2) {
+                    return false;
+                }
+                options.outages[options.outage_count].at_us = seconds(at_s);
+                options.outages[options.outage_count++].duration_us = seconds(duration_s);
+                break;
+            }
+            case 'B':
+                if (options.reboot_count == MAX_SCHEDULED) {
+                    return false;
+                }
+                options.reboots[options.reboot_count++].at_us
+                    = seconds(strtoul(optarg, NULL, 0));
+                break;
+            case 'P':
+                options.report_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                options.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+                options.heap_kib = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                options.log_level = strtoul(optarg, NULL, 0);
+                break;
+            case 'T':
+                options.trace_path = optarg;
+                break;
+            default:
+                return false;
+        }
+    }
+    if (optind != argc || options.devices == 0 || options.duration_s == 0
+        || options.report_period_s == 0 || options.log_level > ESP_LOG_VERBOSE) {
+        return false;
+    }
+    if (!options.clock_set) {
+        options.clock = options.broker_host ? SIM_CLOCK_REAL : SIM_CLOCK_VIRTUAL;
+    }
+    return !(options.broker_host && options.clock == SIM_CLOCK_VIRTUAL);
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_options(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sim_config_t sim_config
+        = { .clock = options.clock, .seed = options.seed, .log_level = options.log_level };
+    sim_init(&sim_config);
+    // Synced time, so that the samples are timestamped as on a device with SNTP
+    sim_time_set_epoch(1633046400LL * 1000000);
+    sim_astarte_config_t astarte_config = {
+        .broker_host = options.broker_host,
+        .broker_port = options.broker_port,
+        .realm = options.realm,
+        .connect_delay_ms = 100,
+    };
+    sim_astarte_configure(&astarte_config);
+
+    devices = calloc(options.devices, sizeof(device_t));
+    if (!devices) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < options.devices; i++) {
+        device_t *device = &devices[i];
+        char name[16];
+        snprintf(name, sizeof(name), "dev%u", i);
+        sim_chip_config_t chip_config = { .name = name, .heap_size = options.heap_kib * 1024 };
+        device->index = i;
+        device->chip = sim_chip_new(&chip_config);
+        device->stop = xSemaphoreCreateBinary();
+        device->stopped = xSemaphoreCreateBinary();
+        device->rssi = calloc(options.aps ? options.aps : 1, sizeof(int8_t));
+        if (!device->chip || !device->stop || !device->stopped || !device->rssi) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        for (uint32_t j = 0; j < options.aps; j++) {
+            device->rssi[j] = RSSI_MAX - (int8_t) (sim_random() % (RSSI_MAX - RSSI_MIN));
+        }
+        device->boot_at_us = options.boot_window_s
+            ? (int64_t) ((double) sim_random() / UINT32_MAX * seconds(options.boot_window_s))
+            : 0;
+        if (sim_chip_start_task(device->chip, device_task, "app_main", device, NULL) != ESP_OK) {
+            fprintf(stderr, "Unable to start device %u\n", i);
+            return 1;
+        }
+    }
+
+    uint64_t host_start_us = process_cpu_us();
+    int64_t start_us = sim_time_us();
+    int64_t end_us = start_us + seconds(options.duration_s);
+    snapshot_t last = { .time_us = start_us };
+    sim_astarte_get_stats(NULL, &last.stats);
+    while (sim_time_us() < end_us) {
+        int64_t next_us = last.time_us + seconds(options.report_period_s);
+        next_us = next_us < end_us ? next_us : end_us;
+        while (sim_time_us() < next_us) {
+            vTaskDelay(ticks_until(next_us));
+        }
+        snapshot_t now = { .time_us = sim_time_us() };
+        sim_astarte_get_stats(NULL, &now.stats);
+        report_interval(&last, &now);
+        last = now;
+    }
+
+    for (uint32_t i = 0; i < options.devices; i++) {
+        xSemaphoreGive(devices[i].stop);
+    }
+    for (uint32_t i = 0; i < options.devices; i++) {
+        xSemaphoreTake(devices[i].stopped, portMAX_DELAY);
+    }
+    report_summary(sim_time_us() - start_us, process_cpu_us() - host_start_us);
+
+    if (options.trace_path) {
+        FILE *trace = fopen(options.trace_path, "w");
+        bool written = trace && edgehog_trace_dump_chrome(trace);
+        if (!trace || fclose(trace) != 0 || !written) {
+            fprintf(stderr, "Unable to write the trace to %s\n", options.trace_path);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <astarte_bson.h>
+#include <edgehog_device.h>
+#include <esp_event.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <getopt.h>
+#include <sim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Runs one Edgehog built with CONFIG_EDGEHOG_RECORDER on a simulated chip and on the virtual
+ * clock, with an Astarte disconnection midway, then sends it the UploadRecording command and
+ * writes the records it uploads in the format read by the replayer. The recordings are the same
+ * at each run, host/fixtures/recording.bin is one, and its replay must not diverge.
+ */
+
+#define APS 3
+#define RECORDING_INTERFACE "io.edgehog.devicemanager.Recording"
+#define COMMAND_INTERFACE "io.edgehog.devicemanager.Commands"
+// Time left to the device to upload its records
+#define UPLOAD_WAIT_MS 10000
+
+static const char *TAG = "RECORDER";
+
+typedef struct
+{
+    const char *path;
+    uint32_t duration_s;
+    uint32_t scan_period_s;
+    uint32_t disconnect_at_s;
+    uint32_t disconnect_ms;
+    esp_log_level_t log_level;
+} options_t;
+
+static options_t options = {
+    .duration_s = 300,
+    .scan_period_s = 60,
+    .disconnect_at_s = 150,
+    .disconnect_ms = 5000,
+    .log_level = ESP_LOG_WARN,
+};
+static FILE *output;
+static bool write_failed;
+static uint32_t chunks;
+static size_t recorded_bytes;
+static int64_t overwritten_records;
+static astarte_device_handle_t astarte_device;
+static edgehog_device_handle_t edgehog_device;
+
+// The records fields of the Recording aggregates are concatenated, in the order they are sent
+static void publish_hook(astarte_device_handle_t device, const char *topic, const void *payload,
+    size_t len, int qos, void *arg)
+{
+    if (!strstr(topic, RECORDING_INTERFACE)) {
+        return;
+    }
+    uint8_t type;
+    const void *aggregate = astarte_bson_key_lookup("v", payload, &type);
+    const uint8_t *records = aggregate && type == BSON_TYPE_DOCUMENT
+        ? astarte_bson_key_lookup("records", aggregate, &type)
+        : NULL;
+    if (!records || type != BSON_TYPE_BINARY) {
+        ESP_LOGE(TAG, "Unexpected Recording aggregate");
+        write_failed = true;
+        return;
+    }
+    const void *overwritten = astarte_bson_key_lookup("overwrittenRecords", aggregate, &type);
+    if (overwritten && type == BSON_TYPE_INT64) {
+        memcpy(&overwritten_records, overwritten, sizeof(overwritten_records));
+    }
+
+    // A binary value is its int32 length and its subtype, followed by the bytes
+    int32_t records_len;
+    memcpy(&records_len, records, sizeof(records_len));
+    if (fwrite(records + 5, 1, records_len, output) != (size_t) records_len) {
+        write_failed = true;
+    }
+    recorded_bytes += records_len;
+    chunks++;
+}
+
+static void astarte_connection_events_handler(astarte_device_connection_event_t *event)
+{
+    edgehog_device_astarte_connection_event_handler(edgehog_device, event);
+}
+
+static void astarte_disconnection_events_handler(astarte_device_disconnection_event_t *event)
+{
+}
+
+static void astarte_data_events_handler(astarte_device_data_event_t *event)
+{
+    edgehog_device_astarte_event_handler(edgehog_device, event);
+}
+
+static void set_aps(sim_chip_t *chip)
+{
+    wifi_ap_record_t aps[APS] = { 0 };
+    for (int i = 0; i < APS; i++) {
+        snprintf((char *) aps[i].ssid, sizeof(aps[i].ssid), "recorded-%d", i);
+        aps[i].bssid[0] = 0x02;
+        aps[i].bssid[5] = i;
+        aps[i].primary = 1 + i * 5;
+        aps[i].rssi = -50 - i * 10;
+        aps[i].authmode = WIFI_AUTH_WPA2_PSK;
+    }
+    sim_wifi_set_aps(chip, aps, APS, 0);
+}
+
+static bool boot(sim_chip_t *chip)
+{
+    sim_chip_enter(chip);
+    esp_event_loop_create_default();
+    astarte_device_config_t astarte_config = {
+        .data_event_callback = astarte_data_events_handler,
+        .connection_event_callback = astarte_connection_events_handler,
+        .disconnection_event_callback = astarte_disconnection_events_handler,
+        .hwid = "recorded-device",
+    };
+    astarte_device = astarte_device_init(&astarte_config);
+    if (astarte_device) {
+        edgehog_device_config_t edgehog_config = {
+            .astarte_device = astarte_device,
+            .partition_label = "nvs",
+            .wifi_scan = { .period_s = options.scan_period_s },
+        };
+        edgehog_device = edgehog_device_new(&edgehog_config);
+    }
+    if (edgehog_device && astarte_device_start(astarte_device) != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to start the Astarte device");
+    }
+    sim_chip_leave();
+    return edgehog_device != NULL;
+}
+
+static void wait_until(int64_t time_us)
+{
+    // pdMS_TO_TICKS overflows past 71 minutes
+    while (sim_time_us() < time_us) {
+        int64_t wait_ms = (time_us - sim_time_us() + 999) / 1000;
+        vTaskDelay(pdMS_TO_TICKS(wait_ms < 3600000 ? wait_ms : 3600000));
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options] RECORDING\n"
+        "  RECORDING              file the uploaded records are written to\n"
+        "  --duration S           simulated time before the upload (300)\n"
+        "  --scan-period S        WiFi scan period (60)\n"
+        "  --disconnect-at S      time of the Astarte disconnection, 0 for none (150)\n"
+        "  --disconnect-for MS    duration of the disconnection (5000)\n"
+        "  --log-level N          ESP log level of the device, 0-5 (2)\n",
+        name);
+}
+
+static bool parse_options(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "duration", required_argument, NULL, 'd' },
+        { "scan-period", required_argument, NULL, 's' },
+        { "disconnect-at", required_argument, NULL, 'a' },
+        { "disconnect-for", required_argument, NULL, 'f' },
+        { "log-level", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'd':
+                options.duration_s = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                options.scan_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                options.disconnect_at_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                options.disconnect_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                options.log_level = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                return false;
+        }
+    }
+    if (optind != argc - 1 || options.log_level > ESP_LOG_VERBOSE
+        || options.disconnect_at_s >= options.duration_s) {
+        return false;
+    }
+    options.path = argv[optind];
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_options(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+    output = fopen(options.path, "wb");
+    if (!output) {
+        perror(options.path);
+        return 1;
+    }
+
+    sim_config_t sim_config = { .clock = SIM_CLOCK_VIRTUAL, .log_level = options.log_level };
+    sim_init(&sim_config);
+    // Synced time, as on a device with SNTP
+    sim_time_set_epoch(1633046400LL * 1000000);
+    sim_astarte_config_t astarte_config = { .connect_delay_ms = 100 };
+    sim_astarte_configure(&astarte_config);
+    sim_astarte_set_publish_hook(publish_hook, NULL);
+
+    sim_chip_config_t chip_config = { .name = "recorded" };
+    sim_chip_t *chip = sim_chip_new(&chip_config);
+    if (!chip) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    set_aps(chip);
+    if (!boot(chip)) {
+        fprintf(stderr, "Unable to start Edgehog\n");
+        return 1;
+    }
+
+    int64_t start_us = sim_time_us();
+    if (options.disconnect_at_s > 0) {
+        wait_until(start_us + options.disconnect_at_s * 1000000LL);
+        sim_astarte_disconnect(astarte_device, options.disconnect_ms);
+    }
+    wait_until(start_us + options.duration_s * 1000000LL);
+    sim_astarte_receive_string(astarte_device, COMMAND_INTERFACE, "/request", "UploadRecording");
+    vTaskDelay(pdMS_TO_TICKS(UPLOAD_WAIT_MS));
+
+    if (fclose(output) != 0) {
+        write_failed = true;
+    }
+    printf("%zu bytes of records in %u chunks, %lld records overwritten\n", recorded_bytes,
+        chunks, (long long) overwritten_records);
+    if (write_failed || recorded_bytes == 0) {
+        fprintf(stderr, "Unable to write the recording to %s\n", options.path);
+        return 1;
+    }
+    return 0;
+}
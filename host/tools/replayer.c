@@ -0,0 +1,517 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_recorder.h"
+#include <edgehog_device.h>
+#include <esp_event.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <getopt.h>
+#include <sim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Feeds a recording uploaded by a device with CONFIG_EDGEHOG_RECORDER back into Edgehog, on a
+ * simulated chip and on the virtual clock, so that a field problem can be reproduced and debugged
+ * on the host, and replays of the same recording are identical.
+ *
+ * The recording is the concatenation of the records fields of the Recording aggregates, in the
+ * order they were sent. The stimuli (events, WiFi scans, Astarte connections and commands) are
+ * injected at their timestamps. The responses (system time readings, Astarte and NVS results) are
+ * returned to Edgehog when it asks for them, in the order they were recorded. A response asked
+ * for when none was recorded around that time, or recorded but never asked for, is a divergence:
+ * the replayed Edgehog did not do what the recorded one did.
+ */
+
+#define RECORD_HEADER_SIZE 10
+#define RESPONSE_TYPES (EDGEHOG_RECORD_NVS_RESULT + 1)
+
+static const char *TAG = "REPLAYER";
+
+typedef struct
+{
+    int64_t timestamp_us;
+    uint8_t type;
+    uint8_t len;
+    uint8_t payload[UINT8_MAX];
+} record_t;
+
+typedef struct
+{
+    const char *path;
+    uint32_t scan_period_s;
+    uint32_t status_period_s;
+    uint32_t metrics_period_s;
+    uint32_t tolerance_ms;
+    uint32_t heap_kib;
+    bool quiet;
+    esp_log_level_t log_level;
+} options_t;
+
+typedef struct
+{
+    // Index of the next record of the type to return
+    size_t next;
+    uint64_t matched;
+    // Recorded but never asked for
+    uint64_t missed;
+    // Asked for but not recorded
+    uint64_t unrecorded;
+} response_stats_t;
+
+static options_t options = {
+    .scan_period_s = 60,
+    .tolerance_ms = 1000,
+    .log_level = ESP_LOG_WARN,
+};
+static record_t *records;
+static size_t record_count;
+static portMUX_TYPE replay_lock = portMUX_INITIALIZER_UNLOCKED;
+static response_stats_t responses[RESPONSE_TYPES];
+static uint64_t publishes;
+static astarte_device_handle_t astarte_device;
+static edgehog_device_handle_t edgehog_device;
+static bool connected;
+
+static const char *const response_names[RESPONSE_TYPES] = {
+    [EDGEHOG_RECORD_TIME] = "system time",
+    [EDGEHOG_RECORD_ASTARTE_RESULT] = "Astarte results",
+    [EDGEHOG_RECORD_NVS_RESULT] = "NVS commits",
+};
+
+static bool load_records(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    size_t capacity = 0;
+    uint8_t header[RECORD_HEADER_SIZE];
+    bool ok = true;
+    while (fread(header, 1, sizeof(header), file) == sizeof(header)) {
+        if (record_count == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            record_t *grown = realloc(records, capacity * sizeof(record_t));
+            if (!grown) {
+                fprintf(stderr, "Out of memory\n");
+                ok = false;
+                break;
+            }
+            records = grown;
+        }
+        record_t *record = &records[record_count];
+        // The records are little endian, as the chips and the hosts the tool runs on
+        memcpy(&record->timestamp_us, header, sizeof(record->timestamp_us));
+        record->type = header[8];
+        record->len = header[9];
+        if (fread(record->payload, 1, record->len, file) != record->len) {
+            fprintf(stderr, "%s: truncated record at %zu\n", path, record_count);
+            ok = false;
+            break;
+        }
+        record_count++;
+    }
+    if (ok && ferror(file)) {
+        perror(path);
+        ok = false;
+    }
+    fclose(file);
+    return ok;
+}
+
+// Returns the payload of the recorded response of the given type and length for the current time
+static const uint8_t *take_response(edgehog_record_type_t type, size_t len)
+{
+    int64_t now_us = esp_timer_get_time();
+    int64_t tolerance_us = (int64_t) options.tolerance_ms * 1000;
+    const uint8_t *payload = NULL;
+    uint64_t missed = 0;
+    bool unrecorded = false;
+
+    portENTER_CRITICAL(&replay_lock);
+    response_stats_t *stats = &responses[type];
+    for (; stats->next < record_count; stats->next++) {
+        const record_t *record = &records[stats->next];
+        if (record->type != type || record->len != len) {
+            continue;
+        }
+        if (record->timestamp_us < now_us - tolerance_us) {
+            missed++;
+            continue;
+        }
+        if (record->timestamp_us <= now_us + tolerance_us) {
+            payload = record->payload;
+            stats->matched++;
+            stats->next++;
+        }
+        break;
+    }
+    // Outside of the recording Edgehog runs on the values of the simulation, the upload that
+    // ended it copied the records at or after the last one
+    if (!payload && now_us >= records[0].timestamp_us - tolerance_us
+        && now_us < records[record_count - 1].timestamp_us) {
+        unrecorded = true;
+        stats->unrecorded++;
+    }
+    stats->missed += missed;
+    portEXIT_CRITICAL(&replay_lock);
+
+    if (missed > 0) {
+        ESP_LOGW(TAG, "%.6f s: %llu %s recorded earlier were not asked for", now_us / 1e6,
+            (unsigned long long) missed, response_names[type]);
+    }
+    if (unrecorded) {
+        ESP_LOGW(TAG, "%.6f s: %s asked for, none recorded", now_us / 1e6, response_names[type]);
+    }
+    return payload;
+}
+
+static int64_t time_hook(int64_t epoch_us, void *arg)
+{
+    const uint8_t *payload = take_response(EDGEHOG_RECORD_TIME, sizeof(int64_t));
+    if (payload) {
+        memcpy(&epoch_us, payload, sizeof(epoch_us));
+    }
+    return epoch_us;
+}
+
+static int32_t take_result(edgehog_record_type_t type, int32_t ret)
+{
+    const uint8_t *payload = take_response(type, sizeof(int32_t));
+    if (payload) {
+        memcpy(&ret, payload, sizeof(ret));
+    }
+    return ret;
+}
+
+static astarte_err_t astarte_result_hook(astarte_err_t ret, void *arg)
+{
+    return take_result(EDGEHOG_RECORD_ASTARTE_RESULT, ret);
+}
+
+static esp_err_t nvs_commit_hook(esp_err_t ret, void *arg)
+{
+    return take_result(EDGEHOG_RECORD_NVS_RESULT, ret);
+}
+
+static void publish_hook(astarte_device_handle_t device, const char *topic, const void *payload,
+    size_t len, int qos, void *arg)
+{
+    __atomic_fetch_add(&publishes, 1, __ATOMIC_RELAXED);
+    if (!options.quiet) {
+        printf("%12.6f  publish  %s, %zu B, QoS %d\n", esp_timer_get_time() / 1e6, topic, len, qos);
+    }
+}
+
+static void astarte_connection_events_handler(astarte_device_connection_event_t *event)
+{
+    __atomic_store_n(&connected, true, __ATOMIC_RELAXED);
+    edgehog_device_astarte_connection_event_handler(edgehog_device, event);
+}
+
+static void astarte_disconnection_events_handler(astarte_device_disconnection_event_t *event)
+{
+    __atomic_store_n(&connected, false, __ATOMIC_RELAXED);
+}
+
+static void astarte_data_events_handler(astarte_device_data_event_t *event)
+{
+    edgehog_device_astarte_event_handler(edgehog_device, event);
+}
+
+static bool boot(sim_chip_t *chip)
+{
+    sim_chip_enter(chip);
+    esp_event_loop_create_default();
+    astarte_device_config_t astarte_config = {
+        .data_event_callback = astarte_data_events_handler,
+        .connection_event_callback = astarte_connection_events_handler,
+        .disconnection_event_callback = astarte_disconnection_events_handler,
+        .hwid = "replayed-device",
+    };
+    astarte_device = astarte_device_init(&astarte_config);
+    if (astarte_device) {
+        edgehog_device_config_t edgehog_config = {
+            .astarte_device = astarte_device,
+            .partition_label = "nvs",
+            .wifi_scan = { .period_s = options.scan_period_s },
+            .system_status_period_s = options.status_period_s,
+            .metrics_period_s = options.metrics_period_s,
+        };
+        edgehog_device = edgehog_device_new(&edgehog_config);
+    }
+    if (edgehog_device && astarte_device_start(astarte_device) != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to start the Astarte device");
+    }
+    sim_chip_leave();
+    return edgehog_device != NULL;
+}
+
+static void wait_until(int64_t timestamp_us)
+{
+    // In steps of an hour, pdMS_TO_TICKS overflows past 71 minutes
+    int64_t wait_us;
+    while ((wait_us = timestamp_us - esp_timer_get_time()) > 0) {
+        vTaskDelay(pdMS_TO_TICKS(wait_us < 3600000000LL ? (wait_us + 999) / 1000 : 3600000));
+    }
+}
+
+// Completes a scan with the AP records following its scan done event, returns the records used
+static size_t replay_scan_done(sim_chip_t *chip, size_t index)
+{
+    const record_t *record = &records[index];
+    edgehog_record_event_t event;
+    wifi_event_sta_scan_done_t scan_done;
+    memcpy(&event, record->payload, sizeof(event));
+    memcpy(&scan_done, record->payload + sizeof(event), sizeof(scan_done));
+
+    wifi_ap_record_t *aps = calloc(scan_done.number ? scan_done.number : 1, sizeof(*aps));
+    if (!aps) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    size_t used = 1;
+    uint16_t count = 0;
+    for (size_t i = index + 1; i < record_count && count < scan_done.number; i++) {
+        const record_t *ap_record = &records[i];
+        if (ap_record->type == EDGEHOG_RECORD_EVENT) {
+            break;
+        }
+        if (ap_record->type != EDGEHOG_RECORD_WIFI_AP) {
+            continue;
+        }
+        edgehog_record_wifi_ap_t ap = { 0 };
+        memcpy(&ap, ap_record->payload,
+            ap_record->len < sizeof(ap) ? ap_record->len : sizeof(ap));
+        wifi_ap_record_t *out = &aps[count++];
+        memcpy(out->bssid, ap.bssid, sizeof(out->bssid));
+        memcpy(out->ssid, ap.ssid, ap.ssid_len < sizeof(ap.ssid) ? ap.ssid_len : sizeof(ap.ssid));
+        out->primary = ap.channel;
+        out->rssi = ap.rssi;
+        out->authmode = ap.authmode;
+        used = i - index + 1;
+    }
+    if (count < scan_done.number) {
+        ESP_LOGW(TAG, "Scan done at %lld us with %u APs, %u recorded",
+            (long long) record->timestamp_us, scan_done.number, count);
+    }
+    if (sim_wifi_complete_scan(chip, scan_done.status, aps, count) != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to post the scan done at %lld us", (long long) record->timestamp_us);
+    }
+    free(aps);
+    return used;
+}
+
+// Injects the stimulus at index, returns the records used
+static size_t replay_stimulus(sim_chip_t *chip, size_t index)
+{
+    const record_t *record = &records[index];
+    switch (record->type) {
+        case EDGEHOG_RECORD_EVENT: {
+            edgehog_record_event_t event;
+            if (record->len < sizeof(event)) {
+                break;
+            }
+            memcpy(&event, record->payload, sizeof(event));
+            if (event.base == EDGEHOG_RECORD_EVENT_BASE_WIFI && event.id == WIFI_EVENT_SCAN_DONE
+                && record->len == sizeof(event) + sizeof(wifi_event_sta_scan_done_t)) {
+                wait_until(record->timestamp_us);
+                return replay_scan_done(chip, index);
+            }
+            ESP_LOGW(TAG, "Event %d of base %u not replayed", event.id, event.base);
+            break;
+        }
+        case EDGEHOG_RECORD_WIFI_AP:
+            // The scan done event of these APs was overwritten on the chip
+            ESP_LOGW(TAG, "AP record at %lld us without its scan, skipped",
+                (long long) record->timestamp_us);
+            break;
+        case EDGEHOG_RECORD_ASTARTE_CONNECTION: {
+            int32_t session_present;
+            if (record->len != sizeof(session_present)) {
+                break;
+            }
+            memcpy(&session_present, record->payload, sizeof(session_present));
+            wait_until(record->timestamp_us);
+            // Disconnections are not recorded, a connection implies the previous one was lost
+            if (__atomic_load_n(&connected, __ATOMIC_RELAXED)) {
+                sim_astarte_disconnect(astarte_device, 0);
+            }
+            sim_astarte_connect(astarte_device, session_present);
+            break;
+        }
+        case EDGEHOG_RECORD_ASTARTE_COMMAND: {
+            char command[UINT8_MAX + 1];
+            memcpy(command, record->payload, record->len);
+            command[record->len] = '\0';
+            wait_until(record->timestamp_us);
+            if (!options.quiet) {
+                printf("%12.6f  command  %s\n", esp_timer_get_time() / 1e6, command);
+            }
+            sim_astarte_receive_string(astarte_device, "io.edgehog.devicemanager.Commands",
+                "/request", command);
+            break;
+        }
+        default:
+            break;
+    }
+    return 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options] RECORDING\n"
+        "  RECORDING              the records fields of the Recording aggregates, concatenated\n"
+        "  --scan-period S        WiFi scan period of the recorded device (60)\n"
+        "  --status-period S      SystemStatus period of the recorded device (Edgehog default)\n"
+        "  --metrics-period S     metrics period of the recorded device (Edgehog default)\n"
+        "  --tolerance MS         how far from its recorded time a response is returned (1000)\n"
+        "  --heap KIB             heap of the chip (300)\n"
+        "  --quiet                do not print the publishes and the commands\n"
+        "  --log-level N          ESP log level of the device, 0-5 (2)\n",
+        name);
+}
+
+static bool parse_options(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "scan-period", required_argument, NULL, 's' },
+        { "status-period", required_argument, NULL, 'S' },
+        { "metrics-period", required_argument, NULL, 'm' },
+        { "tolerance", required_argument, NULL, 't' },
+        { "heap", required_argument, NULL, 'h' },
+        { "quiet", no_argument, NULL, 'q' },
+        { "log-level", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                options.scan_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'S':
+                options.status_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                options.metrics_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                options.tolerance_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+                options.heap_kib = strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                options.quiet = true;
+                break;
+            case 'l':
+                options.log_level = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                return false;
+        }
+    }
+    if (optind != argc - 1 || options.log_level > ESP_LOG_VERBOSE) {
+        return false;
+    }
+    options.path = argv[optind];
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_options(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!load_records(options.path)) {
+        return 1;
+    }
+    if (record_count == 0) {
+        fprintf(stderr, "%s: no records\n", options.path);
+        return 1;
+    }
+
+    sim_config_t sim_config = { .clock = SIM_CLOCK_VIRTUAL, .log_level = options.log_level };
+    sim_init(&sim_config);
+    // Connections happen only when recorded
+    sim_astarte_config_t astarte_config = { .connect_delay_ms = 0 };
+    sim_astarte_configure(&astarte_config);
+    sim_time_set_hook(time_hook, NULL);
+    sim_astarte_set_result_hook(astarte_result_hook, NULL);
+    sim_astarte_set_publish_hook(publish_hook, NULL);
+    sim_nvs_set_commit_hook(nvs_commit_hook, NULL);
+
+    sim_chip_config_t chip_config = { .name = "replay", .heap_size = options.heap_kib * 1024 };
+    sim_chip_t *chip = sim_chip_new(&chip_config);
+    if (!chip) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    // Scans complete only when recorded
+    sim_wifi_set_scan_mode(chip, SIM_WIFI_SCAN_EXTERNAL);
+    if (!boot(chip)) {
+        fprintf(stderr, "Unable to start Edgehog\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < record_count;) {
+        i += replay_stimulus(chip, i);
+    }
+    // Leaves Edgehog the time to ask for the responses of the last stimuli
+    wait_until(records[record_count - 1].timestamp_us + (int64_t) options.tolerance_ms * 1000);
+
+    portENTER_CRITICAL(&replay_lock);
+    uint64_t divergences = 0;
+    for (int type = EDGEHOG_RECORD_TIME; type < RESPONSE_TYPES; type++) {
+        if (!response_names[type]) {
+            continue;
+        }
+        response_stats_t *stats = &responses[type];
+        for (; stats->next < record_count; stats->next++) {
+            stats->missed += records[stats->next].type == type;
+        }
+    }
+    portEXIT_CRITICAL(&replay_lock);
+
+    printf("\nReplayed %zu records, from %.6f s to %.6f s, %llu publishes\n", record_count,
+        records[0].timestamp_us / 1e6, records[record_count - 1].timestamp_us / 1e6,
+        (unsigned long long) publishes);
+    printf("%-16s %12s %12s %12s\n", "Responses", "matched", "missed", "unrecorded");
+    for (int type = EDGEHOG_RECORD_TIME; type < RESPONSE_TYPES; type++) {
+        if (!response_names[type]) {
+            continue;
+        }
+        const response_stats_t *stats = &responses[type];
+        printf("%-16s %12llu %12llu %12llu\n", response_names[type],
+            (unsigned long long) stats->matched, (unsigned long long) stats->missed,
+            (unsigned long long) stats->unrecorded);
+        divergences += stats->missed + stats->unrecorded;
+    }
+    printf("%llu divergences\n", (unsigned long long) divergences);
+    return divergences ? 2 : 0;
+}
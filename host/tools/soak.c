@@ -0,0 +1,254 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_soak.h"
+#include <edgehog_device.h>
+#include <esp_event.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <getopt.h>
+#include <sim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Runs one Edgehog built with CONFIG_EDGEHOG_SOAK on a simulated chip and on the virtual clock,
+ * so that weeks of operation take minutes: the periodic SystemStatus, metrics and scans, plus the
+ * setter calls, property updates and Astarte stops and restarts of the soak driver. The soak
+ * checks of Edgehog run on the heap of the chip, a first fit allocator that fragments like the
+ * one of the ESP-IDF, and the run fails when they do.
+ */
+
+#define APS 6
+// How often the run is checked for a failure, pdMS_TO_TICKS overflows past 71 minutes
+#define POLL_PERIOD_S 3600
+
+static const char *TAG = "SOAK";
+
+typedef struct
+{
+    uint32_t duration_s;
+    uint32_t report_s;
+    uint32_t scan_period_s;
+    uint32_t status_period_s;
+    uint32_t heap_kib;
+    uint32_t leak_bytes;
+    uint32_t seed;
+    esp_log_level_t log_level;
+} options_t;
+
+static options_t options = {
+    .duration_s = 14 * 86400,
+    .report_s = 86400,
+    .scan_period_s = 600,
+    .log_level = ESP_LOG_ERROR,
+};
+static astarte_device_handle_t astarte_device;
+static edgehog_device_handle_t edgehog_device;
+static uint64_t publishes;
+static uint64_t connections;
+// Keeps the compiler from dropping the leaked allocations
+static void *volatile leaked;
+
+static void publish_hook(astarte_device_handle_t device, const char *topic, const void *payload,
+    size_t len, int qos, void *arg)
+{
+    __atomic_fetch_add(&publishes, 1, __ATOMIC_RELAXED);
+    // Checks the checks: the publishing task runs on the chip, so the leak is on its heap
+    if (options.leak_bytes > 0 && strstr(topic, "/io.edgehog.devicemanager.SystemStatus/")) {
+        leaked = malloc(options.leak_bytes);
+    }
+}
+
+static void astarte_connection_events_handler(astarte_device_connection_event_t *event)
+{
+    __atomic_fetch_add(&connections, 1, __ATOMIC_RELAXED);
+    edgehog_device_astarte_connection_event_handler(edgehog_device, event);
+}
+
+static void astarte_disconnection_events_handler(astarte_device_disconnection_event_t *event)
+{
+}
+
+static void astarte_data_events_handler(astarte_device_data_event_t *event)
+{
+    edgehog_device_astarte_event_handler(edgehog_device, event);
+}
+
+static void set_aps(sim_chip_t *chip)
+{
+    wifi_ap_record_t aps[APS] = { 0 };
+    for (int i = 0; i < APS; i++) {
+        snprintf((char *) aps[i].ssid, sizeof(aps[i].ssid), "soak-%d", i % 2);
+        uint32_t bssid = sim_random();
+        aps[i].bssid[0] = 0x02;
+        memcpy(aps[i].bssid + 2, &bssid, sizeof(bssid));
+        aps[i].primary = 1 + i * 2;
+        aps[i].rssi = -50 - i * 6;
+        aps[i].authmode = WIFI_AUTH_WPA2_PSK;
+    }
+    sim_wifi_set_aps(chip, aps, APS, 0);
+}
+
+static bool boot(sim_chip_t *chip)
+{
+    sim_chip_enter(chip);
+    esp_event_loop_create_default();
+    astarte_device_config_t astarte_config = {
+        .data_event_callback = astarte_data_events_handler,
+        .connection_event_callback = astarte_connection_events_handler,
+        .disconnection_event_callback = astarte_disconnection_events_handler,
+        .hwid = "soak-device",
+    };
+    astarte_device = astarte_device_init(&astarte_config);
+    if (astarte_device) {
+        edgehog_device_config_t edgehog_config = {
+            .astarte_device = astarte_device,
+            .partition_label = "nvs",
+            .wifi_scan = { .period_s = options.scan_period_s },
+            .system_status_period_s = options.status_period_s,
+        };
+        edgehog_device = edgehog_device_new(&edgehog_config);
+    }
+    if (edgehog_device && astarte_device_start(astarte_device) != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to start the Astarte device");
+    }
+    sim_chip_leave();
+    return edgehog_device != NULL;
+}
+
+static void report(sim_chip_t *chip)
+{
+    sim_heap_info_t heap;
+    sim_heap_get_info(chip, &heap);
+    printf("%9.2f %12zu %12zu %12zu %12zu %12llu %12llu\n", sim_time_us() / 86400e6,
+        heap.total - heap.free, heap.total - heap.minimum_free, heap.largest_free_block,
+        heap.allocated_blocks, (unsigned long long) __atomic_load_n(&publishes, __ATOMIC_RELAXED),
+        (unsigned long long) __atomic_load_n(&connections, __ATOMIC_RELAXED));
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --duration S           simulated time (1209600, two weeks)\n"
+        "  --report S             period of the heap reports (86400)\n"
+        "  --scan-period S        WiFi scan period (600)\n"
+        "  --status-period S      SystemStatus period (Edgehog default)\n"
+        "  --heap KIB             heap of the chip (300)\n"
+        "  --leak BYTES           leak BYTES at each SystemStatus publish, to check the checks\n"
+        "  --seed N               seed of the simulation (1)\n"
+        "  --log-level N          ESP log level of the device, 0-5 (1)\n",
+        name);
+}
+
+static bool parse_options(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "duration", required_argument, NULL, 'd' },
+        { "report", required_argument, NULL, 'r' },
+        { "scan-period", required_argument, NULL, 's' },
+        { "status-period", required_argument, NULL, 'S' },
+        { "heap", required_argument, NULL, 'h' },
+        { "leak", required_argument, NULL, 'L' },
+        { "seed", required_argument, NULL, 'e' },
+        { "log-level", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'd':
+                options.duration_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                options.report_s = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                options.scan_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'S':
+                options.status_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+                options.heap_kib = strtoul(optarg, NULL, 0);
+                break;
+            case 'L':
+                options.leak_bytes = strtoul(optarg, NULL, 0);
+                break;
+            case 'e':
+                options.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                options.log_level = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                return false;
+        }
+    }
+    return optind == argc && options.report_s > 0 && options.log_level <= ESP_LOG_VERBOSE;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_options(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sim_config_t sim_config
+        = { .clock = SIM_CLOCK_VIRTUAL, .seed = options.seed, .log_level = options.log_level };
+    sim_init(&sim_config);
+    sim_astarte_set_publish_hook(publish_hook, NULL);
+
+    sim_chip_config_t chip_config = { .name = "soak", .heap_size = options.heap_kib * 1024 };
+    sim_chip_t *chip = sim_chip_new(&chip_config);
+    if (!chip) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    set_aps(chip);
+    if (!boot(chip)) {
+        fprintf(stderr, "Unable to start Edgehog\n");
+        return 1;
+    }
+
+    printf("%9s %12s %12s %12s %12s %12s %12s\n", "day", "used", "peak used", "largest free",
+        "blocks", "publishes", "connections");
+    bool failed = false;
+    for (uint32_t elapsed_s = 0; elapsed_s < options.duration_s && !failed;) {
+        uint32_t step_s = options.duration_s - elapsed_s < POLL_PERIOD_S
+            ? options.duration_s - elapsed_s
+            : POLL_PERIOD_S;
+        vTaskDelay(pdMS_TO_TICKS(step_s * 1000));
+        elapsed_s += step_s;
+        sim_chip_enter(chip);
+        failed = edgehog_soak_failed(edgehog_device);
+        sim_chip_leave();
+        if (failed || elapsed_s % options.report_s == 0 || elapsed_s == options.duration_s) {
+            report(chip);
+        }
+    }
+
+    printf("Soak run %s after %.2f days\n", failed ? "FAILED" : "passed",
+        sim_time_us() / 86400e6);
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,671 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <astarte_bson.h>
+#include <edgehog_device.h>
+#include <edgehog_wifi_scan.h>
+#include <esp_event.h>
+#include <esp_log.h>
+#include <freertos/semphr.h>
+#include <getopt.h>
+#include <nvs.h>
+#include <sim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Hammers the public API of one Edgehog device from many tasks on both cores, on the real clock,
+ * while the WiFi scans, the periodic publishes and the Astarte reconnections run, then checks that
+ * the device is consistent and reports the contention on its locks.
+ *
+ * The checks, once the tasks stopped and the device reconnected:
+ * - the appliance info stored on the NVS is the one last published, and none is left unsent;
+ * - the callback of every accepted asynchronous setter was called exactly once;
+ * - a value set asynchronously never overwrites one set afterwards, when the worker runs late;
+ * - no WiFi scan callback runs after edgehog_device_wifi_scan_unsubscribe returned;
+ * - the heap used by Edgehog is back to where it was before edgehog_device_new.
+ */
+
+#define APPLIANCE_INTERFACE "io.edgehog.devicemanager.ApplianceInfo"
+#define APPLIANCE_NAMESPACE "eh_appliance"
+#define APPLIANCE_DIRTY_KEY "dirty"
+#define VALUE_MAX_LEN 32
+// Sync setter latencies are counted in power of two buckets of microseconds
+#define LATENCY_BUCKETS 24
+#define SETTLE_TIMEOUT_MS 30000
+#define SETTLE_POLL_MS 50
+// Each round sets a value asynchronously and then another one synchronously
+#define ORDERING_ROUNDS 200
+// A scan callback lasts long enough for the subscriber to unsubscribe meanwhile
+#define SCAN_CALLBACK_MS 20
+#define SUBSCRIBED_MAX_MS 100
+#define SUBSCRIBER_TASKS 3
+#define SUBSCRIBER_ALIVE 0x5ca45ca4
+#define SUBSCRIBER_GONE 0xdeaddead
+
+static const char *TAG = "STRESS";
+
+typedef enum
+{
+    FIELD_SERIAL_NUMBER = 0,
+    FIELD_PART_NUMBER,
+    FIELD_COUNT,
+} field_t;
+
+static const struct
+{
+    const char *key;
+    const char *path;
+} fields[FIELD_COUNT] = {
+    [FIELD_SERIAL_NUMBER] = { .key = "serial_number", .path = "/serialNumber" },
+    [FIELD_PART_NUMBER] = { .key = "part_number", .path = "/partNumber" },
+};
+
+typedef struct
+{
+    uint32_t tasks;
+    uint32_t duration_s;
+    uint32_t async_percent;
+    uint32_t disconnect_period_ms;
+    uint32_t scan_period_s;
+    uint32_t seed;
+    esp_log_level_t log_level;
+} options_t;
+
+typedef struct
+{
+    uint64_t sync_calls;
+    uint64_t sync_failed;
+    uint64_t async_accepted;
+    uint64_t async_rejected;
+    uint64_t scans_acquired;
+    uint64_t latency[LATENCY_BUCKETS];
+    uint64_t max_latency_us;
+} task_stats_t;
+
+typedef struct
+{
+    uint32_t index;
+    task_stats_t stats;
+} setter_task_t;
+
+static options_t options = {
+    .tasks = 8,
+    .duration_s = 10,
+    .async_percent = 50,
+    .disconnect_period_ms = 200,
+    .scan_period_s = 1,
+    .log_level = ESP_LOG_ERROR,
+};
+static sim_chip_t *chip;
+static astarte_device_handle_t astarte_device;
+static edgehog_device_handle_t edgehog_device;
+static bool connected;
+static bool stopping;
+static SemaphoreHandle_t tasks_done;
+static UBaseType_t expected_tasks;
+static uint64_t async_callbacks;
+static uint64_t async_accepted;
+static uint64_t async_publish_failed;
+static uint64_t async_superseded;
+static uint64_t scan_callbacks;
+static uint64_t late_scan_callbacks;
+static portMUX_TYPE published_lock = portMUX_INITIALIZER_UNLOCKED;
+static char published[FIELD_COUNT][VALUE_MAX_LEN];
+
+static void astarte_connection_events_handler(astarte_device_connection_event_t *event)
+{
+    __atomic_store_n(&connected, true, __ATOMIC_RELAXED);
+    edgehog_device_astarte_connection_event_handler(edgehog_device, event);
+}
+
+static void astarte_disconnection_events_handler(astarte_device_disconnection_event_t *event)
+{
+    __atomic_store_n(&connected, false, __ATOMIC_RELAXED);
+}
+
+static void astarte_data_events_handler(astarte_device_data_event_t *event)
+{
+    edgehog_device_astarte_event_handler(edgehog_device, event);
+}
+
+// Keeps the last value published for each appliance info field, in the order sent to Astarte
+static void publish_hook(astarte_device_handle_t device, const char *topic, const void *payload,
+    size_t len, int qos, void *arg)
+{
+    const char *path = strstr(topic, APPLIANCE_INTERFACE);
+    if (!path) {
+        return;
+    }
+    path += strlen(APPLIANCE_INTERFACE);
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        uint8_t type;
+        const void *value = astarte_bson_key_lookup("v", payload, &type);
+        if (strcmp(path, fields[field].path) != 0 || !value || type != BSON_TYPE_STRING) {
+            continue;
+        }
+        uint32_t value_len;
+        const char *string = astarte_bson_value_to_string(value, &value_len);
+        portENTER_CRITICAL(&published_lock);
+        snprintf(published[field], sizeof(published[field]), "%.*s", (int) value_len, string);
+        portEXIT_CRITICAL(&published_lock);
+    }
+}
+
+static void set_cb(edgehog_device_handle_t device, esp_err_t publish_result,
+    esp_err_t persist_result, void *user_data)
+{
+    if (publish_result == ESP_ERR_INVALID_STATE) {
+        __atomic_fetch_add(&async_superseded, 1, __ATOMIC_RELAXED);
+    } else if (publish_result != ESP_OK) {
+        __atomic_fetch_add(&async_publish_failed, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&async_callbacks, 1, __ATOMIC_RELAXED);
+}
+
+static void record_latency(task_stats_t *stats, int64_t latency_us)
+{
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && latency_us >= (2LL << bucket)) {
+        bucket++;
+    }
+    stats->latency[bucket]++;
+    if ((uint64_t) latency_us > stats->max_latency_us) {
+        stats->max_latency_us = latency_us;
+    }
+}
+
+static void setter_task(void *arg)
+{
+    setter_task_t *task = arg;
+    task_stats_t *stats = &task->stats;
+
+    for (uint32_t sequence = 0; !__atomic_load_n(&stopping, __ATOMIC_RELAXED); sequence++) {
+        uint32_t choice = sim_random();
+        field_t field = choice % FIELD_COUNT;
+        char value[VALUE_MAX_LEN];
+        snprintf(value, sizeof(value), "T%02u-%08u", task->index, sequence);
+
+        if ((choice >> 8) % 100 < options.async_percent) {
+            esp_err_t ret = field == FIELD_SERIAL_NUMBER
+                ? edgehog_device_set_appliance_serial_number_async(
+                    edgehog_device, value, set_cb, NULL)
+                : edgehog_device_set_appliance_part_number_async(
+                    edgehog_device, value, set_cb, NULL);
+            if (ret == ESP_OK) {
+                stats->async_accepted++;
+            } else {
+                stats->async_rejected++;
+                // The worker queue is full, as it would be on the chip under this load
+                vTaskDelay(1);
+            }
+        } else {
+            int64_t start_us = sim_time_us();
+            esp_err_t ret = field == FIELD_SERIAL_NUMBER
+                ? edgehog_device_set_appliance_serial_number(edgehog_device, value)
+                : edgehog_device_set_appliance_part_number(edgehog_device, value);
+            record_latency(stats, sim_time_us() - start_us);
+            stats->sync_calls++;
+            stats->sync_failed += ret != ESP_OK;
+        }
+
+        // The scan results are shared with the event loop, which replaces them at each scan
+        if ((choice >> 16) % 8 == 0) {
+            const edgehog_wifi_scan_result_t *result
+                = edgehog_device_wifi_scan_acquire(edgehog_device);
+            if (result) {
+                stats->scans_acquired++;
+                edgehog_wifi_scan_result_release(result);
+            }
+        }
+    }
+
+    xSemaphoreGive(tasks_done);
+    vTaskDelete(NULL);
+}
+
+static void scan_cb(
+    edgehog_device_handle_t device, const edgehog_wifi_scan_result_t *result, void *user_data)
+{
+    vTaskDelay(pdMS_TO_TICKS(SCAN_CALLBACK_MS));
+    if (__atomic_load_n((uint32_t *) user_data, __ATOMIC_ACQUIRE) != SUBSCRIBER_ALIVE) {
+        __atomic_fetch_add(&late_scan_callbacks, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&scan_callbacks, 1, __ATOMIC_RELAXED);
+}
+
+// Subscribes to the scans for a random time, then marks its user data as gone
+static void subscriber_task(void *arg)
+{
+    while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        uint32_t *state = malloc(sizeof(uint32_t));
+        if (!state) {
+            break;
+        }
+        *state = SUBSCRIBER_ALIVE;
+        if (edgehog_device_wifi_scan_subscribe(edgehog_device, scan_cb, state) == ESP_OK) {
+            vTaskDelay(pdMS_TO_TICKS(sim_random() % SUBSCRIBED_MAX_MS));
+            edgehog_device_wifi_scan_unsubscribe(edgehog_device, scan_cb, state);
+        }
+        __atomic_store_n(state, SUBSCRIBER_GONE, __ATOMIC_RELEASE);
+        // A late callback reads the state meanwhile instead of freed memory
+        vTaskDelay(pdMS_TO_TICKS(2 * SCAN_CALLBACK_MS));
+        free(state);
+    }
+    xSemaphoreGive(tasks_done);
+    vTaskDelete(NULL);
+}
+
+static void disconnect_task(void *arg)
+{
+    while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        vTaskDelay(pdMS_TO_TICKS(options.disconnect_period_ms));
+        if (__atomic_load_n(&connected, __ATOMIC_RELAXED)) {
+            sim_astarte_disconnect(astarte_device, 1 + sim_random() % 100);
+        }
+    }
+    xSemaphoreGive(tasks_done);
+    vTaskDelete(NULL);
+}
+
+static bool boot(void)
+{
+    static const wifi_ap_record_t aps[] = {
+        { .ssid = "stress", .bssid = { 0x02, 0, 0, 0, 0, 1 }, .primary = 1, .rssi = -45 },
+        { .ssid = "stress", .bssid = { 0x02, 0, 0, 0, 0, 2 }, .primary = 6, .rssi = -60 },
+        { .ssid = "other", .bssid = { 0x02, 0, 0, 0, 0, 3 }, .primary = 11, .rssi = -75 },
+    };
+    sim_wifi_set_aps(chip, aps, sizeof(aps) / sizeof(aps[0]), 0);
+
+    astarte_device_config_t astarte_config = {
+        .data_event_callback = astarte_data_events_handler,
+        .connection_event_callback = astarte_connection_events_handler,
+        .disconnection_event_callback = astarte_disconnection_events_handler,
+        .hwid = "stress-device",
+    };
+    astarte_device = astarte_device_init(&astarte_config);
+    if (!astarte_device) {
+        return false;
+    }
+    edgehog_device_config_t edgehog_config = {
+        .astarte_device = astarte_device,
+        .partition_label = "nvs",
+        .wifi_scan = { .period_s = options.scan_period_s },
+        .system_status_period_s = 1,
+        .metrics_period_s = 1,
+    };
+    edgehog_device = edgehog_device_new(&edgehog_config);
+    if (!edgehog_device) {
+        astarte_device_destroy(astarte_device);
+        return false;
+    }
+    return astarte_device_start(astarte_device) == ASTARTE_OK;
+}
+
+static bool wait_for(bool (*condition)(void))
+{
+    for (int waited_ms = 0; waited_ms < SETTLE_TIMEOUT_MS; waited_ms += SETTLE_POLL_MS) {
+        if (condition()) {
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(SETTLE_POLL_MS));
+    }
+    return condition();
+}
+
+static bool is_connected(void)
+{
+    return __atomic_load_n(&connected, __ATOMIC_RELAXED);
+}
+
+static bool callbacks_done(void)
+{
+    return __atomic_load_n(&async_callbacks, __ATOMIC_RELAXED) >= async_accepted;
+}
+
+static bool tasks_exited(void)
+{
+    sim_chip_enter(chip);
+    UBaseType_t tasks = uxTaskGetNumberOfTasks();
+    sim_chip_leave();
+    return tasks <= expected_tasks;
+}
+
+static uint8_t read_dirty(void)
+{
+    uint8_t dirty = 0;
+    nvs_handle nvs;
+    sim_chip_enter(chip);
+    if (nvs_open_from_partition("nvs", APPLIANCE_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        nvs_get_u8(nvs, APPLIANCE_DIRTY_KEY, &dirty);
+        nvs_close(nvs);
+    }
+    sim_chip_leave();
+    return dirty;
+}
+
+static bool all_sent(void)
+{
+    return is_connected() && read_dirty() == 0;
+}
+
+static void read_stored(field_t field, char stored[VALUE_MAX_LEN])
+{
+    stored[0] = '\0';
+    nvs_handle nvs;
+    sim_chip_enter(chip);
+    if (nvs_open_from_partition("nvs", APPLIANCE_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        size_t len = VALUE_MAX_LEN;
+        nvs_get_str(nvs, fields[field].key, stored, &len);
+        nvs_close(nvs);
+    }
+    sim_chip_leave();
+}
+
+// Returns the number of fields whose stored and published values differ
+static int check_appliance_info(void)
+{
+    int mismatches = 0;
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        char stored[VALUE_MAX_LEN];
+        read_stored(field, stored);
+        portENTER_CRITICAL(&published_lock);
+        bool match = strcmp(stored, published[field]) == 0;
+        printf("  %-14s stored %-14s published %-14s %s\n", fields[field].key, stored,
+            published[field], match ? "ok" : "MISMATCH");
+        portEXIT_CRITICAL(&published_lock);
+        mismatches += !match;
+    }
+    return mismatches;
+}
+
+static void ordering_cb(edgehog_device_handle_t device, esp_err_t publish_result,
+    esp_err_t persist_result, void *user_data)
+{
+    __atomic_store_n((bool *) user_data, true, __ATOMIC_RELEASE);
+}
+
+static bool ordering_job_done;
+
+static bool ordering_job_ran(void)
+{
+    return __atomic_load_n(&ordering_job_done, __ATOMIC_ACQUIRE);
+}
+
+// Returns the number of rounds in which a value set asynchronously overwrote one set afterwards
+static int check_ordering(void)
+{
+    int overwritten = 0;
+    for (int round = 0; round < ORDERING_ROUNDS; round++) {
+        field_t field = round % FIELD_COUNT;
+        char latest[VALUE_MAX_LEN];
+        snprintf(latest, sizeof(latest), "SYNC-%08d", round);
+
+        __atomic_store_n(&ordering_job_done, false, __ATOMIC_RELAXED);
+        sim_chip_enter(chip);
+        esp_err_t ret = field == FIELD_SERIAL_NUMBER
+            ? edgehog_device_set_appliance_serial_number_async(
+                edgehog_device, "ASYNC", ordering_cb, &ordering_job_done)
+            : edgehog_device_set_appliance_part_number_async(
+                edgehog_device, "ASYNC", ordering_cb, &ordering_job_done);
+        if (field == FIELD_SERIAL_NUMBER) {
+            edgehog_device_set_appliance_serial_number(edgehog_device, latest);
+        } else {
+            edgehog_device_set_appliance_part_number(edgehog_device, latest);
+        }
+        sim_chip_leave();
+        if (ret != ESP_OK || !wait_for(ordering_job_ran)) {
+            continue;
+        }
+
+        char stored[VALUE_MAX_LEN];
+        read_stored(field, stored);
+        overwritten += strcmp(stored, latest) != 0;
+    }
+    printf("  ordering       %d of %d asynchronous values overwrote a later one  %s\n",
+        overwritten, ORDERING_ROUNDS, overwritten == 0 ? "ok" : "STALE");
+    return overwritten > 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --tasks N              tasks calling the setters, on alternate cores (8)\n"
+        "  --duration S           time the tasks run, on the host clock (10)\n"
+        "  --async PCT            share of the asynchronous setter calls (50)\n"
+        "  --disconnect-period MS period of the Astarte disconnections, 0 for none (200)\n"
+        "  --scan-period S        WiFi scan period (1)\n"
+        "  --seed N               seed of the simulation (1)\n"
+        "  --log-level N          ESP log level of the device, 0-5 (1)\n",
+        name);
+}
+
+static bool parse_options(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "tasks", required_argument, NULL, 'n' },
+        { "duration", required_argument, NULL, 'd' },
+        { "async", required_argument, NULL, 'a' },
+        { "disconnect-period", required_argument, NULL, 'D' },
+        { "scan-period", required_argument, NULL, 's' },
+        { "seed", required_argument, NULL, 'z' },
+        { "log-level", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                options.tasks = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                options.duration_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                options.async_percent = strtoul(optarg, NULL, 0);
+                break;
+            case 'D':
+                options.disconnect_period_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                options.scan_period_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                options.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                options.log_level = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                return false;
+        }
+    }
+    return optind == argc && options.tasks > 0 && options.duration_s > 0
+        && options.async_percent <= 100 && options.log_level <= ESP_LOG_VERBOSE;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_options(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Concurrency needs the tasks to run in parallel
+    sim_config_t sim_config
+        = { .clock = SIM_CLOCK_REAL, .seed = options.seed, .log_level = options.log_level };
+    sim_init(&sim_config);
+    // Half of the reconnections lose the session, so the properties resync races with the setters
+    sim_astarte_config_t astarte_config = { .connect_delay_ms = 20, .session_loss = 0.5f };
+    sim_astarte_configure(&astarte_config);
+    sim_astarte_set_publish_hook(publish_hook, NULL);
+
+    sim_chip_config_t chip_config = { .name = "stress" };
+    chip = sim_chip_new(&chip_config);
+    tasks_done = xSemaphoreCreateCounting(options.tasks + 1 + SUBSCRIBER_TASKS, 0);
+    setter_task_t *tasks = calloc(options.tasks, sizeof(setter_task_t));
+    if (!chip || !tasks_done || !tasks) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    sim_chip_enter(chip);
+    esp_event_loop_create_default();
+    sim_heap_info_t heap_before;
+    sim_heap_get_info(chip, &heap_before);
+    UBaseType_t boot_tasks = uxTaskGetNumberOfTasks();
+    bool booted = boot();
+    sim_chip_leave();
+    if (!booted || !wait_for(is_connected)) {
+        fprintf(stderr, "Unable to start Edgehog\n");
+        return 1;
+    }
+
+    sim_lock_stats_t locks_before;
+    sim_chip_get_lock_stats(chip, &locks_before);
+    uint64_t cpu_before_us = sim_chip_cpu_us(chip);
+    int64_t start_us = sim_time_us();
+    sim_chip_enter(chip);
+    expected_tasks = uxTaskGetNumberOfTasks();
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < options.tasks; i++) {
+        tasks[i].index = i;
+        started += xTaskCreatePinnedToCore(setter_task, "setter", 4096, &tasks[i], 5, NULL, i % 2)
+            == pdPASS;
+    }
+    if (options.disconnect_period_ms > 0
+        && xTaskCreate(disconnect_task, "disconnect", 4096, NULL, 5, NULL) == pdPASS) {
+        started++;
+    }
+    for (int i = 0; i < SUBSCRIBER_TASKS; i++) {
+        started += xTaskCreate(subscriber_task, "subscriber", 4096, NULL, 5, NULL) == pdPASS;
+    }
+    sim_chip_leave();
+
+    vTaskDelay(pdMS_TO_TICKS(options.duration_s * 1000));
+    __atomic_store_n(&stopping, true, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < started; i++) {
+        xSemaphoreTake(tasks_done, portMAX_DELAY);
+    }
+    // The tasks free their stack in vTaskDelete, after they signalled that they are done
+    wait_for(tasks_exited);
+    int64_t elapsed_us = sim_time_us() - start_us;
+    uint64_t cpu_us = sim_chip_cpu_us(chip) - cpu_before_us;
+    sim_lock_stats_t locks;
+    sim_chip_get_lock_stats(chip, &locks);
+
+    task_stats_t total = { 0 };
+    for (uint32_t i = 0; i < options.tasks; i++) {
+        const task_stats_t *stats = &tasks[i].stats;
+        total.sync_calls += stats->sync_calls;
+        total.sync_failed += stats->sync_failed;
+        total.async_accepted += stats->async_accepted;
+        total.async_rejected += stats->async_rejected;
+        total.scans_acquired += stats->scans_acquired;
+        for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+            total.latency[bucket] += stats->latency[bucket];
+        }
+        if (stats->max_latency_us > total.max_latency_us) {
+            total.max_latency_us = stats->max_latency_us;
+        }
+    }
+    __atomic_store_n(&async_accepted, total.async_accepted, __ATOMIC_RELAXED);
+
+    int failures = 0;
+    // The worker runs the accepted jobs, then the values not sent are sent on the reconnection
+    if (!wait_for(callbacks_done)) {
+        ESP_LOGE(TAG, "Callbacks of the asynchronous setters missing");
+    }
+    if (!wait_for(all_sent)) {
+        ESP_LOGE(TAG, "Appliance info still unsent, dirty 0x%x", read_dirty());
+        failures++;
+    }
+    uint64_t callbacks = __atomic_load_n(&async_callbacks, __ATOMIC_RELAXED);
+
+    printf("%u tasks for %.1f s, %.1f ms of CPU of the chip\n", options.tasks, elapsed_us / 1e6,
+        cpu_us / 1e3);
+    printf("  sync setters   %llu, %.0f/s, %llu failed\n", (unsigned long long) total.sync_calls,
+        total.sync_calls / (elapsed_us / 1e6), (unsigned long long) total.sync_failed);
+    printf("  async setters  %llu accepted, %llu rejected, %llu callbacks, %llu superseded, %llu"
+           " failed publishes\n",
+        (unsigned long long) total.async_accepted, (unsigned long long) total.async_rejected,
+        (unsigned long long) callbacks,
+        (unsigned long long) __atomic_load_n(&async_superseded, __ATOMIC_RELAXED),
+        (unsigned long long) __atomic_load_n(&async_publish_failed, __ATOMIC_RELAXED));
+    printf("  scans acquired %llu\n", (unsigned long long) total.scans_acquired);
+
+    printf("\nSync setter latency\n");
+    uint64_t counted = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        counted += total.latency[bucket];
+        if (total.latency[bucket] > 0) {
+            printf("  < %8llu us %10llu  %5.1f%%\n", 2ULL << bucket,
+                (unsigned long long) total.latency[bucket],
+                100.0 * counted / (total.sync_calls ? total.sync_calls : 1));
+        }
+    }
+    printf("  max %llu us\n", (unsigned long long) total.max_latency_us);
+
+    uint64_t mutex_takes = locks.mutex_takes - locks_before.mutex_takes;
+    uint64_t mutex_contended = locks.mutex_contended - locks_before.mutex_contended;
+    uint64_t critical_entries = locks.critical_entries - locks_before.critical_entries;
+    uint64_t critical_contended = locks.critical_contended - locks_before.critical_contended;
+    printf("\nContention\n");
+    printf("  mutexes            %10llu takes, %5.1f%% contended, %.1f us mean wait\n",
+        (unsigned long long) mutex_takes, 100.0 * mutex_contended / (mutex_takes ? mutex_takes : 1),
+        (double) (locks.mutex_wait_us - locks_before.mutex_wait_us)
+            / (mutex_contended ? mutex_contended : 1));
+    printf("  critical sections  %10llu entries, %5.1f%% contended\n",
+        (unsigned long long) critical_entries,
+        100.0 * critical_contended / (critical_entries ? critical_entries : 1));
+
+    printf("\nChecks\n");
+    failures += check_appliance_info();
+    if (callbacks != total.async_accepted) {
+        printf("  %llu callbacks for %llu accepted asynchronous setters  MISMATCH\n",
+            (unsigned long long) callbacks, (unsigned long long) total.async_accepted);
+        failures++;
+    }
+    failures += check_ordering();
+    uint64_t late = __atomic_load_n(&late_scan_callbacks, __ATOMIC_RELAXED);
+    printf("  unsubscribe    %llu of %llu scan callbacks ran after unsubscribing  %s\n",
+        (unsigned long long) late,
+        (unsigned long long) __atomic_load_n(&scan_callbacks, __ATOMIC_RELAXED),
+        late == 0 ? "ok" : "LATE");
+    failures += late > 0;
+
+    sim_chip_enter(chip);
+    // Destroys the Astarte device too
+    edgehog_device_destroy(edgehog_device);
+    sim_chip_leave();
+    // The worker task exits after edgehog_device_destroy returns
+    expected_tasks = boot_tasks;
+    wait_for(tasks_exited);
+    sim_heap_info_t heap_after;
+    sim_heap_get_info(chip, &heap_after);
+    long long leaked = (long long) heap_before.free - (long long) heap_after.free;
+    printf("  heap           %lld B not freed by edgehog_device_destroy  %s\n", leaked,
+        leaked == 0 ? "ok" : "LEAK");
+    failures += leaked != 0;
+
+    printf("%d failures\n", failures);
+    return failures ? 2 : 0;
+}
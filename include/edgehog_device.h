@@ -28,12 +28,115 @@ extern "C" {
 #include <astarte_device.h>
 #include <esp_err.h>
 
+/**
+ * @brief WiFi scan results source
+ *
+ * @details EDGEHOG_WIFI_SCAN_SOURCE_OWN makes Edgehog use only the scans it starts itself.
+ * EDGEHOG_WIFI_SCAN_SOURCE_OPPORTUNISTIC makes Edgehog collect any completed scan, including the
+ * ones started by the application, and skip its own scans while the latest result is fresh. In
+ * this mode the application should read the results through the edgehog_wifi_scan.h API, since
+ * the WiFi driver hands the AP records only to the first caller of esp_wifi_scan_get_ap_records.
+ */
+typedef enum
+{
+    EDGEHOG_WIFI_SCAN_SOURCE_OWN = 0,
+    EDGEHOG_WIFI_SCAN_SOURCE_OPPORTUNISTIC,
+} edgehog_wifi_scan_source_t;
+
+/**
+ * @brief WiFi scan trigger
+ *
+ * @details EDGEHOG_WIFI_SCAN_TRIGGER_PERIODIC scans every period_s seconds.
+ * EDGEHOG_WIFI_SCAN_TRIGGER_RSSI periodically checks the RSSI of the associated AP, which does not
+ * need a scan, and scans only when it falls below a threshold or degrades since the last scan.
+ * In this mode period_s is the maximum interval between two scans.
+ */
+typedef enum
+{
+    EDGEHOG_WIFI_SCAN_TRIGGER_PERIODIC = 0,
+    EDGEHOG_WIFI_SCAN_TRIGGER_RSSI,
+} edgehog_wifi_scan_trigger_t;
+
+/**
+ * @brief WiFi scan report
+ *
+ * @details EDGEHOG_WIFI_REPORT_ALL_APS publishes every AP found by each scan.
+ * EDGEHOG_WIFI_REPORT_LOCATION_CHANGES computes a compact fingerprint of each scan on the device
+ * and publishes it only when it differs from the previous one, so stationary devices do not send
+ * WiFi data at all. EDGEHOG_WIFI_REPORT_GROUPED_BY_ESSID publishes a single record for each ESSID,
+ * with the number of APs, the strongest BSSID, the channels and the RSSI range, which keeps
+ * reports small on mesh networks advertising the same ESSID from many BSSIDs.
+ */
+typedef enum
+{
+    EDGEHOG_WIFI_REPORT_ALL_APS = 0,
+    EDGEHOG_WIFI_REPORT_LOCATION_CHANGES,
+    EDGEHOG_WIFI_REPORT_GROUPED_BY_ESSID,
+} edgehog_wifi_report_t;
+
+/**
+ * @brief Edgehog WiFi scan configuration struct
+ *
+ * @details period_s is the interval between scheduled scans, 0 means that WiFi is scanned only
+ * when the device is created. freshness_ms is used in opportunistic mode: a scheduled scan is
+ * skipped if the latest result is younger than this, 0 means 30 seconds. When reconnect_hints is
+ * true the best BSSIDs of the configured SSID are persisted, see edgehog_wifi_reconnect_hint_apply.
+ * rssi_threshold and rssi_drop are used by EDGEHOG_WIFI_SCAN_TRIGGER_RSSI: a scan is started when
+ * the RSSI crosses rssi_threshold dBm (0 means -75) or drops by rssi_drop dB since the last scan
+ * (0 means 10), and at least every period_s seconds (0 means one hour). location_similarity is
+ * used by EDGEHOG_WIFI_REPORT_LOCATION_CHANGES: the location changed when the similarity between
+ * two fingerprints is below this percentage, 0 means 60.
+ */
+typedef struct
+{
+    edgehog_wifi_scan_source_t source;
+    edgehog_wifi_scan_trigger_t trigger;
+    edgehog_wifi_report_t report;
+    uint32_t period_s;
+    uint32_t freshness_ms;
+    bool reconnect_hints;
+    int8_t rssi_threshold;
+    uint8_t rssi_drop;
+    uint8_t location_similarity;
+} edgehog_wifi_scan_config_t;
+
+/**
+ * @brief Edgehog health monitor configuration struct
+ *
+ * @details Edgehog samples free heap, task count, WiFi RSSI and CPU load, the latter only when
+ * CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER is set. Each metric keeps an exponentially
+ * weighted mean and variance: while the z-score of its samples crosses z_threshold every sample
+ * is published, otherwise only periodic summaries are.
+ * sample_period_s is the sampling period, 10 seconds when zero.
+ * summary_period_s is the period of the summaries, 900 seconds when zero.
+ * z_threshold is the z-score of an anomaly, 3 when zero.
+ */
+typedef struct
+{
+    uint32_t sample_period_s;
+    uint32_t summary_period_s;
+    float z_threshold;
+} edgehog_monitor_config_t;
+
 /**
  * @brief Edgehog device configuration struct
  *
  * @details This struct is used to collect all the data needed by the edgehog_device_new function.
  * Pay attention that astarte_device is required and must not be null, while partition_label is
  * completely optional. If no partition label is provided, NVS_DEFAULT_PART_NAME will be used.
+ * factory_partition_label is the optional read-only partition holding the factory data written at
+ * manufacturing. The serial and part numbers it provides are published from it and cannot be
+ * changed by the setters.
+ * wifi_scan is optional too, when left zeroed WiFi is scanned only once by Edgehog itself.
+ * system_status_period_s is the period of SystemStatus and of the heap forecast, 600 seconds when
+ * zero. While a heap leak is suspected, they are published 6 times more often.
+ * metrics_period_s is the period of the application metrics samples, 60 seconds when zero.
+ * monitor is optional, see edgehog_monitor_config_t.
+ * event_loop_probe_period_ms is the period of the probes that measure the lag of the default event
+ * loop, published with the metrics. Probes are not posted when it is zero.
+ * backlog_size is the memory used to keep the SystemStatus, heap forecast, WiFi scan and location
+ * change samples while Astarte is unreachable, 16 KiB when zero. The older samples are thinned so
+ * that the whole outage is covered, and they are sent a few at a time once the connection is back.
  * The values provided with this struct are not copied, do not free() them before calling
  * edgehog_device_destroy.
  */
@@ -41,8 +144,27 @@ typedef struct
 {
     astarte_device_handle_t astarte_device;
     const char *partition_label;
+    const char *factory_partition_label;
+    edgehog_wifi_scan_config_t wifi_scan;
+    uint32_t system_status_period_s;
+    uint32_t metrics_period_s;
+    uint32_t event_loop_probe_period_ms;
+    edgehog_monitor_config_t monitor;
+    uint32_t backlog_size;
 } edgehog_device_config_t;
 
+/**
+ * @brief completion callback of the asynchronous setters
+ *
+ * @details publish_result is the outcome of the Astarte publish and persist_result the outcome
+ * of the NVS store. A value that could not be published is still stored and sent on the next
+ * Astarte connection. A value superseded by a later call of a setter of the same field before the
+ * worker ran is neither sent nor stored, and both results are ESP_ERR_INVALID_STATE. The callback
+ * is invoked from the Edgehog worker task.
+ */
+typedef void (*edgehog_device_set_cb_t)(edgehog_device_handle_t edgehog_device,
+    esp_err_t publish_result, esp_err_t persist_result, void *user_data);
+
 /**
  * @brief create Edgehog device handle.
  *
@@ -66,7 +188,8 @@ edgehog_device_handle_t edgehog_device_new(edgehog_device_config_t *config);
 /**
  * @brief destroy Edgehog device.
  *
- * @details This function destroys the device, freeing all its resources.
+ * @details This function destroys the device, freeing all its resources. It must not be called
+ * while other tasks are still using the device.
  * @param edgehog_device A valid Edgehog device handle.
  */
 void edgehog_device_destroy(edgehog_device_handle_t edgehog_device);
@@ -75,6 +198,9 @@ void edgehog_device_destroy(edgehog_device_handle_t edgehog_device);
  * @brief set the appliance serial number
  *
  * @details This function sends the appliance serial number on Astarte and stores it on the nvs.
+ * If it cannot be sent, e.g. because the device is offline, the serial number is stored anyway
+ * and sent on the next Astarte connection, see edgehog_device_astarte_connection_event_handler.
+ * It can be called concurrently from multiple tasks.
  *
  * @param edgehog_device A valid Edgehog device handle.
  * @param serial_num The serial number to be stored
@@ -87,6 +213,9 @@ esp_err_t edgehog_device_set_appliance_serial_number(
  * @brief set the appliance part number
  *
  * @details This function sends the appliance part number on Astarte and stores it on the nvs.
+ * If it cannot be sent, e.g. because the device is offline, the part number is stored anyway
+ * and sent on the next Astarte connection, see edgehog_device_astarte_connection_event_handler.
+ * It can be called concurrently from multiple tasks.
  *
  * @param edgehog_device A valid Edgehog device handle.
  * @param part_num The part number to be stored
@@ -95,6 +224,76 @@ esp_err_t edgehog_device_set_appliance_serial_number(
 esp_err_t edgehog_device_set_appliance_part_number(
     edgehog_device_handle_t edgehog_device, const char *part_num);
 
+/**
+ * @brief handle an Astarte connection event
+ *
+ * @details This function must be called from the connection_event_callback of the Astarte device,
+ * so that Edgehog can send the data that was not sent while the device was offline. When the
+ * broker did not keep the session, all the Edgehog properties are sent again.
+ *
+ * Example:
+ *  static void astarte_connection_events_handler(astarte_device_connection_event_t *event)
+ *  {
+ *      edgehog_device_astarte_connection_event_handler(edgehog_device, event);
+ *  }
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param event The event received by the Astarte connection callback.
+ */
+void edgehog_device_astarte_connection_event_handler(
+    edgehog_device_handle_t edgehog_device, const astarte_device_connection_event_t *event);
+
+/**
+ * @brief handle an Astarte data event
+ *
+ * @details This function must be called from the data_event_callback of the Astarte device, so
+ * that Edgehog can receive the commands sent by the server. Events of interfaces that are not
+ * Edgehog's are ignored, so it can be called for every event.
+ *
+ * Example:
+ *  static void astarte_data_events_handler(astarte_device_data_event_t *event)
+ *  {
+ *      edgehog_device_astarte_event_handler(edgehog_device, event);
+ *  }
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param event The event received by the Astarte data callback.
+ */
+void edgehog_device_astarte_event_handler(
+    edgehog_device_handle_t edgehog_device, const astarte_device_data_event_t *event);
+
+/**
+ * @brief set the appliance serial number without blocking
+ *
+ * @details This function copies the serial number and queues its publish and store, which are
+ * then run by the Edgehog worker task, so the caller never waits for the flash or the network.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param serial_num The serial number to be stored
+ * @param callback An optional callback invoked once the serial number was sent and stored, or
+ * with ESP_ERR_INVALID_STATE if a later call superseded it.
+ * @param user_data An opaque pointer passed to the callback.
+ * @return ESP_OK if the change was queued, an esp_err_t otherwise.
+ */
+esp_err_t edgehog_device_set_appliance_serial_number_async(edgehog_device_handle_t edgehog_device,
+    const char *serial_num, edgehog_device_set_cb_t callback, void *user_data);
+
+/**
+ * @brief set the appliance part number without blocking
+ *
+ * @details This function copies the part number and queues its publish and store, which are
+ * then run by the Edgehog worker task, so the caller never waits for the flash or the network.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param part_num The part number to be stored
+ * @param callback An optional callback invoked once the part number was sent and stored, or
+ * with ESP_ERR_INVALID_STATE if a later call superseded it.
+ * @param user_data An opaque pointer passed to the callback.
+ * @return ESP_OK if the change was queued, an esp_err_t otherwise.
+ */
+esp_err_t edgehog_device_set_appliance_part_number_async(edgehog_device_handle_t edgehog_device,
+    const char *part_num, edgehog_device_set_cb_t callback, void *user_data);
+
 #ifdef __cplusplus
 }
 #endif
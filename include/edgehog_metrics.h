@@ -0,0 +1,120 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_METRICS_H
+#define EDGEHOG_METRICS_H
+
+#include "edgehog_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define EDGEHOG_METRIC_NAME_MAX_LEN 31
+#define EDGEHOG_METRIC_HISTOGRAM_MAX_BOUNDS 7
+
+/**
+ * @brief Edgehog application metric
+ *
+ * @details Metrics are owned by the Edgehog device they are registered on and stay valid until
+ * edgehog_device_destroy. Edgehog samples all of them every metrics_period_s seconds and publishes
+ * them together in a single aggregate.
+ */
+typedef struct edgehog_metric_t *edgehog_metric_handle_t;
+
+/**
+ * @brief register a counter
+ *
+ * @details Each sample contains the increments accumulated since the previous one.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param name The name of the metric, up to EDGEHOG_METRIC_NAME_MAX_LEN characters, copied.
+ * @return The metric handle, NULL if the name is invalid or already used, or if too many metrics
+ * are registered.
+ */
+edgehog_metric_handle_t edgehog_device_metric_register_counter(
+    edgehog_device_handle_t edgehog_device, const char *name);
+
+/**
+ * @brief register a gauge
+ *
+ * @details Each sample contains the last value set.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param name The name of the metric, up to EDGEHOG_METRIC_NAME_MAX_LEN characters, copied.
+ * @return The metric handle, NULL if the name is invalid or already used, or if too many metrics
+ * are registered.
+ */
+edgehog_metric_handle_t edgehog_device_metric_register_gauge(
+    edgehog_device_handle_t edgehog_device, const char *name);
+
+/**
+ * @brief register a histogram
+ *
+ * @details A value is counted in the first bucket whose upper bound is greater or equal to it, an
+ * additional last bucket counts the values above all the bounds. Each sample contains the bucket
+ * counts accumulated since the previous one.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param name The name of the metric, up to EDGEHOG_METRIC_NAME_MAX_LEN characters, copied.
+ * @param bounds The upper bounds of the buckets in ascending order, copied.
+ * @param bound_count The number of bounds, from 1 to EDGEHOG_METRIC_HISTOGRAM_MAX_BOUNDS.
+ * @return The metric handle, NULL if the name or the bounds are invalid, if the name is already
+ * used or if too many metrics are registered.
+ */
+edgehog_metric_handle_t edgehog_device_metric_register_histogram(
+    edgehog_device_handle_t edgehog_device, const char *name, const int32_t *bounds,
+    uint8_t bound_count);
+
+/**
+ * @brief add to a counter
+ *
+ * @details This function does not lock and can be called from any task or from an ISR.
+ *
+ * @param metric A valid counter handle.
+ * @param delta The increment.
+ */
+void edgehog_metric_counter_add(edgehog_metric_handle_t metric, uint32_t delta);
+
+/**
+ * @brief set a gauge
+ *
+ * @details This function does not lock and can be called from any task or from an ISR.
+ *
+ * @param metric A valid gauge handle.
+ * @param value The new value.
+ */
+void edgehog_metric_gauge_set(edgehog_metric_handle_t metric, int32_t value);
+
+/**
+ * @brief record a value in a histogram
+ *
+ * @details This function does not lock and can be called from any task or from an ISR.
+ *
+ * @param metric A valid histogram handle.
+ * @param value The value to be counted.
+ */
+void edgehog_metric_histogram_record(edgehog_metric_handle_t metric, int32_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_METRICS_H
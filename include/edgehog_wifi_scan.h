@@ -0,0 +1,132 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_WIFI_SCAN_H
+#define EDGEHOG_WIFI_SCAN_H
+
+#include "edgehog_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <esp_err.h>
+#include <esp_wifi_types.h>
+#include <stdint.h>
+
+/**
+ * @brief Edgehog WiFi scan result
+ *
+ * @details A result is shared by Edgehog and all its users without copies: it must be treated as
+ * read only and it stays valid until it is released with edgehog_wifi_scan_result_release.
+ */
+typedef struct
+{
+    uint32_t sequence_number;
+    int64_t timestamp_us;
+    uint16_t ap_count;
+    const wifi_ap_record_t *ap_records;
+} edgehog_wifi_scan_result_t;
+
+/**
+ * @brief WiFi scan subscription callback
+ *
+ * @details The callback is invoked from the default event loop task every time Edgehog collects
+ * new scan results, so it must not block. The result is valid only during the call, use
+ * edgehog_device_wifi_scan_acquire to keep it longer.
+ */
+typedef void (*edgehog_wifi_scan_cb_t)(edgehog_device_handle_t edgehog_device,
+    const edgehog_wifi_scan_result_t *result, void *user_data);
+
+/**
+ * @brief acquire the latest WiFi scan result
+ *
+ * @details This function gives access to the latest scan collected by Edgehog, so the application
+ * does not need to start its own scans. Each acquired result must be released with
+ * edgehog_wifi_scan_result_release.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return The latest scan result, NULL if no scan was collected yet.
+ */
+const edgehog_wifi_scan_result_t *edgehog_device_wifi_scan_acquire(
+    edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief release a WiFi scan result
+ *
+ * @param result A result returned by edgehog_device_wifi_scan_acquire.
+ */
+void edgehog_wifi_scan_result_release(const edgehog_wifi_scan_result_t *result);
+
+/**
+ * @brief get the age of a WiFi scan result
+ *
+ * @param result A valid scan result.
+ * @return The milliseconds elapsed since the scan was completed.
+ */
+int64_t edgehog_wifi_scan_result_get_age_ms(const edgehog_wifi_scan_result_t *result);
+
+/**
+ * @brief subscribe to the WiFi scans collected by Edgehog
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param callback The function invoked at every new scan result.
+ * @param user_data An opaque pointer passed to the callback.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if there are too many subscribers.
+ */
+esp_err_t edgehog_device_wifi_scan_subscribe(
+    edgehog_device_handle_t edgehog_device, edgehog_wifi_scan_cb_t callback, void *user_data);
+
+/**
+ * @brief unsubscribe from the WiFi scans collected by Edgehog
+ *
+ * @details Once this function returns the callback is not running and will not be invoked again,
+ * so its user data can be freed. If a scan is being notified the function waits for its
+ * callbacks to return: it must not be called holding a lock a callback takes. It can be called
+ * from a callback, which does not wait.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param callback The callback passed to edgehog_device_wifi_scan_subscribe.
+ * @param user_data The user data passed to edgehog_device_wifi_scan_subscribe.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the subscription does not exist.
+ */
+esp_err_t edgehog_device_wifi_scan_unsubscribe(
+    edgehog_device_handle_t edgehog_device, edgehog_wifi_scan_cb_t callback, void *user_data);
+
+/**
+ * @brief fill a station configuration with the best known AP for its SSID
+ *
+ * @details When reconnect hints are enabled in edgehog_wifi_scan_config_t, Edgehog keeps track of
+ * the best BSSIDs seen in its scans for the configured SSID and persists them on the NVS. This
+ * function sets bssid, bssid_set and channel of wifi_config so that the driver can skip the full
+ * channel scan when associating. It does not need an Edgehog device, so it can be used right
+ * after a deep sleep wake up. If the connection with the hint fails, the application should clear
+ * bssid_set and channel and retry.
+ *
+ * @param partition_label The NVS partition used by Edgehog, NULL for NVS_DEFAULT_PART_NAME.
+ * @param wifi_config A station configuration with the SSID already set.
+ * @return ESP_OK if a hint was applied, ESP_ERR_NOT_FOUND if no hint is known for the SSID.
+ */
+esp_err_t edgehog_wifi_reconnect_hint_apply(
+    const char *partition_label, wifi_config_t *wifi_config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_WIFI_SCAN_H
@@ -0,0 +1,66 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_ANOMALY_DETECTOR_H
+#define EDGEHOG_ANOMALY_DETECTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief EWMA anomaly detector
+ *
+ * @details Tracks the exponentially weighted mean and variance of a metric. A sample whose z-score
+ * crosses the threshold makes the metric anomalous, until a few samples in a row come back within
+ * a lower threshold. The standard deviation is floored, so that a metric that stays constant for a
+ * while does not become anomalous on the smallest change it can make.
+ */
+typedef struct
+{
+    double min_stddev;
+    double min_relative_stddev;
+    double mean;
+    double variance;
+    double z_score;
+    uint32_t samples;
+    uint8_t calm_samples;
+    bool anomalous;
+} edgehog_anomaly_detector_t;
+
+/**
+ * @brief initialize an anomaly detector.
+ *
+ * @param detector The detector to be initialized.
+ * @param min_stddev The floor of the standard deviation, e.g. the quantum of an integer metric.
+ * @param min_relative_stddev The floor of the standard deviation relative to the absolute mean.
+ */
+void edgehog_anomaly_detector_init(
+    edgehog_anomaly_detector_t *detector, double min_stddev, double min_relative_stddev);
+
+/**
+ * @brief add a sample to an anomaly detector.
+ *
+ * @param detector A valid detector.
+ * @param value The sample.
+ * @param z_threshold The z-score that makes the metric anomalous.
+ * @return true if the metric is anomalous after the sample.
+ */
+bool edgehog_anomaly_detector_update(
+    edgehog_anomaly_detector_t *detector, double value, double z_threshold);
+
+#endif // EDGEHOG_ANOMALY_DETECTOR_H
@@ -0,0 +1,106 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_BACKLOG_H
+#define EDGEHOG_BACKLOG_H
+
+#include "edgehog_device.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct edgehog_backlog_entry;
+
+typedef struct
+{
+    // Serializes the access to the entries, not taken while publishing
+    SemaphoreHandle_t lock;
+    // Oldest first
+    struct edgehog_backlog_entry *head;
+    struct edgehog_backlog_entry *tail;
+    uint32_t count;
+    size_t bytes;
+    size_t max_bytes;
+    // Samples dropped to make room, since boot
+    uint32_t thinned;
+    // One shot, armed again by each batch with the current period
+    esp_timer_handle_t replay_timer;
+    // Adapted to the publish latency, reset at each connection
+    size_t batch_bytes;
+    uint32_t period_ms;
+} edgehog_backlog_t;
+
+/**
+ * @brief initialize the backlog of an Edgehog device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param max_bytes The memory that the kept samples can use.
+ * @return ESP_OK on success, an esp_err_t otherwise.
+ */
+esp_err_t edgehog_backlog_init(edgehog_device_handle_t edgehog_device, size_t max_bytes);
+
+/**
+ * @brief stop the replay of the backlog of an Edgehog device.
+ *
+ * @details Call it before stopping the worker, and edgehog_backlog_destroy after.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_backlog_stop(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief free the samples kept by the backlog of an Edgehog device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_backlog_destroy(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief keep an aggregate that could not be sent.
+ *
+ * @details When the backlog is full, every other sample of each stream is dropped among the
+ * samples that went through the fewest thinnings, so it covers the whole outage with a resolution
+ * that decreases with the age of the samples. The aggregates with the same sample time, e.g. the
+ * APs of a scan, are kept or dropped together.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param interface_name The name of the interface, not copied.
+ * @param path The path of the aggregate, not copied.
+ * @param doc The BSON document of the aggregate, copied.
+ * @param sample_time_us The esp_timer_get_time() value when the sample was taken.
+ * @return true if the aggregate was kept, false if there is no backlog or memory for it.
+ */
+bool edgehog_backlog_push(edgehog_device_handle_t edgehog_device, const char *interface_name,
+    const char *path, const void *doc, int64_t sample_time_us);
+
+/**
+ * @brief start sending the kept samples, a few at a time.
+ *
+ * @details Batches start small and grow while the publishes are fast, they shrink and get further
+ * apart when a publish is slow. A batch gives way as soon as other jobs are waiting for the
+ * worker. A publish that fails while still connected halves the batch and waits for the longest
+ * period. The replay stops when the backlog is empty or when a publish fails while disconnected.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_backlog_start_replay(edgehog_device_handle_t edgehog_device);
+
+#endif // EDGEHOG_BACKLOG_H
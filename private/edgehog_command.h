@@ -0,0 +1,39 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_COMMAND_H
+#define EDGEHOG_COMMAND_H
+
+#include "edgehog_device.h"
+
+extern const astarte_interface_t edgehog_command_interface;
+
+/**
+ * @brief handle a command sent by the server.
+ *
+ * @details The command is run by the worker, so this function can be called from the Astarte
+ * data event callback.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param command The name of the command.
+ * @return ESP_OK if the command was queued, ESP_ERR_NOT_FOUND if it is unknown, ESP_ERR_TIMEOUT if
+ * the worker is busy.
+ */
+esp_err_t edgehog_command_dispatch(edgehog_device_handle_t edgehog_device, const char *command);
+
+#endif // EDGEHOG_COMMAND_H
@@ -0,0 +1,130 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_DEVICE_PRIVATE_H
+#define EDGEHOG_DEVICE_PRIVATE_H
+
+#include "edgehog_backlog.h"
+#include "edgehog_device.h"
+#include "edgehog_event_loop_monitor.h"
+#include "edgehog_factory_data.h"
+#include "edgehog_heap_predictor.h"
+#include "edgehog_load_stats.h"
+#include "edgehog_metrics_registry.h"
+#include "edgehog_monitor.h"
+#include "edgehog_nvs_stats.h"
+#include "edgehog_property_cache.h"
+#include "edgehog_soak.h"
+#include "edgehog_wifi_fingerprint.h"
+#include "edgehog_wifi_reconnect_hint.h"
+#include "edgehog_wifi_scan_cache.h"
+#include <esp_event.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+struct edgehog_device_t
+{
+    char boot_id[38];
+    astarte_device_handle_t astarte_device;
+    const char *partition_name;
+    TaskHandle_t worker_task;
+    QueueHandle_t worker_queue;
+    edgehog_property_cache_t property_cache;
+    // Serializes the appliance info setters
+    SemaphoreHandle_t appliance_lock;
+    // Numbers the appliance info setter calls, including the asynchronous ones when they are made
+    uint32_t appliance_calls;
+    // Number of the call whose value is stored, per appliance info field, an older one is dropped
+    uint32_t appliance_stored_call[2];
+    // Appliance info from the factory data not sent yet since boot, one bit per field
+    uint8_t appliance_factory_pending;
+    // Jobs of a connection the worker had no room for, retried by the timer until queued
+    uint8_t connection_jobs_pending;
+    esp_timer_handle_t connection_jobs_timer;
+    // Protects the WiFi scan scheduling state shared by the timer and the event loop
+    portMUX_TYPE wifi_scan_lock;
+    edgehog_wifi_scan_config_t wifi_scan_config;
+    edgehog_wifi_scan_cache_t wifi_scan_cache;
+    esp_timer_handle_t wifi_scan_timer;
+    esp_event_handler_instance_t wifi_scan_done_handler;
+    bool wifi_scan_pending;
+    int64_t wifi_last_scan_us;
+    int8_t wifi_rssi_baseline;
+    bool wifi_rssi_baseline_valid;
+    edgehog_wifi_reconnect_hints_t wifi_reconnect_hints;
+    edgehog_wifi_fingerprint_t wifi_fingerprint;
+    bool wifi_fingerprint_valid;
+    edgehog_metrics_registry_t metrics;
+    edgehog_load_stats_t load_stats;
+    edgehog_event_loop_monitor_t event_loop_monitor;
+    esp_timer_handle_t system_status_timer;
+    uint32_t system_status_period_s;
+    // SystemStatus is published faster because a heap leak is suspected
+    bool system_status_fast;
+    edgehog_heap_predictor_t heap_predictor;
+    edgehog_monitor_t monitor;
+    edgehog_nvs_stats_t nvs_stats;
+    // Mapped for the lifetime of the device, the appliance info is cached in place
+    edgehog_factory_data_t factory_data;
+    edgehog_backlog_t backlog;
+#ifdef CONFIG_EDGEHOG_SOAK
+    edgehog_soak_t soak;
+#endif
+};
+
+/**
+ * @brief stream an aggregate of an Edgehog device, with a timestamp if known.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param interface_name The name of the interface.
+ * @param path The path of the aggregate.
+ * @param doc The BSON document of the aggregate.
+ * @param timestamp_ms The epoch of the sample in ms, 0 to let Astarte timestamp it on reception.
+ * @return ASTARTE_OK on success, an astarte_err_t otherwise.
+ */
+astarte_err_t edgehog_device_stream_aggregate(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const void *doc, uint64_t timestamp_ms);
+
+/**
+ * @brief stream a sample of an Edgehog device, keeping it in the backlog if it cannot be sent.
+ *
+ * @details Used for the periodic samples whose history is worth sending after an outage. The kept
+ * samples are replayed on the next connection, timestamped from their monotonic time.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param interface_name The name of the interface, a static string.
+ * @param path The path of the aggregate, a static string.
+ * @param doc The BSON document of the aggregate.
+ * @param sample_time_us The esp_timer_get_time() value when the sample was taken. The aggregates
+ * of the same sample, e.g. the APs of a scan, must share it.
+ * @return ASTARTE_OK if the sample was sent or kept in the backlog, an astarte_err_t otherwise.
+ */
+astarte_err_t edgehog_device_stream_sample(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const void *doc, int64_t sample_time_us);
+
+/**
+ * @brief publish the HardwareInfo properties of an Edgehog device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_device_publish_hardware_info(edgehog_device_handle_t edgehog_device);
+
+#endif // EDGEHOG_DEVICE_PRIVATE_H
@@ -0,0 +1,66 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_EVENT_LOOP_MONITOR_H
+#define EDGEHOG_EVENT_LOOP_MONITOR_H
+
+#include "edgehog_device.h"
+#include "edgehog_metrics.h"
+#include <esp_event.h>
+#include <esp_timer.h>
+
+typedef struct
+{
+    edgehog_metric_handle_t handler_us;
+    edgehog_metric_handle_t lag_us;
+    edgehog_metric_handle_t probe_drops;
+    esp_timer_handle_t probe_timer;
+    esp_event_handler_instance_t probe_handler;
+} edgehog_event_loop_monitor_t;
+
+/**
+ * @brief start monitoring the default event loop.
+ *
+ * @details The execution time of the Edgehog handlers is always measured. When probe_period_ms
+ * is not zero, a probe event is also posted periodically to measure how long the events wait in
+ * the loop before being dispatched. The histograms are published with the application metrics.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param probe_period_ms The period of the probe events, 0 to not post them.
+ * @return ESP_OK on success, an esp_err_t otherwise.
+ */
+esp_err_t edgehog_event_loop_monitor_start(
+    edgehog_device_handle_t edgehog_device, uint32_t probe_period_ms);
+
+/**
+ * @brief stop monitoring the default event loop.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_event_loop_monitor_stop(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief record the execution time of an Edgehog event handler.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param start_us The esp_timer_get_time() at the start of the handler.
+ */
+void edgehog_event_loop_monitor_record_handler(
+    edgehog_device_handle_t edgehog_device, int64_t start_us);
+
+#endif // EDGEHOG_EVENT_LOOP_MONITOR_H
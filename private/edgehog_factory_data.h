@@ -0,0 +1,95 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_FACTORY_DATA_H
+#define EDGEHOG_FACTORY_DATA_H
+
+#include <esp_err.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include <esp_partition.h>
+#endif
+
+/*
+ * The factory data partition is written at manufacturing and never written by the firmware.
+ * Its layout is little endian:
+ *
+ *   uint32_t magic      0x44464845, "EHFD"
+ *   uint8_t  version    1
+ *   uint8_t  reserved[3]
+ *   uint32_t length     bytes of the records that follow the header
+ *   uint32_t crc32      CRC-32 (IEEE, as zlib) of the records
+ *
+ * followed by records made of a uint8_t tag, a uint8_t length and the value. String values
+ * include their NUL terminator, so they are used in place. Unknown tags are skipped.
+ */
+
+typedef enum
+{
+    EDGEHOG_FACTORY_DATA_SERIAL_NUMBER = 1,
+    EDGEHOG_FACTORY_DATA_PART_NUMBER = 2,
+} edgehog_factory_data_tag_t;
+
+typedef struct
+{
+    // Records in the mapping, NULL when the partition is not mapped
+    const uint8_t *records;
+    uint32_t records_len;
+    const void *mapping;
+    size_t mapping_len;
+#ifndef CONFIG_IDF_TARGET_LINUX
+    spi_flash_mmap_handle_t mmap_handle;
+#endif
+} edgehog_factory_data_t;
+
+/**
+ * @brief map a factory data partition and check its records.
+ *
+ * @details On Linux the label is the path of a file holding the partition image.
+ *
+ * @param partition_label The label of the partition.
+ * @param factory_data The factory data to be opened.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND when there is no such partition,
+ * ESP_ERR_INVALID_CRC or ESP_ERR_INVALID_VERSION when its content is not valid factory data, an
+ * esp_err_t otherwise.
+ */
+esp_err_t edgehog_factory_data_open(
+    const char *partition_label, edgehog_factory_data_t *factory_data);
+
+/**
+ * @brief unmap a factory data partition.
+ *
+ * @details The values returned by edgehog_factory_data_get_string are no longer valid.
+ *
+ * @param factory_data Factory data opened with edgehog_factory_data_open, or zeroed.
+ */
+void edgehog_factory_data_close(edgehog_factory_data_t *factory_data);
+
+/**
+ * @brief get a string value of the factory data, without copying it.
+ *
+ * @param factory_data Factory data opened with edgehog_factory_data_open, or zeroed.
+ * @param tag The tag of the record.
+ * @return A NUL terminated string in the mapped partition, valid until
+ * edgehog_factory_data_close, or NULL when the record is missing.
+ */
+const char *edgehog_factory_data_get_string(
+    const edgehog_factory_data_t *factory_data, edgehog_factory_data_tag_t tag);
+
+#endif // EDGEHOG_FACTORY_DATA_H
@@ -0,0 +1,80 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_HEAP_PREDICTOR_H
+#define EDGEHOG_HEAP_PREDICTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief streaming linear trend of the free heap
+ *
+ * @details The trend is a least squares fit whose samples lose weight exponentially with their
+ * age, so a leak is detected whatever the sampling period and the fit follows the recent behavior.
+ */
+typedef struct
+{
+    int64_t origin_us;
+    int64_t last_us;
+    // Weighted sums of the fit, times are in hours from origin_us
+    double sw;
+    double swt;
+    double swy;
+    double swtt;
+    double swty;
+    // Running mean of the absolute residuals, used to reject outliers
+    double residual_scale;
+    uint32_t samples;
+    uint8_t rejected_in_row;
+    bool leak_suspected;
+} edgehog_heap_predictor_t;
+
+typedef struct
+{
+    // Free heap according to the trend
+    double free_bytes;
+    double slope_bytes_per_hour;
+    // -1 if the free heap is not decreasing
+    int64_t time_to_exhaustion_s;
+    bool leak_suspected;
+    bool outlier;
+} edgehog_heap_forecast_t;
+
+/**
+ * @brief initialize a heap predictor.
+ *
+ * @param predictor The predictor to be initialized.
+ */
+void edgehog_heap_predictor_init(edgehog_heap_predictor_t *predictor);
+
+/**
+ * @brief add a free heap sample and compute the forecast.
+ *
+ * @details A sample far from the trend is considered an outlier and does not update it, unless
+ * more of them come in a row, which means that the heap usage changed level.
+ *
+ * @param predictor A valid predictor.
+ * @param time_us The esp_timer_get_time() of the sample.
+ * @param free_bytes The free heap.
+ * @param forecast The forecast after the sample.
+ */
+void edgehog_heap_predictor_update(edgehog_heap_predictor_t *predictor, int64_t time_us,
+    uint32_t free_bytes, edgehog_heap_forecast_t *forecast);
+
+#endif // EDGEHOG_HEAP_PREDICTOR_H
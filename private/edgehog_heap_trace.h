@@ -0,0 +1,43 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_HEAP_TRACE_H
+#define EDGEHOG_HEAP_TRACE_H
+
+#include "edgehog_device.h"
+
+#ifdef CONFIG_EDGEHOG_HEAP_TRACE
+
+extern const astarte_interface_t edgehog_heap_trace_interface;
+
+/**
+ * @brief start a heap trace session.
+ *
+ * @details This is a worker job, it is run by the StartHeapTrace command. The allocations made
+ * during CONFIG_EDGEHOG_HEAP_TRACE_DURATION_S seconds and not freed by its end are grouped by
+ * call site and uploaded, then tracing is disabled. Only one session runs at a time, and the
+ * device must not be destroyed before it ends.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param arg Unused.
+ */
+void edgehog_heap_trace_start(edgehog_device_handle_t edgehog_device, void *arg);
+
+#endif
+
+#endif // EDGEHOG_HEAP_TRACE_H
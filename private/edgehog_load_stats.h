@@ -0,0 +1,78 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_LOAD_STATS_H
+#define EDGEHOG_LOAD_STATS_H
+
+#include "edgehog_device.h"
+#include "edgehog_metrics.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Sizes of the BSON documents built by the Astarte SDK around the published values
+#define EDGEHOG_LOAD_STATS_STRING_PROPERTY_BYTES(len) ((len) + 13)
+#define EDGEHOG_LOAD_STATS_LONGINTEGER_PROPERTY_BYTES 16
+#define EDGEHOG_LOAD_STATS_AGGREGATE_BYTES(doc_len) ((doc_len) + 8)
+#define EDGEHOG_LOAD_STATS_TIMESTAMPED_AGGREGATE_BYTES(doc_len) ((doc_len) + 19)
+
+typedef struct
+{
+    edgehog_metric_handle_t publishes;
+    edgehog_metric_handle_t bytes;
+    edgehog_metric_handle_t payload_bytes;
+    edgehog_metric_handle_t job_wall_us;
+#ifdef CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+    edgehog_metric_handle_t worker_cpu_us;
+    uint32_t last_worker_run_time;
+#endif
+} edgehog_load_stats_t;
+
+/**
+ * @brief register the metrics of the load an Edgehog device puts on Astarte and on its CPU.
+ *
+ * @details They are published with the application metrics: the publishes and their BSON payload
+ * bytes, the payload size distribution, the wall time of the worker jobs and, when FreeRTOS keeps
+ * the run time stats, the CPU time of the worker task. The wall time includes the delays some jobs
+ * pace their publishes with, only the CPU time measures the cost on the device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the metrics could not be registered.
+ */
+esp_err_t edgehog_load_stats_init(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief account a publish to Astarte.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param bytes The size of the BSON payload.
+ */
+void edgehog_load_stats_record_publish(edgehog_device_handle_t edgehog_device, size_t bytes);
+
+/**
+ * @brief account the wall time of a worker job and the CPU time used by the worker since the last
+ * one.
+ *
+ * @details Must be called from the worker task. The run time stats of the running task are only
+ * updated when it is switched out, so the CPU time of a job is accounted with the following ones.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param start_us The esp_timer_get_time() value taken when the job started.
+ */
+void edgehog_load_stats_record_job(edgehog_device_handle_t edgehog_device, int64_t start_us);
+
+#endif // EDGEHOG_LOAD_STATS_H
@@ -0,0 +1,83 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_METRICS_REGISTRY_H
+#define EDGEHOG_METRICS_REGISTRY_H
+
+#include "edgehog_device.h"
+#include "edgehog_metrics.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+#define EDGEHOG_METRICS_MAX 20
+
+typedef enum
+{
+    EDGEHOG_METRIC_COUNTER = 0,
+    EDGEHOG_METRIC_GAUGE,
+    EDGEHOG_METRIC_HISTOGRAM,
+} edgehog_metric_type_t;
+
+struct edgehog_metric_t
+{
+    char name[EDGEHOG_METRIC_NAME_MAX_LEN + 1];
+    edgehog_metric_type_t type;
+    // Running total of a counter, or the last value of a gauge
+    uint32_t value;
+    // Counter total at the previous sample, used only by the publisher
+    uint32_t sampled_value;
+    uint8_t bound_count;
+    int32_t bounds[EDGEHOG_METRIC_HISTOGRAM_MAX_BOUNDS];
+    uint32_t buckets[EDGEHOG_METRIC_HISTOGRAM_MAX_BOUNDS + 1];
+};
+
+typedef struct
+{
+    // Serializes the registrations, updates and samples do not take it
+    portMUX_TYPE lock;
+    uint8_t count;
+    esp_timer_handle_t timer;
+    struct edgehog_metric_t metrics[EDGEHOG_METRICS_MAX];
+} edgehog_metrics_registry_t;
+
+extern const astarte_interface_t edgehog_metrics_interface;
+
+/**
+ * @brief initialize the metrics registry of an Edgehog device.
+ *
+ * @param registry The registry to be initialized.
+ */
+void edgehog_metrics_init(edgehog_metrics_registry_t *registry);
+
+/**
+ * @brief start publishing the metrics of an Edgehog device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param period_s The sampling period in seconds.
+ * @return ESP_OK on success, an esp_err_t otherwise.
+ */
+esp_err_t edgehog_metrics_start(edgehog_device_handle_t edgehog_device, uint32_t period_s);
+
+/**
+ * @brief stop publishing the metrics of an Edgehog device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_metrics_stop(edgehog_device_handle_t edgehog_device);
+
+#endif // EDGEHOG_METRICS_REGISTRY_H
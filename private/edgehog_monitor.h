@@ -0,0 +1,82 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_MONITOR_H
+#define EDGEHOG_MONITOR_H
+
+#include "edgehog_anomaly_detector.h"
+#include "edgehog_device.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+typedef enum
+{
+    EDGEHOG_MONITOR_FREE_HEAP = 0,
+    EDGEHOG_MONITOR_TASK_COUNT,
+    EDGEHOG_MONITOR_WIFI_RSSI,
+    EDGEHOG_MONITOR_CPU_LOAD,
+    EDGEHOG_MONITOR_COUNT
+} edgehog_monitored_metric_t;
+
+typedef struct
+{
+    double sum;
+    double min;
+    double max;
+    uint32_t count;
+    uint32_t anomalous_count;
+} edgehog_monitor_summary_t;
+
+typedef struct
+{
+    edgehog_monitor_config_t config;
+    esp_timer_handle_t timer;
+    // Start of the period of the summaries, in esp_timer time
+    int64_t summary_start_us;
+    edgehog_anomaly_detector_t detectors[EDGEHOG_MONITOR_COUNT];
+    edgehog_monitor_summary_t summaries[EDGEHOG_MONITOR_COUNT];
+    // State of the CPU load sampling
+    int64_t last_sample_us;
+    uint32_t last_idle_run_time[portNUM_PROCESSORS];
+} edgehog_monitor_t;
+
+extern const astarte_interface_t edgehog_monitor_samples_interface;
+extern const astarte_interface_t edgehog_monitor_summaries_interface;
+
+/**
+ * @brief start monitoring the health metrics of an Edgehog device.
+ *
+ * @details Every metric is sampled every sample_period_s seconds. Its samples are published one
+ * by one only while it is anomalous, otherwise only a summary is published every
+ * summary_period_s seconds.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param config The monitor configuration, with the defaults already applied.
+ * @return ESP_OK on success, an esp_err_t otherwise.
+ */
+esp_err_t edgehog_monitor_start(
+    edgehog_device_handle_t edgehog_device, const edgehog_monitor_config_t *config);
+
+/**
+ * @brief stop monitoring the health metrics of an Edgehog device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_monitor_stop(edgehog_device_handle_t edgehog_device);
+
+#endif // EDGEHOG_MONITOR_H
@@ -0,0 +1,91 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_NVS_STATS_H
+#define EDGEHOG_NVS_STATS_H
+
+#include "edgehog_device.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EDGEHOG_NVS_STATS_MAX_KEYS 8
+
+typedef struct
+{
+    // NVS namespaces and keys are at most 15 characters
+    char namespace_name[16];
+    char key[16];
+    uint32_t writes;
+    uint32_t bytes;
+    // Estimated 32 bytes NVS entries written
+    uint32_t entries;
+} edgehog_nvs_key_stats_t;
+
+// Persisted as a single blob
+typedef struct
+{
+    uint8_t version;
+    // Seconds of uptime covered by the statistics, across reboots
+    uint32_t accounted_s;
+    edgehog_nvs_key_stats_t keys[EDGEHOG_NVS_STATS_MAX_KEYS];
+} edgehog_nvs_stats_data_t;
+
+typedef struct
+{
+    // Protects data and unsaved_writes, NVS is never accessed while holding it
+    portMUX_TYPE lock;
+    edgehog_nvs_stats_data_t data;
+    int64_t accounted_since_us;
+    uint32_t unsaved_writes;
+    esp_timer_handle_t timer;
+} edgehog_nvs_stats_t;
+
+extern const astarte_interface_t edgehog_storage_health_interface;
+
+/**
+ * @brief load the NVS write statistics of an Edgehog device and start publishing them.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return ESP_OK on success, an esp_err_t otherwise.
+ */
+esp_err_t edgehog_nvs_stats_start(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief stop publishing the NVS write statistics of an Edgehog device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_nvs_stats_stop(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief account a successful NVS write of Edgehog.
+ *
+ * @details The statistics are persisted by the worker once enough writes are accounted, this
+ * function does not access the NVS, so it can be called with a NVS handle open.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param namespace_name The NVS namespace.
+ * @param key The NVS key.
+ * @param bytes The size of the value, including the terminator of strings.
+ */
+void edgehog_nvs_stats_record(edgehog_device_handle_t edgehog_device, const char *namespace_name,
+    const char *key, size_t bytes);
+
+#endif // EDGEHOG_NVS_STATS_H
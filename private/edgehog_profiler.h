@@ -0,0 +1,43 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_PROFILER_H
+#define EDGEHOG_PROFILER_H
+
+#include "edgehog_device.h"
+
+#ifdef CONFIG_EDGEHOG_PROFILER
+
+extern const astarte_interface_t edgehog_profiler_interface;
+
+/**
+ * @brief start a sampling profiler session.
+ *
+ * @details This is a worker job, it is run by the StartProfiler command. The interrupted PC and
+ * task of each core are sampled at every FreeRTOS tick for CONFIG_EDGEHOG_PROFILER_DURATION_S
+ * seconds, then the histogram is uploaded and freed. Only one session runs at a time, and the
+ * device must not be destroyed before it ends.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param arg Unused.
+ */
+void edgehog_profiler_start(edgehog_device_handle_t edgehog_device, void *arg);
+
+#endif
+
+#endif // EDGEHOG_PROFILER_H
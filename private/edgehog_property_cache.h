@@ -0,0 +1,154 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_PROPERTY_CACHE_H
+#define EDGEHOG_PROPERTY_CACHE_H
+
+#include "edgehog_device.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#define EDGEHOG_PROPERTY_CACHE_SIZE 16
+
+typedef enum
+{
+    EDGEHOG_PROPERTY_STRING,
+    // A string that is not owned by the cache
+    EDGEHOG_PROPERTY_STATIC_STRING,
+    EDGEHOG_PROPERTY_LONGINTEGER,
+} edgehog_property_type_t;
+
+typedef struct
+{
+    const char *interface_name;
+    const char *path;
+    edgehog_property_type_t type;
+    union
+    {
+        char *string;
+        const char *static_string;
+        long long longinteger;
+    } value;
+} edgehog_property_t;
+
+typedef struct
+{
+    SemaphoreHandle_t lock;
+    // Held across the store and the publish of a value, and across the publish of a resend, so a
+    // resend cannot overwrite on Astarte a newer value sent by a setter
+    SemaphoreHandle_t publish_lock;
+    int count;
+    edgehog_property_t properties[EDGEHOG_PROPERTY_CACHE_SIZE];
+} edgehog_property_cache_t;
+
+/**
+ * @brief initialize the property cache of an Edgehog device.
+ *
+ * @param cache The cache to be initialized.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM otherwise.
+ */
+esp_err_t edgehog_property_cache_init(edgehog_property_cache_t *cache);
+
+/**
+ * @brief destroy the property cache of an Edgehog device.
+ *
+ * @param cache A valid cache.
+ */
+void edgehog_property_cache_destroy(edgehog_property_cache_t *cache);
+
+/**
+ * @brief store the value of a device owned string property, without sending it.
+ *
+ * @details interface_name and path are not copied, they must be static strings.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param interface_name The name of the interface.
+ * @param path The path of the property.
+ * @param value The value, which is copied.
+ */
+void edgehog_property_cache_store_string(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const char *value);
+
+/**
+ * @brief store the value of a device owned string property without copying it, nor sending it.
+ *
+ * @details interface_name, path and value are not copied, they must outlive the device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param interface_name The name of the interface.
+ * @param path The path of the property.
+ * @param value The value.
+ */
+void edgehog_property_cache_store_static_string(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const char *value);
+
+/**
+ * @brief send a string property and store its value in the cache.
+ *
+ * @details interface_name and path are not copied, they must be static strings.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param interface_name The name of the interface.
+ * @param path The path of the property.
+ * @param value The value of the property.
+ * @return The result of astarte_device_set_string_property.
+ */
+astarte_err_t edgehog_property_set_string(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const char *value);
+
+/**
+ * @brief send a string property and store its value in the cache without copying it.
+ *
+ * @details interface_name, path and value are not copied, they must outlive the device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param interface_name The name of the interface.
+ * @param path The path of the property.
+ * @param value The value of the property.
+ * @return The result of astarte_device_set_string_property.
+ */
+astarte_err_t edgehog_property_set_static_string(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const char *value);
+
+/**
+ * @brief send a longinteger property and store its value in the cache.
+ *
+ * @details interface_name and path are not copied, they must be static strings.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param interface_name The name of the interface.
+ * @param path The path of the property.
+ * @param value The value of the property.
+ * @return The result of astarte_device_set_longinteger_property.
+ */
+astarte_err_t edgehog_property_set_longinteger(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, long long value);
+
+/**
+ * @brief send again all the cached properties.
+ *
+ * @details The properties are sent one at a time with a short pause in between, so a new session
+ * does not flood the MQTT outbox. The setters wait only for the publish of the property being
+ * resent, not for the whole resend. It is meant to be run by the Edgehog worker.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param arg Unused.
+ */
+void edgehog_property_cache_resend(edgehog_device_handle_t edgehog_device, void *arg);
+
+#endif // EDGEHOG_PROPERTY_CACHE_H
@@ -0,0 +1,120 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_RECORDER_H
+#define EDGEHOG_RECORDER_H
+
+#include "edgehog_device.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Recorded inputs are uploaded as a sequence of records, each made of a little endian int64_t
+ * esp_timer_get_time() timestamp, a uint8_t type, a uint8_t length and the payload.
+ */
+typedef enum
+{
+    // payload: edgehog_record_event_t, followed by the event data for the WiFi scan done event
+    EDGEHOG_RECORD_EVENT = 1,
+    // payload: edgehog_record_wifi_ap_t, one record for each AP of a scan
+    EDGEHOG_RECORD_WIFI_AP,
+    // payload: the int64_t system time in microseconds read by edgehog_time
+    EDGEHOG_RECORD_TIME,
+    // payload: the int32_t astarte_err_t of a publish
+    EDGEHOG_RECORD_ASTARTE_RESULT,
+    // payload: the int32_t session_present of an Astarte connection
+    EDGEHOG_RECORD_ASTARTE_CONNECTION,
+    // payload: the command received on the Commands interface, without terminator
+    EDGEHOG_RECORD_ASTARTE_COMMAND,
+    // payload: the int32_t esp_err_t of an NVS commit
+    EDGEHOG_RECORD_NVS_RESULT,
+} edgehog_record_type_t;
+
+typedef enum
+{
+    EDGEHOG_RECORD_EVENT_BASE_OTHER = 0,
+    EDGEHOG_RECORD_EVENT_BASE_WIFI,
+} edgehog_record_event_base_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t base;
+    int32_t id;
+} edgehog_record_event_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+    uint8_t authmode;
+    uint8_t ssid_len;
+    uint8_t ssid[32];
+} edgehog_record_wifi_ap_t;
+
+#ifdef CONFIG_EDGEHOG_RECORDER
+
+extern const astarte_interface_t edgehog_recording_interface;
+
+/**
+ * @brief record an input of Edgehog.
+ *
+ * @details Records are shared by all the Edgehog devices and kept in a ring buffer, the oldest
+ * ones are overwritten. This function can be called from any task, but not from an ISR. Use the
+ * EDGEHOG_RECORD macros so that it is compiled out when recording is disabled.
+ *
+ * @param type The type of the record.
+ * @param data The payload, copied.
+ * @param len The length of the payload, at most 255 bytes.
+ */
+void edgehog_recorder_record(edgehog_record_type_t type, const void *data, size_t len);
+
+/**
+ * @brief record the result code of an operation.
+ *
+ * @param type The type of the record.
+ * @param result The result code.
+ */
+void edgehog_recorder_record_result(edgehog_record_type_t type, int32_t result);
+
+/**
+ * @brief upload the records kept since the previous upload.
+ *
+ * @details This is a worker job, it is run by the UploadRecording command. The records are removed
+ * from the ring only once sent, so an upload interrupted by a failed publish can be repeated.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param arg Unused.
+ */
+void edgehog_recorder_upload(edgehog_device_handle_t edgehog_device, void *arg);
+
+#define EDGEHOG_RECORD(type, data, len) edgehog_recorder_record((type), (data), (len))
+#define EDGEHOG_RECORD_RESULT(type, result) edgehog_recorder_record_result((type), (result))
+
+#else
+
+#define EDGEHOG_RECORD(type, data, len)                                                            \
+    do {                                                                                           \
+    } while (0)
+#define EDGEHOG_RECORD_RESULT(type, result)                                                        \
+    do {                                                                                           \
+    } while (0)
+
+#endif
+
+#endif // EDGEHOG_RECORDER_H
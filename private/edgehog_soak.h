@@ -0,0 +1,102 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_SOAK_H
+#define EDGEHOG_SOAK_H
+
+#include "edgehog_device.h"
+#include <esp_timer.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef CONFIG_EDGEHOG_SOAK
+// Periods are shortened so that a soak run exercises days of periodic work in hours
+#define EDGEHOG_SOAK_PERIOD_S(period_s)                                                            \
+    ((period_s) >= CONFIG_EDGEHOG_SOAK_TIME_SCALE ? (period_s) / CONFIG_EDGEHOG_SOAK_TIME_SCALE : 1)
+#else
+#define EDGEHOG_SOAK_PERIOD_S(period_s) (period_s)
+#endif
+
+#ifdef CONFIG_EDGEHOG_SOAK
+typedef struct
+{
+    // Driver state, used by the worker only
+    esp_timer_handle_t timer;
+    uint32_t steps;
+    bool astarte_stopped;
+
+    // Check state, used by the SystemStatus sampling only
+    uint32_t samples;
+    // Lowest used heap of the current window of samples
+    size_t window_used_floor;
+    size_t previous_used_floor;
+    int64_t previous_window_end_us;
+    // Consecutive windows whose used heap floor grew faster than the threshold
+    uint32_t growing_in_row;
+    size_t lowest_largest_free_block;
+    // Consecutive samples whose largest free block was a new low
+    uint32_t shrinking_in_row;
+    bool failed;
+} edgehog_soak_t;
+
+/**
+ * @brief start the soak driver of an Edgehog device.
+ *
+ * @details The driver calls the appliance info setters, updates the HardwareInfo properties and
+ * stops and restarts the Astarte device from the worker, every CONFIG_EDGEHOG_SOAK_DRIVE_PERIOD_S.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return ESP_OK on success, an esp_err_t otherwise.
+ */
+esp_err_t edgehog_soak_start(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief stop the soak driver of an Edgehog device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_soak_stop(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief check the heap of a soak run at each SystemStatus sample.
+ *
+ * @details The samples are grouped in windows, whose lowest used heap filters out the transient
+ * allocations. After a warm-up, the run fails when that floor grows faster than
+ * CONFIG_EDGEHOG_SOAK_MAX_GROWTH for CONFIG_EDGEHOG_SOAK_GROWTH_WINDOWS windows in a row, or when
+ * the largest free block keeps shrinking, which is a sign of fragmentation. A failed run is logged
+ * and, if CONFIG_EDGEHOG_SOAK_ABORT is set, aborted so that the test rig records it.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param sample_time_us The uptime of the sample.
+ * @param used_bytes The used heap of the sample.
+ * @param largest_free_block The largest free block of the sample.
+ */
+void edgehog_soak_check(edgehog_device_handle_t edgehog_device, int64_t sample_time_us,
+    size_t used_bytes, size_t largest_free_block);
+
+/**
+ * @brief check whether the soak run of an Edgehog device failed.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return true if a check failed, false otherwise.
+ */
+bool edgehog_soak_failed(edgehog_device_handle_t edgehog_device);
+#endif
+
+#endif // EDGEHOG_SOAK_H
@@ -0,0 +1,53 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_TIME_H
+#define EDGEHOG_TIME_H
+
+#include <stdint.h>
+
+/**
+ * @brief initialize the Edgehog time sync subsystem.
+ *
+ * @details This function starts SNTP (unless CONFIG_EDGEHOG_SNTP is disabled or the application
+ * already started it) and hooks the sync notification used to calibrate the monotonic clock
+ * against the wall clock. It can safely be called more than once.
+ */
+void edgehog_time_init(void);
+
+/**
+ * @brief convert a monotonic timestamp to milliseconds since the Unix epoch.
+ *
+ * @details The conversion uses the last wall clock reference and the estimated drift of
+ * esp_timer_get_time, so timestamps captured before the first sync of the current boot are
+ * converted correctly as soon as a sync happens. The reference is taken again from the system time
+ * every few minutes, so syncs done by an SNTP client owned by the application are picked up too.
+ *
+ * @param monotonic_us A timestamp obtained from esp_timer_get_time.
+ * @return The epoch timestamp in milliseconds, 0 if the wall clock is not known yet.
+ */
+uint64_t edgehog_time_monotonic_to_epoch_ms(int64_t monotonic_us);
+
+/**
+ * @brief get the current time in milliseconds since the Unix epoch.
+ *
+ * @return The epoch timestamp in milliseconds, 0 if the wall clock is not known yet.
+ */
+uint64_t edgehog_time_get_epoch_ms(void);
+
+#endif // EDGEHOG_TIME_H
@@ -0,0 +1,112 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_TRACE_H
+#define EDGEHOG_TRACE_H
+
+#include "edgehog_device.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum
+{
+    EDGEHOG_TRACE_DEVICE_NEW_BEGIN = 0,
+    EDGEHOG_TRACE_DEVICE_NEW_END,
+    // arg: the esp_err_t of esp_wifi_scan_start
+    EDGEHOG_TRACE_WIFI_SCAN_START,
+    // arg: the number of APs found
+    EDGEHOG_TRACE_WIFI_SCAN_DONE,
+    // arg: the number of APs published
+    EDGEHOG_TRACE_PUBLISH_WIFI_AP_BEGIN,
+    EDGEHOG_TRACE_PUBLISH_WIFI_AP_END,
+    EDGEHOG_TRACE_SERIALIZE_BEGIN,
+    // arg: the size of the BSON document
+    EDGEHOG_TRACE_SERIALIZE_END,
+    EDGEHOG_TRACE_PUBLISH_BEGIN,
+    // arg: the astarte_err_t of the publish
+    EDGEHOG_TRACE_PUBLISH_END,
+    EDGEHOG_TRACE_NVS_COMMIT_BEGIN,
+    // arg: the esp_err_t of nvs_commit
+    EDGEHOG_TRACE_NVS_COMMIT_END,
+} edgehog_trace_event_t;
+
+/**
+ * @brief Edgehog trace entry
+ *
+ * @details Entries are uploaded as they are laid out in memory, i.e. 16 bytes little endian each.
+ */
+typedef struct
+{
+    int64_t timestamp_us;
+    uint32_t event;
+    uint32_t arg;
+} edgehog_trace_entry_t;
+
+#ifdef CONFIG_EDGEHOG_TRACE
+
+extern const astarte_interface_t edgehog_trace_interface;
+
+/**
+ * @brief record a trace point in the ring buffer of the current core.
+ *
+ * @details This function does not lock and can be called from any task or from an ISR, use the
+ * EDGEHOG_TRACE macro so that it is compiled out when tracing is disabled.
+ *
+ * @param event The event.
+ * @param arg An event specific argument.
+ */
+void edgehog_trace_record(edgehog_trace_event_t event, uint32_t arg);
+
+/**
+ * @brief upload the trace points recorded since the previous upload.
+ *
+ * @details This is a worker job, it is run by the UploadTrace command.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param arg Unused.
+ */
+void edgehog_trace_upload(edgehog_device_handle_t edgehog_device, void *arg);
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+
+/**
+ * @brief write the trace points kept in the ring buffers as a Chrome trace.
+ *
+ * @details Only available in the host build. The output is the JSON object format of the Chrome
+ * trace event format, it can be loaded in chrome://tracing or Perfetto: the BEGIN and END events
+ * are durations, the other ones instant events, and each core is a thread.
+ *
+ * @param file The file to write to.
+ * @return true on success, false if the file could not be written.
+ */
+bool edgehog_trace_dump_chrome(FILE *file);
+
+#endif
+
+#define EDGEHOG_TRACE(event, arg) edgehog_trace_record((event), (uint32_t) (arg))
+
+#else
+
+#define EDGEHOG_TRACE(event, arg)                                                                  \
+    do {                                                                                           \
+    } while (0)
+
+#endif
+
+#endif // EDGEHOG_TRACE_H
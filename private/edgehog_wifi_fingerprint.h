@@ -0,0 +1,75 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_WIFI_FINGERPRINT_H
+#define EDGEHOG_WIFI_FINGERPRINT_H
+
+#include "edgehog_wifi_scan.h"
+
+#define EDGEHOG_WIFI_FINGERPRINT_MAX_APS 16
+// Each AP is packed as a little endian 32 bit BSSID hash followed by an 8 bit weight
+#define EDGEHOG_WIFI_FINGERPRINT_PACKED_AP_SIZE 5
+
+typedef struct
+{
+    uint32_t bssid_hash;
+    uint8_t weight;
+} edgehog_wifi_fingerprint_ap_t;
+
+/**
+ * @brief WiFi location fingerprint
+ *
+ * @details The strongest APs of a scan, sorted by BSSID hash, weighted by their quantized RSSI.
+ */
+typedef struct
+{
+    uint8_t ap_count;
+    edgehog_wifi_fingerprint_ap_t aps[EDGEHOG_WIFI_FINGERPRINT_MAX_APS];
+} edgehog_wifi_fingerprint_t;
+
+/**
+ * @brief compute the location fingerprint of a scan.
+ *
+ * @param scan_result A valid scan result.
+ * @param fingerprint The computed fingerprint.
+ */
+void edgehog_wifi_fingerprint_compute(
+    const edgehog_wifi_scan_result_t *scan_result, edgehog_wifi_fingerprint_t *fingerprint);
+
+/**
+ * @brief compute the similarity of two fingerprints.
+ *
+ * @details The similarity is the weighted Jaccard index of the two AP sets.
+ *
+ * @param a A valid fingerprint.
+ * @param b A valid fingerprint.
+ * @return The similarity in percent, 100 if the fingerprints are identical.
+ */
+int edgehog_wifi_fingerprint_similarity(
+    const edgehog_wifi_fingerprint_t *a, const edgehog_wifi_fingerprint_t *b);
+
+/**
+ * @brief pack a fingerprint into a compact binary representation.
+ *
+ * @param fingerprint A valid fingerprint.
+ * @param out A buffer of at least EDGEHOG_WIFI_FINGERPRINT_MAX_APS * 5 bytes.
+ * @return The number of bytes written.
+ */
+int edgehog_wifi_fingerprint_pack(const edgehog_wifi_fingerprint_t *fingerprint, uint8_t *out);
+
+#endif // EDGEHOG_WIFI_FINGERPRINT_H
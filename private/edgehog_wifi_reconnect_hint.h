@@ -0,0 +1,61 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_WIFI_RECONNECT_HINT_H
+#define EDGEHOG_WIFI_RECONNECT_HINT_H
+
+#include "edgehog_wifi_scan.h"
+
+#define EDGEHOG_WIFI_RECONNECT_HINT_MAX_APS 4
+
+typedef struct
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+    uint8_t misses;
+} edgehog_wifi_reconnect_hint_ap_t;
+
+typedef struct
+{
+    uint8_t version;
+    uint8_t ssid[32];
+    uint8_t ap_count;
+    edgehog_wifi_reconnect_hint_ap_t aps[EDGEHOG_WIFI_RECONNECT_HINT_MAX_APS];
+} edgehog_wifi_reconnect_hints_t;
+
+/**
+ * @brief load the persisted reconnect hints of an Edgehog device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_wifi_reconnect_hint_load(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief update the reconnect hints with a new scan result.
+ *
+ * @details The hints are persisted only when the best AP changes, so the flash is not written at
+ * every scan.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param scan_result A valid scan result.
+ */
+void edgehog_wifi_reconnect_hint_update(
+    edgehog_device_handle_t edgehog_device, const edgehog_wifi_scan_result_t *scan_result);
+
+#endif // EDGEHOG_WIFI_RECONNECT_HINT_H
@@ -0,0 +1,76 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_WIFI_SCAN_CACHE_H
+#define EDGEHOG_WIFI_SCAN_CACHE_H
+
+#include "edgehog_wifi_scan.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#define EDGEHOG_WIFI_SCAN_MAX_SUBSCRIBERS 4
+
+struct edgehog_wifi_scan_snapshot;
+
+typedef struct
+{
+    edgehog_wifi_scan_cb_t callback;
+    void *user_data;
+} edgehog_wifi_scan_subscriber_t;
+
+typedef struct
+{
+    portMUX_TYPE lock;
+    struct edgehog_wifi_scan_snapshot *latest;
+    uint32_t sequence_number;
+    edgehog_wifi_scan_subscriber_t subscribers[EDGEHOG_WIFI_SCAN_MAX_SUBSCRIBERS];
+    // Held while the subscribers are notified, unsubscribing waits for it
+    SemaphoreHandle_t notify_lock;
+    // Task notifying the subscribers, a callback unsubscribing runs in it and does not wait
+    TaskHandle_t notifier;
+} edgehog_wifi_scan_cache_t;
+
+/**
+ * @brief initialize the WiFi scan cache of an Edgehog device.
+ *
+ * @param cache The cache to be initialized.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM otherwise.
+ */
+esp_err_t edgehog_wifi_scan_cache_init(edgehog_wifi_scan_cache_t *cache);
+
+/**
+ * @brief destroy the WiFi scan cache, dropping the reference to the latest result.
+ *
+ * @param cache A valid cache.
+ */
+void edgehog_wifi_scan_cache_destroy(edgehog_wifi_scan_cache_t *cache);
+
+/**
+ * @brief collect the results of a completed scan.
+ *
+ * @details This function moves the AP records out of the WiFi driver into a new cached result
+ * and notifies the subscribers.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return The new result, already acquired for the caller, NULL if an error occurred.
+ */
+const edgehog_wifi_scan_result_t *edgehog_wifi_scan_cache_collect(
+    edgehog_device_handle_t edgehog_device);
+
+#endif // EDGEHOG_WIFI_SCAN_CACHE_H
@@ -0,0 +1,69 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDGEHOG_WORKER_H
+#define EDGEHOG_WORKER_H
+
+#include "edgehog_device.h"
+#include <esp_err.h>
+#include <stdbool.h>
+
+typedef void (*edgehog_worker_job_t)(edgehog_device_handle_t edgehog_device, void *arg);
+
+/**
+ * @brief start the worker task of an Edgehog device.
+ *
+ * @details The worker runs the jobs that would otherwise block the caller or the event loop,
+ * e.g. NVS writes and Astarte publishes, one at a time in submission order.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return ESP_OK on success, an esp_err_t otherwise.
+ */
+esp_err_t edgehog_worker_start(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief stop the worker task of an Edgehog device.
+ *
+ * @details The jobs already submitted are run before the worker stops.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_worker_stop(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief submit a job to the worker task, without blocking.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param job The function to be run by the worker.
+ * @param arg An opaque pointer passed to the job.
+ * @return ESP_OK if the job was queued, ESP_ERR_TIMEOUT if the queue is full.
+ */
+esp_err_t edgehog_worker_submit(
+    edgehog_device_handle_t edgehog_device, edgehog_worker_job_t job, void *arg);
+
+/**
+ * @brief check whether jobs are waiting for the worker task.
+ *
+ * @details Long jobs can use it to give way to the jobs submitted after them.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return true if at least one job is queued, false otherwise.
+ */
+bool edgehog_worker_pending(edgehog_device_handle_t edgehog_device);
+
+#endif // EDGEHOG_WORKER_H
@@ -0,0 +1,70 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_anomaly_detector.h"
+#include <math.h>
+#include <string.h>
+
+// Weight of a new sample in the mean and the variance
+#define EWMA_ALPHA 0.05
+// Samples needed before the statistics are trusted
+#define WARMUP_SAMPLES 20
+// The metric is back to normal after this many samples in a row below half the threshold
+#define CALM_SAMPLES 5
+
+void edgehog_anomaly_detector_init(
+    edgehog_anomaly_detector_t *detector, double min_stddev, double min_relative_stddev)
+{
+    memset(detector, 0, sizeof(edgehog_anomaly_detector_t));
+    detector->min_stddev = min_stddev;
+    detector->min_relative_stddev = min_relative_stddev;
+}
+
+bool edgehog_anomaly_detector_update(
+    edgehog_anomaly_detector_t *detector, double value, double z_threshold)
+{
+    if (detector->samples == 0) {
+        detector->mean = value;
+        detector->samples = 1;
+        return false;
+    }
+
+    double diff = value - detector->mean;
+    double stddev = sqrt(detector->variance);
+    double min_stddev = detector->min_relative_stddev * fabs(detector->mean);
+    min_stddev = min_stddev > detector->min_stddev ? min_stddev : detector->min_stddev;
+    detector->z_score = fabs(diff) / (stddev > min_stddev ? stddev : min_stddev);
+
+    if (detector->samples >= WARMUP_SAMPLES) {
+        if (detector->z_score >= z_threshold) {
+            detector->anomalous = true;
+            detector->calm_samples = 0;
+        } else if (detector->anomalous && detector->z_score >= z_threshold / 2) {
+            detector->calm_samples = 0;
+        } else if (detector->anomalous && ++detector->calm_samples >= CALM_SAMPLES) {
+            detector->anomalous = false;
+        }
+    }
+
+    // The statistics keep adapting during an anomaly, so a lasting change becomes the new normal
+    double increment = EWMA_ALPHA * diff;
+    detector->mean += increment;
+    detector->variance = (1 - EWMA_ALPHA) * (detector->variance + diff * increment);
+    detector->samples++;
+    return detector->anomalous;
+}
@@ -0,0 +1,354 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_backlog.h"
+#include "edgehog_device_private.h"
+#include "edgehog_time.h"
+#include "edgehog_worker.h"
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Samples are sent in small batches, so the replay does not burst after a reconnection. The batch
+// size grows additively while the publishes are fast, and is halved when one is slow.
+#define REPLAY_PERIOD_MS 250
+#define REPLAY_MAX_PERIOD_MS 8000
+#define REPLAY_MIN_BATCH_BYTES 512
+#define REPLAY_MAX_BATCH_BYTES 4096
+#define REPLAY_BATCH_STEP_BYTES 512
+// The samples are sent with QoS 0, a publish blocks while the MQTT client cannot write
+#define REPLAY_SLOW_PUBLISH_US 100000
+// Distinct streams thinned independently, others are thinned together
+#define MAX_STREAMS 4
+
+static const char *TAG = "EDGEHOG_BACKLOG";
+
+struct edgehog_backlog_entry
+{
+    struct edgehog_backlog_entry *next;
+    const char *interface_name;
+    const char *path;
+    // The sample time, shared by the aggregates of the same sample
+    int64_t monotonic_us;
+    // Times the entry survived a thinning
+    uint8_t level;
+    size_t doc_len;
+    uint8_t doc[];
+};
+
+static size_t entry_size(const struct edgehog_backlog_entry *entry)
+{
+    return sizeof(struct edgehog_backlog_entry) + entry->doc_len;
+}
+
+// Must be called with the backlog lock held, returns the number of samples dropped.
+// Every other sample of each stream among the entries at the given level is dropped, the others
+// are moved to the next level. The entries of the sample being pushed are left alone, so that all
+// its aggregates stay at the same level.
+static uint32_t thin_level(edgehog_backlog_t *backlog, uint8_t level, int64_t pushed_us)
+{
+    struct
+    {
+        const char *interface_name;
+        const char *path;
+        // Entries of the same stream and sample, e.g. the APs of a scan, are thinned together
+        int64_t monotonic_us;
+        bool keep;
+    } streams[MAX_STREAMS] = { 0 };
+    int stream_count = 0;
+    uint32_t dropped = 0;
+
+    struct edgehog_backlog_entry **link = &backlog->head;
+    struct edgehog_backlog_entry *previous = NULL;
+    while (*link) {
+        struct edgehog_backlog_entry *entry = *link;
+        if (entry->level != level || entry->monotonic_us == pushed_us) {
+            previous = entry;
+            link = &entry->next;
+            continue;
+        }
+
+        int stream = 0;
+        while (stream < stream_count
+            && (streams[stream].interface_name != entry->interface_name
+                || streams[stream].path != entry->path)) {
+            stream++;
+        }
+        if (stream == stream_count) {
+            if (stream_count < MAX_STREAMS) {
+                stream_count++;
+            } else {
+                stream = MAX_STREAMS - 1;
+            }
+            streams[stream].interface_name = entry->interface_name;
+            streams[stream].path = entry->path;
+            streams[stream].monotonic_us = entry->monotonic_us;
+            streams[stream].keep = true;
+        } else if (streams[stream].monotonic_us != entry->monotonic_us) {
+            streams[stream].monotonic_us = entry->monotonic_us;
+            streams[stream].keep = !streams[stream].keep;
+            dropped += streams[stream].keep ? 0 : 1;
+        }
+
+        if (streams[stream].keep) {
+            entry->level++;
+            previous = entry;
+            link = &entry->next;
+            continue;
+        }
+        *link = entry->next;
+        backlog->count--;
+        backlog->bytes -= entry_size(entry);
+        free(entry);
+    }
+    backlog->tail = previous;
+    return dropped;
+}
+
+// Must be called with the backlog lock held, returns the number of samples dropped
+static uint32_t thin(edgehog_backlog_t *backlog, int64_t pushed_us)
+{
+    uint8_t min_level = UINT8_MAX;
+    uint8_t max_level = 0;
+    for (struct edgehog_backlog_entry *entry = backlog->head; entry; entry = entry->next) {
+        min_level = entry->level < min_level ? entry->level : min_level;
+        max_level = entry->level > max_level ? entry->level : max_level;
+    }
+    // The newest samples are at the lowest level, so the oldest are the sparsest
+    for (int level = min_level; level <= max_level && level < UINT8_MAX; level++) {
+        uint32_t dropped = thin_level(backlog, level, pushed_us);
+        if (dropped > 0) {
+            return dropped;
+        }
+    }
+    return 0;
+}
+
+// Must be called with the backlog lock held
+static void drop_head(edgehog_backlog_t *backlog)
+{
+    struct edgehog_backlog_entry *entry = backlog->head;
+    backlog->head = entry->next;
+    if (!backlog->head) {
+        backlog->tail = NULL;
+    }
+    backlog->count--;
+    backlog->bytes -= entry_size(entry);
+    free(entry);
+}
+
+bool edgehog_backlog_push(edgehog_device_handle_t edgehog_device, const char *interface_name,
+    const char *path, const void *doc, int64_t sample_time_us)
+{
+    edgehog_backlog_t *backlog = &edgehog_device->backlog;
+    if (!doc) {
+        return false;
+    }
+    // A BSON document starts with its little endian length
+    int32_t doc_len;
+    memcpy(&doc_len, doc, sizeof(doc_len));
+
+    size_t size = sizeof(struct edgehog_backlog_entry) + doc_len;
+    if (!backlog->lock || doc_len <= 0 || size > backlog->max_bytes) {
+        return false;
+    }
+    struct edgehog_backlog_entry *entry = malloc(size);
+    if (!entry) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return false;
+    }
+    entry->next = NULL;
+    entry->interface_name = interface_name;
+    entry->path = path;
+    entry->monotonic_us = sample_time_us;
+    entry->level = 0;
+    entry->doc_len = doc_len;
+    memcpy(entry->doc, doc, doc_len);
+
+    xSemaphoreTake(backlog->lock, portMAX_DELAY);
+    while (backlog->count > 0 && backlog->bytes + size > backlog->max_bytes) {
+        uint32_t dropped = thin(backlog, sample_time_us);
+        if (dropped == 0) {
+            // Nothing left to thin, e.g. a single sample per stream
+            drop_head(backlog);
+            dropped = 1;
+        }
+        backlog->thinned += dropped;
+    }
+    if (backlog->tail) {
+        backlog->tail->next = entry;
+    } else {
+        backlog->head = entry;
+    }
+    backlog->tail = entry;
+    backlog->count++;
+    backlog->bytes += size;
+    xSemaphoreGive(backlog->lock);
+    return true;
+}
+
+static void replay_batch(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    edgehog_backlog_t *backlog = &edgehog_device->backlog;
+
+    xSemaphoreTake(backlog->lock, portMAX_DELAY);
+    size_t batch_bytes = backlog->batch_bytes;
+    uint32_t period_ms = backlog->period_ms;
+    xSemaphoreGive(backlog->lock);
+
+    size_t sent_bytes = 0;
+    bool slow = false;
+    // Live samples queued meanwhile are sent first, the batch goes on at the next period
+    while (sent_bytes < batch_bytes && !slow && !edgehog_worker_pending(edgehog_device)) {
+        xSemaphoreTake(backlog->lock, portMAX_DELAY);
+        struct edgehog_backlog_entry *entry = backlog->head;
+        if (entry) {
+            backlog->head = entry->next;
+            if (!backlog->head) {
+                backlog->tail = NULL;
+            }
+            backlog->count--;
+            backlog->bytes -= entry_size(entry);
+        }
+        xSemaphoreGive(backlog->lock);
+        if (!entry) {
+            ESP_LOGI(TAG, "Backlog sent, %u samples were thinned", (unsigned) backlog->thinned);
+            return;
+        }
+
+        // Samples taken before the first clock sync get their timestamp now
+        uint64_t timestamp_ms = edgehog_time_monotonic_to_epoch_ms(entry->monotonic_us);
+        int64_t start_us = esp_timer_get_time();
+        astarte_err_t ret = edgehog_device_stream_aggregate(
+            edgehog_device, entry->interface_name, entry->path, entry->doc, timestamp_ms);
+        if (ret != ASTARTE_OK) {
+            // Put it back in front, the next connection starts the replay again
+            xSemaphoreTake(backlog->lock, portMAX_DELAY);
+            entry->next = backlog->head;
+            backlog->head = entry;
+            if (!backlog->tail) {
+                backlog->tail = entry;
+            }
+            backlog->count++;
+            backlog->bytes += entry_size(entry);
+            if (astarte_device_is_connected(edgehog_device->astarte_device)) {
+                // Still connected, the MQTT outbox is likely full, back off and try again
+                backlog->batch_bytes = batch_bytes / 2 > REPLAY_MIN_BATCH_BYTES
+                    ? batch_bytes / 2
+                    : REPLAY_MIN_BATCH_BYTES;
+                backlog->period_ms = REPLAY_MAX_PERIOD_MS;
+                esp_timer_start_once(backlog->replay_timer, REPLAY_MAX_PERIOD_MS * 1000ULL);
+            }
+            xSemaphoreGive(backlog->lock);
+            return;
+        }
+        slow = esp_timer_get_time() - start_us > REPLAY_SLOW_PUBLISH_US;
+        sent_bytes += entry->doc_len;
+        free(entry);
+    }
+
+    if (slow) {
+        batch_bytes /= 2;
+        period_ms *= 2;
+    } else if (sent_bytes >= batch_bytes) {
+        // A batch cut short by live jobs says nothing about the link
+        batch_bytes += REPLAY_BATCH_STEP_BYTES;
+        period_ms /= 2;
+    }
+    batch_bytes = batch_bytes < REPLAY_MIN_BATCH_BYTES ? REPLAY_MIN_BATCH_BYTES : batch_bytes;
+    batch_bytes = batch_bytes > REPLAY_MAX_BATCH_BYTES ? REPLAY_MAX_BATCH_BYTES : batch_bytes;
+    period_ms = period_ms < REPLAY_PERIOD_MS ? REPLAY_PERIOD_MS : period_ms;
+    period_ms = period_ms > REPLAY_MAX_PERIOD_MS ? REPLAY_MAX_PERIOD_MS : period_ms;
+    xSemaphoreTake(backlog->lock, portMAX_DELAY);
+    backlog->batch_bytes = batch_bytes;
+    backlog->period_ms = period_ms;
+    xSemaphoreGive(backlog->lock);
+    esp_timer_start_once(backlog->replay_timer, period_ms * 1000ULL);
+}
+
+static void replay_timer_cb(void *arg)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+    edgehog_backlog_t *backlog = &edgehog_device->backlog;
+
+    if (edgehog_worker_submit(edgehog_device, replay_batch, NULL) == ESP_ERR_TIMEOUT) {
+        ESP_LOGW(TAG, "Worker busy, backlog batch delayed");
+        esp_timer_start_once(backlog->replay_timer, backlog->period_ms * 1000ULL);
+    }
+}
+
+esp_err_t edgehog_backlog_init(edgehog_device_handle_t edgehog_device, size_t max_bytes)
+{
+    edgehog_backlog_t *backlog = &edgehog_device->backlog;
+
+    memset(backlog, 0, sizeof(edgehog_backlog_t));
+    backlog->max_bytes = max_bytes;
+    backlog->lock = xSemaphoreCreateMutex();
+    if (!backlog->lock) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = replay_timer_cb,
+        .arg = edgehog_device,
+        .name = "edgehog_backlog",
+    };
+    return esp_timer_create(&timer_args, &backlog->replay_timer);
+}
+
+void edgehog_backlog_start_replay(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_backlog_t *backlog = &edgehog_device->backlog;
+
+    if (!backlog->replay_timer || __atomic_load_n(&backlog->count, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+    // The link may be slower than before the outage, the pace is learnt again
+    xSemaphoreTake(backlog->lock, portMAX_DELAY);
+    backlog->batch_bytes = REPLAY_MIN_BATCH_BYTES;
+    backlog->period_ms = REPLAY_PERIOD_MS;
+    xSemaphoreGive(backlog->lock);
+    // Already armed if a previous replay did not complete
+    esp_timer_start_once(backlog->replay_timer, REPLAY_PERIOD_MS * 1000ULL);
+}
+
+void edgehog_backlog_stop(edgehog_device_handle_t edgehog_device)
+{
+    if (edgehog_device->backlog.replay_timer) {
+        esp_timer_stop(edgehog_device->backlog.replay_timer);
+    }
+}
+
+void edgehog_backlog_destroy(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_backlog_t *backlog = &edgehog_device->backlog;
+
+    if (backlog->replay_timer) {
+        // A queued batch may have been run after edgehog_backlog_stop
+        esp_timer_stop(backlog->replay_timer);
+        esp_timer_delete(backlog->replay_timer);
+        backlog->replay_timer = NULL;
+    }
+    while (backlog->head) {
+        drop_head(backlog);
+    }
+    if (backlog->lock) {
+        vSemaphoreDelete(backlog->lock);
+        backlog->lock = NULL;
+    }
+}
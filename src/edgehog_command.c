@@ -0,0 +1,71 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_command.h"
+#include "edgehog_heap_trace.h"
+#include "edgehog_profiler.h"
+#include "edgehog_recorder.h"
+#include "edgehog_trace.h"
+#include "edgehog_worker.h"
+#include <esp_log.h>
+#include <string.h>
+
+static const char *TAG = "EDGEHOG_COMMAND";
+
+const astarte_interface_t edgehog_command_interface
+    = { .name = "io.edgehog.devicemanager.Commands",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_SERVER,
+          .type = TYPE_DATASTREAM };
+
+static const struct
+{
+    const char *name;
+    edgehog_worker_job_t job;
+} commands[] = {
+#ifdef CONFIG_EDGEHOG_TRACE
+    { .name = "UploadTrace", .job = edgehog_trace_upload },
+#endif
+#ifdef CONFIG_EDGEHOG_PROFILER
+    { .name = "StartProfiler", .job = edgehog_profiler_start },
+#endif
+#ifdef CONFIG_EDGEHOG_HEAP_TRACE
+    { .name = "StartHeapTrace", .job = edgehog_heap_trace_start },
+#endif
+#ifdef CONFIG_EDGEHOG_RECORDER
+    { .name = "UploadRecording", .job = edgehog_recorder_upload },
+#endif
+    { .name = NULL, .job = NULL },
+};
+
+esp_err_t edgehog_command_dispatch(edgehog_device_handle_t edgehog_device, const char *command)
+{
+    for (int i = 0; commands[i].name; i++) {
+        if (strcmp(commands[i].name, command) == 0) {
+            esp_err_t ret = edgehog_worker_submit(edgehog_device, commands[i].job, NULL);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "Unable to queue command %s", command);
+            }
+            return ret;
+        }
+    }
+
+    ESP_LOGW(TAG, "Unknown command %s", command);
+    return ESP_ERR_NOT_FOUND;
+}
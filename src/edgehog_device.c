@@ -17,8 +17,31 @@
  */
 
 #include "edgehog_device.h"
+#include "edgehog_backlog.h"
+#include "edgehog_command.h"
+#include "edgehog_device_private.h"
+#include "edgehog_event_loop_monitor.h"
+#include "edgehog_factory_data.h"
+#include "edgehog_heap_predictor.h"
+#include "edgehog_heap_trace.h"
+#include "edgehog_load_stats.h"
+#include "edgehog_metrics_registry.h"
+#include "edgehog_monitor.h"
+#include "edgehog_nvs_stats.h"
+#include "edgehog_profiler.h"
+#include "edgehog_property_cache.h"
+#include "edgehog_recorder.h"
+#include "edgehog_soak.h"
+#include "edgehog_time.h"
+#include "edgehog_trace.h"
+#include "edgehog_wifi_fingerprint.h"
+#include "edgehog_wifi_reconnect_hint.h"
+#include "edgehog_wifi_scan_cache.h"
+#include "edgehog_worker.h"
 #include "esp_system.h"
+#include <astarte_bson.h>
 #include <astarte_bson_serializer.h>
+#include <astarte_bson_types.h>
 #include <esp_err.h>
 #include <esp_heap_caps.h>
 #include <esp_log.h>
@@ -26,22 +49,38 @@
 #include <esp_wifi.h>
 #include <esp_wifi_types.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <nvs_flash.h>
 #include <string.h>
 #include <uuid.h>
 
 #define APPLIANCE_NAMESPACE "eh_appliance"
+// Bitmask of the appliance info values stored on the NVS but not sent to Astarte yet
+#define APPLIANCE_DIRTY_KEY "dirty"
+#define BACKLOG_DEFAULT_SIZE (16 * 1024)
+// Jobs run after a connection, see queue_connection_jobs
+#define CONNECTION_JOB_RESYNC (1 << 0)
+#define CONNECTION_JOB_RECONCILE (1 << 1)
+#define CONNECTION_JOBS_RETRY_MS 1000
+#define METRICS_DEFAULT_PERIOD_S 60
+#define MONITOR_DEFAULT_SAMPLE_PERIOD_S 10
+#define MONITOR_DEFAULT_SUMMARY_PERIOD_S 900
+#define MONITOR_DEFAULT_Z_THRESHOLD 3.0f
+#define SYSTEM_STATUS_DEFAULT_PERIOD_S 600
+// SystemStatus is published this many times more often while a heap leak is suspected
+#define SYSTEM_STATUS_LEAK_RATE_FACTOR 6
+#define WIFI_SCAN_DEFAULT_FRESHNESS_MS 30000
+#define WIFI_SCAN_DEFAULT_RSSI_THRESHOLD (-75)
+#define WIFI_SCAN_DEFAULT_RSSI_DROP 10
+#define WIFI_SCAN_DEFAULT_MAX_INTERVAL_S 3600
+#define WIFI_DEFAULT_LOCATION_SIMILARITY 60
+#define WIFI_RSSI_CHECK_PERIOD_US (5 * 1000000)
+// Minimum interval between two RSSI triggered scans, to not scan continuously on a flaky link
+#define WIFI_RSSI_SCAN_MIN_INTERVAL_US (30 * 1000000)
 
 static const char *TAG = "EDGEHOG";
 
-struct edgehog_device_t
-{
-    char boot_id[38];
-    astarte_device_handle_t astarte_device;
-    const char *partition_name;
-};
-
 const static astarte_interface_t hardware_info_interface
     = { .name = "io.edgehog.devicemanager.HardwareInfo",
           .major_version = 0,
@@ -56,6 +95,20 @@ const static astarte_interface_t wifi_scan_result_interface
           .ownership = OWNERSHIP_DEVICE,
           .type = TYPE_DATASTREAM };
 
+const static astarte_interface_t wifi_fingerprint_interface
+    = { .name = "io.edgehog.devicemanager.WiFiFingerprint",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+const static astarte_interface_t wifi_scan_grouped_result_interface
+    = { .name = "io.edgehog.devicemanager.WiFiScanGroupedResults",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
 const static astarte_interface_t system_status_status_interface
     = { .name = "io.edgehog.devicemanager.SystemStatus",
           .major_version = 0,
@@ -63,6 +116,13 @@ const static astarte_interface_t system_status_status_interface
           .ownership = OWNERSHIP_DEVICE,
           .type = TYPE_DATASTREAM };
 
+const static astarte_interface_t heap_forecast_interface
+    = { .name = "io.edgehog.devicemanager.HeapForecast",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
 const static astarte_interface_t appliance_info_interface
     = { .name = "io.edgehog.devicemanager.ApplianceInfo",
           .major_version = 0,
@@ -70,11 +130,60 @@ const static astarte_interface_t appliance_info_interface
           .ownership = OWNERSHIP_DEVICE,
           .type = TYPE_PROPERTIES };
 
-static esp_err_t add_interfaces(astarte_device_handle_t astarte_device);
-static void publish_device_hardware_info(astarte_device_handle_t astarte_device);
+typedef enum
+{
+    APPLIANCE_INFO_SERIAL_NUMBER = 0,
+    APPLIANCE_INFO_PART_NUMBER,
+    APPLIANCE_INFO_COUNT
+} appliance_info_t;
+
+static const struct
+{
+    const char *key;
+    const char *path;
+    edgehog_factory_data_tag_t factory_tag;
+} appliance_info_fields[APPLIANCE_INFO_COUNT] = {
+    [APPLIANCE_INFO_SERIAL_NUMBER] = { .key = "serial_number",
+        .path = "/serialNumber",
+        .factory_tag = EDGEHOG_FACTORY_DATA_SERIAL_NUMBER },
+    [APPLIANCE_INFO_PART_NUMBER] = { .key = "part_number",
+        .path = "/partNumber",
+        .factory_tag = EDGEHOG_FACTORY_DATA_PART_NUMBER },
+};
+
+static esp_err_t add_interfaces(edgehog_device_handle_t edgehog_device);
+static void load_appliance_info(edgehog_device_handle_t edgehog_device);
 static void publish_system_status(edgehog_device_handle_t edgehog_device);
-static void publish_wifi_ap(edgehog_device_handle_t edgehog_device);
+static esp_err_t start_system_status_schedule(edgehog_device_handle_t edgehog_device);
+static void publish_wifi_ap(
+    edgehog_device_handle_t edgehog_device, const edgehog_wifi_scan_result_t *scan_result);
 static void scan_wifi_ap(edgehog_device_handle_t edgehog_device);
+static void reconcile_appliance_info(edgehog_device_handle_t edgehog_device, void *arg);
+static esp_err_t create_connection_jobs_timer(edgehog_device_handle_t edgehog_device);
+static void queue_connection_jobs(edgehog_device_handle_t edgehog_device, uint8_t jobs);
+static void update_wifi_rssi_baseline(
+    edgehog_device_handle_t edgehog_device, const edgehog_wifi_scan_result_t *scan_result);
+
+#ifdef CONFIG_EDGEHOG_RECORDER
+static void record_event(esp_event_base_t event_base, int32_t event_id, const void *event_data)
+{
+    struct __attribute__((packed))
+    {
+        edgehog_record_event_t event;
+        wifi_event_sta_scan_done_t scan_done;
+    } record = { .event = { .base = EDGEHOG_RECORD_EVENT_BASE_OTHER, .id = event_id } };
+    size_t len = sizeof(record.event);
+
+    if (event_base == WIFI_EVENT) {
+        record.event.base = EDGEHOG_RECORD_EVENT_BASE_WIFI;
+        if (event_id == WIFI_EVENT_SCAN_DONE) {
+            memcpy(&record.scan_done, event_data, sizeof(record.scan_done));
+            len = sizeof(record);
+        }
+    }
+    EDGEHOG_RECORD(EDGEHOG_RECORD_EVENT, &record, len);
+}
+#endif
 
 static void edgehog_event_handler(
     void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
@@ -83,18 +192,165 @@ static void edgehog_event_handler(
         return;
     }
 
+    int64_t start_us = esp_timer_get_time();
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+#ifdef CONFIG_EDGEHOG_RECORDER
+    record_event(event_base, event_id, event_data);
+#endif
+
     // this if statement could become a double nested switch statement in the future
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
         wifi_event_sta_scan_done_t *wifi_event_sta_scan_done
             = (wifi_event_sta_scan_done_t *) event_data;
-        edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+        EDGEHOG_TRACE(EDGEHOG_TRACE_WIFI_SCAN_DONE, wifi_event_sta_scan_done->number);
+        if (edgehog_device->wifi_scan_config.source == EDGEHOG_WIFI_SCAN_SOURCE_OWN) {
+            esp_event_handler_instance_unregister(
+                WIFI_EVENT, WIFI_EVENT_SCAN_DONE, edgehog_device->wifi_scan_done_handler);
+            edgehog_device->wifi_scan_done_handler = NULL;
+        }
+        __atomic_store_n(&edgehog_device->wifi_scan_pending, false, __ATOMIC_RELEASE);
+
         if (wifi_event_sta_scan_done->status == 0) {
             // status of scanning APs: 0 — success, 1 - failure
-            publish_wifi_ap(edgehog_device);
-            esp_event_handler_instance_unregister(
-                WIFI_EVENT, WIFI_EVENT_SCAN_DONE, edgehog_event_handler);
+            const edgehog_wifi_scan_result_t *scan_result
+                = edgehog_wifi_scan_cache_collect(edgehog_device);
+            if (scan_result) {
+                update_wifi_rssi_baseline(edgehog_device, scan_result);
+                if (edgehog_device->wifi_scan_config.reconnect_hints) {
+                    edgehog_wifi_reconnect_hint_update(edgehog_device, scan_result);
+                }
+                EDGEHOG_TRACE(EDGEHOG_TRACE_PUBLISH_WIFI_AP_BEGIN, scan_result->ap_count);
+                publish_wifi_ap(edgehog_device, scan_result);
+                EDGEHOG_TRACE(EDGEHOG_TRACE_PUBLISH_WIFI_AP_END, 0);
+                edgehog_wifi_scan_result_release(scan_result);
+            }
+        }
+    }
+
+    edgehog_event_loop_monitor_record_handler(edgehog_device, start_us);
+}
+
+static void update_wifi_rssi_baseline(
+    edgehog_device_handle_t edgehog_device, const edgehog_wifi_scan_result_t *scan_result)
+{
+    wifi_ap_record_t ap_info;
+    bool associated = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+
+    portENTER_CRITICAL(&edgehog_device->wifi_scan_lock);
+    edgehog_device->wifi_last_scan_us = scan_result->timestamp_us;
+    // The RSSI of another AP is not a baseline, it is taken again once associated
+    edgehog_device->wifi_rssi_baseline_valid = associated;
+    if (associated) {
+        edgehog_device->wifi_rssi_baseline = ap_info.rssi;
+    }
+    portEXIT_CRITICAL(&edgehog_device->wifi_scan_lock);
+}
+
+static bool wifi_rssi_scan_needed(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_wifi_scan_config_t *scan_config = &edgehog_device->wifi_scan_config;
+
+    portENTER_CRITICAL(&edgehog_device->wifi_scan_lock);
+    int64_t last_scan_us = edgehog_device->wifi_last_scan_us;
+    int8_t baseline = edgehog_device->wifi_rssi_baseline;
+    bool baseline_valid = edgehog_device->wifi_rssi_baseline_valid;
+    portEXIT_CRITICAL(&edgehog_device->wifi_scan_lock);
+
+    int64_t since_last_scan_us = esp_timer_get_time() - last_scan_us;
+
+    if (since_last_scan_us >= (int64_t) scan_config->period_s * 1000000) {
+        return true;
+    }
+    if (since_last_scan_us < WIFI_RSSI_SCAN_MIN_INTERVAL_US) {
+        return false;
+    }
+
+    // Getting the associated AP info is cheap, it does not use the radio
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return false;
+    }
+    if (!baseline_valid) {
+        // Not associated at the last scan, compare the next checks with the current link
+        portENTER_CRITICAL(&edgehog_device->wifi_scan_lock);
+        edgehog_device->wifi_rssi_baseline = ap_info.rssi;
+        edgehog_device->wifi_rssi_baseline_valid = true;
+        portEXIT_CRITICAL(&edgehog_device->wifi_scan_lock);
+        return false;
+    }
+
+    // Trigger only when crossing the threshold, a link that stays weak is handled by rssi_drop
+    bool crossed_threshold
+        = ap_info.rssi < scan_config->rssi_threshold && baseline >= scan_config->rssi_threshold;
+    bool dropped = baseline - ap_info.rssi >= scan_config->rssi_drop;
+    if (crossed_threshold || dropped) {
+        ESP_LOGI(TAG, "AP RSSI is %d dBm (was %d dBm), scanning", ap_info.rssi, baseline);
+        return true;
+    }
+    return false;
+}
+
+static void wifi_scan_timer_cb(void *arg)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+
+    if (edgehog_device->wifi_scan_config.trigger == EDGEHOG_WIFI_SCAN_TRIGGER_RSSI
+        && !wifi_rssi_scan_needed(edgehog_device)) {
+        return;
+    }
+    scan_wifi_ap(edgehog_device);
+}
+
+static esp_err_t start_wifi_scan_schedule(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_wifi_scan_config_t *scan_config = &edgehog_device->wifi_scan_config;
+
+    if (scan_config->source == EDGEHOG_WIFI_SCAN_SOURCE_OPPORTUNISTIC) {
+        // Stay registered to collect also the scans started by the application
+        esp_err_t ret = esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE,
+            edgehog_event_handler, edgehog_device, &edgehog_device->wifi_scan_done_handler);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG,
+                "Unable to register to default event loop. Be sure to have called "
+                "esp_event_loop_create_default() before calling edgehog_device_new");
+            return ret;
         }
     }
+
+    uint64_t timer_period_us = (uint64_t) scan_config->period_s * 1000000;
+    if (scan_config->trigger == EDGEHOG_WIFI_SCAN_TRIGGER_RSSI) {
+        timer_period_us = WIFI_RSSI_CHECK_PERIOD_US;
+    } else if (scan_config->period_s == 0) {
+        return ESP_OK;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = wifi_scan_timer_cb,
+        .arg = edgehog_device,
+        .name = "edgehog_wifi_scan",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &edgehog_device->wifi_scan_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the WiFi scan timer, error %d", ret);
+        return ret;
+    }
+
+    return esp_timer_start_periodic(edgehog_device->wifi_scan_timer, timer_period_us);
+}
+
+static void stop_wifi_scan_schedule(edgehog_device_handle_t edgehog_device)
+{
+    if (edgehog_device->wifi_scan_timer) {
+        esp_timer_stop(edgehog_device->wifi_scan_timer);
+        esp_timer_delete(edgehog_device->wifi_scan_timer);
+        edgehog_device->wifi_scan_timer = NULL;
+    }
+
+    if (edgehog_device->wifi_scan_done_handler) {
+        esp_event_handler_instance_unregister(
+            WIFI_EVENT, WIFI_EVENT_SCAN_DONE, edgehog_device->wifi_scan_done_handler);
+        edgehog_device->wifi_scan_done_handler = NULL;
+    }
 }
 
 edgehog_device_handle_t edgehog_device_new(edgehog_device_config_t *config)
@@ -109,16 +365,30 @@ edgehog_device_handle_t edgehog_device_new(edgehog_device_config_t *config)
         return NULL;
     }
 
+    EDGEHOG_TRACE(EDGEHOG_TRACE_DEVICE_NEW_BEGIN, 0);
     edgehog_device_handle_t edgehog_device = calloc(1, sizeof(struct edgehog_device_t));
     if (!edgehog_device) {
         ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
         return NULL;
     }
 
-    edgehog_device->astarte_device = config->astarte_device;
-    uuid_t boot_id;
-    uuid_generate_v4(boot_id);
-    uuid_to_string(boot_id, edgehog_device->boot_id);
+    edgehog_device->appliance_lock = xSemaphoreCreateMutex();
+    if (!edgehog_device->appliance_lock
+        || edgehog_property_cache_init(&edgehog_device->property_cache) != ESP_OK
+        || edgehog_wifi_scan_cache_init(&edgehog_device->wifi_scan_cache) != ESP_OK) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        goto error;
+    }
+    vPortCPUInitializeMutex(&edgehog_device->wifi_scan_lock);
+    edgehog_metrics_init(&edgehog_device->metrics);
+    if (edgehog_load_stats_init(edgehog_device) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to register the load metrics");
+    }
+
+    if (edgehog_worker_start(edgehog_device) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to start the Edgehog worker");
+        goto error;
+    }
 
     if (config->partition_label) {
         edgehog_device->partition_name = config->partition_label;
@@ -126,15 +396,121 @@ edgehog_device_handle_t edgehog_device_new(edgehog_device_config_t *config)
         edgehog_device->partition_name = NVS_DEFAULT_PART_NAME;
     }
 
-    ESP_ERROR_CHECK(add_interfaces(config->astarte_device));
-    publish_device_hardware_info(config->astarte_device);
+    edgehog_device->astarte_device = config->astarte_device;
+    edgehog_device->wifi_scan_config = config->wifi_scan;
+    if (edgehog_device->wifi_scan_config.freshness_ms == 0) {
+        edgehog_device->wifi_scan_config.freshness_ms = WIFI_SCAN_DEFAULT_FRESHNESS_MS;
+    }
+    if (edgehog_device->wifi_scan_config.location_similarity == 0) {
+        edgehog_device->wifi_scan_config.location_similarity = WIFI_DEFAULT_LOCATION_SIMILARITY;
+    }
+    if (edgehog_device->wifi_scan_config.trigger == EDGEHOG_WIFI_SCAN_TRIGGER_RSSI) {
+        if (edgehog_device->wifi_scan_config.rssi_threshold == 0) {
+            edgehog_device->wifi_scan_config.rssi_threshold = WIFI_SCAN_DEFAULT_RSSI_THRESHOLD;
+        }
+        if (edgehog_device->wifi_scan_config.rssi_drop == 0) {
+            edgehog_device->wifi_scan_config.rssi_drop = WIFI_SCAN_DEFAULT_RSSI_DROP;
+        }
+        if (edgehog_device->wifi_scan_config.period_s == 0) {
+            edgehog_device->wifi_scan_config.period_s = WIFI_SCAN_DEFAULT_MAX_INTERVAL_S;
+        }
+    }
+    if (edgehog_device->wifi_scan_config.period_s > 0) {
+        edgehog_device->wifi_scan_config.period_s
+            = EDGEHOG_SOAK_PERIOD_S(edgehog_device->wifi_scan_config.period_s);
+    }
+    if (edgehog_device->wifi_scan_config.reconnect_hints) {
+        edgehog_wifi_reconnect_hint_load(edgehog_device);
+    }
+    uuid_t boot_id;
+    uuid_generate_v4(boot_id);
+    uuid_to_string(boot_id, edgehog_device->boot_id);
+
+    edgehog_time_init();
+    if (edgehog_backlog_init(edgehog_device,
+            config->backlog_size ? config->backlog_size : BACKLOG_DEFAULT_SIZE)
+        != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the backlog, samples will be lost while offline");
+    }
+    ESP_ERROR_CHECK(add_interfaces(edgehog_device));
+    edgehog_device_publish_hardware_info(edgehog_device);
+    if (config->factory_partition_label) {
+        edgehog_factory_data_open(config->factory_partition_label, &edgehog_device->factory_data);
+    }
+    load_appliance_info(edgehog_device);
+    edgehog_heap_predictor_init(&edgehog_device->heap_predictor);
+    edgehog_device->system_status_period_s = config->system_status_period_s;
+    if (edgehog_device->system_status_period_s == 0) {
+        edgehog_device->system_status_period_s = SYSTEM_STATUS_DEFAULT_PERIOD_S;
+    }
+    edgehog_device->system_status_period_s
+        = EDGEHOG_SOAK_PERIOD_S(edgehog_device->system_status_period_s);
     publish_system_status(edgehog_device);
+    if (start_system_status_schedule(edgehog_device) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to schedule the SystemStatus publishing");
+    }
+    uint32_t metrics_period_s = config->metrics_period_s;
+    if (metrics_period_s == 0) {
+        metrics_period_s = METRICS_DEFAULT_PERIOD_S;
+    }
+    metrics_period_s = EDGEHOG_SOAK_PERIOD_S(metrics_period_s);
+    if (edgehog_metrics_start(edgehog_device, metrics_period_s) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to schedule the metrics publishing");
+    }
+    if (edgehog_event_loop_monitor_start(edgehog_device, config->event_loop_probe_period_ms)
+        != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to monitor the default event loop");
+    }
+    edgehog_monitor_config_t monitor_config = config->monitor;
+    if (monitor_config.sample_period_s == 0) {
+        monitor_config.sample_period_s = MONITOR_DEFAULT_SAMPLE_PERIOD_S;
+    }
+    if (monitor_config.summary_period_s == 0) {
+        monitor_config.summary_period_s = MONITOR_DEFAULT_SUMMARY_PERIOD_S;
+    }
+    monitor_config.sample_period_s = EDGEHOG_SOAK_PERIOD_S(monitor_config.sample_period_s);
+    monitor_config.summary_period_s = EDGEHOG_SOAK_PERIOD_S(monitor_config.summary_period_s);
+    if (monitor_config.z_threshold <= 0) {
+        monitor_config.z_threshold = MONITOR_DEFAULT_Z_THRESHOLD;
+    }
+    if (edgehog_monitor_start(edgehog_device, &monitor_config) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to schedule the health monitor");
+    }
+    if (edgehog_nvs_stats_start(edgehog_device) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to schedule the StorageHealth publishing");
+    }
+    if (start_wifi_scan_schedule(edgehog_device) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to schedule WiFi scans");
+    }
     scan_wifi_ap(edgehog_device);
+#ifdef CONFIG_EDGEHOG_SOAK
+    if (edgehog_soak_start(edgehog_device) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to start the soak driver");
+    }
+#endif
+    if (create_connection_jobs_timer(edgehog_device) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the connection jobs timer");
+    }
+    // Values set while offline during the previous boot are still pending
+    queue_connection_jobs(edgehog_device, CONNECTION_JOB_RECONCILE);
+    EDGEHOG_TRACE(EDGEHOG_TRACE_DEVICE_NEW_END, 0);
     return edgehog_device;
+
+error:
+    if (edgehog_device->appliance_lock) {
+        vSemaphoreDelete(edgehog_device->appliance_lock);
+    }
+    edgehog_property_cache_destroy(&edgehog_device->property_cache);
+    if (edgehog_device->wifi_scan_cache.notify_lock) {
+        edgehog_wifi_scan_cache_destroy(&edgehog_device->wifi_scan_cache);
+    }
+    free(edgehog_device);
+    return NULL;
 }
 
-esp_err_t add_interfaces(astarte_device_handle_t device)
+esp_err_t add_interfaces(edgehog_device_handle_t edgehog_device)
 {
+    astarte_device_handle_t device = edgehog_device->astarte_device;
     astarte_err_t ret;
 
     ret = astarte_device_add_interface(device, &hardware_info_interface);
@@ -150,6 +526,13 @@ esp_err_t add_interfaces(astarte_device_handle_t device)
             system_status_status_interface.name, ret);
     }
 
+    ret = astarte_device_add_interface(device, &heap_forecast_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            heap_forecast_interface.name, ret);
+        return ESP_FAIL;
+    }
+
     ret = astarte_device_add_interface(device, &wifi_scan_result_interface);
     if (ret != ASTARTE_OK) {
         ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
@@ -157,16 +540,105 @@ esp_err_t add_interfaces(astarte_device_handle_t device)
         return ESP_FAIL;
     }
 
+    if (edgehog_device->wifi_scan_config.report == EDGEHOG_WIFI_REPORT_LOCATION_CHANGES) {
+        ret = astarte_device_add_interface(device, &wifi_fingerprint_interface);
+        if (ret != ASTARTE_OK) {
+            ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+                wifi_fingerprint_interface.name, ret);
+            return ESP_FAIL;
+        }
+    }
+
+    if (edgehog_device->wifi_scan_config.report == EDGEHOG_WIFI_REPORT_GROUPED_BY_ESSID) {
+        ret = astarte_device_add_interface(device, &wifi_scan_grouped_result_interface);
+        if (ret != ASTARTE_OK) {
+            ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+                wifi_scan_grouped_result_interface.name, ret);
+            return ESP_FAIL;
+        }
+    }
+
     ret = astarte_device_add_interface(device, &appliance_info_interface);
     if (ret != ASTARTE_OK) {
         ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
             appliance_info_interface.name, ret);
         return ESP_FAIL;
     }
+
+    ret = astarte_device_add_interface(device, &edgehog_metrics_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            edgehog_metrics_interface.name, ret);
+        return ESP_FAIL;
+    }
+
+    ret = astarte_device_add_interface(device, &edgehog_monitor_samples_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            edgehog_monitor_samples_interface.name, ret);
+        return ESP_FAIL;
+    }
+
+    ret = astarte_device_add_interface(device, &edgehog_monitor_summaries_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            edgehog_monitor_summaries_interface.name, ret);
+        return ESP_FAIL;
+    }
+
+    ret = astarte_device_add_interface(device, &edgehog_storage_health_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            edgehog_storage_health_interface.name, ret);
+        return ESP_FAIL;
+    }
+
+    ret = astarte_device_add_interface(device, &edgehog_command_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            edgehog_command_interface.name, ret);
+        return ESP_FAIL;
+    }
+
+#ifdef CONFIG_EDGEHOG_TRACE
+    ret = astarte_device_add_interface(device, &edgehog_trace_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            edgehog_trace_interface.name, ret);
+        return ESP_FAIL;
+    }
+#endif
+
+#ifdef CONFIG_EDGEHOG_PROFILER
+    ret = astarte_device_add_interface(device, &edgehog_profiler_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            edgehog_profiler_interface.name, ret);
+        return ESP_FAIL;
+    }
+#endif
+
+#ifdef CONFIG_EDGEHOG_HEAP_TRACE
+    ret = astarte_device_add_interface(device, &edgehog_heap_trace_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            edgehog_heap_trace_interface.name, ret);
+        return ESP_FAIL;
+    }
+#endif
+
+#ifdef CONFIG_EDGEHOG_RECORDER
+    ret = astarte_device_add_interface(device, &edgehog_recording_interface);
+    if (ret != ASTARTE_OK) {
+        ESP_LOGE(TAG, "Unable to add Astarte Interface ( %s ) error code: %d",
+            edgehog_recording_interface.name, ret);
+        return ESP_FAIL;
+    }
+#endif
     return ESP_OK;
 }
 
-static void publish_device_hardware_info(astarte_device_handle_t astarte_device)
+void edgehog_device_publish_hardware_info(edgehog_device_handle_t edgehog_device)
 {
     esp_chip_info_t chip_info;
     esp_chip_info(&chip_info);
@@ -209,24 +681,153 @@ static void publish_device_hardware_info(astarte_device_handle_t astarte_device)
 #ifdef CONFIG_SPIRAM_USE
     mem_total_bytes += (long) heap_caps_get_total_size(MALLOC_CAP_SPIRAM);
 #endif
-    astarte_device_set_string_property(
-        astarte_device, hardware_info_interface.name, "/cpu/architecture", cpu_architecture);
-    astarte_device_set_string_property(
-        astarte_device, hardware_info_interface.name, "/cpu/model", cpu_model);
-    astarte_device_set_string_property(
-        astarte_device, hardware_info_interface.name, "/cpu/modelName", cpu_model_name);
-    astarte_device_set_string_property(
-        astarte_device, hardware_info_interface.name, "/cpu/vendor", cpu_vendor);
-    astarte_device_set_longinteger_property(
-        astarte_device, hardware_info_interface.name, "/mem/totalBytes", mem_total_bytes);
+    edgehog_property_set_string(
+        edgehog_device, hardware_info_interface.name, "/cpu/architecture", cpu_architecture);
+    edgehog_property_set_string(
+        edgehog_device, hardware_info_interface.name, "/cpu/model", cpu_model);
+    edgehog_property_set_string(
+        edgehog_device, hardware_info_interface.name, "/cpu/modelName", cpu_model_name);
+    edgehog_property_set_string(
+        edgehog_device, hardware_info_interface.name, "/cpu/vendor", cpu_vendor);
+    edgehog_property_set_longinteger(
+        edgehog_device, hardware_info_interface.name, "/mem/totalBytes", mem_total_bytes);
+}
+
+astarte_err_t edgehog_device_stream_aggregate(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const void *doc, uint64_t timestamp_ms)
+{
+    // The serializer has no document once it ran out of memory
+    if (!doc) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return ASTARTE_ERR_OUT_OF_MEMORY;
+    }
+    astarte_err_t ret;
+    // A BSON document starts with its little endian length
+    int32_t doc_len;
+    memcpy(&doc_len, doc, sizeof(doc_len));
+    size_t bytes;
+
+    EDGEHOG_TRACE(EDGEHOG_TRACE_PUBLISH_BEGIN, 0);
+    if (timestamp_ms == 0) {
+        // No wall clock yet, the sample is timestamped by Astarte on reception
+        ret = astarte_device_stream_aggregate(
+            edgehog_device->astarte_device, interface_name, path, doc, 0);
+        bytes = EDGEHOG_LOAD_STATS_AGGREGATE_BYTES(doc_len);
+    } else {
+        ret = astarte_device_stream_aggregate_with_timestamp(
+            edgehog_device->astarte_device, interface_name, path, doc, timestamp_ms, 0);
+        bytes = EDGEHOG_LOAD_STATS_TIMESTAMPED_AGGREGATE_BYTES(doc_len);
+    }
+    EDGEHOG_TRACE(EDGEHOG_TRACE_PUBLISH_END, ret);
+    EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_ASTARTE_RESULT, ret);
+    if (ret == ASTARTE_OK) {
+        edgehog_load_stats_record_publish(edgehog_device, bytes);
+    }
+    return ret;
+}
+
+astarte_err_t edgehog_device_stream_sample(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const void *doc, int64_t sample_time_us)
+{
+    astarte_err_t ret = ASTARTE_ERR;
+    if (astarte_device_is_connected(edgehog_device->astarte_device)) {
+        ret = edgehog_device_stream_aggregate(edgehog_device, interface_name, path, doc,
+            edgehog_time_monotonic_to_epoch_ms(sample_time_us));
+    }
+    if (ret != ASTARTE_OK
+        && edgehog_backlog_push(edgehog_device, interface_name, path, doc, sample_time_us)) {
+        ret = ASTARTE_OK;
+    }
+    return ret;
+}
+
+static void system_status_job(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    publish_system_status(edgehog_device);
+}
+
+static void system_status_timer_cb(void *arg)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+
+    if (edgehog_worker_submit(edgehog_device, system_status_job, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Worker busy, SystemStatus sample skipped");
+    }
+}
+
+static esp_err_t start_system_status_schedule(edgehog_device_handle_t edgehog_device)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = system_status_timer_cb,
+        .arg = edgehog_device,
+        .name = "edgehog_system_status",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &edgehog_device->system_status_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the SystemStatus timer, error %d", ret);
+        return ret;
+    }
+
+    return esp_timer_start_periodic(
+        edgehog_device->system_status_timer, edgehog_device->system_status_period_s * 1000000ULL);
+}
+
+static void update_system_status_rate(edgehog_device_handle_t edgehog_device, bool leak_suspected)
+{
+    if (!edgehog_device->system_status_timer
+        || leak_suspected == edgehog_device->system_status_fast) {
+        return;
+    }
+
+    uint64_t period_us = edgehog_device->system_status_period_s * 1000000ULL;
+    if (leak_suspected) {
+        ESP_LOGW(TAG, "Heap leak suspected, publishing SystemStatus more often");
+        period_us /= SYSTEM_STATUS_LEAK_RATE_FACTOR;
+    }
+    esp_timer_stop(edgehog_device->system_status_timer);
+    if (esp_timer_start_periodic(edgehog_device->system_status_timer, period_us) == ESP_OK) {
+        edgehog_device->system_status_fast = leak_suspected;
+    }
+}
+
+static void publish_heap_forecast(
+    edgehog_device_handle_t edgehog_device, int64_t sample_time_us, uint32_t avail_memory)
+{
+    edgehog_heap_forecast_t forecast;
+    edgehog_heap_predictor_update(
+        &edgehog_device->heap_predictor, sample_time_us, avail_memory, &forecast);
+    size_t largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_BEGIN, 0);
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int64(&bs, "freeTrendBytes", (int64_t) forecast.free_bytes);
+    astarte_bson_serializer_append_int64(&bs, "largestFreeBlockBytes", largest_free_block);
+    astarte_bson_serializer_append_boolean(&bs, "leakSuspected", forecast.leak_suspected);
+    astarte_bson_serializer_append_boolean(&bs, "outlier", forecast.outlier);
+    astarte_bson_serializer_append_double(&bs, "slopeBytesPerHour", forecast.slope_bytes_per_hour);
+    astarte_bson_serializer_append_int64(
+        &bs, "timeToExhaustionSeconds", forecast.time_to_exhaustion_s);
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_END, doc_len);
+    edgehog_device_stream_sample(
+        edgehog_device, heap_forecast_interface.name, "/forecast", doc, sample_time_us);
+    astarte_bson_serializer_destroy(&bs);
+
+    update_system_status_rate(edgehog_device, forecast.leak_suspected);
 }
 
 static void publish_system_status(edgehog_device_handle_t edgehog_device)
 {
-    int64_t uptime_millis = esp_timer_get_time() / 1000;
+    int64_t sample_time_us = esp_timer_get_time();
+    int64_t uptime_millis = sample_time_us / 1000;
     uint32_t avail_memory = esp_get_free_heap_size();
     int task_count = uxTaskGetNumberOfTasks();
 
+    EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_BEGIN, 0);
     struct astarte_bson_serializer_t bs;
     astarte_bson_serializer_init(&bs);
     astarte_bson_serializer_append_int64(&bs, "availMemoryBytes", avail_memory);
@@ -237,56 +838,220 @@ static void publish_system_status(edgehog_device_handle_t edgehog_device)
 
     int doc_len;
     const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
-    astarte_device_stream_aggregate(edgehog_device->astarte_device,
-        system_status_status_interface.name, "/systemStatus", doc, 0);
+    EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_END, doc_len);
+    edgehog_device_stream_sample(edgehog_device, system_status_status_interface.name,
+        "/systemStatus", doc, sample_time_us);
     astarte_bson_serializer_destroy(&bs);
+
+    publish_heap_forecast(edgehog_device, sample_time_us, avail_memory);
+#ifdef CONFIG_EDGEHOG_SOAK
+    edgehog_soak_check(edgehog_device, sample_time_us,
+        heap_caps_get_total_size(MALLOC_CAP_DEFAULT) - avail_memory,
+        heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+#endif
 }
 
 static void scan_wifi_ap(edgehog_device_handle_t edgehog_device)
 {
-    // Register the event at every scan and unregister it at every publish to avoid
-    // catching event generated by third party scan
-    esp_err_t ret = esp_event_handler_instance_register(
-        WIFI_EVENT, WIFI_EVENT_SCAN_DONE, edgehog_event_handler, edgehog_device, NULL);
+    edgehog_wifi_scan_config_t *scan_config = &edgehog_device->wifi_scan_config;
 
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG,
-            "Unable to register to default event loop. Be sure to have called "
-            "esp_event_loop_create_default() before calling edgehog_device_new");
+    if (scan_config->source == EDGEHOG_WIFI_SCAN_SOURCE_OPPORTUNISTIC) {
+        const edgehog_wifi_scan_result_t *latest
+            = edgehog_device_wifi_scan_acquire(edgehog_device);
+        if (latest) {
+            bool fresh = edgehog_wifi_scan_result_get_age_ms(latest) < scan_config->freshness_ms;
+            edgehog_wifi_scan_result_release(latest);
+            if (fresh) {
+                ESP_LOGD(TAG, "Latest WiFi scan is still fresh, skipping scheduled scan");
+                return;
+            }
+        }
+    }
+
+    if (__atomic_exchange_n(&edgehog_device->wifi_scan_pending, true, __ATOMIC_ACQ_REL)) {
         return;
     }
+    int64_t now_us = esp_timer_get_time();
+    portENTER_CRITICAL(&edgehog_device->wifi_scan_lock);
+    edgehog_device->wifi_last_scan_us = now_us;
+    portEXIT_CRITICAL(&edgehog_device->wifi_scan_lock);
+
+    esp_err_t ret;
+    if (scan_config->source == EDGEHOG_WIFI_SCAN_SOURCE_OWN) {
+        // Register the event at every scan and unregister it at every publish to avoid
+        // catching event generated by third party scan
+        ret = esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE,
+            edgehog_event_handler, edgehog_device, &edgehog_device->wifi_scan_done_handler);
+
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG,
+                "Unable to register to default event loop. Be sure to have called "
+                "esp_event_loop_create_default() before calling edgehog_device_new");
+            __atomic_store_n(&edgehog_device->wifi_scan_pending, false, __ATOMIC_RELEASE);
+            return;
+        }
+    }
 
     wifi_scan_config_t config = { .show_hidden = true,
         .scan_type = WIFI_SCAN_TYPE_ACTIVE,
         .scan_time = { .active = { .max = 120 } } };
 
-    esp_wifi_scan_start(&config, false);
+    ret = esp_wifi_scan_start(&config, false);
+    EDGEHOG_TRACE(EDGEHOG_TRACE_WIFI_SCAN_START, ret);
+    if (ret != ESP_OK) {
+        // e.g. another scan is in progress, in opportunistic mode its results are used instead
+        ESP_LOGW(TAG, "Unable to start WiFi scan, error %d", ret);
+        if (scan_config->source == EDGEHOG_WIFI_SCAN_SOURCE_OWN) {
+            esp_event_handler_instance_unregister(
+                WIFI_EVENT, WIFI_EVENT_SCAN_DONE, edgehog_device->wifi_scan_done_handler);
+            edgehog_device->wifi_scan_done_handler = NULL;
+        }
+        __atomic_store_n(&edgehog_device->wifi_scan_pending, false, __ATOMIC_RELEASE);
+    }
 }
 
-static void publish_wifi_ap(edgehog_device_handle_t edgehog_device)
+static void publish_wifi_location_change(
+    edgehog_device_handle_t edgehog_device, const edgehog_wifi_scan_result_t *scan_result)
 {
-    uint16_t ap_count = 0;
-    esp_err_t ret = esp_wifi_scan_get_ap_num(&ap_count);
-    if (ret != ESP_OK) {
+    // A failed or empty scan is not similar to any place, it would report a change and one back
+    if (scan_result->ap_count == 0) {
         return;
     }
 
-    wifi_ap_record_t *ap_info = (wifi_ap_record_t *) malloc(ap_count * sizeof(wifi_ap_record_t));
-    if (!ap_info) {
-        ESP_LOGE(TAG, "Unable to allocate memory for %d access point records", ap_count);
-        return;
+    edgehog_wifi_fingerprint_t fingerprint;
+    edgehog_wifi_fingerprint_compute(scan_result, &fingerprint);
+
+    int similarity = 0;
+    if (edgehog_device->wifi_fingerprint_valid) {
+        similarity
+            = edgehog_wifi_fingerprint_similarity(&edgehog_device->wifi_fingerprint, &fingerprint);
+        if (similarity >= edgehog_device->wifi_scan_config.location_similarity) {
+            // Stationary, the fingerprint is not updated to not follow slow drifts
+            return;
+        }
     }
 
-    ret = esp_wifi_scan_get_ap_records(&ap_count, ap_info);
-    if (ret != ESP_OK) {
-        free(ap_info);
-        return;
+    uint8_t packed[EDGEHOG_WIFI_FINGERPRINT_MAX_APS * EDGEHOG_WIFI_FINGERPRINT_PACKED_AP_SIZE];
+    int packed_len = edgehog_wifi_fingerprint_pack(&fingerprint, packed);
+
+    EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_BEGIN, 0);
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int32(&bs, "apCount", scan_result->ap_count);
+    astarte_bson_serializer_append_binary(&bs, "fingerprint", packed, packed_len);
+    astarte_bson_serializer_append_int32(&bs, "similarity", similarity);
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_END, doc_len);
+    astarte_err_t ret = edgehog_device_stream_sample(edgehog_device,
+        wifi_fingerprint_interface.name, "/locationChange", doc, scan_result->timestamp_us);
+    astarte_bson_serializer_destroy(&bs);
+
+    // Until the change is sent or kept in the backlog, the next scans are still compared with the
+    // previous place
+    if (ret == ASTARTE_OK) {
+        edgehog_device->wifi_fingerprint = fingerprint;
+        edgehog_device->wifi_fingerprint_valid = true;
+    }
+}
+
+static void publish_wifi_essid_groups(
+    edgehog_device_handle_t edgehog_device, const edgehog_wifi_scan_result_t *scan_result)
+{
+    const wifi_ap_record_t *ap_info = scan_result->ap_records;
+
+    for (int i = 0; i < scan_result->ap_count; i++) {
+        const char *essid = (const char *) ap_info[i].ssid;
+
+        // The group of an ESSID is published when its first AP is found
+        bool already_grouped = false;
+        for (int j = 0; j < i && !already_grouped; j++) {
+            already_grouped = strcmp(essid, (const char *) ap_info[j].ssid) == 0;
+        }
+        if (already_grouped) {
+            continue;
+        }
+
+        int count = 0;
+        int strongest = i;
+        int8_t rssi_min = ap_info[i].rssi;
+        int8_t rssi_max = ap_info[i].rssi;
+        uint32_t channel_mask = 0;
+        for (int j = i; j < scan_result->ap_count; j++) {
+            if (strcmp(essid, (const char *) ap_info[j].ssid) != 0) {
+                continue;
+            }
+            count++;
+            if (ap_info[j].rssi > rssi_max) {
+                rssi_max = ap_info[j].rssi;
+                strongest = j;
+            }
+            if (ap_info[j].rssi < rssi_min) {
+                rssi_min = ap_info[j].rssi;
+            }
+            if (ap_info[j].primary < 32) {
+                channel_mask |= 1u << ap_info[j].primary;
+            }
+        }
+
+        int32_t channels[32];
+        int channel_count = 0;
+        for (int channel = 0; channel < 32; channel++) {
+            if (channel_mask & (1u << channel)) {
+                channels[channel_count++] = channel;
+            }
+        }
+
+        const uint8_t *bssid = ap_info[strongest].bssid;
+        char mac[18];
+        snprintf(mac, 18, "%02x:%02x:%02x:%02x:%02x:%02x", bssid[0], bssid[1], bssid[2], bssid[3],
+            bssid[4], bssid[5]);
+
+        EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_BEGIN, 0);
+        struct astarte_bson_serializer_t bs;
+        astarte_bson_serializer_init(&bs);
+        astarte_bson_serializer_append_int32(&bs, "apCount", count);
+        astarte_bson_serializer_append_int32_array(&bs, "channels", channels, channel_count);
+        astarte_bson_serializer_append_string(&bs, "essid", essid);
+        astarte_bson_serializer_append_int32(&bs, "rssiMax", rssi_max);
+        astarte_bson_serializer_append_int32(&bs, "rssiMin", rssi_min);
+        astarte_bson_serializer_append_string(&bs, "strongestMacAddress", mac);
+        astarte_bson_serializer_append_end_of_document(&bs);
+
+        int doc_len;
+        const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+        EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_END, doc_len);
+        edgehog_device_stream_sample(edgehog_device, wifi_scan_grouped_result_interface.name,
+            "/essid", doc, scan_result->timestamp_us);
+        astarte_bson_serializer_destroy(&bs);
+    }
+}
+
+static void publish_wifi_ap(
+    edgehog_device_handle_t edgehog_device, const edgehog_wifi_scan_result_t *scan_result)
+{
+    switch (edgehog_device->wifi_scan_config.report) {
+        case EDGEHOG_WIFI_REPORT_LOCATION_CHANGES:
+            publish_wifi_location_change(edgehog_device, scan_result);
+            return;
+        case EDGEHOG_WIFI_REPORT_GROUPED_BY_ESSID:
+            publish_wifi_essid_groups(edgehog_device, scan_result);
+            return;
+        default:
+            break;
     }
-    for (int i = 0; i < ap_count; i++) {
+
+    // All the records of a scan share the timestamp of its completion
+    const wifi_ap_record_t *ap_info = scan_result->ap_records;
+
+    for (int i = 0; i < scan_result->ap_count; i++) {
         char mac[18];
         snprintf(mac, 18, "%02x:%02x:%02x:%02x:%02x:%02x", ap_info[i].bssid[0], ap_info[i].bssid[1],
             ap_info[i].bssid[2], ap_info[i].bssid[3], ap_info[i].bssid[4], ap_info[i].bssid[5]);
 
+        EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_BEGIN, 0);
         struct astarte_bson_serializer_t bs;
         astarte_bson_serializer_init(&bs);
         astarte_bson_serializer_append_int32(&bs, "channel", ap_info[i].primary);
@@ -297,113 +1062,447 @@ static void publish_wifi_ap(edgehog_device_handle_t edgehog_device)
 
         int doc_len;
         const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
-        astarte_device_stream_aggregate(
-            edgehog_device->astarte_device, wifi_scan_result_interface.name, "/ap", doc, 0);
+        EDGEHOG_TRACE(EDGEHOG_TRACE_SERIALIZE_END, doc_len);
+        edgehog_device_stream_sample(
+            edgehog_device, wifi_scan_result_interface.name, "/ap", doc, scan_result->timestamp_us);
         astarte_bson_serializer_destroy(&bs);
     }
+}
+
+static char *edgehog_nvs_get_string(nvs_handle nvs, const char *key)
+{
+    size_t required_size = 0;
+    esp_err_t ret = nvs_get_str(nvs, key, NULL, &required_size);
+    if (ret != ESP_OK || required_size == 0) {
+        return NULL;
+    }
+    char *out_value = malloc(required_size * sizeof(char));
+    if (!out_value) {
+        return NULL;
+    }
+    if (nvs_get_str(nvs, key, out_value, &required_size) != ESP_OK) {
+        free(out_value);
+        return NULL;
+    }
+    return out_value;
+}
 
-    free(ap_info);
+static const char *factory_appliance_info(
+    edgehog_device_handle_t edgehog_device, appliance_info_t info)
+{
+    return edgehog_factory_data_get_string(
+        &edgehog_device->factory_data, appliance_info_fields[info].factory_tag);
 }
 
-static esp_err_t edgehog_nvs_set_str(const char *partition_name, const char *key, char *value)
+static void load_appliance_info(edgehog_device_handle_t edgehog_device)
 {
-    nvs_handle nvs;
-    esp_err_t ret
-        = nvs_open_from_partition(partition_name, APPLIANCE_NAMESPACE, NVS_READWRITE, &nvs);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Unable to open %s", partition_name);
-        return ret;
+    // Factory values are cached in place, the NVS is read only for the missing ones
+    bool from_factory = true;
+    for (int info = 0; info < APPLIANCE_INFO_COUNT; info++) {
+        const char *value = factory_appliance_info(edgehog_device, info);
+        if (value) {
+            edgehog_property_cache_store_static_string(edgehog_device,
+                appliance_info_interface.name, appliance_info_fields[info].path, value);
+            // Sent by reconcile_appliance_info, also when the Astarte session is kept
+            edgehog_device->appliance_factory_pending |= 1 << info;
+        } else {
+            from_factory = false;
+        }
+    }
+    if (from_factory) {
+        return;
     }
 
-    ret = nvs_set_str(nvs, key, value);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Unable to set %s: %s. Error %d", key, value, ret);
-        nvs_close(nvs);
-        return ret;
+    nvs_handle nvs;
+    if (nvs_open_from_partition(
+            edgehog_device->partition_name, APPLIANCE_NAMESPACE, NVS_READONLY, &nvs)
+        != ESP_OK) {
+        return;
     }
 
-    nvs_commit(nvs);
+    // Cache the stored values, so they can be resent without reading the NVS again
+    for (int info = 0; info < APPLIANCE_INFO_COUNT; info++) {
+        if (factory_appliance_info(edgehog_device, info)) {
+            continue;
+        }
+        char *value = edgehog_nvs_get_string(nvs, appliance_info_fields[info].key);
+        if (value) {
+            edgehog_property_cache_store_string(edgehog_device, appliance_info_interface.name,
+                appliance_info_fields[info].path, value);
+            free(value);
+        }
+    }
     nvs_close(nvs);
-    return ESP_OK;
 }
 
-static char *edgehog_nvs_get_string(const char *partition_name, const char *key)
+// Returns false if a later call already set a newer value, both results are then
+// ESP_ERR_INVALID_STATE
+static bool store_appliance_info(edgehog_device_handle_t edgehog_device, appliance_info_t info,
+    uint32_t call, const char *value, esp_err_t *publish_result, esp_err_t *persist_result)
 {
+    const char *key = appliance_info_fields[info].key;
+    uint8_t info_bit = 1 << info;
+
+    // Factory values are read-only, setting the same value is accepted as a no-op
+    const char *factory_value = factory_appliance_info(edgehog_device, info);
+    if (factory_value) {
+        if (strcmp(factory_value, value) != 0) {
+            ESP_LOGW(TAG, "%s is set by the factory data, %s ignored", key, value);
+            *publish_result = ESP_ERR_NOT_SUPPORTED;
+        } else {
+            *publish_result = ESP_OK;
+        }
+        *persist_result = *publish_result;
+        return true;
+    }
+
+    // Compare, publish and store under the same lock, so concurrent setters cannot leave
+    // Astarte and the NVS with different values
+    xSemaphoreTake(edgehog_device->appliance_lock, portMAX_DELAY);
+
+    // A call run after a later one already set a newer value, e.g. an asynchronous one
+    if ((int32_t) (call - edgehog_device->appliance_stored_call[info]) < 0) {
+        xSemaphoreGive(edgehog_device->appliance_lock);
+        ESP_LOGD(TAG, "%s: %s superseded by a later call", key, value);
+        *publish_result = ESP_ERR_INVALID_STATE;
+        *persist_result = ESP_ERR_INVALID_STATE;
+        return false;
+    }
+    edgehog_device->appliance_stored_call[info] = call;
+
     nvs_handle nvs;
-    nvs_open_from_partition(partition_name, APPLIANCE_NAMESPACE, NVS_READONLY, &nvs);
+    esp_err_t ret = nvs_open_from_partition(
+        edgehog_device->partition_name, APPLIANCE_NAMESPACE, NVS_READWRITE, &nvs);
+    bool nvs_opened = ret == ESP_OK;
+    if (!nvs_opened) {
+        ESP_LOGE(TAG, "Unable to open %s", edgehog_device->partition_name);
+    }
 
-    size_t required_size;
-    nvs_get_str(nvs, key, NULL, &required_size);
-    if (required_size == 0) {
-        goto error;
+    uint8_t dirty = 0;
+    char *previous_value = NULL;
+    if (nvs_opened) {
+        nvs_get_u8(nvs, APPLIANCE_DIRTY_KEY, &dirty);
+        previous_value = edgehog_nvs_get_string(nvs, key);
     }
-    char *out_value = malloc(required_size * sizeof(char *));
-    if (!out_value) {
-        goto error;
+    bool changed = !previous_value || strcmp(previous_value, value) != 0;
+    free(previous_value);
+
+    *publish_result = ESP_OK;
+    *persist_result = ret;
+    if (changed || (dirty & info_bit)) {
+        *publish_result = edgehog_property_set_string(
+            edgehog_device, appliance_info_interface.name, appliance_info_fields[info].path, value);
+
+        // A value that could not be sent is kept as dirty and sent on the next connection
+        uint8_t new_dirty = *publish_result == ASTARTE_OK ? dirty & ~info_bit : dirty | info_bit;
+        if (nvs_opened && changed) {
+            ret = nvs_set_str(nvs, key, value);
+            if (ret == ESP_OK) {
+                edgehog_nvs_stats_record(
+                    edgehog_device, APPLIANCE_NAMESPACE, key, strlen(value) + 1);
+            }
+        }
+        if (nvs_opened && ret == ESP_OK && new_dirty != dirty) {
+            ret = nvs_set_u8(nvs, APPLIANCE_DIRTY_KEY, new_dirty);
+            if (ret == ESP_OK) {
+                edgehog_nvs_stats_record(
+                    edgehog_device, APPLIANCE_NAMESPACE, APPLIANCE_DIRTY_KEY, sizeof(new_dirty));
+            }
+        }
+        if (nvs_opened && ret == ESP_OK && (changed || new_dirty != dirty)) {
+            EDGEHOG_TRACE(EDGEHOG_TRACE_NVS_COMMIT_BEGIN, 0);
+            ret = nvs_commit(nvs);
+            EDGEHOG_TRACE(EDGEHOG_TRACE_NVS_COMMIT_END, ret);
+            EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_NVS_RESULT, ret);
+        }
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to set %s: %s. Error %d", key, value, ret);
+        }
+        *persist_result = ret;
+    }
+
+    if (nvs_opened) {
+        nvs_close(nvs);
+    }
+    xSemaphoreGive(edgehog_device->appliance_lock);
+    return true;
+}
+
+static void reconcile_appliance_info(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    xSemaphoreTake(edgehog_device->appliance_lock, portMAX_DELAY);
+
+    // The factory data may have been flashed since the last boot, its values are sent once
+    for (int info = 0; info < APPLIANCE_INFO_COUNT; info++) {
+        if ((edgehog_device->appliance_factory_pending & (1 << info))
+            && edgehog_property_set_static_string(edgehog_device, appliance_info_interface.name,
+                   appliance_info_fields[info].path, factory_appliance_info(edgehog_device, info))
+                == ASTARTE_OK) {
+            edgehog_device->appliance_factory_pending &= ~(1 << info);
+        }
+    }
+
+    nvs_handle nvs;
+    uint8_t dirty = 0;
+    if (nvs_open_from_partition(
+            edgehog_device->partition_name, APPLIANCE_NAMESPACE, NVS_READWRITE, &nvs)
+        != ESP_OK) {
+        xSemaphoreGive(edgehog_device->appliance_lock);
+        return;
+    }
+    nvs_get_u8(nvs, APPLIANCE_DIRTY_KEY, &dirty);
+
+    // Only the latest value of each property was kept, so multiple offline updates of the same
+    // property are sent once
+    uint8_t reconciled = dirty;
+    for (int info = 0; info < APPLIANCE_INFO_COUNT; info++) {
+        if (!(dirty & (1 << info)) || factory_appliance_info(edgehog_device, info)) {
+            continue;
+        }
+        char *value = edgehog_nvs_get_string(nvs, appliance_info_fields[info].key);
+        if (!value
+            || edgehog_property_set_string(edgehog_device, appliance_info_interface.name,
+                   appliance_info_fields[info].path, value)
+                == ASTARTE_OK) {
+            reconciled &= ~(1 << info);
+        }
+        free(value);
+    }
+
+    if (reconciled != dirty) {
+        ESP_LOGI(TAG, "Sent pending appliance info, still pending: 0x%x", reconciled);
+        if (nvs_set_u8(nvs, APPLIANCE_DIRTY_KEY, reconciled) == ESP_OK) {
+            edgehog_nvs_stats_record(
+                edgehog_device, APPLIANCE_NAMESPACE, APPLIANCE_DIRTY_KEY, sizeof(reconciled));
+            EDGEHOG_TRACE(EDGEHOG_TRACE_NVS_COMMIT_BEGIN, 0);
+            esp_err_t ret = nvs_commit(nvs);
+            EDGEHOG_TRACE(EDGEHOG_TRACE_NVS_COMMIT_END, ret);
+            EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_NVS_RESULT, ret);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Unable to store pending appliance info. Error %d", ret);
+            }
+        }
     }
-    nvs_get_str(nvs, key, out_value, &required_size);
-    nvs_close(nvs);
-    return out_value;
 
-error:
     nvs_close(nvs);
-    return NULL;
+    xSemaphoreGive(edgehog_device->appliance_lock);
 }
 
-esp_err_t edgehog_device_set_appliance_serial_number(
-    edgehog_device_handle_t edgehog_device, const char *serial_num)
+static esp_err_t set_appliance_info(
+    edgehog_device_handle_t edgehog_device, appliance_info_t info, const char *value)
 {
-    if (!serial_num) {
+    if (!edgehog_device || !value) {
         return ESP_FAIL;
     }
 
-    char *previous_value = edgehog_nvs_get_string(edgehog_device->partition_name, "serial_number");
-    if (previous_value && strcmp(previous_value, serial_num) == 0) {
+    uint32_t call = __atomic_add_fetch(&edgehog_device->appliance_calls, 1, __ATOMIC_RELAXED);
+    esp_err_t publish_result;
+    esp_err_t persist_result;
+    if (!store_appliance_info(
+            edgehog_device, info, call, value, &publish_result, &persist_result)) {
+        // A concurrent call took the lock first with a later value, as if this one ran before
         return ESP_OK;
     }
+    return publish_result != ESP_OK ? publish_result : persist_result;
+}
 
-    esp_err_t ret = astarte_device_set_string_property(edgehog_device->astarte_device,
-        appliance_info_interface.name, "/serialNumber", (char *) serial_num);
-    if (ret != ASTARTE_OK) {
-        return ret;
-    }
-    if (edgehog_device->partition_name) {
-        return edgehog_nvs_set_str(
-            edgehog_device->partition_name, "serial_number", (char *) serial_num);
-    } else {
-        return ESP_OK;
+typedef struct
+{
+    appliance_info_t info;
+    uint32_t call;
+    edgehog_device_set_cb_t callback;
+    void *user_data;
+    char value[];
+} appliance_info_job_t;
+
+static void appliance_info_job(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    appliance_info_job_t *job = (appliance_info_job_t *) arg;
+
+    esp_err_t publish_result;
+    esp_err_t persist_result;
+    store_appliance_info(
+        edgehog_device, job->info, job->call, job->value, &publish_result, &persist_result);
+    if (job->callback) {
+        job->callback(edgehog_device, publish_result, persist_result, job->user_data);
     }
+    free(job);
 }
 
-esp_err_t edgehog_device_set_appliance_part_number(
-    edgehog_device_handle_t edgehog_device, const char *part_num)
+static esp_err_t set_appliance_info_async(edgehog_device_handle_t edgehog_device,
+    appliance_info_t info, const char *value, edgehog_device_set_cb_t callback, void *user_data)
 {
-    if (!part_num) {
+    if (!edgehog_device || !value) {
         return ESP_FAIL;
     }
 
-    char *previous_value = edgehog_nvs_get_string(edgehog_device->partition_name, "part_number");
-    if (previous_value && strcmp(previous_value, part_num) == 0) {
-        return ESP_OK;
+    size_t value_len = strlen(value);
+    appliance_info_job_t *job = malloc(sizeof(appliance_info_job_t) + value_len + 1);
+    if (!job) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return ESP_ERR_NO_MEM;
     }
+    job->info = info;
+    job->callback = callback;
+    job->user_data = user_data;
+    job->call = __atomic_add_fetch(&edgehog_device->appliance_calls, 1, __ATOMIC_RELAXED);
+    memcpy(job->value, value, value_len + 1);
 
-    esp_err_t ret = astarte_device_set_string_property(edgehog_device->astarte_device,
-        appliance_info_interface.name, "/partNumber", (char *) part_num);
-    if (ret != ASTARTE_OK) {
-        return ret;
+    esp_err_t ret = edgehog_worker_submit(edgehog_device, appliance_info_job, job);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to queue %s update, error %d", appliance_info_fields[info].key, ret);
+        free(job);
     }
-    if (edgehog_device->partition_name) {
-        return edgehog_nvs_set_str(
-            edgehog_device->partition_name, "part_number", (char *) part_num);
-    } else {
-        return ESP_OK;
+    return ret;
+}
+
+static void queue_connection_jobs(edgehog_device_handle_t edgehog_device, uint8_t jobs)
+{
+    static const struct
+    {
+        uint8_t bit;
+        edgehog_worker_job_t job;
+    } connection_jobs[] = {
+        { CONNECTION_JOB_RESYNC, edgehog_property_cache_resend },
+        { CONNECTION_JOB_RECONCILE, reconcile_appliance_info },
+    };
+
+    // Called from the MQTT task and the timer, the pending jobs are claimed one at a time
+    __atomic_fetch_or(&edgehog_device->connection_jobs_pending, jobs, __ATOMIC_RELAXED);
+    bool retry = false;
+    for (size_t i = 0; i < sizeof(connection_jobs) / sizeof(connection_jobs[0]); i++) {
+        uint8_t bit = connection_jobs[i].bit;
+        if (!(__atomic_fetch_and(&edgehog_device->connection_jobs_pending, ~bit, __ATOMIC_RELAXED)
+                & bit)) {
+            continue;
+        }
+        if (edgehog_worker_submit(edgehog_device, connection_jobs[i].job, NULL) != ESP_OK) {
+            __atomic_fetch_or(&edgehog_device->connection_jobs_pending, bit, __ATOMIC_RELAXED);
+            retry = true;
+        }
+    }
+    if (retry) {
+        if (!edgehog_device->connection_jobs_timer) {
+            ESP_LOGW(TAG, "Unable to queue the properties resync or the pending appliance info");
+            return;
+        }
+        ESP_LOGW(TAG, "Worker busy, delaying the jobs of the Astarte connection");
+        // Already armed if a previous retry is pending
+        esp_timer_start_once(
+            edgehog_device->connection_jobs_timer, CONNECTION_JOBS_RETRY_MS * 1000ULL);
     }
 }
 
+static void connection_jobs_timer_cb(void *arg)
+{
+    queue_connection_jobs((edgehog_device_handle_t) arg, 0);
+}
+
+static esp_err_t create_connection_jobs_timer(edgehog_device_handle_t edgehog_device)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = connection_jobs_timer_cb,
+        .arg = edgehog_device,
+        .name = "edgehog_connection_jobs",
+    };
+    return esp_timer_create(&timer_args, &edgehog_device->connection_jobs_timer);
+}
+
+void edgehog_device_astarte_connection_event_handler(
+    edgehog_device_handle_t edgehog_device, const astarte_device_connection_event_t *event)
+{
+    if (!edgehog_device || !event) {
+        return;
+    }
+
+    EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_ASTARTE_CONNECTION, event->session_present);
+    // This runs in the MQTT task, the properties are sent by the worker. A job the worker has no
+    // room for stays pending and is queued by the timer, a lost resync would leave Astarte with
+    // stale properties until the next clean session.
+    queue_connection_jobs(edgehog_device,
+        event->session_present ? CONNECTION_JOB_RECONCILE
+                               : CONNECTION_JOB_RESYNC | CONNECTION_JOB_RECONCILE);
+    edgehog_backlog_start_replay(edgehog_device);
+}
+
+void edgehog_device_astarte_event_handler(
+    edgehog_device_handle_t edgehog_device, const astarte_device_data_event_t *event)
+{
+    if (!edgehog_device || !event
+        || strcmp(event->interface_name, edgehog_command_interface.name) != 0) {
+        return;
+    }
+
+    if (strcmp(event->path, "/request") != 0 || event->bson_value_type != BSON_TYPE_STRING) {
+        ESP_LOGW(TAG, "Unexpected command on %s", event->path);
+        return;
+    }
+    uint32_t len;
+    const char *command = astarte_bson_value_to_string(event->bson_value, &len);
+    EDGEHOG_RECORD(EDGEHOG_RECORD_ASTARTE_COMMAND, command, len > UINT8_MAX ? UINT8_MAX : len);
+    edgehog_command_dispatch(edgehog_device, command);
+}
+
+esp_err_t edgehog_device_set_appliance_serial_number(
+    edgehog_device_handle_t edgehog_device, const char *serial_num)
+{
+    return set_appliance_info(edgehog_device, APPLIANCE_INFO_SERIAL_NUMBER, serial_num);
+}
+
+esp_err_t edgehog_device_set_appliance_part_number(
+    edgehog_device_handle_t edgehog_device, const char *part_num)
+{
+    return set_appliance_info(edgehog_device, APPLIANCE_INFO_PART_NUMBER, part_num);
+}
+
+esp_err_t edgehog_device_set_appliance_serial_number_async(edgehog_device_handle_t edgehog_device,
+    const char *serial_num, edgehog_device_set_cb_t callback, void *user_data)
+{
+    return set_appliance_info_async(
+        edgehog_device, APPLIANCE_INFO_SERIAL_NUMBER, serial_num, callback, user_data);
+}
+
+esp_err_t edgehog_device_set_appliance_part_number_async(edgehog_device_handle_t edgehog_device,
+    const char *part_num, edgehog_device_set_cb_t callback, void *user_data)
+{
+    return set_appliance_info_async(
+        edgehog_device, APPLIANCE_INFO_PART_NUMBER, part_num, callback, user_data);
+}
+
 void edgehog_device_destroy(edgehog_device_handle_t edgehog_device)
 {
     if (edgehog_device) {
+        stop_wifi_scan_schedule(edgehog_device);
+        if (edgehog_device->system_status_timer) {
+            esp_timer_stop(edgehog_device->system_status_timer);
+        }
+        edgehog_event_loop_monitor_stop(edgehog_device);
+        edgehog_monitor_stop(edgehog_device);
+        edgehog_metrics_stop(edgehog_device);
+        edgehog_nvs_stats_stop(edgehog_device);
+#ifdef CONFIG_EDGEHOG_SOAK
+        edgehog_soak_stop(edgehog_device);
+#endif
+        edgehog_backlog_stop(edgehog_device);
+        if (edgehog_device->connection_jobs_timer) {
+            esp_timer_stop(edgehog_device->connection_jobs_timer);
+        }
+        edgehog_worker_stop(edgehog_device);
+        if (edgehog_device->connection_jobs_timer) {
+            esp_timer_delete(edgehog_device->connection_jobs_timer);
+        }
+        if (edgehog_device->system_status_timer) {
+            // A queued job may have restarted it with a new rate
+            esp_timer_stop(edgehog_device->system_status_timer);
+            esp_timer_delete(edgehog_device->system_status_timer);
+        }
+        edgehog_backlog_destroy(edgehog_device);
         astarte_device_destroy(edgehog_device->astarte_device);
+        edgehog_wifi_scan_cache_destroy(&edgehog_device->wifi_scan_cache);
+        edgehog_property_cache_destroy(&edgehog_device->property_cache);
+        // The cache referenced the factory values in place
+        edgehog_factory_data_close(&edgehog_device->factory_data);
+        vSemaphoreDelete(edgehog_device->appliance_lock);
     }
 
     free(edgehog_device);
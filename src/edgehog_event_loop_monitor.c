@@ -0,0 +1,136 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_event_loop_monitor.h"
+#include <esp_log.h>
+
+ESP_EVENT_DECLARE_BASE(EDGEHOG_EVENT);
+ESP_EVENT_DEFINE_BASE(EDGEHOG_EVENT);
+
+enum
+{
+    EDGEHOG_EVENT_PROBE = 0,
+};
+
+typedef struct
+{
+    edgehog_device_handle_t edgehog_device;
+    int64_t post_time_us;
+} probe_event_t;
+
+static const char *TAG = "EDGEHOG_EVENT_LOOP";
+
+// Upper bounds of the latency buckets, in microseconds
+static const int32_t latency_bounds_us[] = { 100, 500, 1000, 5000, 10000, 50000, 100000 };
+
+static void probe_timer_cb(void *arg)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+    probe_event_t probe
+        = { .edgehog_device = edgehog_device, .post_time_us = esp_timer_get_time() };
+
+    // Never wait, a full queue is itself a sign of a congested loop
+    if (esp_event_post(EDGEHOG_EVENT, EDGEHOG_EVENT_PROBE, &probe, sizeof(probe), 0) != ESP_OK) {
+        edgehog_metric_counter_add(edgehog_device->event_loop_monitor.probe_drops, 1);
+    }
+}
+
+static void probe_handler(
+    void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+    const probe_event_t *probe = (const probe_event_t *) event_data;
+
+    // Probes of other Edgehog devices share the same event base
+    if (!probe || probe->edgehog_device != edgehog_device) {
+        return;
+    }
+    int64_t lag_us = esp_timer_get_time() - probe->post_time_us;
+    edgehog_metric_histogram_record(
+        edgehog_device->event_loop_monitor.lag_us, lag_us > INT32_MAX ? INT32_MAX : lag_us);
+}
+
+esp_err_t edgehog_event_loop_monitor_start(
+    edgehog_device_handle_t edgehog_device, uint32_t probe_period_ms)
+{
+    edgehog_event_loop_monitor_t *monitor = &edgehog_device->event_loop_monitor;
+    uint8_t bound_count = sizeof(latency_bounds_us) / sizeof(latency_bounds_us[0]);
+
+    monitor->handler_us = edgehog_device_metric_register_histogram(
+        edgehog_device, "edgehog.eventLoop.handlerUs", latency_bounds_us, bound_count);
+    if (probe_period_ms == 0) {
+        return monitor->handler_us ? ESP_OK : ESP_ERR_NO_MEM;
+    }
+
+    monitor->lag_us = edgehog_device_metric_register_histogram(
+        edgehog_device, "edgehog.eventLoop.lagUs", latency_bounds_us, bound_count);
+    monitor->probe_drops
+        = edgehog_device_metric_register_counter(edgehog_device, "edgehog.eventLoop.probeDrops");
+    if (!monitor->handler_us || !monitor->lag_us || !monitor->probe_drops) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = esp_event_handler_instance_register(EDGEHOG_EVENT, EDGEHOG_EVENT_PROBE,
+        probe_handler, edgehog_device, &monitor->probe_handler);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to register the probe handler, error %d", ret);
+        return ret;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = probe_timer_cb,
+        .arg = edgehog_device,
+        .name = "edgehog_loop_probe",
+    };
+    ret = esp_timer_create(&timer_args, &monitor->probe_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the probe timer, error %d", ret);
+        return ret;
+    }
+
+    return esp_timer_start_periodic(monitor->probe_timer, (uint64_t) probe_period_ms * 1000);
+}
+
+void edgehog_event_loop_monitor_stop(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_event_loop_monitor_t *monitor = &edgehog_device->event_loop_monitor;
+
+    if (monitor->probe_timer) {
+        esp_timer_stop(monitor->probe_timer);
+        esp_timer_delete(monitor->probe_timer);
+        monitor->probe_timer = NULL;
+    }
+
+    if (monitor->probe_handler) {
+        esp_event_handler_instance_unregister(
+            EDGEHOG_EVENT, EDGEHOG_EVENT_PROBE, monitor->probe_handler);
+        monitor->probe_handler = NULL;
+    }
+}
+
+void edgehog_event_loop_monitor_record_handler(
+    edgehog_device_handle_t edgehog_device, int64_t start_us)
+{
+    edgehog_metric_handle_t handler_us = edgehog_device->event_loop_monitor.handler_us;
+    if (handler_us) {
+        int64_t elapsed_us = esp_timer_get_time() - start_us;
+        edgehog_metric_histogram_record(
+            handler_us, elapsed_us > INT32_MAX ? INT32_MAX : elapsed_us);
+    }
+}
@@ -0,0 +1,170 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_factory_data.h"
+#include <esp_log.h>
+#include <string.h>
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define FACTORY_DATA_MAGIC 0x44464845
+#define FACTORY_DATA_VERSION 1
+
+static const char *TAG = "EDGEHOG_FACTORY_DATA";
+
+typedef struct
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t reserved[3];
+    uint32_t length;
+    uint32_t crc32;
+} factory_data_header_t;
+
+// Bitwise, it runs once at boot over a few bytes
+static uint32_t crc32_le(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+static esp_err_t map_partition(const char *partition_label, edgehog_factory_data_t *factory_data)
+{
+    int fd = open(partition_label, O_RDONLY);
+    if (fd < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid once the file is closed
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return ESP_FAIL;
+    }
+    factory_data->mapping = mapping;
+    factory_data->mapping_len = st.st_size;
+    return ESP_OK;
+}
+
+static void unmap_partition(edgehog_factory_data_t *factory_data)
+{
+    munmap((void *) factory_data->mapping, factory_data->mapping_len);
+}
+#else
+static esp_err_t map_partition(const char *partition_label, edgehog_factory_data_t *factory_data)
+{
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label);
+    if (!partition) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t ret = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA,
+        &factory_data->mapping, &factory_data->mmap_handle);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    factory_data->mapping_len = partition->size;
+    return ESP_OK;
+}
+
+static void unmap_partition(edgehog_factory_data_t *factory_data)
+{
+    spi_flash_munmap(factory_data->mmap_handle);
+}
+#endif
+
+esp_err_t edgehog_factory_data_open(
+    const char *partition_label, edgehog_factory_data_t *factory_data)
+{
+    memset(factory_data, 0, sizeof(edgehog_factory_data_t));
+    esp_err_t ret = map_partition(partition_label, factory_data);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to map %s, error %d", partition_label, ret);
+        return ret;
+    }
+
+    // Partitions are 4 KiB aligned, so the header can be read in place
+    const factory_data_header_t *header = (const factory_data_header_t *) factory_data->mapping;
+    if (factory_data->mapping_len < sizeof(factory_data_header_t)
+        || header->magic != FACTORY_DATA_MAGIC || header->version != FACTORY_DATA_VERSION) {
+        ret = ESP_ERR_INVALID_VERSION;
+    } else if (header->length > factory_data->mapping_len - sizeof(factory_data_header_t)) {
+        ret = ESP_ERR_INVALID_SIZE;
+    } else {
+        const uint8_t *records = (const uint8_t *) (header + 1);
+        if (crc32_le(records, header->length) != header->crc32) {
+            ret = ESP_ERR_INVALID_CRC;
+        } else {
+            factory_data->records = records;
+            factory_data->records_len = header->length;
+        }
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid factory data in %s, error %d", partition_label, ret);
+        edgehog_factory_data_close(factory_data);
+    }
+    return ret;
+}
+
+void edgehog_factory_data_close(edgehog_factory_data_t *factory_data)
+{
+    if (factory_data->mapping) {
+        unmap_partition(factory_data);
+    }
+    memset(factory_data, 0, sizeof(edgehog_factory_data_t));
+}
+
+const char *edgehog_factory_data_get_string(
+    const edgehog_factory_data_t *factory_data, edgehog_factory_data_tag_t tag)
+{
+    if (!factory_data->records) {
+        return NULL;
+    }
+
+    uint32_t offset = 0;
+    while (offset + 2 <= factory_data->records_len) {
+        uint8_t record_tag = factory_data->records[offset];
+        uint8_t record_len = factory_data->records[offset + 1];
+        const char *value = (const char *) &factory_data->records[offset + 2];
+        offset += 2 + record_len;
+        if (offset > factory_data->records_len) {
+            break;
+        }
+        if (record_tag == tag) {
+            // A string that is not terminated in place cannot be used without a copy
+            return record_len > 0 && value[record_len - 1] == '\0' ? value : NULL;
+        }
+    }
+    return NULL;
+}
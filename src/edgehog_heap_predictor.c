@@ -0,0 +1,112 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_heap_predictor.h"
+#include <math.h>
+#include <string.h>
+
+// Time constant of the sample weights
+#define FIT_TIME_CONSTANT_H 6.0
+// Samples needed before the forecast is trusted
+#define MIN_SAMPLES 8
+// Outliers are further from the trend than this many mean residuals, plus a fixed margin
+#define OUTLIER_RESIDUALS 4.0
+#define OUTLIER_MARGIN_BYTES 2048.0
+// Consecutive outliers accepted as a new level of the heap usage
+#define MAX_REJECTED_IN_ROW 3
+// A leak is suspected when the heap is predicted to run out within this horizon, and cleared
+// when the prediction goes beyond twice it
+#define LEAK_HORIZON_H (7 * 24.0)
+
+void edgehog_heap_predictor_init(edgehog_heap_predictor_t *predictor)
+{
+    memset(predictor, 0, sizeof(edgehog_heap_predictor_t));
+}
+
+static bool fit(const edgehog_heap_predictor_t *predictor, double *intercept, double *slope)
+{
+    double det = predictor->sw * predictor->swtt - predictor->swt * predictor->swt;
+    if (predictor->samples < 2 || fabs(det) < 1e-12) {
+        return false;
+    }
+    *slope = (predictor->sw * predictor->swty - predictor->swt * predictor->swy) / det;
+    *intercept = (predictor->swy - *slope * predictor->swt) / predictor->sw;
+    return true;
+}
+
+void edgehog_heap_predictor_update(edgehog_heap_predictor_t *predictor, int64_t time_us,
+    uint32_t free_bytes, edgehog_heap_forecast_t *forecast)
+{
+    if (predictor->samples == 0) {
+        predictor->origin_us = time_us;
+        predictor->last_us = time_us;
+    }
+    double t = (time_us - predictor->origin_us) / 3600e6;
+    double y = free_bytes;
+
+    double intercept = y;
+    double slope = 0;
+    bool fitted = fit(predictor, &intercept, &slope);
+
+    forecast->outlier = false;
+    if (fitted && predictor->samples >= MIN_SAMPLES) {
+        double residual = fabs(y - (intercept + slope * t));
+        if (residual > OUTLIER_RESIDUALS * predictor->residual_scale + OUTLIER_MARGIN_BYTES
+            && predictor->rejected_in_row < MAX_REJECTED_IN_ROW) {
+            predictor->rejected_in_row++;
+            forecast->outlier = true;
+        } else {
+            predictor->rejected_in_row = 0;
+            predictor->residual_scale += (residual - predictor->residual_scale) / 8;
+        }
+    } else if (fitted) {
+        predictor->residual_scale += (fabs(y - (intercept + slope * t)) - predictor->residual_scale)
+            / (predictor->samples + 1);
+    }
+
+    if (!forecast->outlier) {
+        // Age the previous samples, then add the new one with weight 1
+        double decay = exp(-((time_us - predictor->last_us) / 3600e6) / FIT_TIME_CONSTANT_H);
+        predictor->sw = predictor->sw * decay + 1;
+        predictor->swt = predictor->swt * decay + t;
+        predictor->swy = predictor->swy * decay + y;
+        predictor->swtt = predictor->swtt * decay + t * t;
+        predictor->swty = predictor->swty * decay + t * y;
+        predictor->last_us = time_us;
+        predictor->samples++;
+        fitted = fit(predictor, &intercept, &slope);
+    }
+
+    forecast->free_bytes = fitted ? intercept + slope * t : y;
+    forecast->slope_bytes_per_hour = fitted ? slope : 0;
+    forecast->time_to_exhaustion_s = -1;
+    double hours_left = -1;
+    if (fitted && slope < 0 && forecast->free_bytes > 0) {
+        hours_left = forecast->free_bytes / -slope;
+        forecast->time_to_exhaustion_s = (int64_t) (hours_left * 3600);
+    }
+
+    if (predictor->samples >= MIN_SAMPLES) {
+        if (hours_left >= 0 && hours_left < LEAK_HORIZON_H) {
+            predictor->leak_suspected = true;
+        } else if (hours_left < 0 || hours_left > 2 * LEAK_HORIZON_H) {
+            predictor->leak_suspected = false;
+        }
+    }
+    forecast->leak_suspected = predictor->leak_suspected;
+}
@@ -0,0 +1,195 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_heap_trace.h"
+
+#ifdef CONFIG_EDGEHOG_HEAP_TRACE
+
+#include "edgehog_device_private.h"
+#include "edgehog_worker.h"
+#include <astarte_bson_serializer.h>
+#include <esp_heap_trace.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdlib.h>
+
+// Distinct call sites reported, the allocations of any other site are only counted as a total
+#define HEAP_TRACE_MAX_SITES 32
+
+static const char *TAG = "EDGEHOG_HEAP_TRACE";
+
+const astarte_interface_t edgehog_heap_trace_interface
+    = { .name = "io.edgehog.devicemanager.HeapTraceSummary",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+struct heap_trace_session
+{
+    edgehog_device_handle_t edgehog_device;
+    esp_timer_handle_t timer;
+    heap_trace_record_t records[CONFIG_EDGEHOG_HEAP_TRACE_RECORDS];
+};
+
+struct heap_trace_summary
+{
+    int site_count;
+    int64_t callers[HEAP_TRACE_MAX_SITES];
+    int32_t counts[HEAP_TRACE_MAX_SITES];
+    int64_t bytes[HEAP_TRACE_MAX_SITES];
+    int32_t other_count;
+    int64_t other_bytes;
+};
+
+// Heap tracing is global, so the session is shared by all the Edgehog devices
+static struct heap_trace_session *session;
+
+static void summary_add(struct heap_trace_summary *summary, const heap_trace_record_t *record)
+{
+    int64_t caller = (intptr_t) record->alloced_by[0];
+
+    for (int i = 0; i < summary->site_count; i++) {
+        if (summary->callers[i] == caller) {
+            summary->counts[i]++;
+            summary->bytes[i] += record->size;
+            return;
+        }
+    }
+    if (summary->site_count == HEAP_TRACE_MAX_SITES) {
+        summary->other_count++;
+        summary->other_bytes += record->size;
+        return;
+    }
+    summary->callers[summary->site_count] = caller;
+    summary->counts[summary->site_count] = 1;
+    summary->bytes[summary->site_count] = record->size;
+    summary->site_count++;
+}
+
+static void heap_trace_finish(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    struct heap_trace_session *finished = (struct heap_trace_session *) arg;
+
+    heap_trace_stop();
+    size_t record_count = heap_trace_get_count();
+
+    struct heap_trace_summary *summary = calloc(1, sizeof(struct heap_trace_summary));
+    if (!summary) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        goto end;
+    }
+    for (size_t i = 0; i < record_count; i++) {
+        heap_trace_record_t record;
+        if (heap_trace_get(i, &record) == ESP_OK && record.address) {
+            summary_add(summary, &record);
+        }
+    }
+    ESP_LOGI(TAG, "%u allocations outstanding from %d call sites", (unsigned) record_count,
+        summary->site_count);
+
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int64_array(&bs, "bytes", summary->bytes, summary->site_count);
+    astarte_bson_serializer_append_int64_array(
+        &bs, "callers", summary->callers, summary->site_count);
+    astarte_bson_serializer_append_int32_array(
+        &bs, "counts", summary->counts, summary->site_count);
+    astarte_bson_serializer_append_int64(&bs, "otherBytes", summary->other_bytes);
+    astarte_bson_serializer_append_int32(&bs, "otherCount", summary->other_count);
+    // A full buffer means that some allocations of the window were not traced
+    astarte_bson_serializer_append_boolean(
+        &bs, "truncated", record_count == CONFIG_EDGEHOG_HEAP_TRACE_RECORDS);
+    astarte_bson_serializer_append_int32(
+        &bs, "windowSeconds", CONFIG_EDGEHOG_HEAP_TRACE_DURATION_S);
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    edgehog_device_stream_aggregate(
+        edgehog_device, edgehog_heap_trace_interface.name, "/outstanding", doc, 0);
+    astarte_bson_serializer_destroy(&bs);
+    free(summary);
+
+end:
+    esp_timer_delete(finished->timer);
+    free(finished);
+    __atomic_store_n(&session, NULL, __ATOMIC_RELEASE);
+}
+
+static void heap_trace_timer_cb(void *arg)
+{
+    struct heap_trace_session *running = (struct heap_trace_session *) arg;
+
+    if (edgehog_worker_submit(running->edgehog_device, heap_trace_finish, running) != ESP_OK) {
+        // Retry later, the session cannot be left running
+        ESP_LOGW(TAG, "Worker busy, delaying the end of the heap trace session");
+        esp_timer_start_once(running->timer, 1000000);
+    }
+}
+
+void edgehog_heap_trace_start(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    struct heap_trace_session *started = calloc(1, sizeof(struct heap_trace_session));
+    if (!started) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return;
+    }
+    started->edgehog_device = edgehog_device;
+
+    // Each device starts its sessions in its own worker, so the claim of the global session is
+    // atomic, and it is released when the session cannot be started or ends
+    struct heap_trace_session *running = NULL;
+    if (!__atomic_compare_exchange_n(
+            &session, &running, started, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        ESP_LOGW(TAG, "A heap trace session is already running");
+        free(started);
+        return;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = heap_trace_timer_cb,
+        .arg = started,
+        .name = "edgehog_heap_trace",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &started->timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the heap trace timer, error %d", ret);
+        free(started);
+        __atomic_store_n(&session, NULL, __ATOMIC_RELEASE);
+        return;
+    }
+
+    ret = heap_trace_init_standalone(started->records, CONFIG_EDGEHOG_HEAP_TRACE_RECORDS);
+    if (ret == ESP_OK) {
+        ret = heap_trace_start(HEAP_TRACE_LEAKS);
+    }
+    if (ret != ESP_OK) {
+        // e.g. the application is tracing the heap itself
+        ESP_LOGE(TAG, "Unable to start heap tracing, error %d", ret);
+        esp_timer_delete(started->timer);
+        free(started);
+        __atomic_store_n(&session, NULL, __ATOMIC_RELEASE);
+        return;
+    }
+
+    esp_timer_start_once(started->timer, (uint64_t) CONFIG_EDGEHOG_HEAP_TRACE_DURATION_S * 1000000);
+    ESP_LOGI(TAG, "Tracing the heap for %d s", CONFIG_EDGEHOG_HEAP_TRACE_DURATION_S);
+}
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_load_stats.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Upper bounds of the payload size buckets, in bytes
+static const int32_t payload_bounds[] = { 32, 64, 128, 256, 512, 1024, 4096 };
+// Upper bounds of the job wall time buckets, in microseconds
+static const int32_t job_bounds_us[] = { 100, 500, 1000, 5000, 10000, 50000, 100000 };
+
+esp_err_t edgehog_load_stats_init(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_load_stats_t *stats = &edgehog_device->load_stats;
+
+    stats->publishes
+        = edgehog_device_metric_register_counter(edgehog_device, "edgehog.publish.count");
+    stats->bytes = edgehog_device_metric_register_counter(edgehog_device, "edgehog.publish.bytes");
+    stats->payload_bytes = edgehog_device_metric_register_histogram(edgehog_device,
+        "edgehog.publish.payloadBytes", payload_bounds,
+        sizeof(payload_bounds) / sizeof(payload_bounds[0]));
+    stats->job_wall_us
+        = edgehog_device_metric_register_histogram(edgehog_device, "edgehog.worker.jobWallUs",
+            job_bounds_us, sizeof(job_bounds_us) / sizeof(job_bounds_us[0]));
+
+    if (!stats->publishes || !stats->bytes || !stats->payload_bytes || !stats->job_wall_us) {
+        return ESP_ERR_NO_MEM;
+    }
+
+#ifdef CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+    stats->worker_cpu_us
+        = edgehog_device_metric_register_counter(edgehog_device, "edgehog.worker.cpuUs");
+    if (!stats->worker_cpu_us) {
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+    return ESP_OK;
+}
+
+void edgehog_load_stats_record_publish(edgehog_device_handle_t edgehog_device, size_t bytes)
+{
+    edgehog_load_stats_t *stats = &edgehog_device->load_stats;
+
+    if (stats->publishes && stats->bytes && stats->payload_bytes) {
+        edgehog_metric_counter_add(stats->publishes, 1);
+        edgehog_metric_counter_add(stats->bytes, bytes);
+        edgehog_metric_histogram_record(
+            stats->payload_bytes, bytes > INT32_MAX ? INT32_MAX : bytes);
+    }
+}
+
+void edgehog_load_stats_record_job(edgehog_device_handle_t edgehog_device, int64_t start_us)
+{
+    edgehog_load_stats_t *stats = &edgehog_device->load_stats;
+
+    if (stats->job_wall_us) {
+        int64_t elapsed_us = esp_timer_get_time() - start_us;
+        edgehog_metric_histogram_record(
+            stats->job_wall_us, elapsed_us > INT32_MAX ? INT32_MAX : elapsed_us);
+    }
+
+#ifdef CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+    // The run time counters are in microseconds and wrap, the deltas do not
+    if (stats->worker_cpu_us) {
+        TaskStatus_t status;
+        vTaskGetInfo(xTaskGetCurrentTaskHandle(), &status, pdFALSE, eRunning);
+        edgehog_metric_counter_add(
+            stats->worker_cpu_us, status.ulRunTimeCounter - stats->last_worker_run_time);
+        stats->last_worker_run_time = status.ulRunTimeCounter;
+    }
+#endif
+}
@@ -0,0 +1,274 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_metrics_registry.h"
+#include "edgehog_worker.h"
+#include <astarte_bson_serializer.h>
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "EDGEHOG_METRICS";
+
+const astarte_interface_t edgehog_metrics_interface
+    = { .name = "io.edgehog.devicemanager.ApplicationMetrics",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+// One sample of all the metrics, the histograms are flattened in registry order
+struct metrics_sample
+{
+    const char *names[EDGEHOG_METRICS_MAX];
+    int32_t types[EDGEHOG_METRICS_MAX];
+    int64_t values[EDGEHOG_METRICS_MAX];
+    int bound_count;
+    int64_t bounds[EDGEHOG_METRICS_MAX * EDGEHOG_METRIC_HISTOGRAM_MAX_BOUNDS];
+    int bucket_count;
+    int64_t buckets[EDGEHOG_METRICS_MAX * (EDGEHOG_METRIC_HISTOGRAM_MAX_BOUNDS + 1)];
+};
+
+void edgehog_metrics_init(edgehog_metrics_registry_t *registry)
+{
+    memset(registry, 0, sizeof(edgehog_metrics_registry_t));
+    vPortCPUInitializeMutex(&registry->lock);
+}
+
+static edgehog_metric_handle_t metric_register(edgehog_device_handle_t edgehog_device,
+    const char *name, edgehog_metric_type_t type, const int32_t *bounds, uint8_t bound_count)
+{
+    edgehog_metrics_registry_t *registry = &edgehog_device->metrics;
+
+    if (!name || name[0] == '\0' || strlen(name) > EDGEHOG_METRIC_NAME_MAX_LEN) {
+        ESP_LOGE(TAG, "Invalid metric name");
+        return NULL;
+    }
+
+    struct edgehog_metric_t *metric = NULL;
+    portENTER_CRITICAL(&registry->lock);
+    bool duplicate = false;
+    for (int i = 0; i < registry->count; i++) {
+        if (strcmp(registry->metrics[i].name, name) == 0) {
+            duplicate = true;
+            break;
+        }
+    }
+    if (!duplicate && registry->count < EDGEHOG_METRICS_MAX) {
+        metric = &registry->metrics[registry->count];
+        strcpy(metric->name, name);
+        metric->type = type;
+        metric->bound_count = bound_count;
+        if (bound_count > 0) {
+            memcpy(metric->bounds, bounds, bound_count * sizeof(int32_t));
+        }
+        // The publisher reads the count without the lock, the slot must be complete before
+        __atomic_store_n(&registry->count, registry->count + 1, __ATOMIC_RELEASE);
+    }
+    portEXIT_CRITICAL(&registry->lock);
+
+    if (duplicate) {
+        ESP_LOGE(TAG, "Metric %s already registered", name);
+    } else if (!metric) {
+        ESP_LOGE(TAG, "Unable to register %s, too many metrics", name);
+    }
+    return metric;
+}
+
+edgehog_metric_handle_t edgehog_device_metric_register_counter(
+    edgehog_device_handle_t edgehog_device, const char *name)
+{
+    return metric_register(edgehog_device, name, EDGEHOG_METRIC_COUNTER, NULL, 0);
+}
+
+edgehog_metric_handle_t edgehog_device_metric_register_gauge(
+    edgehog_device_handle_t edgehog_device, const char *name)
+{
+    return metric_register(edgehog_device, name, EDGEHOG_METRIC_GAUGE, NULL, 0);
+}
+
+edgehog_metric_handle_t edgehog_device_metric_register_histogram(
+    edgehog_device_handle_t edgehog_device, const char *name, const int32_t *bounds,
+    uint8_t bound_count)
+{
+    if (!bounds || bound_count == 0 || bound_count > EDGEHOG_METRIC_HISTOGRAM_MAX_BOUNDS) {
+        ESP_LOGE(TAG, "Invalid bounds for histogram %s", name ? name : "");
+        return NULL;
+    }
+    for (int i = 1; i < bound_count; i++) {
+        if (bounds[i] <= bounds[i - 1]) {
+            ESP_LOGE(TAG, "Bounds of histogram %s are not ascending", name ? name : "");
+            return NULL;
+        }
+    }
+
+    return metric_register(
+        edgehog_device, name, EDGEHOG_METRIC_HISTOGRAM, bounds, bound_count);
+}
+
+void edgehog_metric_counter_add(edgehog_metric_handle_t metric, uint32_t delta)
+{
+    __atomic_add_fetch(&metric->value, delta, __ATOMIC_RELAXED);
+}
+
+void edgehog_metric_gauge_set(edgehog_metric_handle_t metric, int32_t value)
+{
+    __atomic_store_n(&metric->value, (uint32_t) value, __ATOMIC_RELAXED);
+}
+
+void edgehog_metric_histogram_record(edgehog_metric_handle_t metric, int32_t value)
+{
+    int bucket = 0;
+    while (bucket < metric->bound_count && value > metric->bounds[bucket]) {
+        bucket++;
+    }
+    __atomic_add_fetch(&metric->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+static void metrics_sample(
+    edgehog_metrics_registry_t *registry, int count, struct metrics_sample *sample)
+{
+    for (int i = 0; i < count; i++) {
+        struct edgehog_metric_t *metric = &registry->metrics[i];
+        sample->names[i] = metric->name;
+        sample->types[i] = metric->type;
+
+        switch (metric->type) {
+            case EDGEHOG_METRIC_COUNTER: {
+                uint32_t total = __atomic_load_n(&metric->value, __ATOMIC_RELAXED);
+                // Unsigned arithmetic keeps the delta right across a wrap around
+                sample->values[i] = total - metric->sampled_value;
+                metric->sampled_value = total;
+                break;
+            }
+            case EDGEHOG_METRIC_GAUGE:
+                sample->values[i] = (int32_t) __atomic_load_n(&metric->value, __ATOMIC_RELAXED);
+                break;
+            case EDGEHOG_METRIC_HISTOGRAM:
+                sample->values[i] = 0;
+                for (int b = 0; b < metric->bound_count; b++) {
+                    sample->bounds[sample->bound_count++] = metric->bounds[b];
+                }
+                for (int b = 0; b <= metric->bound_count; b++) {
+                    uint32_t hits = __atomic_exchange_n(&metric->buckets[b], 0, __ATOMIC_RELAXED);
+                    sample->buckets[sample->bucket_count++] = hits;
+                    sample->values[i] += hits;
+                }
+                break;
+        }
+    }
+}
+
+// Gives back to the metrics the counts of a sample that could not be published nor kept
+static void metrics_restore(
+    edgehog_metrics_registry_t *registry, int count, const struct metrics_sample *sample)
+{
+    int bucket = 0;
+    for (int i = 0; i < count; i++) {
+        struct edgehog_metric_t *metric = &registry->metrics[i];
+        switch (metric->type) {
+            case EDGEHOG_METRIC_COUNTER:
+                // Only the worker moves the sampled value, the next delta includes this one
+                metric->sampled_value -= (uint32_t) sample->values[i];
+                break;
+            case EDGEHOG_METRIC_GAUGE:
+                break;
+            case EDGEHOG_METRIC_HISTOGRAM:
+                for (int b = 0; b <= metric->bound_count; b++) {
+                    uint32_t hits = sample->buckets[bucket++];
+                    __atomic_add_fetch(&metric->buckets[b], hits, __ATOMIC_RELAXED);
+                }
+                break;
+        }
+    }
+}
+
+static void metrics_publish(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    int64_t sample_time_us = esp_timer_get_time();
+    int count = __atomic_load_n(&edgehog_device->metrics.count, __ATOMIC_ACQUIRE);
+    if (count == 0) {
+        return;
+    }
+
+    // Too big for the worker stack
+    struct metrics_sample *sample = calloc(1, sizeof(struct metrics_sample));
+    if (!sample) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return;
+    }
+    metrics_sample(&edgehog_device->metrics, count, sample);
+
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int64_array(
+        &bs, "bounds", sample->bounds, sample->bound_count);
+    astarte_bson_serializer_append_int64_array(
+        &bs, "buckets", sample->buckets, sample->bucket_count);
+    astarte_bson_serializer_append_string_array(&bs, "names", sample->names, count);
+    astarte_bson_serializer_append_int32_array(&bs, "types", sample->types, count);
+    astarte_bson_serializer_append_int64_array(&bs, "values", sample->values, count);
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    // Kept in the backlog while offline, and given back to the metrics if that fails too
+    if (edgehog_device_stream_sample(
+            edgehog_device, edgehog_metrics_interface.name, "/sample", doc, sample_time_us)
+        != ASTARTE_OK) {
+        ESP_LOGW(TAG, "Unable to publish the metrics, they are added to the next sample");
+        metrics_restore(&edgehog_device->metrics, count, sample);
+    }
+    astarte_bson_serializer_destroy(&bs);
+    free(sample);
+}
+
+static void metrics_timer_cb(void *arg)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+
+    if (edgehog_worker_submit(edgehog_device, metrics_publish, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Worker busy, metrics sample skipped");
+    }
+}
+
+esp_err_t edgehog_metrics_start(edgehog_device_handle_t edgehog_device, uint32_t period_s)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = metrics_timer_cb,
+        .arg = edgehog_device,
+        .name = "edgehog_metrics",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &edgehog_device->metrics.timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the metrics timer, error %d", ret);
+        return ret;
+    }
+
+    return esp_timer_start_periodic(edgehog_device->metrics.timer, (uint64_t) period_s * 1000000);
+}
+
+void edgehog_metrics_stop(edgehog_device_handle_t edgehog_device)
+{
+    if (edgehog_device->metrics.timer) {
+        esp_timer_stop(edgehog_device->metrics.timer);
+        esp_timer_delete(edgehog_device->metrics.timer);
+        edgehog_device->metrics.timer = NULL;
+    }
+}
@@ -0,0 +1,241 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_monitor.h"
+#include "edgehog_worker.h"
+#include "esp_system.h"
+#include <astarte_bson_serializer.h>
+#include <esp_log.h>
+#include <esp_wifi.h>
+#include <freertos/task.h>
+#include <string.h>
+
+static const char *TAG = "EDGEHOG_MONITOR";
+
+const astarte_interface_t edgehog_monitor_samples_interface
+    = { .name = "io.edgehog.devicemanager.MonitoredSamples",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+const astarte_interface_t edgehog_monitor_summaries_interface
+    = { .name = "io.edgehog.devicemanager.MonitoredSummaries",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+static const char *const metric_paths[EDGEHOG_MONITOR_COUNT] = {
+    [EDGEHOG_MONITOR_FREE_HEAP] = "/freeHeap",
+    [EDGEHOG_MONITOR_TASK_COUNT] = "/taskCount",
+    [EDGEHOG_MONITOR_WIFI_RSSI] = "/wifiRssi",
+    [EDGEHOG_MONITOR_CPU_LOAD] = "/cpuLoad",
+};
+
+// Floors of the standard deviation of each metric, its quantum or its usual jitter, so that a
+// metric steady for a while is not anomalous on a change of one unit
+static const double metric_min_stddev[EDGEHOG_MONITOR_COUNT] = {
+    [EDGEHOG_MONITOR_FREE_HEAP] = 1024,
+    [EDGEHOG_MONITOR_TASK_COUNT] = 1,
+    [EDGEHOG_MONITOR_WIFI_RSSI] = 2,
+    [EDGEHOG_MONITOR_CPU_LOAD] = 1,
+};
+// The free heap moves with the allocations, it is anomalous only when it changes by a few percent
+static const double metric_min_relative_stddev[EDGEHOG_MONITOR_COUNT] = {
+    [EDGEHOG_MONITOR_FREE_HEAP] = 0.01,
+};
+
+static bool sample_cpu_load(edgehog_monitor_t *monitor, int64_t now_us, double *load)
+{
+#ifdef CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+    // The run time counters are in microseconds, like esp_timer
+    uint32_t idle_us = 0;
+    for (int cpu = 0; cpu < portNUM_PROCESSORS; cpu++) {
+        TaskStatus_t status;
+        vTaskGetInfo(xTaskGetIdleTaskHandleForCPU(cpu), &status, pdFALSE, eReady);
+        idle_us += status.ulRunTimeCounter - monitor->last_idle_run_time[cpu];
+        monitor->last_idle_run_time[cpu] = status.ulRunTimeCounter;
+    }
+
+    int64_t elapsed_us = now_us - monitor->last_sample_us;
+    bool first = monitor->last_sample_us == 0;
+    monitor->last_sample_us = now_us;
+    if (first || elapsed_us <= 0) {
+        return false;
+    }
+
+    *load = 100.0 * (1.0 - (double) idle_us / ((double) elapsed_us * portNUM_PROCESSORS));
+    if (*load < 0) {
+        *load = 0;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void publish_sample(edgehog_device_handle_t edgehog_device,
+    edgehog_monitored_metric_t metric, double value, int64_t sample_time_us)
+{
+    const edgehog_anomaly_detector_t *detector = &edgehog_device->monitor.detectors[metric];
+
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_double(&bs, "mean", detector->mean);
+    astarte_bson_serializer_append_double(&bs, "value", value);
+    astarte_bson_serializer_append_double(&bs, "zScore", detector->z_score);
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    if (edgehog_device_stream_sample(edgehog_device, edgehog_monitor_samples_interface.name,
+            metric_paths[metric], doc, sample_time_us)
+        != ASTARTE_OK) {
+        ESP_LOGW(TAG, "Unable to publish the anomalous sample of %s", metric_paths[metric]);
+    }
+    astarte_bson_serializer_destroy(&bs);
+}
+
+static void publish_summary(edgehog_device_handle_t edgehog_device,
+    edgehog_monitored_metric_t metric, int64_t sample_time_us)
+{
+    const edgehog_monitor_summary_t *summary = &edgehog_device->monitor.summaries[metric];
+
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int32(&bs, "anomalousCount", summary->anomalous_count);
+    astarte_bson_serializer_append_int32(&bs, "count", summary->count);
+    astarte_bson_serializer_append_double(&bs, "max", summary->max);
+    astarte_bson_serializer_append_double(&bs, "mean", summary->sum / summary->count);
+    astarte_bson_serializer_append_double(&bs, "min", summary->min);
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    if (edgehog_device_stream_sample(edgehog_device, edgehog_monitor_summaries_interface.name,
+            metric_paths[metric], doc, sample_time_us)
+        != ASTARTE_OK) {
+        ESP_LOGW(TAG, "Unable to publish the summary of %s", metric_paths[metric]);
+    }
+    astarte_bson_serializer_destroy(&bs);
+}
+
+static void summary_add(edgehog_monitor_summary_t *summary, double value, bool anomalous)
+{
+    if (summary->count == 0 || value < summary->min) {
+        summary->min = value;
+    }
+    if (summary->count == 0 || value > summary->max) {
+        summary->max = value;
+    }
+    summary->sum += value;
+    summary->count++;
+    if (anomalous) {
+        summary->anomalous_count++;
+    }
+}
+
+static void monitor_sample(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    edgehog_monitor_t *monitor = &edgehog_device->monitor;
+    int64_t sample_time_us = esp_timer_get_time();
+
+    double values[EDGEHOG_MONITOR_COUNT];
+    bool valid[EDGEHOG_MONITOR_COUNT];
+    values[EDGEHOG_MONITOR_FREE_HEAP] = esp_get_free_heap_size();
+    valid[EDGEHOG_MONITOR_FREE_HEAP] = true;
+    values[EDGEHOG_MONITOR_TASK_COUNT] = uxTaskGetNumberOfTasks();
+    valid[EDGEHOG_MONITOR_TASK_COUNT] = true;
+    wifi_ap_record_t ap_info;
+    valid[EDGEHOG_MONITOR_WIFI_RSSI] = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+    values[EDGEHOG_MONITOR_WIFI_RSSI] = ap_info.rssi;
+    valid[EDGEHOG_MONITOR_CPU_LOAD]
+        = sample_cpu_load(monitor, sample_time_us, &values[EDGEHOG_MONITOR_CPU_LOAD]);
+
+    for (int metric = 0; metric < EDGEHOG_MONITOR_COUNT; metric++) {
+        if (!valid[metric]) {
+            continue;
+        }
+        bool anomalous = edgehog_anomaly_detector_update(
+            &monitor->detectors[metric], values[metric], monitor->config.z_threshold);
+        summary_add(&monitor->summaries[metric], values[metric], anomalous);
+        if (anomalous) {
+            publish_sample(edgehog_device, metric, values[metric], sample_time_us);
+        }
+    }
+
+    // Timed on the clock, samples skipped by a busy worker do not stretch the period. Half a
+    // sample period of slack keeps a sample run a little late from delaying the summary by one.
+    int64_t summary_period_us = (int64_t) monitor->config.summary_period_s * 1000000;
+    int64_t slack_us = (int64_t) monitor->config.sample_period_s * 1000000 / 2;
+    if (sample_time_us - monitor->summary_start_us + slack_us < summary_period_us) {
+        return;
+    }
+    for (int metric = 0; metric < EDGEHOG_MONITOR_COUNT; metric++) {
+        if (monitor->summaries[metric].count > 0) {
+            publish_summary(edgehog_device, metric, sample_time_us);
+        }
+    }
+    memset(monitor->summaries, 0, sizeof(monitor->summaries));
+    monitor->summary_start_us = sample_time_us;
+}
+
+static void monitor_timer_cb(void *arg)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+
+    if (edgehog_worker_submit(edgehog_device, monitor_sample, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Worker busy, monitor sample skipped");
+    }
+}
+
+esp_err_t edgehog_monitor_start(
+    edgehog_device_handle_t edgehog_device, const edgehog_monitor_config_t *config)
+{
+    edgehog_monitor_t *monitor = &edgehog_device->monitor;
+    monitor->config = *config;
+    monitor->summary_start_us = esp_timer_get_time();
+    for (int metric = 0; metric < EDGEHOG_MONITOR_COUNT; metric++) {
+        edgehog_anomaly_detector_init(&monitor->detectors[metric], metric_min_stddev[metric],
+            metric_min_relative_stddev[metric]);
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = monitor_timer_cb,
+        .arg = edgehog_device,
+        .name = "edgehog_monitor",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &monitor->timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the monitor timer, error %d", ret);
+        return ret;
+    }
+
+    return esp_timer_start_periodic(monitor->timer, config->sample_period_s * 1000000ULL);
+}
+
+void edgehog_monitor_stop(edgehog_device_handle_t edgehog_device)
+{
+    if (edgehog_device->monitor.timer) {
+        esp_timer_stop(edgehog_device->monitor.timer);
+        esp_timer_delete(edgehog_device->monitor.timer);
+        edgehog_device->monitor.timer = NULL;
+    }
+}
@@ -0,0 +1,262 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_nvs_stats.h"
+#include "edgehog_recorder.h"
+#include "edgehog_soak.h"
+#include "edgehog_time.h"
+#include "edgehog_worker.h"
+#include <astarte_bson_serializer.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <nvs_flash.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STATS_NAMESPACE "eh_nvs_stats"
+#define STATS_KEY "stats"
+#define STATS_VERSION 1
+// Accounted writes after which the statistics are persisted
+#define SAVE_THRESHOLD_WRITES 16
+#define PUBLISH_PERIOD_S EDGEHOG_SOAK_PERIOD_S(24 * 3600)
+#define NVS_ENTRY_SIZE 32
+#define NVS_ENTRIES_PER_PAGE 126
+#define NVS_PAGE_SIZE 4096
+// Typical erase cycles endured by a flash sector
+#define FLASH_ERASE_CYCLES 100000
+
+static const char *TAG = "EDGEHOG_NVS_STATS";
+
+const astarte_interface_t edgehog_storage_health_interface
+    = { .name = "io.edgehog.devicemanager.StorageHealth",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+// Returns true when the statistics should be saved
+static bool account_write(
+    edgehog_nvs_stats_t *stats, const char *namespace_name, const char *key, size_t bytes)
+{
+    // A value spans its header entry and the data entries, except for integers
+    uint32_t entries = 1 + (bytes > 8 ? (bytes + NVS_ENTRY_SIZE - 1) / NVS_ENTRY_SIZE : 0);
+
+    portENTER_CRITICAL(&stats->lock);
+    edgehog_nvs_key_stats_t *key_stats = NULL;
+    for (int i = 0; i < EDGEHOG_NVS_STATS_MAX_KEYS; i++) {
+        edgehog_nvs_key_stats_t *candidate = &stats->data.keys[i];
+        if (candidate->writes == 0) {
+            // Unused slots are zeroed, so the copies stay terminated
+            strncpy(candidate->namespace_name, namespace_name,
+                sizeof(candidate->namespace_name) - 1);
+            strncpy(candidate->key, key, sizeof(candidate->key) - 1);
+        }
+        if (strcmp(candidate->namespace_name, namespace_name) == 0
+            && strcmp(candidate->key, key) == 0) {
+            key_stats = candidate;
+            break;
+        }
+    }
+    // Keys beyond the table are accounted in its last slot
+    if (!key_stats) {
+        key_stats = &stats->data.keys[EDGEHOG_NVS_STATS_MAX_KEYS - 1];
+    }
+    key_stats->writes++;
+    key_stats->bytes += bytes;
+    key_stats->entries += entries;
+    // A save that could not be queued is retried on the next write
+    bool save = ++stats->unsaved_writes >= SAVE_THRESHOLD_WRITES;
+    portEXIT_CRITICAL(&stats->lock);
+
+    return save;
+}
+
+static void stats_save(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_nvs_stats_t *stats = &edgehog_device->nvs_stats;
+    edgehog_nvs_stats_data_t data;
+
+    int64_t now_us = esp_timer_get_time();
+    portENTER_CRITICAL(&stats->lock);
+    stats->data.accounted_s += (now_us - stats->accounted_since_us) / 1000000;
+    stats->accounted_since_us = now_us - (now_us - stats->accounted_since_us) % 1000000;
+    // Nothing new to save, the accounted time is saved along with the next writes
+    if (stats->unsaved_writes == 0) {
+        portEXIT_CRITICAL(&stats->lock);
+        return;
+    }
+    stats->unsaved_writes = 0;
+    data = stats->data;
+    portEXIT_CRITICAL(&stats->lock);
+
+    nvs_handle nvs;
+    esp_err_t ret = nvs_open_from_partition(
+        edgehog_device->partition_name, STATS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to open %s", edgehog_device->partition_name);
+        return;
+    }
+    ret = nvs_set_blob(nvs, STATS_KEY, &data, sizeof(data));
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs);
+        EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_NVS_RESULT, ret);
+    }
+    nvs_close(nvs);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to store NVS statistics. Error %d", ret);
+        return;
+    }
+
+    // Saving the statistics wears the flash too, it is saved along with the next writes
+    account_write(stats, STATS_NAMESPACE, STATS_KEY, sizeof(data));
+}
+
+static void stats_save_job(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    stats_save(edgehog_device);
+}
+
+void edgehog_nvs_stats_record(edgehog_device_handle_t edgehog_device, const char *namespace_name,
+    const char *key, size_t bytes)
+{
+    if (account_write(&edgehog_device->nvs_stats, namespace_name, key, bytes)
+        && edgehog_worker_submit(edgehog_device, stats_save_job, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to queue the NVS statistics save");
+    }
+}
+
+static void stats_publish(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    edgehog_nvs_stats_t *stats = &edgehog_device->nvs_stats;
+    stats_save(edgehog_device);
+
+    nvs_stats_t nvs_stats = { 0 };
+    nvs_get_stats(edgehog_device->partition_name, &nvs_stats);
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, edgehog_device->partition_name);
+
+    const char *keys[EDGEHOG_NVS_STATS_MAX_KEYS];
+    char key_names[EDGEHOG_NVS_STATS_MAX_KEYS][32];
+    int64_t key_writes[EDGEHOG_NVS_STATS_MAX_KEYS];
+    int64_t key_bytes[EDGEHOG_NVS_STATS_MAX_KEYS];
+    int key_count = 0;
+    uint64_t entries = 0;
+
+    portENTER_CRITICAL(&stats->lock);
+    uint32_t accounted_s = stats->data.accounted_s;
+    for (int i = 0; i < EDGEHOG_NVS_STATS_MAX_KEYS && stats->data.keys[i].writes > 0; i++) {
+        const edgehog_nvs_key_stats_t *key_stats = &stats->data.keys[i];
+        snprintf(key_names[i], sizeof(key_names[i]), "%s/%s", key_stats->namespace_name,
+            key_stats->key);
+        keys[i] = key_names[i];
+        key_writes[i] = key_stats->writes;
+        key_bytes[i] = key_stats->bytes;
+        entries += key_stats->entries;
+        key_count++;
+    }
+    portEXIT_CRITICAL(&stats->lock);
+
+    // NVS fills its pages in turn and erases one to reclaim it, so the erases are spread over
+    // all the pages but the spare one
+    double erase_cycles_per_day = 0;
+    double wear_out_days = -1;
+    if (partition && partition->size >= 2 * NVS_PAGE_SIZE && accounted_s > 0) {
+        uint32_t pages = partition->size / NVS_PAGE_SIZE - 1;
+        double entries_per_day = (double) entries * 86400 / accounted_s;
+        erase_cycles_per_day = entries_per_day / ((double) pages * NVS_ENTRIES_PER_PAGE);
+        if (erase_cycles_per_day > 0) {
+            wear_out_days = FLASH_ERASE_CYCLES / erase_cycles_per_day;
+        }
+    }
+
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int64(&bs, "accountedSeconds", accounted_s);
+    astarte_bson_serializer_append_double(&bs, "eraseCyclesPerDay", erase_cycles_per_day);
+    astarte_bson_serializer_append_int64(&bs, "freeEntries", nvs_stats.free_entries);
+    astarte_bson_serializer_append_int64_array(&bs, "keyBytes", key_bytes, key_count);
+    astarte_bson_serializer_append_int64_array(&bs, "keyWrites", key_writes, key_count);
+    astarte_bson_serializer_append_string_array(&bs, "keys", keys, key_count);
+    astarte_bson_serializer_append_int64(&bs, "totalEntries", nvs_stats.total_entries);
+    astarte_bson_serializer_append_int64(&bs, "usedEntries", nvs_stats.used_entries);
+    astarte_bson_serializer_append_double(&bs, "wearOutDays", wear_out_days);
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    edgehog_device_stream_aggregate(edgehog_device, edgehog_storage_health_interface.name, "/nvs",
+        doc, edgehog_time_get_epoch_ms());
+    astarte_bson_serializer_destroy(&bs);
+}
+
+static void stats_timer_cb(void *arg)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+
+    if (edgehog_worker_submit(edgehog_device, stats_publish, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Worker busy, StorageHealth sample skipped");
+    }
+}
+
+esp_err_t edgehog_nvs_stats_start(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_nvs_stats_t *stats = &edgehog_device->nvs_stats;
+    vPortCPUInitializeMutex(&stats->lock);
+    stats->accounted_since_us = esp_timer_get_time();
+
+    nvs_handle nvs;
+    if (nvs_open_from_partition(
+            edgehog_device->partition_name, STATS_NAMESPACE, NVS_READONLY, &nvs)
+        == ESP_OK) {
+        size_t size = sizeof(edgehog_nvs_stats_data_t);
+        if (nvs_get_blob(nvs, STATS_KEY, &stats->data, &size) != ESP_OK
+            || size != sizeof(edgehog_nvs_stats_data_t) || stats->data.version != STATS_VERSION) {
+            memset(&stats->data, 0, sizeof(edgehog_nvs_stats_data_t));
+        }
+        nvs_close(nvs);
+    }
+    stats->data.version = STATS_VERSION;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = stats_timer_cb,
+        .arg = edgehog_device,
+        .name = "edgehog_nvs_stats",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &stats->timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the StorageHealth timer, error %d", ret);
+        return ret;
+    }
+
+    ret = esp_timer_start_periodic(stats->timer, PUBLISH_PERIOD_S * 1000000ULL);
+    if (ret == ESP_OK) {
+        // The first sample is sent after boot, not a day later
+        edgehog_worker_submit(edgehog_device, stats_publish, NULL);
+    }
+    return ret;
+}
+
+void edgehog_nvs_stats_stop(edgehog_device_handle_t edgehog_device)
+{
+    if (edgehog_device->nvs_stats.timer) {
+        esp_timer_stop(edgehog_device->nvs_stats.timer);
+        esp_timer_delete(edgehog_device->nvs_stats.timer);
+        edgehog_device->nvs_stats.timer = NULL;
+    }
+}
@@ -0,0 +1,253 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_profiler.h"
+
+#ifdef CONFIG_EDGEHOG_PROFILER
+
+#include "edgehog_device_private.h"
+#include "edgehog_worker.h"
+#include <astarte_bson_serializer.h>
+#include <esp_attr.h>
+#include <esp_freertos_hooks.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/xtensa_context.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Distinct tasks tracked on each core, the samples of any other task are dropped
+#define PROFILER_MAX_TASKS 16
+// Samples sent in a single aggregate
+#define UPLOAD_CHUNK_SAMPLES 32
+// Pause between two chunks of an upload
+#define UPLOAD_INTERVAL_MS 20
+
+static const char *TAG = "EDGEHOG_PROFILER";
+
+const astarte_interface_t edgehog_profiler_interface
+    = { .name = "io.edgehog.devicemanager.ProfilerSamples",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+struct profiler_slot
+{
+    uint32_t pc;
+    uint32_t count;
+    uint8_t task;
+};
+
+// Written only by the tick hook of its own core
+struct profiler_core
+{
+    uint32_t samples;
+    uint32_t dropped;
+    uint8_t task_count;
+    TaskHandle_t task_handles[PROFILER_MAX_TASKS];
+    char task_names[PROFILER_MAX_TASKS][configMAX_TASK_NAME_LEN];
+    struct profiler_slot slots[CONFIG_EDGEHOG_PROFILER_SLOTS];
+};
+
+struct profiler_session
+{
+    edgehog_device_handle_t edgehog_device;
+    esp_timer_handle_t timer;
+    struct profiler_core cores[portNUM_PROCESSORS];
+};
+
+// The tick hooks have no argument, so the session is shared by all the Edgehog devices
+static struct profiler_session *session;
+static bool sampling;
+
+static int IRAM_ATTR task_index(struct profiler_core *core, TaskHandle_t task)
+{
+    for (int i = 0; i < core->task_count; i++) {
+        if (core->task_handles[i] == task) {
+            return i;
+        }
+    }
+    if (core->task_count == PROFILER_MAX_TASKS) {
+        return -1;
+    }
+    core->task_handles[core->task_count] = task;
+    strncpy(core->task_names[core->task_count], pcTaskGetTaskName(task),
+        configMAX_TASK_NAME_LEN - 1);
+    return core->task_count++;
+}
+
+static void IRAM_ATTR profiler_tick_hook(void)
+{
+    if (!__atomic_load_n(&sampling, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    BaseType_t core_id = xPortGetCoreID();
+    struct profiler_core *core = &session->cores[core_id];
+    TaskHandle_t task = xTaskGetCurrentTaskHandleForCPU(core_id);
+    core->samples++;
+
+    // The tick interrupt saved the context of the interrupted task on its stack, and stored the
+    // stack pointer in pxTopOfStack, the first member of the TCB
+    const XtExcFrame *frame = *(XtExcFrame **) task;
+    uint32_t pc = frame->pc;
+    int task_id = task_index(core, task);
+    if (task_id < 0) {
+        core->dropped++;
+        return;
+    }
+
+    // Open addressing on the PC, the slots are never removed during a session
+    uint32_t hash = (pc >> 2) * 2654435761u;
+    for (int probe = 0; probe < CONFIG_EDGEHOG_PROFILER_SLOTS; probe++) {
+        struct profiler_slot *slot = &core->slots[(hash + probe) % CONFIG_EDGEHOG_PROFILER_SLOTS];
+        if (slot->count == 0) {
+            slot->pc = pc;
+            slot->task = task_id;
+            slot->count = 1;
+            return;
+        }
+        if (slot->pc == pc && slot->task == task_id) {
+            slot->count++;
+            return;
+        }
+    }
+    core->dropped++;
+}
+
+static void upload_chunk(edgehog_device_handle_t edgehog_device, int core_id,
+    const struct profiler_core *core, int task_id, const int64_t *pcs, const int32_t *counts,
+    int count)
+{
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int32(&bs, "core", core_id);
+    astarte_bson_serializer_append_int32_array(&bs, "counts", counts, count);
+    astarte_bson_serializer_append_int32(&bs, "dropped", core->dropped);
+    astarte_bson_serializer_append_int64_array(&bs, "pcs", pcs, count);
+    astarte_bson_serializer_append_int32(&bs, "samples", core->samples);
+    astarte_bson_serializer_append_string(&bs, "task", core->task_names[task_id]);
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    edgehog_device_stream_aggregate(
+        edgehog_device, edgehog_profiler_interface.name, "/samples", doc, 0);
+    astarte_bson_serializer_destroy(&bs);
+}
+
+static void profiler_finish(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    struct profiler_session *finished = (struct profiler_session *) arg;
+
+    __atomic_store_n(&sampling, false, __ATOMIC_RELEASE);
+    for (int core_id = 0; core_id < portNUM_PROCESSORS; core_id++) {
+        esp_deregister_freertos_tick_hook_for_cpu(profiler_tick_hook, core_id);
+    }
+    // A hook may still be running on the other core
+    vTaskDelay(1);
+
+    int64_t pcs[UPLOAD_CHUNK_SAMPLES];
+    int32_t counts[UPLOAD_CHUNK_SAMPLES];
+    for (int core_id = 0; core_id < portNUM_PROCESSORS; core_id++) {
+        const struct profiler_core *core = &finished->cores[core_id];
+        ESP_LOGI(TAG, "Core %d: %u samples, %u dropped", core_id, (unsigned) core->samples,
+            (unsigned) core->dropped);
+
+        for (int task_id = 0; task_id < core->task_count; task_id++) {
+            int count = 0;
+            for (int i = 0; i < CONFIG_EDGEHOG_PROFILER_SLOTS; i++) {
+                const struct profiler_slot *slot = &core->slots[i];
+                if (slot->count == 0 || slot->task != task_id) {
+                    continue;
+                }
+                pcs[count] = slot->pc;
+                counts[count] = slot->count;
+                if (++count == UPLOAD_CHUNK_SAMPLES) {
+                    upload_chunk(edgehog_device, core_id, core, task_id, pcs, counts, count);
+                    vTaskDelay(pdMS_TO_TICKS(UPLOAD_INTERVAL_MS));
+                    count = 0;
+                }
+            }
+            if (count > 0) {
+                upload_chunk(edgehog_device, core_id, core, task_id, pcs, counts, count);
+                vTaskDelay(pdMS_TO_TICKS(UPLOAD_INTERVAL_MS));
+            }
+        }
+    }
+
+    esp_timer_delete(finished->timer);
+    free(finished);
+    __atomic_store_n(&session, NULL, __ATOMIC_RELEASE);
+}
+
+static void profiler_timer_cb(void *arg)
+{
+    struct profiler_session *running = (struct profiler_session *) arg;
+
+    if (edgehog_worker_submit(running->edgehog_device, profiler_finish, running) != ESP_OK) {
+        // Retry later, the session cannot be left running
+        ESP_LOGW(TAG, "Worker busy, delaying the end of the profiler session");
+        esp_timer_start_once(running->timer, 1000000);
+    }
+}
+
+void edgehog_profiler_start(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    struct profiler_session *started = calloc(1, sizeof(struct profiler_session));
+    if (!started) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return;
+    }
+    started->edgehog_device = edgehog_device;
+
+    // Each device starts its sessions in its own worker, so the session is claimed atomically
+    struct profiler_session *running = NULL;
+    if (!__atomic_compare_exchange_n(
+            &session, &running, started, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        ESP_LOGW(TAG, "A profiler session is already running");
+        free(started);
+        return;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = profiler_timer_cb,
+        .arg = started,
+        .name = "edgehog_profiler",
+    };
+    if (esp_timer_create(&timer_args, &started->timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to create the profiler timer");
+        free(started);
+        __atomic_store_n(&session, NULL, __ATOMIC_RELEASE);
+        return;
+    }
+
+    __atomic_store_n(&sampling, true, __ATOMIC_RELEASE);
+    for (int core_id = 0; core_id < portNUM_PROCESSORS; core_id++) {
+        if (esp_register_freertos_tick_hook_for_cpu(profiler_tick_hook, core_id) != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to register the tick hook of core %d", core_id);
+        }
+    }
+    esp_timer_start_once(started->timer, (uint64_t) CONFIG_EDGEHOG_PROFILER_DURATION_S * 1000000);
+    ESP_LOGI(TAG, "Profiling for %d s", CONFIG_EDGEHOG_PROFILER_DURATION_S);
+}
+
+#endif
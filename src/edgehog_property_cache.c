@@ -0,0 +1,251 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_load_stats.h"
+#include "edgehog_property_cache.h"
+#include "edgehog_recorder.h"
+#include <esp_log.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pause between two properties sent by a resync
+#define RESEND_INTERVAL_MS 20
+
+static const char *TAG = "EDGEHOG_PROPERTIES";
+
+esp_err_t edgehog_property_cache_init(edgehog_property_cache_t *cache)
+{
+    memset(cache, 0, sizeof(edgehog_property_cache_t));
+    cache->lock = xSemaphoreCreateMutex();
+    cache->publish_lock = xSemaphoreCreateMutex();
+    if (!cache->lock || !cache->publish_lock) {
+        edgehog_property_cache_destroy(cache);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void edgehog_property_cache_destroy(edgehog_property_cache_t *cache)
+{
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->properties[i].type == EDGEHOG_PROPERTY_STRING) {
+            free(cache->properties[i].value.string);
+        }
+    }
+    cache->count = 0;
+    if (cache->lock) {
+        vSemaphoreDelete(cache->lock);
+        cache->lock = NULL;
+    }
+    if (cache->publish_lock) {
+        vSemaphoreDelete(cache->publish_lock);
+        cache->publish_lock = NULL;
+    }
+}
+
+// Must be called with the cache lock held
+static edgehog_property_t *find_or_add(
+    edgehog_property_cache_t *cache, const char *interface_name, const char *path)
+{
+    for (int i = 0; i < cache->count; i++) {
+        edgehog_property_t *property = &cache->properties[i];
+        if (strcmp(property->interface_name, interface_name) == 0
+            && strcmp(property->path, path) == 0) {
+            return property;
+        }
+    }
+
+    if (cache->count == EDGEHOG_PROPERTY_CACHE_SIZE) {
+        ESP_LOGE(TAG, "Property cache full, %s%s will not be resent", interface_name, path);
+        return NULL;
+    }
+    edgehog_property_t *property = &cache->properties[cache->count++];
+    property->interface_name = interface_name;
+    property->path = path;
+    property->type = EDGEHOG_PROPERTY_LONGINTEGER;
+    property->value.longinteger = 0;
+    return property;
+}
+
+void edgehog_property_cache_store_string(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const char *value)
+{
+    edgehog_property_cache_t *cache = &edgehog_device->property_cache;
+    char *copy = strdup(value);
+    if (!copy) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return;
+    }
+
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    edgehog_property_t *property = find_or_add(cache, interface_name, path);
+    if (property) {
+        if (property->type == EDGEHOG_PROPERTY_STRING) {
+            free(property->value.string);
+        }
+        property->type = EDGEHOG_PROPERTY_STRING;
+        property->value.string = copy;
+        copy = NULL;
+    }
+    xSemaphoreGive(cache->lock);
+
+    free(copy);
+}
+
+void edgehog_property_cache_store_static_string(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const char *value)
+{
+    edgehog_property_cache_t *cache = &edgehog_device->property_cache;
+
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    edgehog_property_t *property = find_or_add(cache, interface_name, path);
+    if (property) {
+        if (property->type == EDGEHOG_PROPERTY_STRING) {
+            free(property->value.string);
+        }
+        property->type = EDGEHOG_PROPERTY_STATIC_STRING;
+        property->value.static_string = value;
+    }
+    xSemaphoreGive(cache->lock);
+}
+
+astarte_err_t edgehog_property_set_string(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const char *value)
+{
+    edgehog_property_cache_t *cache = &edgehog_device->property_cache;
+
+    xSemaphoreTake(cache->publish_lock, portMAX_DELAY);
+    // The value is cached even if it cannot be sent, it is the one expected by Astarte
+    edgehog_property_cache_store_string(edgehog_device, interface_name, path, value);
+    astarte_err_t ret = astarte_device_set_string_property(
+        edgehog_device->astarte_device, interface_name, path, (char *) value);
+    xSemaphoreGive(cache->publish_lock);
+    EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_ASTARTE_RESULT, ret);
+    if (ret == ASTARTE_OK) {
+        edgehog_load_stats_record_publish(
+            edgehog_device, EDGEHOG_LOAD_STATS_STRING_PROPERTY_BYTES(strlen(value)));
+    }
+    return ret;
+}
+
+astarte_err_t edgehog_property_set_static_string(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, const char *value)
+{
+    edgehog_property_cache_t *cache = &edgehog_device->property_cache;
+
+    xSemaphoreTake(cache->publish_lock, portMAX_DELAY);
+    edgehog_property_cache_store_static_string(edgehog_device, interface_name, path, value);
+    // The SDK does not modify the value, it only takes a non-const pointer
+    astarte_err_t ret = astarte_device_set_string_property(
+        edgehog_device->astarte_device, interface_name, path, (char *) value);
+    xSemaphoreGive(cache->publish_lock);
+    EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_ASTARTE_RESULT, ret);
+    if (ret == ASTARTE_OK) {
+        edgehog_load_stats_record_publish(
+            edgehog_device, EDGEHOG_LOAD_STATS_STRING_PROPERTY_BYTES(strlen(value)));
+    }
+    return ret;
+}
+
+astarte_err_t edgehog_property_set_longinteger(edgehog_device_handle_t edgehog_device,
+    const char *interface_name, const char *path, long long value)
+{
+    edgehog_property_cache_t *cache = &edgehog_device->property_cache;
+
+    xSemaphoreTake(cache->publish_lock, portMAX_DELAY);
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    edgehog_property_t *property = find_or_add(cache, interface_name, path);
+    if (property) {
+        if (property->type == EDGEHOG_PROPERTY_STRING) {
+            free(property->value.string);
+        }
+        property->type = EDGEHOG_PROPERTY_LONGINTEGER;
+        property->value.longinteger = value;
+    }
+    xSemaphoreGive(cache->lock);
+
+    astarte_err_t ret = astarte_device_set_longinteger_property(
+        edgehog_device->astarte_device, interface_name, path, value);
+    xSemaphoreGive(cache->publish_lock);
+    EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_ASTARTE_RESULT, ret);
+    if (ret == ASTARTE_OK) {
+        edgehog_load_stats_record_publish(
+            edgehog_device, EDGEHOG_LOAD_STATS_LONGINTEGER_PROPERTY_BYTES);
+    }
+    return ret;
+}
+
+void edgehog_property_cache_resend(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    edgehog_property_cache_t *cache = &edgehog_device->property_cache;
+    int sent = 0;
+    int failed = 0;
+
+    // Entries are never removed. Each one is copied and sent under the publish lock, so no setter
+    // can send a newer value in between, and the setters do not wait for the pauses
+    for (int i = 0;; i++) {
+        xSemaphoreTake(cache->publish_lock, portMAX_DELAY);
+        xSemaphoreTake(cache->lock, portMAX_DELAY);
+        if (i >= cache->count) {
+            xSemaphoreGive(cache->lock);
+            xSemaphoreGive(cache->publish_lock);
+            break;
+        }
+        edgehog_property_t property = cache->properties[i];
+        if (property.type == EDGEHOG_PROPERTY_STRING) {
+            property.value.string = strdup(property.value.string);
+        }
+        xSemaphoreGive(cache->lock);
+        sent++;
+
+        astarte_err_t ret;
+        size_t bytes;
+        if (property.type == EDGEHOG_PROPERTY_STRING) {
+            if (!property.value.string) {
+                xSemaphoreGive(cache->publish_lock);
+                ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+                failed++;
+                continue;
+            }
+            ret = astarte_device_set_string_property(edgehog_device->astarte_device,
+                property.interface_name, property.path, property.value.string);
+            bytes = EDGEHOG_LOAD_STATS_STRING_PROPERTY_BYTES(strlen(property.value.string));
+            free(property.value.string);
+        } else if (property.type == EDGEHOG_PROPERTY_STATIC_STRING) {
+            // The SDK does not modify the value, it only takes a non-const pointer
+            ret = astarte_device_set_string_property(edgehog_device->astarte_device,
+                property.interface_name, property.path, (char *) property.value.static_string);
+            bytes = EDGEHOG_LOAD_STATS_STRING_PROPERTY_BYTES(strlen(property.value.static_string));
+        } else {
+            ret = astarte_device_set_longinteger_property(edgehog_device->astarte_device,
+                property.interface_name, property.path, property.value.longinteger);
+            bytes = EDGEHOG_LOAD_STATS_LONGINTEGER_PROPERTY_BYTES;
+        }
+        xSemaphoreGive(cache->publish_lock);
+        EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_ASTARTE_RESULT, ret);
+        if (ret == ASTARTE_OK) {
+            edgehog_load_stats_record_publish(edgehog_device, bytes);
+        } else {
+            failed++;
+        }
+        vTaskDelay(pdMS_TO_TICKS(RESEND_INTERVAL_MS));
+    }
+    ESP_LOGI(TAG, "Resent %d properties, %d failed", sent, failed);
+}
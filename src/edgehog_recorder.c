@@ -0,0 +1,181 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_recorder.h"
+
+#ifdef CONFIG_EDGEHOG_RECORDER
+
+#include "edgehog_device_private.h"
+#include <astarte_bson_serializer.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The ring positions are running byte counts reduced modulo the size, which stays continuous
+// across their 32 bit wrap only for a power of two
+#if (CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE & (CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE - 1)) != 0
+#error "CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE must be a power of two"
+#endif
+
+#define RECORD_HEADER_SIZE 10
+// Bytes of records sent in a single aggregate
+#define UPLOAD_CHUNK_BYTES 1024
+// Pause between two chunks of an upload
+#define UPLOAD_INTERVAL_MS 20
+
+static const char *TAG = "EDGEHOG_RECORDER";
+
+const astarte_interface_t edgehog_recording_interface
+    = { .name = "io.edgehog.devicemanager.Recording",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+// Byte ring of whole records, head and tail are running byte counts
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t ring[CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE];
+static uint32_t ring_head;
+static uint32_t ring_tail;
+static uint32_t overwritten_records;
+
+// Must be called with the ring lock held
+static void ring_write(uint32_t pos, const void *data, size_t len)
+{
+    uint32_t offset = pos % CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE;
+    size_t first = CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE - offset;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&ring[offset], data, first);
+    memcpy(ring, (const uint8_t *) data + first, len - first);
+}
+
+// Must be called with the ring lock held
+static void ring_read(uint32_t pos, void *data, size_t len)
+{
+    uint32_t offset = pos % CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE;
+    size_t first = CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE - offset;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(data, &ring[offset], first);
+    memcpy((uint8_t *) data + first, ring, len - first);
+}
+
+void edgehog_recorder_record(edgehog_record_type_t type, const void *data, size_t len)
+{
+    if (len > UINT8_MAX || RECORD_HEADER_SIZE + len > CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE) {
+        return;
+    }
+
+    uint8_t header[RECORD_HEADER_SIZE];
+    int64_t timestamp_us = esp_timer_get_time();
+    memcpy(header, &timestamp_us, sizeof(timestamp_us));
+    header[8] = type;
+    header[9] = len;
+
+    portENTER_CRITICAL(&ring_lock);
+    // Drop the oldest records until the new one fits
+    while (ring_head + RECORD_HEADER_SIZE + len - ring_tail > CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE) {
+        uint8_t old_len;
+        ring_read(ring_tail + 9, &old_len, sizeof(old_len));
+        ring_tail += RECORD_HEADER_SIZE + old_len;
+        overwritten_records++;
+    }
+    ring_write(ring_head, header, RECORD_HEADER_SIZE);
+    ring_write(ring_head + RECORD_HEADER_SIZE, data, len);
+    ring_head += RECORD_HEADER_SIZE + len;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+void edgehog_recorder_record_result(edgehog_record_type_t type, int32_t result)
+{
+    edgehog_recorder_record(type, &result, sizeof(result));
+}
+
+static astarte_err_t upload_chunk(edgehog_device_handle_t edgehog_device, const uint8_t *records,
+    size_t len, uint32_t overwritten)
+{
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int64(&bs, "overwrittenRecords", overwritten);
+    astarte_bson_serializer_append_binary(&bs, "records", records, len);
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    astarte_err_t ret = edgehog_device_stream_aggregate(
+        edgehog_device, edgehog_recording_interface.name, "/records", doc, 0);
+    astarte_bson_serializer_destroy(&bs);
+    return ret;
+}
+
+void edgehog_recorder_upload(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    uint8_t *records = malloc(CONFIG_EDGEHOG_RECORDER_BUFFER_SIZE);
+    if (!records) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return;
+    }
+
+    // The records are copied out of the ring, recording continues during the upload
+    portENTER_CRITICAL(&ring_lock);
+    uint32_t start = ring_tail;
+    size_t len = ring_head - ring_tail;
+    ring_read(ring_tail, records, len);
+    uint32_t overwritten = overwritten_records;
+    portEXIT_CRITICAL(&ring_lock);
+
+    size_t offset = 0;
+    while (offset < len) {
+        // Chunks are cut at record boundaries, so each one can be decoded on its own
+        size_t chunk_len = 0;
+        while (offset + chunk_len < len) {
+            size_t record_len = RECORD_HEADER_SIZE + records[offset + chunk_len + 9];
+            if (chunk_len > 0 && chunk_len + record_len > UPLOAD_CHUNK_BYTES) {
+                break;
+            }
+            chunk_len += record_len;
+        }
+        if (upload_chunk(edgehog_device, &records[offset], chunk_len, overwritten) != ASTARTE_OK) {
+            break;
+        }
+        offset += chunk_len;
+
+        // Only the records sent are removed, unless they were overwritten meanwhile
+        portENTER_CRITICAL(&ring_lock);
+        if ((int32_t) (start + offset - ring_tail) > 0) {
+            ring_tail = start + offset;
+        }
+        portEXIT_CRITICAL(&ring_lock);
+        vTaskDelay(pdMS_TO_TICKS(UPLOAD_INTERVAL_MS));
+    }
+    if (offset < len) {
+        ESP_LOGW(TAG, "Upload interrupted, %u bytes of records kept for the next one",
+            (unsigned) (len - offset));
+    } else {
+        ESP_LOGI(TAG, "Uploaded %u bytes of records", (unsigned) len);
+    }
+    free(records);
+}
+
+#endif
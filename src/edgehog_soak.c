@@ -0,0 +1,164 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef CONFIG_EDGEHOG_SOAK
+
+#include "edgehog_device_private.h"
+#include "edgehog_soak.h"
+#include "edgehog_worker.h"
+#include <esp_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// SystemStatus samples in a window, whose lowest used heap is compared with the previous one
+#define WINDOW_SAMPLES 12
+// Windows ignored after boot, while the heap settles and the caches fill
+#define WARMUP_WINDOWS 3
+// New lows of the largest free block in a row that fail the run
+#define MAX_SHRINKING_IN_ROW 12
+// Values set in turn, so the setters store and free values without filling the NVS
+#define SETTER_VALUES 16
+
+static const char *TAG = "EDGEHOG_SOAK";
+
+static void soak_fail(edgehog_soak_t *soak, const char *reason)
+{
+    ESP_LOGE(TAG, "Soak run failed: %s", reason);
+    soak->failed = true;
+#ifdef CONFIG_EDGEHOG_SOAK_ABORT
+    abort();
+#endif
+}
+
+static void drive_step(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    edgehog_soak_t *soak = &edgehog_device->soak;
+    uint32_t step = ++soak->steps;
+
+    char value[16];
+    snprintf(value, sizeof(value), "soak-%u", (unsigned) (step % SETTER_VALUES));
+    esp_err_t ret = edgehog_device_set_appliance_serial_number(edgehog_device, value);
+    if (ret != ESP_OK) {
+        ESP_LOGD(TAG, "Step %u: serial number not set, error %d", (unsigned) step, ret);
+    }
+    if (edgehog_device_set_appliance_part_number_async(edgehog_device, value, NULL, NULL)
+        != ESP_OK) {
+        ESP_LOGW(TAG, "Step %u: part number not queued", (unsigned) step);
+    }
+    edgehog_device_publish_hardware_info(edgehog_device);
+
+#if CONFIG_EDGEHOG_SOAK_DISCONNECT_STEPS > 0
+    if (soak->astarte_stopped) {
+        if (astarte_device_start(edgehog_device->astarte_device) == ASTARTE_OK) {
+            soak->astarte_stopped = false;
+        }
+    } else if (step % CONFIG_EDGEHOG_SOAK_DISCONNECT_STEPS == 0) {
+        ESP_LOGI(TAG, "Step %u: stopping Astarte for one step", (unsigned) step);
+        soak->astarte_stopped = astarte_device_stop(edgehog_device->astarte_device) == ASTARTE_OK;
+    }
+#endif
+}
+
+static void drive_timer_cb(void *arg)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+    if (edgehog_worker_submit(edgehog_device, drive_step, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to queue a soak step");
+    }
+}
+
+esp_err_t edgehog_soak_start(edgehog_device_handle_t edgehog_device)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = drive_timer_cb,
+        .arg = edgehog_device,
+        .name = "edgehog_soak",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &edgehog_device->soak.timer);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = esp_timer_start_periodic(
+        edgehog_device->soak.timer, CONFIG_EDGEHOG_SOAK_DRIVE_PERIOD_S * 1000000ULL);
+    if (ret != ESP_OK) {
+        esp_timer_delete(edgehog_device->soak.timer);
+        edgehog_device->soak.timer = NULL;
+    }
+    return ret;
+}
+
+void edgehog_soak_stop(edgehog_device_handle_t edgehog_device)
+{
+    if (edgehog_device->soak.timer) {
+        esp_timer_stop(edgehog_device->soak.timer);
+        esp_timer_delete(edgehog_device->soak.timer);
+        edgehog_device->soak.timer = NULL;
+    }
+}
+
+// Returns true when the used heap floor of the window grew faster than the threshold
+static bool check_window(edgehog_soak_t *soak, int64_t window_end_us)
+{
+    double hours = (window_end_us - soak->previous_window_end_us) / 3600e6;
+    double growth_per_hour
+        = ((double) soak->window_used_floor - (double) soak->previous_used_floor) / hours;
+    ESP_LOGI(TAG, "Window of sample %u: used heap floor %u, %.0f B/h", (unsigned) soak->samples,
+        (unsigned) soak->window_used_floor, growth_per_hour);
+    return growth_per_hour > CONFIG_EDGEHOG_SOAK_MAX_GROWTH;
+}
+
+void edgehog_soak_check(edgehog_device_handle_t edgehog_device, int64_t sample_time_us,
+    size_t used_bytes, size_t largest_free_block)
+{
+    edgehog_soak_t *soak = &edgehog_device->soak;
+
+    if (soak->samples++ % WINDOW_SAMPLES == 0 || used_bytes < soak->window_used_floor) {
+        soak->window_used_floor = used_bytes;
+    }
+    if (soak->samples <= WARMUP_WINDOWS * WINDOW_SAMPLES) {
+        soak->lowest_largest_free_block = largest_free_block;
+    } else if (largest_free_block < soak->lowest_largest_free_block) {
+        soak->lowest_largest_free_block = largest_free_block;
+        if (++soak->shrinking_in_row == MAX_SHRINKING_IN_ROW) {
+            soak_fail(soak, "largest free block keeps shrinking");
+        }
+    } else {
+        soak->shrinking_in_row = 0;
+    }
+
+    if (soak->samples % WINDOW_SAMPLES != 0) {
+        return;
+    }
+    // The floor of the last warm-up window is the first one compared
+    if (soak->samples > WARMUP_WINDOWS * WINDOW_SAMPLES) {
+        if (!check_window(soak, sample_time_us)) {
+            soak->growing_in_row = 0;
+        } else if (++soak->growing_in_row == CONFIG_EDGEHOG_SOAK_GROWTH_WINDOWS) {
+            soak_fail(soak, "used heap keeps growing");
+        }
+    }
+    soak->previous_used_floor = soak->window_used_floor;
+    soak->previous_window_end_us = sample_time_us;
+}
+
+bool edgehog_soak_failed(edgehog_device_handle_t edgehog_device)
+{
+    return edgehog_device->soak.failed;
+}
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_recorder.h"
+#include "edgehog_time.h"
+#include <esp_log.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+// A system time before 2021-01-01 means the wall clock was never set
+#define VALID_EPOCH_THRESHOLD_S 1609459200LL
+// How often the system time is checked for corrections not notified to us (e.g. app owned SNTP)
+#define RECALIBRATION_INTERVAL_US (10LL * 60 * 1000000)
+// How often the system time is checked while it was never set
+#define UNSET_RECALIBRATION_INTERVAL_US (1LL * 1000000)
+// Corrections smaller than this are rounding noise, not a sync
+#define MIN_CORRECTION_US 1000
+// Drift is measured only over intervals long enough to make the SNTP error negligible
+#define MIN_DRIFT_INTERVAL_US (60LL * 1000000)
+// Larger drifts are clock steps (e.g. manual settimeofday), not oscillator drift
+#define MAX_DRIFT_PPB 500000
+#define DRIFT_SMOOTHING 4
+
+struct time_reference
+{
+    int64_t monotonic_us;
+    int64_t epoch_us;
+    int64_t last_check_us;
+    int32_t drift_ppb;
+    int drift_samples;
+    bool valid;
+};
+
+static portMUX_TYPE time_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct time_reference time_ref;
+static bool time_initialized;
+
+static void time_calibrate(bool force)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t monotonic_us = esp_timer_get_time();
+    int64_t epoch_us = (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+    EDGEHOG_RECORD(EDGEHOG_RECORD_TIME, &epoch_us, sizeof(epoch_us));
+
+    portENTER_CRITICAL(&time_lock);
+    time_ref.last_check_us = monotonic_us;
+    if (tv.tv_sec < VALID_EPOCH_THRESHOLD_S) {
+        portEXIT_CRITICAL(&time_lock);
+        return;
+    }
+
+    if (time_ref.valid) {
+        // Between two syncs the system time runs on the same oscillator as esp_timer, so the
+        // correction applied by the sync is the drift accumulated since the previous reference
+        int64_t elapsed_us = monotonic_us - time_ref.monotonic_us;
+        int64_t correction_us = epoch_us - time_ref.epoch_us - elapsed_us;
+        if (!force && llabs(correction_us) < MIN_CORRECTION_US) {
+            portEXIT_CRITICAL(&time_lock);
+            return;
+        }
+
+        if (elapsed_us >= MIN_DRIFT_INTERVAL_US) {
+            int64_t drift_ppb = correction_us * 1000 / (elapsed_us / 1000000);
+            if (llabs(drift_ppb) <= MAX_DRIFT_PPB) {
+                if (time_ref.drift_samples == 0) {
+                    time_ref.drift_ppb = drift_ppb;
+                } else {
+                    time_ref.drift_ppb += (drift_ppb - time_ref.drift_ppb) / DRIFT_SMOOTHING;
+                }
+                time_ref.drift_samples++;
+            }
+        }
+    }
+
+    time_ref.monotonic_us = monotonic_us;
+    time_ref.epoch_us = epoch_us;
+    time_ref.valid = true;
+    portEXIT_CRITICAL(&time_lock);
+}
+
+#ifdef CONFIG_EDGEHOG_SNTP
+static const char *TAG = "EDGEHOG_TIME";
+
+static void time_sync_notification_cb(struct timeval *tv)
+{
+    time_calibrate(true);
+}
+#endif
+
+void edgehog_time_init(void)
+{
+    if (time_initialized) {
+        return;
+    }
+    time_initialized = true;
+
+#ifdef CONFIG_EDGEHOG_SNTP
+    if (sntp_enabled()) {
+        ESP_LOGI(TAG, "SNTP already started by the application, using its time sync");
+    } else {
+        sntp_setoperatingmode(SNTP_OPMODE_POLL);
+        sntp_setservername(0, CONFIG_EDGEHOG_SNTP_SERVER);
+        sntp_set_time_sync_notification_cb(time_sync_notification_cb);
+        sntp_init();
+    }
+#endif
+
+    // The system time could already be valid, e.g. after a deep sleep
+    time_calibrate(true);
+}
+
+// Without our own SNTP nothing notifies the syncs, so the system time is polled for them
+static void recalibrate_if_due(void)
+{
+    int64_t monotonic_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&time_lock);
+    int64_t since_check_us = monotonic_us - time_ref.last_check_us;
+    bool check_needed = since_check_us > RECALIBRATION_INTERVAL_US
+        || (!time_ref.valid && since_check_us > UNSET_RECALIBRATION_INTERVAL_US);
+    portEXIT_CRITICAL(&time_lock);
+
+    if (check_needed) {
+        time_calibrate(false);
+    }
+}
+
+uint64_t edgehog_time_monotonic_to_epoch_ms(int64_t monotonic_us)
+{
+    recalibrate_if_due();
+
+    portENTER_CRITICAL(&time_lock);
+    struct time_reference ref = time_ref;
+    portEXIT_CRITICAL(&time_lock);
+
+    if (!ref.valid) {
+        return 0;
+    }
+
+    int64_t delta_us = monotonic_us - ref.monotonic_us;
+    int64_t epoch_us = ref.epoch_us + delta_us + delta_us / 1000 * ref.drift_ppb / 1000000;
+    if (epoch_us <= 0) {
+        return 0;
+    }
+    return (uint64_t) epoch_us / 1000;
+}
+
+uint64_t edgehog_time_get_epoch_ms(void)
+{
+    return edgehog_time_monotonic_to_epoch_ms(esp_timer_get_time());
+}
@@ -0,0 +1,188 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_trace.h"
+
+#ifdef CONFIG_EDGEHOG_TRACE
+
+#include "edgehog_device_private.h"
+#include <astarte_bson_serializer.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The slots are running counts reduced modulo the size, continuous across their wrap only for
+// a power of two
+#if (CONFIG_EDGEHOG_TRACE_BUFFER_SIZE & (CONFIG_EDGEHOG_TRACE_BUFFER_SIZE - 1)) != 0
+#error "CONFIG_EDGEHOG_TRACE_BUFFER_SIZE must be a power of two"
+#endif
+
+// Entries sent in a single aggregate
+#define UPLOAD_CHUNK_ENTRIES 32
+// Pause between two chunks of an upload
+#define UPLOAD_INTERVAL_MS 20
+
+static const char *TAG = "EDGEHOG_TRACE";
+
+const astarte_interface_t edgehog_trace_interface
+    = { .name = "io.edgehog.devicemanager.Trace",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+// Trace points are shared by all the Edgehog devices, as the cores they run on
+struct trace_ring
+{
+    // Total number of entries recorded, the ring keeps the last CONFIG_EDGEHOG_TRACE_BUFFER_SIZE
+    uint32_t head;
+    // Value of head at the previous upload, used only by the uploader
+    uint32_t uploaded;
+    edgehog_trace_entry_t entries[CONFIG_EDGEHOG_TRACE_BUFFER_SIZE];
+};
+
+static struct trace_ring trace_rings[portNUM_PROCESSORS];
+
+void edgehog_trace_record(edgehog_trace_event_t event, uint32_t arg)
+{
+    struct trace_ring *ring = &trace_rings[xPortGetCoreID()];
+
+    // Reserving the slot first keeps the entry consistent if the task is preempted on this core
+    uint32_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    edgehog_trace_entry_t *entry = &ring->entries[slot % CONFIG_EDGEHOG_TRACE_BUFFER_SIZE];
+    entry->timestamp_us = esp_timer_get_time();
+    entry->event = event;
+    entry->arg = arg;
+}
+
+static astarte_err_t upload_chunk(edgehog_device_handle_t edgehog_device, int core,
+    const edgehog_trace_entry_t *entries, int count)
+{
+    struct astarte_bson_serializer_t bs;
+    astarte_bson_serializer_init(&bs);
+    astarte_bson_serializer_append_int32(&bs, "core", core);
+    astarte_bson_serializer_append_binary(
+        &bs, "entries", entries, count * sizeof(edgehog_trace_entry_t));
+    astarte_bson_serializer_append_end_of_document(&bs);
+
+    int doc_len;
+    const void *doc = astarte_bson_serializer_get_document(&bs, &doc_len);
+    astarte_err_t res = edgehog_device_stream_aggregate(
+        edgehog_device, edgehog_trace_interface.name, "/entries", doc, 0);
+    astarte_bson_serializer_destroy(&bs);
+    return res;
+}
+
+void edgehog_trace_upload(edgehog_device_handle_t edgehog_device, void *arg)
+{
+    edgehog_trace_entry_t *chunk = malloc(UPLOAD_CHUNK_ENTRIES * sizeof(edgehog_trace_entry_t));
+    if (!chunk) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return;
+    }
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        struct trace_ring *ring = &trace_rings[core];
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t first = ring->uploaded;
+        if (head - first > CONFIG_EDGEHOG_TRACE_BUFFER_SIZE) {
+            ESP_LOGW(TAG, "%u trace points of core %d were overwritten",
+                (unsigned) (head - first - CONFIG_EDGEHOG_TRACE_BUFFER_SIZE), core);
+            first = head - CONFIG_EDGEHOG_TRACE_BUFFER_SIZE;
+        }
+
+        // Entries are copied out of the ring first, recording continues during the upload
+        while (first != head) {
+            uint32_t next = first;
+            int count = 0;
+            while (count < UPLOAD_CHUNK_ENTRIES && next != head) {
+                chunk[count++] = ring->entries[next++ % CONFIG_EDGEHOG_TRACE_BUFFER_SIZE];
+            }
+            if (upload_chunk(edgehog_device, core, chunk, count) != ASTARTE_OK) {
+                break;
+            }
+            // Only the entries sent are skipped by the next upload
+            first = next;
+            ring->uploaded = first;
+            vTaskDelay(pdMS_TO_TICKS(UPLOAD_INTERVAL_MS));
+        }
+        if (first != head) {
+            ESP_LOGW(TAG, "Trace upload interrupted, %u trace points of core %d are left",
+                (unsigned) (head - first), core);
+            break;
+        }
+    }
+    free(chunk);
+}
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+
+// Name and phase of the events in a Chrome trace, the BEGIN and END events delimit a duration
+static const struct
+{
+    const char *name;
+    char phase;
+} chrome_events[] = {
+    [EDGEHOG_TRACE_DEVICE_NEW_BEGIN] = { "device_new", 'B' },
+    [EDGEHOG_TRACE_DEVICE_NEW_END] = { "device_new", 'E' },
+    [EDGEHOG_TRACE_WIFI_SCAN_START] = { "wifi_scan_start", 'i' },
+    [EDGEHOG_TRACE_WIFI_SCAN_DONE] = { "wifi_scan_done", 'i' },
+    [EDGEHOG_TRACE_PUBLISH_WIFI_AP_BEGIN] = { "publish_wifi_ap", 'B' },
+    [EDGEHOG_TRACE_PUBLISH_WIFI_AP_END] = { "publish_wifi_ap", 'E' },
+    [EDGEHOG_TRACE_SERIALIZE_BEGIN] = { "serialize", 'B' },
+    [EDGEHOG_TRACE_SERIALIZE_END] = { "serialize", 'E' },
+    [EDGEHOG_TRACE_PUBLISH_BEGIN] = { "publish", 'B' },
+    [EDGEHOG_TRACE_PUBLISH_END] = { "publish", 'E' },
+    [EDGEHOG_TRACE_NVS_COMMIT_BEGIN] = { "nvs_commit", 'B' },
+    [EDGEHOG_TRACE_NVS_COMMIT_END] = { "nvs_commit", 'E' },
+};
+
+bool edgehog_trace_dump_chrome(FILE *file)
+{
+    const char *separator = "\n";
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        const struct trace_ring *ring = &trace_rings[core];
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t first
+            = head > CONFIG_EDGEHOG_TRACE_BUFFER_SIZE ? head - CONFIG_EDGEHOG_TRACE_BUFFER_SIZE : 0;
+        for (; first != head; first++) {
+            const edgehog_trace_entry_t *entry
+                = &ring->entries[first % CONFIG_EDGEHOG_TRACE_BUFFER_SIZE];
+            if (entry->event >= sizeof(chrome_events) / sizeof(chrome_events[0])) {
+                continue;
+            }
+            fprintf(file,
+                "%s{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%lld,\"pid\":0,\"tid\":%d,"
+                "\"args\":{\"arg\":%u}}",
+                separator, chrome_events[entry->event].name, chrome_events[entry->event].phase,
+                chrome_events[entry->event].phase == 'i' ? "\"s\":\"t\"," : "",
+                (long long) entry->timestamp_us, core, (unsigned) entry->arg);
+            separator = ",\n";
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fflush(file) == 0 && !ferror(file);
+}
+
+#endif
+
+#endif
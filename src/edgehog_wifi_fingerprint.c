@@ -0,0 +1,124 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_wifi_fingerprint.h"
+
+// RSSI is quantized in steps of this many dB, so small fluctuations do not change the weight
+#define RSSI_QUANTUM_DB 6
+#define RSSI_FLOOR_DBM (-100)
+#define MAX_WEIGHT 15
+
+static uint32_t hash_bssid(const uint8_t *bssid)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 6; i++) {
+        hash ^= bssid[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint8_t rssi_to_weight(int8_t rssi)
+{
+    int weight = (rssi - RSSI_FLOOR_DBM) / RSSI_QUANTUM_DB;
+    if (weight < 1) {
+        return 1;
+    }
+    return weight > MAX_WEIGHT ? MAX_WEIGHT : weight;
+}
+
+void edgehog_wifi_fingerprint_compute(
+    const edgehog_wifi_scan_result_t *scan_result, edgehog_wifi_fingerprint_t *fingerprint)
+{
+    // Select the strongest APs, sorted by descending RSSI
+    int8_t rssi[EDGEHOG_WIFI_FINGERPRINT_MAX_APS];
+    const uint8_t *bssid[EDGEHOG_WIFI_FINGERPRINT_MAX_APS];
+    int count = 0;
+
+    for (int i = 0; i < scan_result->ap_count; i++) {
+        const wifi_ap_record_t *record = &scan_result->ap_records[i];
+        if (count == EDGEHOG_WIFI_FINGERPRINT_MAX_APS && record->rssi <= rssi[count - 1]) {
+            continue;
+        }
+
+        int j = count < EDGEHOG_WIFI_FINGERPRINT_MAX_APS ? count++ : count - 1;
+        while (j > 0 && rssi[j - 1] < record->rssi) {
+            rssi[j] = rssi[j - 1];
+            bssid[j] = bssid[j - 1];
+            j--;
+        }
+        rssi[j] = record->rssi;
+        bssid[j] = record->bssid;
+    }
+
+    // Sort by hash, so two fingerprints can be compared with a single merge pass
+    fingerprint->ap_count = count;
+    for (int i = 0; i < count; i++) {
+        edgehog_wifi_fingerprint_ap_t ap
+            = { .bssid_hash = hash_bssid(bssid[i]), .weight = rssi_to_weight(rssi[i]) };
+        int j = i;
+        while (j > 0 && fingerprint->aps[j - 1].bssid_hash > ap.bssid_hash) {
+            fingerprint->aps[j] = fingerprint->aps[j - 1];
+            j--;
+        }
+        fingerprint->aps[j] = ap;
+    }
+}
+
+int edgehog_wifi_fingerprint_similarity(
+    const edgehog_wifi_fingerprint_t *a, const edgehog_wifi_fingerprint_t *b)
+{
+    int sum_min = 0;
+    int sum_max = 0;
+    int i = 0;
+    int j = 0;
+
+    while (i < a->ap_count || j < b->ap_count) {
+        if (j == b->ap_count
+            || (i < a->ap_count && a->aps[i].bssid_hash < b->aps[j].bssid_hash)) {
+            sum_max += a->aps[i++].weight;
+        } else if (i == a->ap_count || b->aps[j].bssid_hash < a->aps[i].bssid_hash) {
+            sum_max += b->aps[j++].weight;
+        } else {
+            uint8_t weight_a = a->aps[i++].weight;
+            uint8_t weight_b = b->aps[j++].weight;
+            sum_min += weight_a < weight_b ? weight_a : weight_b;
+            sum_max += weight_a > weight_b ? weight_a : weight_b;
+        }
+    }
+
+    if (sum_max == 0) {
+        return 100;
+    }
+    return sum_min * 100 / sum_max;
+}
+
+int edgehog_wifi_fingerprint_pack(const edgehog_wifi_fingerprint_t *fingerprint, uint8_t *out)
+{
+    uint8_t *p = out;
+    for (int i = 0; i < fingerprint->ap_count; i++) {
+        uint32_t hash = fingerprint->aps[i].bssid_hash;
+        *p++ = hash & 0xFF;
+        *p++ = (hash >> 8) & 0xFF;
+        *p++ = (hash >> 16) & 0xFF;
+        *p++ = (hash >> 24) & 0xFF;
+        *p++ = fingerprint->aps[i].weight;
+    }
+    return p - out;
+}
@@ -0,0 +1,223 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_recorder.h"
+#include "edgehog_trace.h"
+#include "edgehog_wifi_reconnect_hint.h"
+#include <esp_log.h>
+#include <esp_wifi.h>
+#include <nvs_flash.h>
+#include <string.h>
+
+#define HINTS_NAMESPACE "eh_wifi"
+#define HINTS_KEY "reconnect"
+#define HINTS_VERSION 1
+// An AP missing from this many consecutive scans is forgotten
+#define MAX_MISSES 3
+// A new AP must be this much stronger to replace the current best one, to avoid flash writes
+// when two APs have a similar signal
+#define BEST_AP_HYSTERESIS_DBM 5
+
+static const char *TAG = "EDGEHOG_WIFI_HINT";
+
+static esp_err_t hints_read(const char *partition_name, edgehog_wifi_reconnect_hints_t *hints)
+{
+    nvs_handle nvs;
+    esp_err_t ret = nvs_open_from_partition(partition_name, HINTS_NAMESPACE, NVS_READONLY, &nvs);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    size_t size = sizeof(edgehog_wifi_reconnect_hints_t);
+    ret = nvs_get_blob(nvs, HINTS_KEY, hints, &size);
+    nvs_close(nvs);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (size != sizeof(edgehog_wifi_reconnect_hints_t) || hints->version != HINTS_VERSION
+        || hints->ap_count > EDGEHOG_WIFI_RECONNECT_HINT_MAX_APS) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    return ESP_OK;
+}
+
+static void hints_write(
+    edgehog_device_handle_t edgehog_device, const edgehog_wifi_reconnect_hints_t *hints)
+{
+    const char *partition_name = edgehog_device->partition_name;
+    nvs_handle nvs;
+    esp_err_t ret = nvs_open_from_partition(partition_name, HINTS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to open %s", partition_name);
+        return;
+    }
+
+    ret = nvs_set_blob(nvs, HINTS_KEY, hints, sizeof(edgehog_wifi_reconnect_hints_t));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to store reconnect hints. Error %d", ret);
+    } else {
+        edgehog_nvs_stats_record(
+            edgehog_device, HINTS_NAMESPACE, HINTS_KEY, sizeof(edgehog_wifi_reconnect_hints_t));
+        EDGEHOG_TRACE(EDGEHOG_TRACE_NVS_COMMIT_BEGIN, 0);
+        ret = nvs_commit(nvs);
+        EDGEHOG_TRACE(EDGEHOG_TRACE_NVS_COMMIT_END, ret);
+        EDGEHOG_RECORD_RESULT(EDGEHOG_RECORD_NVS_RESULT, ret);
+    }
+    nvs_close(nvs);
+}
+
+static int find_ap(const edgehog_wifi_reconnect_hints_t *hints, const uint8_t *bssid)
+{
+    for (int i = 0; i < hints->ap_count; i++) {
+        if (memcmp(hints->aps[i].bssid, bssid, sizeof(hints->aps[i].bssid)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void sort_aps(edgehog_wifi_reconnect_hints_t *hints)
+{
+    // Insertion sort by descending RSSI, the table is tiny
+    for (int i = 1; i < hints->ap_count; i++) {
+        edgehog_wifi_reconnect_hint_ap_t ap = hints->aps[i];
+        int j = i - 1;
+        while (j >= 0 && hints->aps[j].rssi < ap.rssi) {
+            hints->aps[j + 1] = hints->aps[j];
+            j--;
+        }
+        hints->aps[j + 1] = ap;
+    }
+}
+
+void edgehog_wifi_reconnect_hint_load(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_wifi_reconnect_hints_t *hints = &edgehog_device->wifi_reconnect_hints;
+    if (hints_read(edgehog_device->partition_name, hints) != ESP_OK) {
+        memset(hints, 0, sizeof(edgehog_wifi_reconnect_hints_t));
+        hints->version = HINTS_VERSION;
+    }
+}
+
+void edgehog_wifi_reconnect_hint_update(
+    edgehog_device_handle_t edgehog_device, const edgehog_wifi_scan_result_t *scan_result)
+{
+    wifi_config_t wifi_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK || wifi_config.sta.ssid[0] == 0) {
+        return;
+    }
+
+    edgehog_wifi_reconnect_hints_t *hints = &edgehog_device->wifi_reconnect_hints;
+    edgehog_wifi_reconnect_hint_ap_t previous_best = hints->aps[0];
+    bool had_best = hints->ap_count > 0;
+
+    // The bytes after the terminator of the configured SSID are not meaningful
+    if (strncmp((const char *) hints->ssid, (const char *) wifi_config.sta.ssid,
+            sizeof(hints->ssid))
+        != 0) {
+        strncpy((char *) hints->ssid, (const char *) wifi_config.sta.ssid, sizeof(hints->ssid));
+        hints->ap_count = 0;
+        had_best = false;
+    }
+
+    for (int i = 0; i < hints->ap_count; i++) {
+        hints->aps[i].misses++;
+    }
+
+    for (int i = 0; i < scan_result->ap_count; i++) {
+        const wifi_ap_record_t *record = &scan_result->ap_records[i];
+        if (strncmp((const char *) record->ssid, (const char *) hints->ssid, sizeof(hints->ssid))
+            != 0) {
+            continue;
+        }
+
+        int index = find_ap(hints, record->bssid);
+        if (index >= 0) {
+            // Smooth the RSSI to avoid reordering the table on every fluctuation
+            hints->aps[index].rssi = (3 * hints->aps[index].rssi + record->rssi) / 4;
+        } else if (hints->ap_count < EDGEHOG_WIFI_RECONNECT_HINT_MAX_APS) {
+            index = hints->ap_count++;
+            hints->aps[index].rssi = record->rssi;
+        } else if (record->rssi > hints->aps[hints->ap_count - 1].rssi) {
+            index = hints->ap_count - 1;
+            hints->aps[index].rssi = record->rssi;
+        } else {
+            continue;
+        }
+        memcpy(hints->aps[index].bssid, record->bssid, sizeof(hints->aps[index].bssid));
+        hints->aps[index].channel = record->primary;
+        hints->aps[index].misses = 0;
+        sort_aps(hints);
+    }
+
+    int kept = 0;
+    for (int i = 0; i < hints->ap_count; i++) {
+        if (hints->aps[i].misses < MAX_MISSES) {
+            hints->aps[kept++] = hints->aps[i];
+        }
+    }
+    hints->ap_count = kept;
+
+    if (had_best) {
+        // Keep the previous best AP unless it is gone or clearly worse than the new best one
+        int index = find_ap(hints, previous_best.bssid);
+        if (index > 0 && hints->aps[0].rssi - hints->aps[index].rssi < BEST_AP_HYSTERESIS_DBM) {
+            edgehog_wifi_reconnect_hint_ap_t best = hints->aps[index];
+            memmove(
+                &hints->aps[1], &hints->aps[0], index * sizeof(edgehog_wifi_reconnect_hint_ap_t));
+            hints->aps[0] = best;
+        }
+    }
+
+    if (hints->ap_count == 0) {
+        return;
+    }
+
+    bool best_changed = !had_best
+        || memcmp(hints->aps[0].bssid, previous_best.bssid, sizeof(previous_best.bssid)) != 0
+        || hints->aps[0].channel != previous_best.channel;
+    if (best_changed) {
+        ESP_LOGI(TAG, "Best AP for %s is now on channel %d", (const char *) hints->ssid,
+            hints->aps[0].channel);
+        hints_write(edgehog_device, hints);
+    }
+}
+
+esp_err_t edgehog_wifi_reconnect_hint_apply(
+    const char *partition_label, wifi_config_t *wifi_config)
+{
+    if (!wifi_config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    edgehog_wifi_reconnect_hints_t hints;
+    const char *partition_name = partition_label ? partition_label : NVS_DEFAULT_PART_NAME;
+    if (hints_read(partition_name, &hints) != ESP_OK || hints.ap_count == 0
+        || strncmp((const char *) hints.ssid, (const char *) wifi_config->sta.ssid,
+               sizeof(hints.ssid))
+            != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    memcpy(wifi_config->sta.bssid, hints.aps[0].bssid, sizeof(wifi_config->sta.bssid));
+    wifi_config->sta.bssid_set = true;
+    wifi_config->sta.channel = hints.aps[0].channel;
+    return ESP_OK;
+}
@@ -0,0 +1,223 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_recorder.h"
+#include "edgehog_wifi_scan_cache.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "EDGEHOG_WIFI_SCAN";
+
+struct edgehog_wifi_scan_snapshot
+{
+    // Must be the first member, results are converted back to snapshots on release
+    edgehog_wifi_scan_result_t result;
+    uint32_t refcount;
+    wifi_ap_record_t ap_records[];
+};
+
+static void snapshot_release(struct edgehog_wifi_scan_snapshot *snapshot)
+{
+    if (snapshot && __atomic_sub_fetch(&snapshot->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(snapshot);
+    }
+}
+
+esp_err_t edgehog_wifi_scan_cache_init(edgehog_wifi_scan_cache_t *cache)
+{
+    vPortCPUInitializeMutex(&cache->lock);
+    cache->latest = NULL;
+    cache->sequence_number = 0;
+    memset(cache->subscribers, 0, sizeof(cache->subscribers));
+    cache->notifier = NULL;
+    cache->notify_lock = xSemaphoreCreateMutex();
+    return cache->notify_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void edgehog_wifi_scan_cache_destroy(edgehog_wifi_scan_cache_t *cache)
+{
+    portENTER_CRITICAL(&cache->lock);
+    struct edgehog_wifi_scan_snapshot *latest = cache->latest;
+    cache->latest = NULL;
+    portEXIT_CRITICAL(&cache->lock);
+
+    snapshot_release(latest);
+    if (cache->notify_lock) {
+        vSemaphoreDelete(cache->notify_lock);
+        cache->notify_lock = NULL;
+    }
+}
+
+const edgehog_wifi_scan_result_t *edgehog_wifi_scan_cache_collect(
+    edgehog_device_handle_t edgehog_device)
+{
+    edgehog_wifi_scan_cache_t *cache = &edgehog_device->wifi_scan_cache;
+    int64_t timestamp_us = esp_timer_get_time();
+
+    uint16_t ap_count = 0;
+    esp_err_t ret = esp_wifi_scan_get_ap_num(&ap_count);
+    if (ret != ESP_OK) {
+        return NULL;
+    }
+
+    struct edgehog_wifi_scan_snapshot *snapshot
+        = malloc(sizeof(struct edgehog_wifi_scan_snapshot) + ap_count * sizeof(wifi_ap_record_t));
+    if (!snapshot) {
+        ESP_LOGE(TAG, "Unable to allocate memory for %d access point records", ap_count);
+        return NULL;
+    }
+
+    ret = esp_wifi_scan_get_ap_records(&ap_count, snapshot->ap_records);
+    if (ret != ESP_OK) {
+        free(snapshot);
+        return NULL;
+    }
+#ifdef CONFIG_EDGEHOG_RECORDER
+    for (int i = 0; i < ap_count; i++) {
+        const wifi_ap_record_t *ap_record = &snapshot->ap_records[i];
+        edgehog_record_wifi_ap_t record = {
+            .channel = ap_record->primary,
+            .rssi = ap_record->rssi,
+            .authmode = ap_record->authmode,
+            .ssid_len = strnlen((const char *) ap_record->ssid, sizeof(record.ssid)),
+        };
+        memcpy(record.bssid, ap_record->bssid, sizeof(record.bssid));
+        memcpy(record.ssid, ap_record->ssid, record.ssid_len);
+        // The SSID is recorded without its unused bytes
+        EDGEHOG_RECORD(EDGEHOG_RECORD_WIFI_AP, &record,
+            sizeof(record) - sizeof(record.ssid) + record.ssid_len);
+    }
+#endif
+
+    snapshot->result.timestamp_us = timestamp_us;
+    snapshot->result.ap_count = ap_count;
+    snapshot->result.ap_records = snapshot->ap_records;
+    // One reference is owned by the cache and one by the caller
+    snapshot->refcount = 2;
+
+    // The subscribers are copied under the notify lock, so that once unsubscribe returns no
+    // copy of the removed one is left to be called
+    edgehog_wifi_scan_subscriber_t subscribers[EDGEHOG_WIFI_SCAN_MAX_SUBSCRIBERS];
+    xSemaphoreTake(cache->notify_lock, portMAX_DELAY);
+    portENTER_CRITICAL(&cache->lock);
+    snapshot->result.sequence_number = ++cache->sequence_number;
+    struct edgehog_wifi_scan_snapshot *previous = cache->latest;
+    cache->latest = snapshot;
+    memcpy(subscribers, cache->subscribers, sizeof(subscribers));
+    cache->notifier = xTaskGetCurrentTaskHandle();
+    portEXIT_CRITICAL(&cache->lock);
+
+    snapshot_release(previous);
+
+    for (int i = 0; i < EDGEHOG_WIFI_SCAN_MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i].callback) {
+            subscribers[i].callback(edgehog_device, &snapshot->result, subscribers[i].user_data);
+        }
+    }
+    portENTER_CRITICAL(&cache->lock);
+    cache->notifier = NULL;
+    portEXIT_CRITICAL(&cache->lock);
+    xSemaphoreGive(cache->notify_lock);
+
+    return &snapshot->result;
+}
+
+const edgehog_wifi_scan_result_t *edgehog_device_wifi_scan_acquire(
+    edgehog_device_handle_t edgehog_device)
+{
+    if (!edgehog_device) {
+        return NULL;
+    }
+
+    edgehog_wifi_scan_cache_t *cache = &edgehog_device->wifi_scan_cache;
+    portENTER_CRITICAL(&cache->lock);
+    struct edgehog_wifi_scan_snapshot *latest = cache->latest;
+    if (latest) {
+        __atomic_add_fetch(&latest->refcount, 1, __ATOMIC_RELAXED);
+    }
+    portEXIT_CRITICAL(&cache->lock);
+
+    return latest ? &latest->result : NULL;
+}
+
+void edgehog_wifi_scan_result_release(const edgehog_wifi_scan_result_t *result)
+{
+    snapshot_release((struct edgehog_wifi_scan_snapshot *) result);
+}
+
+int64_t edgehog_wifi_scan_result_get_age_ms(const edgehog_wifi_scan_result_t *result)
+{
+    return (esp_timer_get_time() - result->timestamp_us) / 1000;
+}
+
+esp_err_t edgehog_device_wifi_scan_subscribe(
+    edgehog_device_handle_t edgehog_device, edgehog_wifi_scan_cb_t callback, void *user_data)
+{
+    if (!edgehog_device || !callback) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    edgehog_wifi_scan_cache_t *cache = &edgehog_device->wifi_scan_cache;
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    portENTER_CRITICAL(&cache->lock);
+    for (int i = 0; i < EDGEHOG_WIFI_SCAN_MAX_SUBSCRIBERS; i++) {
+        if (!cache->subscribers[i].callback) {
+            cache->subscribers[i].callback = callback;
+            cache->subscribers[i].user_data = user_data;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&cache->lock);
+
+    return ret;
+}
+
+esp_err_t edgehog_device_wifi_scan_unsubscribe(
+    edgehog_device_handle_t edgehog_device, edgehog_wifi_scan_cb_t callback, void *user_data)
+{
+    if (!edgehog_device || !callback) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    edgehog_wifi_scan_cache_t *cache = &edgehog_device->wifi_scan_cache;
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&cache->lock);
+    for (int i = 0; i < EDGEHOG_WIFI_SCAN_MAX_SUBSCRIBERS; i++) {
+        if (cache->subscribers[i].callback == callback
+            && cache->subscribers[i].user_data == user_data) {
+            cache->subscribers[i].callback = NULL;
+            cache->subscribers[i].user_data = NULL;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    bool notifying_task = cache->notifier == xTaskGetCurrentTaskHandle();
+    portEXIT_CRITICAL(&cache->lock);
+
+    // Waits for the notification in progress, unless called by one of its callbacks
+    if (ret == ESP_OK && !notifying_task) {
+        xSemaphoreTake(cache->notify_lock, portMAX_DELAY);
+        xSemaphoreGive(cache->notify_lock);
+    }
+    return ret;
+}
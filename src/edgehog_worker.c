@@ -0,0 +1,116 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2021 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_load_stats.h"
+#include "edgehog_worker.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#define WORKER_QUEUE_LENGTH 8
+
+static const char *TAG = "EDGEHOG_WORKER";
+
+typedef struct
+{
+    edgehog_worker_job_t job;
+    void *arg;
+} worker_item_t;
+
+static void worker_task(void *arg)
+{
+    edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+    worker_item_t item;
+
+    while (true) {
+        if (xQueueReceive(edgehog_device->worker_queue, &item, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (!item.job) {
+            // Stop request, all the previous jobs have been run
+            xSemaphoreGive((SemaphoreHandle_t) item.arg);
+            vTaskDelete(NULL);
+            return;
+        }
+        int64_t start_us = esp_timer_get_time();
+        item.job(edgehog_device, item.arg);
+        edgehog_load_stats_record_job(edgehog_device, start_us);
+    }
+}
+
+esp_err_t edgehog_worker_start(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_device->worker_queue = xQueueCreate(WORKER_QUEUE_LENGTH, sizeof(worker_item_t));
+    if (!edgehog_device->worker_queue) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(worker_task, "edgehog_worker", CONFIG_EDGEHOG_WORKER_STACK_SIZE, edgehog_device,
+            CONFIG_EDGEHOG_WORKER_PRIORITY, &edgehog_device->worker_task)
+        != pdPASS) {
+        ESP_LOGE(TAG, "Unable to create the worker task");
+        vQueueDelete(edgehog_device->worker_queue);
+        edgehog_device->worker_queue = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+void edgehog_worker_stop(edgehog_device_handle_t edgehog_device)
+{
+    if (!edgehog_device->worker_task) {
+        return;
+    }
+
+    SemaphoreHandle_t stopped = xSemaphoreCreateBinary();
+    worker_item_t stop = { .job = NULL, .arg = stopped };
+    if (!stopped || xQueueSend(edgehog_device->worker_queue, &stop, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Unable to stop the worker task");
+        return;
+    }
+    xSemaphoreTake(stopped, portMAX_DELAY);
+    vSemaphoreDelete(stopped);
+
+    vQueueDelete(edgehog_device->worker_queue);
+    edgehog_device->worker_queue = NULL;
+    edgehog_device->worker_task = NULL;
+}
+
+esp_err_t edgehog_worker_submit(
+    edgehog_device_handle_t edgehog_device, edgehog_worker_job_t job, void *arg)
+{
+    if (!edgehog_device->worker_queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    worker_item_t item = { .job = job, .arg = arg };
+    if (xQueueSend(edgehog_device->worker_queue, &item, 0) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+bool edgehog_worker_pending(edgehog_device_handle_t edgehog_device)
+{
+    return edgehog_device->worker_queue && uxQueueMessagesWaiting(edgehog_device->worker_queue) > 0;
+}